@@ -18,6 +18,13 @@
 
 "use strict";
 
+//Binary encoding for the most frequent messages, see server/message_binary.h
+var BINARY_MESSAGE_MAGIC = 0x4D433442;
+var BINARY_MESSAGE_VERSION = 2;
+var BINARY_MESSAGE_TYPE = {SET_PLAYER_POS: 1, REQ_MAPBLOCK: 2, DIG_NODE: 3, PLACE_NODE: 4, REQ_MAPBLOCKS: 5};
+var REQ_MAPBLOCKS_MAX = 256;
+var STREAM_WAIT_TIME = 3000; //ms to wait for the server to push a mapblock within view distance before asking for it
+
 class MapBlockPatch {
   constructor(_server, _pos, _nodeData) {
     this.pos = _pos;
@@ -125,8 +132,12 @@ class ServerRemote extends ServerBase {
     
     this.cache = {};
     this.saved = {};
+    this.pristine = {};
     
     this.requests = new Set();
+    this.pendingRequests = []; //mapblocks to ask for in the next req_mapblocks
+    this.viewDistance = null; //set once the server is streaming mapblocks to us
+    this.streamWaiting = {}; //index -> when we first wanted a mapblock the server should be pushing
     
     this.patches = [];
     this.invPatches = [];
@@ -139,6 +150,8 @@ class ServerRemote extends ServerBase {
     this._posReady = false;
     this._authCredentials = null;
     
+    this.binaryProtocol = 0; //0 means JSON only; set once the server tells us what it supports
+    
     this._url = url;
   }
   
@@ -196,245 +209,22 @@ class ServerRemote extends ServerBase {
     
     this.socket.onmessage = function(e) {
       if(e.data instanceof ArrayBuffer) {
-        //req_mapblock
+        //req_mapblock or req_mapblocks
         var dv = new DataView(e.data);
-        var endianness = false;
-        var magic = dv.getUint32(0);
-        if(magic != 0xABCD5678) {
-          endianness = true;
-        }
-        var posX = dv.getInt32(4, endianness);
-        var posY = dv.getInt32(8, endianness);
-        var posZ = dv.getInt32(12, endianness);
-        var posW = dv.getInt32(16, endianness);
-        var posWorld = dv.getInt32(20, endianness);
-        var posUniverse = dv.getInt32(24, endianness);
-        var updateNum = dv.getUint32(28, endianness);
-        var lightUpdateNum = dv.getUint32(32, endianness);
-        var lightNeedsUpdate = dv.getUint32(36, endianness);
-        var sunlit = (dv.getUint32(40, endianness) & 1) == 1 ? true : false;
-        var dataLen = dv.getUint32(44, endianness);
-        var lightDataLen = dv.getUint32(48 + dataLen * 4, endianness) * 2;
-        var lightDataLenActual = dv.getUint32(48 + dataLen * 4 + 4, endianness);
-        var lightDataOffset = 48 + dataLen * 4 + 4 + 4;
-        var IDtoISLen = dv.getUint32(48 + dataLen * 4 + 4 + 4 + lightDataLen * 2, endianness);
-        var IDtoISOffset = 48 + dataLen * 4 + 4 + 4 + lightDataLen * 2 + 4;
-        
-        var index = posX + "," + posY + "," + posZ + "," + posW + "," + posWorld + "," + posUniverse;
-        var mapBlock = new MapBlock(new MapPos(posX, posY, posZ, posW, posWorld, posUniverse));
-        mapBlock.updateNum = updateNum;
-        mapBlock.lightUpdateNum = lightUpdateNum;
-        mapBlock.lightNeedsUpdate = lightNeedsUpdate;
-        
-        var y = 0;
-        var x = 0;
-        var z = 0;
-        var full = false;
-        for(var i = 0; i < dataLen; i++) {
-          var val = dv.getUint32(48 + i * 4, endianness);
-          var runVal = val & 0b00000000011111111111111111111111;
-          var runLength = ((val >> 23) & 511) + 1; //Run lengths are offset by 1 to allow storing [1, 512] instead of [0, 511]
-          
-          for(var n = 0; n < runLength; n++) {
-            if(full) {
-              throw new Error("decompressed mapblock is too long");
-            }
-            
-            mapBlock.data[x][y][z] = runVal;
-            z++;
-            if(z >= MAPBLOCK_SIZE.z) {
-              z = 0;
-              x++;
-              if(x >= MAPBLOCK_SIZE.x) {
-                x = 0;
-                y++;
-                if(y >= MAPBLOCK_SIZE.y) {
-                  y = 0;
-                  full = true;
-                }
-              }
-            }
-          }
-        }
-        if(!full) {
-          throw new Error("decompressed mapblock is too short");
-        }
-        
-        var y = 0;
-        var x = 0;
-        var z = 0;
-        var full = false;
-        for(var i = 0; i < lightDataLenActual; i++) {
-          var val = dv.getUint16(lightDataOffset + i * 2, endianness);
-          var runVal = val & 0b0000000011111111;
-          var runLength = ((val >> 8) & 255) + 1; //Run lengths are offset by 1 to allow storing [1, 256] instead of [0, 255]
-          
-          for(var n = 0; n < runLength; n++) {
-            if(full) {
-              throw new Error("decompressed mapblock light is too long");
-            }
-            
-            mapBlock.data[x][y][z] |= (runVal << 23);
-            z++;
-            if(z >= MAPBLOCK_SIZE.z) {
-              z = 0;
-              x++;
-              if(x >= MAPBLOCK_SIZE.x) {
-                x = 0;
-                y++;
-                if(y >= MAPBLOCK_SIZE.y) {
-                  y = 0;
-                  full = true;
-                }
-              }
-            }
-          }
-        }
-        if(!full) {
-          throw new Error("decompressed mapblock light is too short");
-        }
-        
-        var dec = new TextDecoder();
-        var IDtoISStr = dec.decode(new DataView(e.data, IDtoISOffset, IDtoISLen));
-        
-        mapBlock.IDtoIS = JSON.parse(IDtoISStr);
-        mapBlock.IStoID = {};
-        for(var i = 0; i < mapBlock.IDtoIS.length; i++) {
-          mapBlock.IStoID[mapBlock.IDtoIS[i]] = i;
-        }
-        mapBlock.props.sunlit = sunlit;
-        
-        var oldMapBlock = null;
-        if(index in this.cache) { oldMapBlock = this.cache[index]; }
-        
-        this.cache[index] = mapBlock;
-        
-        //Apply mapblock patches, oldest to newest
-        var i = 0;
-        var toApply = [];
-        while(i < this.patches.length) {
-          if(mapBlock.pos.equals(this.patches[i].mapBlockPos)) {
-            //Don't use previous patches from the same position
-            for(var n = toApply.length - 1; n >= 0; n--) {
-              if(this.patches[i].localPos.equals(toApply[n].localPos)) {
-                toApply.splice(n, 1);
-              }
-            }
-            
-            if(this.patches[i].isAccepted()) {
-              var localPos = this.patches[i].localPos;
-              this.patches.splice(i, 1);
-              
-              //Also delete previous patches for the same position
-              for(var n = i - 1; n >= 0; n--) {
-                if(this.patches[n].mapBlockPos.equals(mapBlock.pos) && this.patches[n].localPos.equals(localPos)) {
-                  this.patches.splice(n, 1);
-                  i--;
-                }
-              }
-            } else {
-              toApply.push(this.patches[i]);
-              i++;
-            }
-          } else {
-            i++;
-          }
-        }
-        
-        for(var i = 0; i < toApply.length; i++) {
-          toApply[i].doApply();
-        }
-        
-        
-        if(oldMapBlock != null) {
-          if(mapBlock.updateNum != oldMapBlock.updateNum) {
-            //see if any existing IDtoIS entries have changed different
-            var changedIDtoIS = false;
-            if(mapBlock.IDtoIS.length < oldMapBlock.IDtoIS.length) {
-              changedIDtoIS = true;
-            }
-            if(!changedIDtoIS) {
-              for(var i = 0; i < oldMapBlock.IDtoIS.length; i++) {
-                if(mapBlock.IDtoIS[i] != oldMapBlock.IDtoIS[i]) {
-                  changedIDtoIS = true;
-                  break;
-                }
-              }
-            }
-            
-            if(changedIDtoIS) {
-              mapBlock.renderNeedsUpdate = 2; //getMapBlock will force the lighting to be updated (if lightNeedsUpdate is set) before the render update can happen
-            } else {
-              //see where nodes have changed (disregarding lighting)
-              var sides = [false, false, false, false, false, false];
-              var anyDiff = false;
-              for(var x = 0; x < mapBlock.size.x; x++) {
-                for(var y = 0; y < mapBlock.size.y; y++) {
-                  for(var z = 0; z < mapBlock.size.z; z++) {
-                    if((mapBlock.data[x][y][z] & 0b00000000011111111111111111111111) == (oldMapBlock.data[x][y][z] & 0b00000000011111111111111111111111)) { continue; }
-                    
-                    if(x == 0) { sides[0] = true; }
-                    if(x == mapBlock.size.x - 1) { sides[1] = true; }
-                    if(y == 0) { sides[2] = true; }
-                    if(y == mapBlock.size.y - 1) { sides[3] = true; }
-                    if(z == 0) { sides[4] = true; }
-                    if(z == mapBlock.size.z - 1) { sides[5] = true; }
-                    
-                    anyDiff = true;
-                  }
-                }
-              }
-              
-              for(var i = 0; i < sides.length; i++) {
-                if(!sides[i]) { continue; }
-                
-                renderQueueUpdate(new MapPos(mapBlock.pos.x + stdFaces[i].x, mapBlock.pos.y + stdFaces[i].y, mapBlock.pos.z + stdFaces[i].z, mapBlock.pos.w, mapBlock.pos.world, mapBlock.pos.universe), true);
-              }
-              
-              if(anyDiff) {
-                //mapBlock.renderNeedsUpdate = 1;
-                renderQueueUpdate(mapBlock.pos, true);
-              } else if(mapBlock.lightUpdateNum != oldMapBlock.lightUpdateNum) {
-                //we've verified that there's no difference in mapblock content
-                var hasWorker = false;
-                var worker;
-                for(var i = 0; i < renderWorkers.length; i++) {
-                  if(renderWorkers[i].pos.equals(mapBlock.pos)) {
-                    hasWorker = true;
-                    worker = renderWorkers[i];
-                  }
-                }
-                if(index in renderCurrentMeshes) {
-                  if(hasWorker) {
-                    worker.registerOnComplete(function(pos, updateNum, index) {
-                      renderCurrentMeshes[index].main.updateNum = updateNum;
-                      renderQueueLightingUpdate(pos);
-                    }.bind(null, mapBlock.pos, mapBlock.updateNum, index));
-                  } else {
-                    renderCurrentMeshes[index].main.updateNum = updateNum;
-                    renderQueueLightingUpdate(mapBlock.pos);
-                  }
-                } else {
-                  renderQueueUpdate(mapBlock.pos, true);
-                }
-              }
-            }
-          } else if(mapBlock.lightUpdateNum != oldMapBlock.lightUpdateNum) {
-            //FIXME?
-            renderQueueLightingUpdate(mapBlock.pos);
+        if(dv.getUint32(0) == 0xABCD567A || dv.getUint32(0, true) == 0xABCD567A) {
+          //Several mapblocks at once, each prefixed with its length
+          var endianness = dv.getUint32(0) != 0xABCD567A;
+          var count = dv.getUint32(4, endianness);
+          var offset = 8;
+          for(var i = 0; i < count; i++) {
+            var len = dv.getUint32(offset, endianness);
+            this.receiveMapBlockFrame(e.data.slice(offset + 4, offset + 4 + len));
+            offset += 4 + len;
           }
         } else {
-          mapBlock.renderNeedsUpdate = 1;
+          this.receiveMapBlockFrame(e.data);
         }
         
-        this.requests.delete(index);
-        
-        //if(mapBlock.lightNeedsUpdate > 0 && needLight) {
-        //  lightQueueUpdate(mapBlock.pos);
-        //}
-        
-        //console.log("recv_mapblock (" + index + ") updateNum=" + mdata.updateNum + " lightUpdateNum=" + mdata.lightUpdateNum + " lightNeedsUpdate=" + mdata.lightNeedsUpdate);
-        
         return;
       }
       var data = JSON.parse(e.data);
@@ -461,6 +251,11 @@ class ServerRemote extends ServerBase {
         this.player.privs = data.privs;
       } else if(data.type == "set_player_opts") {
         //TODO
+      } else if(data.type == "forget_mapblocks") {
+        //The server won't send updates for these any more, so drop them; they're asked for again if needed.
+        data.mapblocks.forEach(function(pos) {
+          this.suggestUncacheMapBlock(new MapPos(pos.x, pos.y, pos.z, pos.w, pos.world, pos.universe));
+        }.bind(this));
       } else if(data.type == "inv_list") {
         var ref = new InvRef(data.ref.objType, data.ref.objID, data.ref.listName, data.ref.index);
         var list = data.list;
@@ -590,6 +385,11 @@ class ServerRemote extends ServerBase {
           this._authReady = true;
           debug("client", "status", "registered new account for " + this._authCredentials.loginName);
         }
+      } else if(data.type == "binary_protocol") {
+        this.binaryProtocol = Math.min(data.version, BINARY_MESSAGE_VERSION);
+        if(this.binaryProtocol >= 2) {
+          this.sendViewDistance();
+        }
       } else if(data.type == "auth_guest") {
         if(data.message == "guest_ok") {
           this._authReady = true;
@@ -613,6 +413,345 @@ class ServerRemote extends ServerBase {
     }.bind(this));
   }
   
+  //Handles one mapblock or mapblock delta from the server.
+  receiveMapBlockFrame(buf) {
+    var dv = new DataView(buf);
+    var endianness = false;
+    var magic = dv.getUint32(0);
+    if(magic != 0xABCD5678 && magic != 0xABCD5679) {
+      endianness = true;
+      magic = dv.getUint32(0, endianness);
+    }
+    
+    var mapBlock;
+    if(magic == 0xABCD5679) {
+      //Only the nodes that changed since a version we already have
+      mapBlock = this.decodeMapBlockDelta(buf, dv, endianness);
+      if(mapBlock == null) { return; }
+    } else {
+      mapBlock = this.decodeMapBlock(buf, dv, endianness);
+    }
+    var index = mapBlock.pos.x + "," + mapBlock.pos.y + "," + mapBlock.pos.z + "," + mapBlock.pos.w + "," + mapBlock.pos.world + "," + mapBlock.pos.universe;
+    
+    var oldMapBlock = null;
+    if(index in this.cache) { oldMapBlock = this.cache[index]; }
+    
+    this.cache[index] = mapBlock;
+    
+    //Apply mapblock patches, oldest to newest
+    var i = 0;
+    var toApply = [];
+    while(i < this.patches.length) {
+      if(mapBlock.pos.equals(this.patches[i].mapBlockPos)) {
+        //Don't use previous patches from the same position
+        for(var n = toApply.length - 1; n >= 0; n--) {
+          if(this.patches[i].localPos.equals(toApply[n].localPos)) {
+            toApply.splice(n, 1);
+          }
+        }
+        
+        if(this.patches[i].isAccepted()) {
+          var localPos = this.patches[i].localPos;
+          this.patches.splice(i, 1);
+          
+          //Also delete previous patches for the same position
+          for(var n = i - 1; n >= 0; n--) {
+            if(this.patches[n].mapBlockPos.equals(mapBlock.pos) && this.patches[n].localPos.equals(localPos)) {
+              this.patches.splice(n, 1);
+              i--;
+            }
+          }
+        } else {
+          toApply.push(this.patches[i]);
+          i++;
+        }
+      } else {
+        i++;
+      }
+    }
+    
+    if(toApply.length > 0) {
+      this.savePristineMapBlock(index, mapBlock);
+    } else {
+      delete this.pristine[index];
+    }
+    for(var i = 0; i < toApply.length; i++) {
+      toApply[i].doApply();
+    }
+    
+    
+    if(oldMapBlock != null) {
+      if(mapBlock.updateNum != oldMapBlock.updateNum) {
+        //see if any existing IDtoIS entries have changed different
+        var changedIDtoIS = false;
+        if(mapBlock.IDtoIS.length < oldMapBlock.IDtoIS.length) {
+          changedIDtoIS = true;
+        }
+        if(!changedIDtoIS) {
+          for(var i = 0; i < oldMapBlock.IDtoIS.length; i++) {
+            if(mapBlock.IDtoIS[i] != oldMapBlock.IDtoIS[i]) {
+              changedIDtoIS = true;
+              break;
+            }
+          }
+        }
+        
+        if(changedIDtoIS) {
+          mapBlock.renderNeedsUpdate = 2; //getMapBlock will force the lighting to be updated (if lightNeedsUpdate is set) before the render update can happen
+        } else {
+          //see where nodes have changed (disregarding lighting)
+          var sides = [false, false, false, false, false, false];
+          var anyDiff = false;
+          for(var x = 0; x < mapBlock.size.x; x++) {
+            for(var y = 0; y < mapBlock.size.y; y++) {
+              for(var z = 0; z < mapBlock.size.z; z++) {
+                if((mapBlock.data[x][y][z] & 0b00000000011111111111111111111111) == (oldMapBlock.data[x][y][z] & 0b00000000011111111111111111111111)) { continue; }
+                
+                if(x == 0) { sides[0] = true; }
+                if(x == mapBlock.size.x - 1) { sides[1] = true; }
+                if(y == 0) { sides[2] = true; }
+                if(y == mapBlock.size.y - 1) { sides[3] = true; }
+                if(z == 0) { sides[4] = true; }
+                if(z == mapBlock.size.z - 1) { sides[5] = true; }
+                
+                anyDiff = true;
+              }
+            }
+          }
+          
+          for(var i = 0; i < sides.length; i++) {
+            if(!sides[i]) { continue; }
+            
+            renderQueueUpdate(new MapPos(mapBlock.pos.x + stdFaces[i].x, mapBlock.pos.y + stdFaces[i].y, mapBlock.pos.z + stdFaces[i].z, mapBlock.pos.w, mapBlock.pos.world, mapBlock.pos.universe), true);
+          }
+          
+          if(anyDiff) {
+            //mapBlock.renderNeedsUpdate = 1;
+            renderQueueUpdate(mapBlock.pos, true);
+          } else if(mapBlock.lightUpdateNum != oldMapBlock.lightUpdateNum) {
+            //we've verified that there's no difference in mapblock content
+            var hasWorker = false;
+            var worker;
+            for(var i = 0; i < renderWorkers.length; i++) {
+              if(renderWorkers[i].pos.equals(mapBlock.pos)) {
+                hasWorker = true;
+                worker = renderWorkers[i];
+              }
+            }
+            if(index in renderCurrentMeshes) {
+              if(hasWorker) {
+                worker.registerOnComplete(function(pos, updateNum, index) {
+                  renderCurrentMeshes[index].main.updateNum = updateNum;
+                  renderQueueLightingUpdate(pos);
+                }.bind(null, mapBlock.pos, mapBlock.updateNum, index));
+              } else {
+                renderCurrentMeshes[index].main.updateNum = mapBlock.updateNum;
+                renderQueueLightingUpdate(mapBlock.pos);
+              }
+            } else {
+              renderQueueUpdate(mapBlock.pos, true);
+            }
+          }
+        }
+      } else if(mapBlock.lightUpdateNum != oldMapBlock.lightUpdateNum) {
+        //FIXME?
+        renderQueueLightingUpdate(mapBlock.pos);
+      }
+    } else {
+      mapBlock.renderNeedsUpdate = 1;
+    }
+    
+    this.requests.delete(index);
+    delete this.streamWaiting[index];
+    
+    //if(mapBlock.lightNeedsUpdate > 0 && needLight) {
+    //  lightQueueUpdate(mapBlock.pos);
+    //}
+    
+    //console.log("recv_mapblock (" + index + ") updateNum=" + mdata.updateNum + " lightUpdateNum=" + mdata.lightUpdateNum + " lightNeedsUpdate=" + mdata.lightNeedsUpdate);
+  }
+  //Decodes a whole mapblock (see PlayerState::send_mapblock_compressed in the server).
+  decodeMapBlock(buf, dv, endianness) {
+    var posX = dv.getInt32(4, endianness);
+    var posY = dv.getInt32(8, endianness);
+    var posZ = dv.getInt32(12, endianness);
+    var posW = dv.getInt32(16, endianness);
+    var posWorld = dv.getInt32(20, endianness);
+    var posUniverse = dv.getInt32(24, endianness);
+    var updateNum = dv.getUint32(28, endianness);
+    var lightUpdateNum = dv.getUint32(32, endianness);
+    var lightNeedsUpdate = dv.getUint32(36, endianness);
+    var sunlit = (dv.getUint32(40, endianness) & 1) == 1 ? true : false;
+    var dataLen = dv.getUint32(44, endianness);
+    var lightDataLen = dv.getUint32(48 + dataLen * 4, endianness) * 2;
+    var lightDataLenActual = dv.getUint32(48 + dataLen * 4 + 4, endianness);
+    var lightDataOffset = 48 + dataLen * 4 + 4 + 4;
+    var IDtoISLen = dv.getUint32(48 + dataLen * 4 + 4 + 4 + lightDataLen * 2, endianness);
+    var IDtoISOffset = 48 + dataLen * 4 + 4 + 4 + lightDataLen * 2 + 4;
+    
+    var mapBlock = new MapBlock(new MapPos(posX, posY, posZ, posW, posWorld, posUniverse));
+    mapBlock.updateNum = updateNum;
+    mapBlock.lightUpdateNum = lightUpdateNum;
+    mapBlock.lightNeedsUpdate = lightNeedsUpdate;
+    
+    var y = 0;
+    var x = 0;
+    var z = 0;
+    var full = false;
+    for(var i = 0; i < dataLen; i++) {
+      var val = dv.getUint32(48 + i * 4, endianness);
+      var runVal = val & 0b00000000011111111111111111111111;
+      var runLength = ((val >> 23) & 511) + 1; //Run lengths are offset by 1 to allow storing [1, 512] instead of [0, 511]
+      
+      for(var n = 0; n < runLength; n++) {
+        if(full) {
+          throw new Error("decompressed mapblock is too long");
+        }
+        
+        mapBlock.data[x][y][z] = runVal;
+        z++;
+        if(z >= MAPBLOCK_SIZE.z) {
+          z = 0;
+          x++;
+          if(x >= MAPBLOCK_SIZE.x) {
+            x = 0;
+            y++;
+            if(y >= MAPBLOCK_SIZE.y) {
+              y = 0;
+              full = true;
+            }
+          }
+        }
+      }
+    }
+    if(!full) {
+      throw new Error("decompressed mapblock is too short");
+    }
+    
+    var y = 0;
+    var x = 0;
+    var z = 0;
+    var full = false;
+    for(var i = 0; i < lightDataLenActual; i++) {
+      var val = dv.getUint16(lightDataOffset + i * 2, endianness);
+      var runVal = val & 0b0000000011111111;
+      var runLength = ((val >> 8) & 255) + 1; //Run lengths are offset by 1 to allow storing [1, 256] instead of [0, 255]
+      
+      for(var n = 0; n < runLength; n++) {
+        if(full) {
+          throw new Error("decompressed mapblock light is too long");
+        }
+        
+        mapBlock.data[x][y][z] |= (runVal << 23);
+        z++;
+        if(z >= MAPBLOCK_SIZE.z) {
+          z = 0;
+          x++;
+          if(x >= MAPBLOCK_SIZE.x) {
+            x = 0;
+            y++;
+            if(y >= MAPBLOCK_SIZE.y) {
+              y = 0;
+              full = true;
+            }
+          }
+        }
+      }
+    }
+    if(!full) {
+      throw new Error("decompressed mapblock light is too short");
+    }
+    
+    var dec = new TextDecoder();
+    var IDtoISStr = dec.decode(new DataView(buf, IDtoISOffset, IDtoISLen));
+    
+    mapBlock.IDtoIS = JSON.parse(IDtoISStr);
+    mapBlock.IStoID = {};
+    for(var i = 0; i < mapBlock.IDtoIS.length; i++) {
+      mapBlock.IStoID[mapBlock.IDtoIS[i]] = i;
+    }
+    mapBlock.props.sunlit = sunlit;
+    
+    return mapBlock;
+  }
+  
+  //Decodes a mapblock sent as changes to a version we already have (see PlayerState::send_mapblock_delta in the server).
+  //Returns null if we don't have that version, in which case the whole mapblock is requested instead.
+  decodeMapBlockDelta(buf, dv, endianness) {
+    var pos = new MapPos(dv.getInt32(4, endianness), dv.getInt32(8, endianness), dv.getInt32(12, endianness), dv.getInt32(16, endianness), dv.getInt32(20, endianness), dv.getInt32(24, endianness));
+    var baseUpdateNum = dv.getUint32(28, endianness);
+    var baseLightUpdateNum = dv.getUint32(32, endianness);
+    var index = pos.x + "," + pos.y + "," + pos.z + "," + pos.w + "," + pos.world + "," + pos.universe;
+    
+    //Our own predicted changes aren't part of what the server sent, so use the copy from before they were applied.
+    var base = null;
+    if(index in this.pristine) {
+      base = this.pristine[index];
+    } else if(index in this.cache) {
+      base = this.cache[index];
+    }
+    if(base == null || base.updateNum != baseUpdateNum || base.lightUpdateNum != baseLightUpdateNum) {
+      delete this.cache[index];
+      delete this.pristine[index];
+      this.getMapBlock(pos);
+      return null;
+    }
+    
+    var mapBlock = new MapBlock(pos);
+    mapBlock.updateNum = dv.getUint32(36, endianness);
+    mapBlock.lightUpdateNum = dv.getUint32(40, endianness);
+    mapBlock.lightNeedsUpdate = dv.getUint32(44, endianness);
+    mapBlock.props.sunlit = (dv.getUint32(48, endianness) & 1) == 1 ? true : false;
+    var baseIDtoISLen = dv.getUint32(52, endianness);
+    var changeCount = dv.getUint32(56, endianness);
+    
+    for(var x = 0; x < mapBlock.size.x; x++) {
+      for(var y = 0; y < mapBlock.size.y; y++) {
+        for(var z = 0; z < mapBlock.size.z; z++) {
+          mapBlock.data[x][y][z] = base.data[x][y][z];
+        }
+      }
+    }
+    for(var i = 0; i < changeCount; i++) {
+      var n = dv.getUint32(60 + i * 8, endianness);
+      var x = Math.floor(n / (MAPBLOCK_SIZE.y * MAPBLOCK_SIZE.z));
+      var y = Math.floor(n / MAPBLOCK_SIZE.z) % MAPBLOCK_SIZE.y;
+      var z = n % MAPBLOCK_SIZE.z;
+      mapBlock.data[x][y][z] = dv.getUint32(60 + i * 8 + 4, endianness);
+    }
+    
+    var IDtoISLen = dv.getUint32(60 + changeCount * 8, endianness);
+    var IDtoISOffset = 60 + changeCount * 8 + 4;
+    var dec = new TextDecoder();
+    var IDtoISStr = dec.decode(new DataView(buf, IDtoISOffset, IDtoISLen));
+    
+    mapBlock.IDtoIS = base.IDtoIS.slice(0, baseIDtoISLen).concat(JSON.parse(IDtoISStr));
+    mapBlock.IStoID = {};
+    for(var i = 0; i < mapBlock.IDtoIS.length; i++) {
+      mapBlock.IStoID[mapBlock.IDtoIS[i]] = i;
+    }
+    
+    return mapBlock;
+  }
+  
+  //Copy of what the server sent, for use by decodeMapBlockDelta while predicted changes are applied on top of it.
+  savePristineMapBlock(index, mapBlock) {
+    var data = [];
+    for(var x = 0; x < mapBlock.size.x; x++) {
+      var s1 = [];
+      for(var y = 0; y < mapBlock.size.y; y++) {
+        s1.push(mapBlock.data[x][y].slice());
+      }
+      data.push(s1);
+    }
+    this.pristine[index] = {
+      data: data,
+      IDtoIS: mapBlock.IDtoIS.slice(),
+      updateNum: mapBlock.updateNum,
+      lightUpdateNum: mapBlock.lightUpdateNum
+    };
+  }
+  
   addPlayer(player) {
     this.player = player;
     
@@ -649,11 +788,29 @@ class ServerRemote extends ServerBase {
     } else {
       if(!this._socketReady) { return null; }
       
+      //Give the server a chance to send it in its own order before asking.
+      if(this.waitForStream(pos, index)) { return null; }
+      
       if(!this.requests.has(index)) {
-        this.socket.send(JSON.stringify({
-          type: "req_mapblock",
-          pos: {x: pos.x, y: pos.y, z: pos.z, w: pos.w, world: pos.world, universe: pos.universe}
-        }));
+        if(this.binaryProtocol >= 2) {
+          //Ask for everything requested this frame at once
+          if(this.pendingRequests.length == 0) {
+            setTimeout(this.flushMapBlockRequests.bind(this), 0);
+          }
+          this.pendingRequests.push(pos);
+        } else if(this.binaryProtocol >= 1) {
+          var dv = this.binaryMessage(BINARY_MESSAGE_TYPE.REQ_MAPBLOCK, 16);
+          dv.setInt32(8, pos.x, true);
+          dv.setInt32(12, pos.y, true);
+          dv.setInt32(16, pos.z, true);
+          dv.setInt32(20, pos.w, true);
+          this.socket.send(dv.buffer);
+        } else {
+          this.socket.send(JSON.stringify({
+            type: "req_mapblock",
+            pos: {x: pos.x, y: pos.y, z: pos.z, w: pos.w, world: pos.world, universe: pos.universe}
+          }));
+        }
         this.requests.add(index);
         
         setTimeout(function(index) {
@@ -664,6 +821,64 @@ class ServerRemote extends ServerBase {
       return null;
     }
   }
+  //Tells the server how far around us to push mapblocks: everything that gets rendered, plus the neighbors needed to render it.
+  sendViewDistance() {
+    var dist = new MapPos(0, 0, 0, 0, 0, 0);
+    for(var i = 0; i < renderDist.length; i++) {
+      dist.x = Math.max(dist.x, renderDist[i].x + 1);
+      dist.y = Math.max(dist.y, renderDist[i].y + 1);
+      dist.z = Math.max(dist.z, renderDist[i].z + 1);
+      dist.w = Math.max(dist.w, renderDist[i].w);
+    }
+    this.viewDistance = dist;
+    this.sendMessage({
+      type: "set_view_distance",
+      dist: {x: dist.x, y: dist.y, z: dist.z, w: dist.w},
+      keep: {x: serverUncacheDist.x, y: serverUncacheDist.y, z: serverUncacheDist.z, w: serverUncacheDist.w}
+    });
+  }
+  waitForStream(pos, index) {
+    if(this.viewDistance == null || this.playerMapblock == undefined) { return false; }
+    
+    var center = this.playerMapblock;
+    if(Math.abs(pos.x - center.x) > this.viewDistance.x || Math.abs(pos.y - center.y) > this.viewDistance.y ||
+       Math.abs(pos.z - center.z) > this.viewDistance.z || Math.abs(pos.w - center.w) > this.viewDistance.w ||
+       pos.world != center.world || pos.universe != center.universe) {
+      return false;
+    }
+    
+    var now = performance.now();
+    if(!(index in this.streamWaiting)) {
+      this.streamWaiting[index] = now;
+    }
+    if(now - this.streamWaiting[index] < STREAM_WAIT_TIME) { return true; }
+    
+    delete this.streamWaiting[index];
+    return false;
+  }
+  flushMapBlockRequests() {
+    var pending = this.pendingRequests;
+    this.pendingRequests = [];
+    if(!this._socketReady) { return; }
+    
+    for(var start = 0; start < pending.length; start += REQ_MAPBLOCKS_MAX) {
+      var count = Math.min(pending.length - start, REQ_MAPBLOCKS_MAX);
+      var dv = this.binaryMessage(BINARY_MESSAGE_TYPE.REQ_MAPBLOCKS, 4 + count * 24);
+      dv.setUint32(8, count, true);
+      for(var i = 0; i < count; i++) {
+        var pos = pending[start + i];
+        var offset = 12 + i * 24;
+        dv.setInt32(offset, pos.x, true);
+        dv.setInt32(offset + 4, pos.y, true);
+        dv.setInt32(offset + 8, pos.z, true);
+        dv.setInt32(offset + 12, pos.w, true);
+        //Only ever asking for mapblocks we don't have
+        dv.setUint32(offset + 16, 0xFFFFFFFF, true);
+        dv.setUint32(offset + 20, 0xFFFFFFFF, true);
+      }
+      this.socket.send(dv.buffer);
+    }
+  }
   setMapBlock(pos, mapBlock) {
     mapBlock.markDirty();
       
@@ -685,12 +900,18 @@ class ServerRemote extends ServerBase {
     if(index in this.cache) {
       delete this.cache[index];
     }
+    delete this.pristine[index];
   }
   
   setNodePatchOnly(pos, nodeData) {
     //FIXME
     var patch = new MapBlockPatch(this, pos, nodeData);
     
+    var index = patch.mapBlockPos.x + "," + patch.mapBlockPos.y + "," + patch.mapBlockPos.z + "," + patch.mapBlockPos.w + "," + patch.mapBlockPos.world + "," + patch.mapBlockPos.universe;
+    if(!(index in this.pristine) && index in this.cache) {
+      this.savePristineMapBlock(index, this.cache[index]);
+    }
+    
     patch.doApply();
     patch.doQueueUpdates();
     
@@ -726,12 +947,16 @@ class ServerRemote extends ServerBase {
     this.setNodePatchOnly(pos, new NodeData("air"));
     
     if(this._socketReady) {
-      this.socket.send(JSON.stringify({
-        type: "dig_node",
-        pos: {x: pos.x, y: pos.y, z: pos.z, w: pos.w, world: pos.world, universe: pos.universe},
-        wield: player.wieldIndex,
-        existing: nodeData
-      }));
+      if(this.binaryProtocol >= 1) {
+        this.socket.send(this.binaryNodeMessage(BINARY_MESSAGE_TYPE.DIG_NODE, pos, player.wieldIndex, nodeData));
+      } else {
+        this.socket.send(JSON.stringify({
+          type: "dig_node",
+          pos: {x: pos.x, y: pos.y, z: pos.z, w: pos.w, world: pos.world, universe: pos.universe},
+          wield: player.wieldIndex,
+          existing: nodeData
+        }));
+      }
     }
     
     return true;
@@ -755,12 +980,16 @@ class ServerRemote extends ServerBase {
     this.setNodePatchOnly(pos, nodeData);
     
     if(this._socketReady) {
-      this.socket.send(JSON.stringify({
-        type: "place_node",
-        pos: {x: pos.x, y: pos.y, z: pos.z, w: pos.w, world: pos.world, universe: pos.universe},
-        wield: player.wieldIndex,
-        data: nodeData
-      }));
+      if(this.binaryProtocol >= 1) {
+        this.socket.send(this.binaryNodeMessage(BINARY_MESSAGE_TYPE.PLACE_NODE, pos, player.wieldIndex, nodeData));
+      } else {
+        this.socket.send(JSON.stringify({
+          type: "place_node",
+          pos: {x: pos.x, y: pos.y, z: pos.z, w: pos.w, world: pos.world, universe: pos.universe},
+          wield: player.wieldIndex,
+          data: nodeData
+        }));
+      }
     }
     
     return true;
@@ -778,7 +1007,21 @@ class ServerRemote extends ServerBase {
     this.timeSinceUpdateSent += tscale;
     if(this.timeSinceUpdateSent > SERVER_REMOTE_UPDATE_INTERVAL || !this.playerMapblock.equals(this.lastPlayerMapblock)) {
       if(this._socketReady) {
-        if(this.player != null) {
+        if(this.player != null && this.binaryProtocol >= 1) {
+          var dv = this.binaryMessage(BINARY_MESSAGE_TYPE.SET_PLAYER_POS, 84);
+          dv.setFloat64(8, this.player.pos.x, true);
+          dv.setFloat64(16, this.player.pos.y, true);
+          dv.setFloat64(24, this.player.pos.z, true);
+          dv.setInt32(32, this.player.pos.w, true);
+          dv.setFloat64(36, this.player.vel.x, true);
+          dv.setFloat64(44, this.player.vel.y, true);
+          dv.setFloat64(52, this.player.vel.z, true);
+          dv.setFloat64(60, this.player.rot.x, true);
+          dv.setFloat64(68, this.player.rot.y, true);
+          dv.setFloat64(76, this.player.rot.z, true);
+          dv.setFloat64(84, this.player.rot.w, true);
+          this.socket.send(dv.buffer);
+        } else if(this.player != null) {
           this.socket.send(JSON.stringify({
             type: "set_player_pos",
             pos: {x: this.player.pos.x, y: this.player.pos.y, z: this.player.pos.z, w: this.player.pos.w, world: this.player.pos.world, universe: this.player.pos.universe},
@@ -805,6 +1048,30 @@ class ServerRemote extends ServerBase {
     }
   }
   
+  //Starts a binary message, with room for 'len' bytes after the header.
+  binaryMessage(type, len) {
+    var dv = new DataView(new ArrayBuffer(8 + len));
+    dv.setUint32(0, BINARY_MESSAGE_MAGIC, true);
+    dv.setUint16(4, this.binaryProtocol, true);
+    dv.setUint16(6, type, true);
+    return dv;
+  }
+  binaryNodeMessage(type, pos, wieldIndex, nodeData) {
+    var itemstring = new TextEncoder().encode(nodeData.itemstring);
+    var dv = this.binaryMessage(type, 36 + itemstring.length);
+    dv.setInt32(8, pos.x, true);
+    dv.setInt32(12, pos.y, true);
+    dv.setInt32(16, pos.z, true);
+    dv.setInt32(20, pos.w, true);
+    dv.setInt32(24, pos.world, true);
+    dv.setInt32(28, pos.universe, true);
+    dv.setInt32(32, wieldIndex, true);
+    dv.setUint32(36, nodeData.rot, true);
+    dv.setUint32(40, itemstring.length, true);
+    new Uint8Array(dv.buffer, 44).set(itemstring);
+    return dv.buffer;
+  }
+  
   sendMessage(obj) {
     this.socket.send(JSON.stringify(obj));
   }
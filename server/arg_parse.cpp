@@ -46,11 +46,15 @@ void parse_args(int argc, char *argv[]) {
         load_config_file(arg);
       }
       
+      if(expecting_value_for == "--benchmark") {
+        set_config_auto("benchmark.name", arg);
+      }
+      
       expecting_value_for = "";
       continue;
     }
     
-    if(arg == "-o" || arg == "--config-file") { //these options have values following them
+    if(arg == "-o" || arg == "--config-file" || arg == "--benchmark") { //these options have values following them
       expecting_value_for = arg;
       continue;
     }
@@ -0,0 +1,452 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "benchmark.h"
+#include "mapgen.h"
+#include "map.h"
+#include "database.h"
+#include "config.h"
+#include "log.h"
+#include "message_binary.h"
+#include "json.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace {
+  double elapsed_seconds(std::chrono::time_point<std::chrono::steady_clock> start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  
+  std::string format_rate(double count, double seconds) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << (count / seconds);
+    return out.str();
+  }
+  
+  void benchmark_mapgen_one(std::string name, Mapgen& mapgen, int columns) {
+    size_t mapblocks = 0;
+    auto start = std::chrono::steady_clock::now();
+    
+    //walk a square area around the origin, at the surface
+    int side = std::ceil(std::sqrt(columns));
+    for(int i = 0; i < columns; i++) {
+      MapPos<int> pos(i % side - side / 2, 0, i / side - side / 2, 0, 0, 0);
+      std::map<MapPos<int>, Mapblock*> generated = mapgen.generate_near(pos);
+      mapblocks += generated.size();
+      for(auto it : generated) {
+        delete it.second;
+      }
+    }
+    
+    double seconds = elapsed_seconds(start);
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, name + ": " + std::to_string(columns) + " columns in " + std::to_string((int) (seconds * 1000)) + " ms, "
+        + format_rate(columns, seconds) + " columns/s (" + format_rate(mapblocks, seconds) + " mapblocks/s)");
+  }
+  
+  void benchmark_noise(int grids) {
+    uint32_t seed = get_config<int>("map.seed");
+    siv::PerlinNoise perlin(seed);
+    PerlinNoiseBatch perlin_batch(perlin);
+    
+    const int size = MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Z;
+    double scalar[size];
+    double batch[size];
+    
+    //same parameters as the MapgenAlpha heightmap
+    double scalar_sum = 0;
+    double batch_sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < grids; i++) {
+      for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+        for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+          scalar[x * MAPBLOCK_SIZE_Z + z] = perlin.accumulatedOctaveNoise3D((x + i * MAPBLOCK_SIZE_X) / 500.0, z / 500.0, 0 / 300.0, 6);
+        }
+      }
+      for(int j = 0; j < size; j++) {
+        scalar_sum += scalar[j];
+      }
+    }
+    double scalar_seconds = elapsed_seconds(start);
+    
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < grids; i++) {
+      perlin_batch.octave_noise_3d_grid(i * MAPBLOCK_SIZE_X, 0, MAPBLOCK_SIZE_X, MAPBLOCK_SIZE_Z, 500.0, 0, 300.0, 6, batch);
+      for(int j = 0; j < size; j++) {
+        batch_sum += batch[j];
+      }
+    }
+    double batch_seconds = elapsed_seconds(start);
+    
+    //check that the two agree exactly, over a spread of positions
+    int mismatches = std::memcmp(&scalar_sum, &batch_sum, sizeof(double)) == 0 ? 0 : 1;
+    for(int i = -grids / 2; i < grids / 2; i += 7) {
+      perlin_batch.octave_noise_3d_grid(i * MAPBLOCK_SIZE_X, i * 3, MAPBLOCK_SIZE_X, MAPBLOCK_SIZE_Z, 500.0, i % 5, 300.0, 6, batch);
+      for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+        for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+          double expected = perlin.accumulatedOctaveNoise3D((x + i * MAPBLOCK_SIZE_X) / 500.0, (z + i * 3) / 500.0, (i % 5) / 300.0, 6);
+          if(std::memcmp(&expected, &batch[x * MAPBLOCK_SIZE_Z + z], sizeof(double)) != 0) {
+            mismatches++;
+          }
+        }
+      }
+    }
+    
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "noise (6 octaves, 16x16): scalar " + format_rate(grids, scalar_seconds) + " grids/s, batched ("
+        + PerlinNoiseBatch::simd_name() + ") " + format_rate(grids, batch_seconds) + " grids/s, " + std::to_string(mismatches) + " mismatches");
+    if(mismatches > 0) {
+      log(LogSource::BENCHMARK, LogLevel::ERR, "batched noise does not match scalar noise");
+    }
+  }
+  
+  int benchmark_mapgen(int iterations) {
+    if(iterations <= 0) {
+      iterations = 1000;
+    }
+    
+    uint32_t seed = get_config<int>("map.seed");
+    MapgenAlpha mapgen_alpha(seed);
+    MapgenHeck mapgen_heck(seed);
+    
+    benchmark_noise(iterations * 10);
+    benchmark_mapgen_one("MapgenAlpha", mapgen_alpha, iterations);
+    benchmark_mapgen_one("MapgenHeck", mapgen_heck, iterations);
+    return 0;
+  }
+  
+  int benchmark_fluids(int iterations) {
+    if(iterations <= 0) {
+      iterations = 100;
+    }
+    
+    uint32_t seed = get_config<int>("map.seed");
+    MapgenAlpha mapgen(seed);
+    World world("Earth", mapgen);
+    MemoryDB db;
+    boost::asio::io_context io_ctx;
+    Map map(db, {{0, &world}}, io_ctx);
+    
+    //A patch of terrain (including any ocean), with a stone platform up in the air that has water sources dotted over it.
+    std::set<MapPos<int>> region;
+    for(int x = -4; x < 4; x++) {
+      for(int y = -2; y < 4; y++) {
+        for(int z = -4; z < 4; z++) {
+          region.insert(MapPos<int>(x, y, z, 0, 0, 0));
+        }
+      }
+    }
+    for(auto mb_pos : region) {
+      delete map.get_mapblock(mb_pos);
+    }
+    for(int x = -2; x < 2; x++) {
+      for(int z = -2; z < 2; z++) {
+        MapPos<int> mb_pos(x, 3, z, 0, 0, 0);
+        Mapblock *mb = map.get_mapblock(mb_pos);
+        for(int rx = 0; rx < MAPBLOCK_SIZE_X; rx++) {
+          for(int rz = 0; rz < MAPBLOCK_SIZE_Z; rz++) {
+            mb->set_node_rel(MapPos<int>(rx, 0, rz, 0, 0, 0), Node("default:stone"));
+            if(rx % 8 == 4 && rz % 8 == 4) {
+              mb->set_node_rel(MapPos<int>(rx, 1, rz, 0, 0, 0), Node("default:water_source"));
+            }
+          }
+        }
+        map.set_mapblock(mb_pos, mb);
+        delete mb;
+      }
+    }
+    
+    //Let it flow until it settles.
+    int flow_ticks = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(auto mb_pos : region) {
+      map.wake_fluid_tick_mapblock(mb_pos);
+    }
+    for(; flow_ticks < 100; flow_ticks++) {
+      map.tick_fluids(region);
+      if(!map.has_active_fluid()) { break; }
+    }
+    double flow_seconds = elapsed_seconds(start);
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "fluids: settled after " + std::to_string(flow_ticks) + " ticks, " + std::to_string((int) (flow_seconds * 1000)) + " ms");
+    
+    //Then force every mapblock to be ticked, to measure the cellular automaton itself.
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++) {
+      for(auto mb_pos : region) {
+        map.wake_fluid_tick_mapblock(mb_pos);
+      }
+      map.tick_fluids(region);
+    }
+    double seconds = elapsed_seconds(start);
+    double nodes = (double) iterations * region.size() * MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Y * MAPBLOCK_SIZE_Z;
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "fluids: " + std::to_string(iterations) + " full ticks of " + std::to_string(region.size()) + " mapblocks in "
+        + std::to_string((int) (seconds * 1000)) + " ms, " + format_rate(nodes / 1000000.0, seconds) + " million nodes/s");
+    return 0;
+  }
+  
+  //Appends a value to a binary message, as the client would.
+  template<class T> void binary_append(std::string& out, T val) {
+    out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+  }
+  std::string binary_header(BinaryMessageType type) {
+    std::string out;
+    binary_append<uint32_t>(out, BINARY_MESSAGE_MAGIC);
+    binary_append<uint16_t>(out, BINARY_MESSAGE_VERSION);
+    binary_append<uint16_t>(out, (uint16_t) type);
+    return out;
+  }
+  
+  int benchmark_messages(int iterations) {
+    if(iterations <= 0) {
+      iterations = 50;
+    }
+    
+    //What 200 players send in about a second: 4 position updates, 8 mapblock requests, and a dig and a place each.
+    const int players = 200;
+    std::vector<std::string> json_messages;
+    std::vector<std::string> binary_messages;
+    for(int p = 0; p < players; p++) {
+      double x = p * 13.37 - 1000.5, y = 10.25 + p % 7, z = p * -7.71 + 300.125;
+      for(int i = 0; i < 4; i++) {
+        std::ostringstream json;
+        json << std::setprecision(17) << "{\"type\":\"set_player_pos\",\"pos\":{\"x\":" << x + i * 0.3 << ",\"y\":" << y << ",\"z\":" << z
+             << ",\"w\":0,\"world\":0,\"universe\":0},\"vel\":{\"x\":4.317,\"y\":-0.5,\"z\":0.0625},"
+             << "\"rot\":{\"x\":-0.1305,\"y\":0.7011,\"z\":0.1305,\"w\":0.6891}}";
+        json_messages.push_back(json.str());
+        
+        std::string bin = binary_header(BinaryMessageType::SET_PLAYER_POS);
+        for(double val : {x + i * 0.3, y, z}) { binary_append<double>(bin, val); }
+        binary_append<int32_t>(bin, 0);
+        for(double val : {4.317, -0.5, 0.0625, -0.1305, 0.7011, 0.1305, 0.6891}) { binary_append<double>(bin, val); }
+        binary_messages.push_back(bin);
+      }
+      for(int i = 0; i < 8; i++) {
+        int mb_x = (int) (x / 16) + i % 3 - 1, mb_y = i % 2, mb_z = (int) (z / 16) + i / 3 - 1;
+        json_messages.push_back("{\"type\":\"req_mapblock\",\"pos\":{\"x\":" + std::to_string(mb_x) + ",\"y\":" + std::to_string(mb_y)
+                                + ",\"z\":" + std::to_string(mb_z) + ",\"w\":0,\"world\":0,\"universe\":0}}");
+        
+        std::string bin = binary_header(BinaryMessageType::REQ_MAPBLOCK);
+        for(int32_t val : {mb_x, mb_y, mb_z, 0}) { binary_append<int32_t>(bin, val); }
+        binary_messages.push_back(bin);
+      }
+      for(std::string type : {"dig_node", "place_node"}) {
+        std::string node_key = type == "dig_node" ? "existing" : "data";
+        std::string pos_json = "{\"x\":" + std::to_string((int) x + 2) + ",\"y\":" + std::to_string((int) y - 1) + ",\"z\":" + std::to_string((int) z)
+                               + ",\"w\":0,\"world\":0,\"universe\":0}";
+        json_messages.push_back("{\"type\":\"" + type + "\",\"pos\":" + pos_json + ",\"wield\":3,\"" + node_key
+                                + "\":{\"itemstring\":\"default:cobble\",\"rot\":0}}");
+        
+        std::string bin = binary_header(type == "dig_node" ? BinaryMessageType::DIG_NODE : BinaryMessageType::PLACE_NODE);
+        for(int32_t val : {(int) x + 2, (int) y - 1, (int) z, 0, 0, 0, 3}) { binary_append<int32_t>(bin, val); }
+        binary_append<uint32_t>(bin, 0);
+        binary_append<uint32_t>(bin, 14);
+        bin.append("default:cobble");
+        binary_messages.push_back(bin);
+      }
+    }
+    
+    size_t json_bytes = 0;
+    size_t binary_bytes = 0;
+    for(size_t i = 0; i < json_messages.size(); i++) {
+      json_bytes += json_messages[i].size();
+      binary_bytes += binary_messages[i].size();
+    }
+    
+    //Decode the way Server::on_message does, and use the results so they aren't optimized out.
+    double json_sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int n = 0; n < iterations; n++) {
+      for(const std::string& payload : json_messages) {
+        JSONDocument doc(payload);
+        const JSONValue& json = doc.root();
+        std::string type = json.get<std::string>("type");
+        //Summed one at a time, in the same order as below, so that the totals match exactly.
+        if(type == "set_player_pos") {
+          for(std::string key : {"pos.x", "pos.y", "pos.z"}) { json_sum += json.get<double>(key); }
+          json_sum += json.get<int>("pos.w");
+          for(std::string key : {"vel.x", "vel.y", "vel.z", "rot.x", "rot.y", "rot.z", "rot.w"}) { json_sum += json.get<double>(key); }
+        } else if(type == "req_mapblock") {
+          for(std::string key : {"pos.x", "pos.y", "pos.z", "pos.w"}) { json_sum += json.get<int>(key); }
+        } else {
+          std::string node_key = type == "dig_node" ? "existing" : "data";
+          for(std::string key : {"pos.x", "pos.y", "pos.z", "pos.w", "pos.world", "pos.universe", "wield"}) { json_sum += json.get<int>(key); }
+          json_sum += json.get<unsigned int>(node_key + ".rot");
+          json_sum += json.get<std::string>(node_key + ".itemstring").size();
+        }
+      }
+    }
+    double json_seconds = elapsed_seconds(start);
+    
+    double binary_sum = 0;
+    start = std::chrono::steady_clock::now();
+    for(int n = 0; n < iterations; n++) {
+      for(const std::string& payload : binary_messages) {
+        BinaryMessageReader reader(payload);
+        reader.read_u32();
+        reader.read_u16();
+        BinaryMessageType type = (BinaryMessageType) reader.read_u16();
+        //Reads have to happen in order, so one per statement.
+        if(type == BinaryMessageType::SET_PLAYER_POS) {
+          for(int i = 0; i < 3; i++) { binary_sum += reader.read_f64(); }
+          binary_sum += reader.read_i32();
+          for(int i = 0; i < 7; i++) { binary_sum += reader.read_f64(); }
+        } else if(type == BinaryMessageType::REQ_MAPBLOCK) {
+          for(int i = 0; i < 4; i++) { binary_sum += reader.read_i32(); }
+        } else {
+          for(int i = 0; i < 7; i++) { binary_sum += reader.read_i32(); }
+          binary_sum += reader.read_u32();
+          binary_sum += reader.read_string().size();
+        }
+      }
+    }
+    double binary_seconds = elapsed_seconds(start);
+    
+    double count = (double) iterations * json_messages.size();
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "messages: " + std::to_string(players) + " players, " + std::to_string(json_messages.size()) + " messages/s of traffic, "
+        + std::to_string(json_bytes) + " bytes as JSON, " + std::to_string(binary_bytes) + " bytes as binary");
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "messages: JSON " + format_rate(count, json_seconds) + " messages/s, binary " + format_rate(count, binary_seconds) + " messages/s");
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "messages: one second of traffic takes " + format_rate(json_seconds * 1000, iterations) + " ms to decode as JSON, "
+        + format_rate(binary_seconds * 1000000, iterations) + " us as binary");
+    if(json_sum != binary_sum) {
+      log(LogSource::BENCHMARK, LogLevel::ERR, "JSON and binary messages decoded differently");
+      return 1;
+    }
+    return 0;
+  }
+  
+  //Sums the fields Server::on_message reads from each message type; works on a ptree or a JSONValue.
+  template<class Tree> double json_message_fields(const Tree& msg) {
+    std::string type = msg.template get<std::string>("type");
+    double sum = type.size();
+    if(type == "set_player_pos") {
+      for(const char *key : {"pos.x", "pos.y", "pos.z", "vel.x", "vel.y", "vel.z", "rot.x", "rot.y", "rot.z", "rot.w"}) { sum += msg.template get<double>(key); }
+      sum += msg.template get<int>("pos.w");
+    } else if(type == "req_mapblock" || type == "interact") {
+      for(const char *key : {"pos.x", "pos.y", "pos.z", "pos.w", "pos.world", "pos.universe"}) { sum += msg.template get<int>(key); }
+    } else if(type == "dig_node" || type == "place_node") {
+      std::string node_key = type == "dig_node" ? "existing" : "data";
+      for(const char *key : {"pos.x", "pos.y", "pos.z", "pos.w", "pos.world", "pos.universe", "wield"}) { sum += msg.template get<int>(key); }
+      sum += msg.template get<unsigned int>(node_key + ".rot");
+      sum += msg.template get<std::string>(node_key + ".itemstring").size();
+    } else if(type == "inv_swap" || type == "inv_distribute") {
+      for(const char *key : {"ref1.objType", "ref1.listName", "ref2.objType", "ref2.listName", "orig1.itemstring", "orig2.itemstring", "reqID", "craftPatchID"}) {
+        sum += msg.template get<std::string>(key).size();
+      }
+      for(const char *key : {"ref1.index", "ref2.index", "orig1.count", "orig2.count"}) { sum += msg.template get<int>(key); }
+      if(type == "inv_distribute")
+        sum += msg.template get<int>("qty1") + msg.template get<int>("qty2");
+    } else if(type == "send_chat") {
+      sum += msg.template get<std::string>("channel").size() + msg.template get<std::string>("message").size();
+    } else if(type == "chat_command") {
+      sum += msg.template get<std::string>("command").size();
+    } else if(type == "ui_close") {
+      sum += msg.template get<std::string>("id").size();
+    }
+    return sum;
+  }
+  
+  int benchmark_json(int iterations) {
+    if(iterations <= 0) {
+      iterations = 20000;
+    }
+    
+    //Captured from a web client session, roughly in the proportions it sends them.
+    std::vector<std::string> messages = {
+      "{\"type\":\"set_player_pos\",\"pos\":{\"x\":-34.51728813380951,\"y\":11.6,\"z\":120.28906307161734,\"w\":0,\"world\":0,\"universe\":0},\"vel\":{\"x\":-3.0524339590539466,\"y\":0,\"z\":3.0524339590539475},\"rot\":{\"x\":-0.04107537768864601,\"y\":-0.9128603005349426,\"z\":-0.09652826049960818,\"w\":0.3884423488048558}}",
+      "{\"type\":\"set_player_pos\",\"pos\":{\"x\":-34.8225315297149,\"y\":11.6,\"z\":120.5943064675228,\"w\":0,\"world\":0,\"universe\":0},\"vel\":{\"x\":-3.0524339590539466,\"y\":-0.32666666666666666,\"z\":3.0524339590539475},\"rot\":{\"x\":-0.04107537768864601,\"y\":-0.9128603005349426,\"z\":-0.09652826049960818,\"w\":0.3884423488048558}}",
+      "{\"type\":\"req_mapblock\",\"pos\":{\"x\":-3,\"y\":0,\"z\":7,\"w\":0,\"world\":0,\"universe\":0}}",
+      "{\"type\":\"req_mapblock\",\"pos\":{\"x\":-2,\"y\":1,\"z\":7,\"w\":0,\"world\":0,\"universe\":0}}",
+      "{\"type\":\"req_mapblock\",\"pos\":{\"x\":-3,\"y\":-1,\"z\":8,\"w\":0,\"world\":0,\"universe\":0}}",
+      "{\"type\":\"dig_node\",\"pos\":{\"x\":-36,\"y\":10,\"z\":122,\"w\":0,\"world\":0,\"universe\":0},\"wield\":0,\"existing\":{\"itemstring\":\"default:grass\",\"rot\":0}}",
+      "{\"type\":\"place_node\",\"pos\":{\"x\":-36,\"y\":11,\"z\":123,\"w\":0,\"world\":0,\"universe\":0},\"wield\":2,\"data\":{\"itemstring\":\"default:wood_planks\",\"rot\":4}}",
+      "{\"type\":\"inv_swap\",\"ref1\":{\"objType\":\"player\",\"objID\":null,\"listName\":\"main\",\"index\":3},\"ref2\":{\"objType\":\"player\",\"objID\":null,\"listName\":\"craft\",\"index\":0},"
+        "\"orig1\":{\"itemstring\":\"default:wood\",\"count\":12,\"wear\":null,\"data\":null},\"orig2\":{\"itemstring\":\"default:cobble\",\"count\":1,\"wear\":null,\"data\":null},"
+        "\"reqID\":\"0.6281945126271537\",\"craftPatchID\":\"0.4405861271843815\"}",
+      "{\"type\":\"inv_distribute\",\"ref1\":{\"objType\":\"player\",\"objID\":null,\"listName\":\"main\",\"index\":3},\"ref2\":{\"objType\":\"player\",\"objID\":null,\"listName\":\"main\",\"index\":9},"
+        "\"orig1\":{\"itemstring\":\"default:wood\",\"count\":12,\"wear\":null,\"data\":null},\"orig2\":{\"itemstring\":\"default:wood\",\"count\":1,\"wear\":null,\"data\":null},"
+        "\"qty1\":6,\"qty2\":7,\"reqID\":\"0.09313287420413597\",\"craftPatchID\":\"0.7723208834016163\"}",
+      "{\"type\":\"send_chat\",\"channel\":\"main\",\"message\":\"anyone seen the \\\"big tree\\\" near spawn? \\u2192 it's at -40 12 130\"}",
+      "{\"type\":\"chat_command\",\"command\":\"/tp -40 12 130\"}",
+      "{\"type\":\"interact\",\"pos\":{\"x\":-37,\"y\":11,\"z\":124,\"w\":0,\"world\":0,\"universe\":0}}",
+      "{\"type\":\"ui_close\",\"id\":\"5d6f7d0e-8a53-4c47-9a2e-3c1b1f0f2a61\"}"
+    };
+    size_t bytes = 0;
+    for(const std::string& msg : messages) {
+      bytes += msg.size();
+    }
+    
+    double ptree_sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int n = 0; n < iterations; n++) {
+      for(const std::string& payload : messages) {
+        std::stringstream ss;
+        ss << payload;
+        boost::property_tree::ptree pt;
+        boost::property_tree::read_json(ss, pt);
+        ptree_sum += json_message_fields(pt);
+      }
+    }
+    double ptree_seconds = elapsed_seconds(start);
+    
+    double reader_sum = 0;
+    start = std::chrono::steady_clock::now();
+    for(int n = 0; n < iterations; n++) {
+      for(const std::string& payload : messages) {
+        JSONDocument doc(payload);
+        reader_sum += json_message_fields(doc.root());
+      }
+    }
+    double reader_seconds = elapsed_seconds(start);
+    
+    double count = (double) iterations * messages.size();
+    double total_bytes = (double) iterations * bytes;
+    log(LogSource::BENCHMARK, LogLevel::NOTICE, "json: ptree " + format_rate(count, ptree_seconds) + " messages/s (" + format_rate(total_bytes / 1000000, ptree_seconds) + " MB/s), "
+        + "JSONDocument " + format_rate(count, reader_seconds) + " messages/s (" + format_rate(total_bytes / 1000000, reader_seconds) + " MB/s)");
+    if(ptree_sum != reader_sum) {
+      log(LogSource::BENCHMARK, LogLevel::ERR, "ptree and JSONDocument decoded differently");
+      return 1;
+    }
+    return 0;
+  }
+}
+
+int run_benchmark(std::string name) {
+  int iterations = get_config<int>("benchmark.iterations");
+  
+  if(name == "mapgen") {
+    return benchmark_mapgen(iterations);
+  }
+  if(name == "fluids") {
+    return benchmark_fluids(iterations);
+  }
+  if(name == "messages") {
+    return benchmark_messages(iterations);
+  }
+  if(name == "json") {
+    return benchmark_json(iterations);
+  }
+  
+  log(LogSource::BENCHMARK, LogLevel::EMERG, "unknown benchmark: '" + name + "'");
+  return 1;
+}
@@ -28,6 +28,7 @@
 std::map<std::string, std::string> config_keys_str = {
   {"server.motd", ""},
   {"server.default_terminate_message", "Server shutting down."},
+  {"server.tick_policy", "skip"},
   
   {"database.backend", "sqlite3"},
   {"database.sqlite3_file", "test_map.sqlite"},
@@ -40,7 +41,9 @@ std::map<std::string, std::string> config_keys_str = {
   {"loader.defs_file", "defs.json"},
   
   {"player.default_grants", "interact shout touch"},
-  {"player.default_kick_message", "Kicked"}
+  {"player.default_kick_message", "Kicked"},
+  
+  {"benchmark.name", ""}
 };
 std::map<std::string, std::string> config_str;
 
@@ -49,13 +52,43 @@ std::map<std::string, int> config_keys_int = {
   {"server.threads", 0},
   {"server.max_players", 0},
   {"server.max_players_from_address", 0},
+  {"server.tick_work_budget", 100},
+  {"server.tick_threads", 0},
+  {"server.tick_interval", 250},
+  {"server.tick_max_catch_up", 4},
+  {"server.mapblock_tick_ratio", 2},
+  {"server.fluid_tick_ratio", 8},
+  {"server.slow_tick_ratio", 1},
+  {"server.interact_tick_ratio", 8},
   
   {"database.L1_cache_target", 10000},
   {"database.L2_cache_target", 100000},
   
   {"map.seed", 82},
   {"map.water_depth", 0},
-  {"map.sand_depth", 3}
+  {"map.sand_depth", 3},
+  {"map.column_cache_target", 4096},
+  {"map.tree_cache_target", 2048},
+  {"map.set_node_window", 50},
+  {"map.region_edit_max_nodes", 4000000},
+  {"map.delta_cache_target", 4096},
+  {"map.frame_cache_target", 4096},
+  
+  {"player.stream_rate", 1048576},
+  {"player.stream_burst", 262144},
+  {"player.max_known_mapblocks", 16384},
+  
+  {"ratelimit.set_player_pos_rate", 30},
+  {"ratelimit.set_player_pos_burst", 60},
+  {"ratelimit.req_mapblock_rate", 400},
+  {"ratelimit.req_mapblock_burst", 4096},
+  {"ratelimit.dig_node_rate", 20},
+  {"ratelimit.dig_node_burst", 40},
+  {"ratelimit.place_node_rate", 20},
+  {"ratelimit.place_node_burst", 40},
+  {"ratelimit.kick_violations", 0},
+  
+  {"benchmark.iterations", 0}
 };
 std::map<std::string, int> config_int;
 
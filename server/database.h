@@ -39,6 +39,7 @@ class Database {
     virtual MapblockCompressed* get_mapblock_compressed(MapPos<int> pos) = 0;
     virtual void set_mapblock(MapPos<int> pos, Mapblock *mb) = 0;
     virtual void set_mapblock_if_not_exists(MapPos<int> pos, Mapblock *mb) = 0;
+    virtual void set_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks) = 0; //all in one batch
     virtual void clean_cache() = 0;
     
     virtual NodeMeta* get_node_meta(MapPos<int> pos) = 0;
@@ -81,6 +82,7 @@ class MemoryDB : public Database {
     virtual MapblockCompressed* get_mapblock_compressed(MapPos<int> pos);
     virtual void set_mapblock(MapPos<int> pos, Mapblock *mb);
     virtual void set_mapblock_if_not_exists(MapPos<int> pos, Mapblock *mb);
+    virtual void set_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks);
     virtual void clean_cache();
     
     virtual NodeMeta* get_node_meta(MapPos<int> pos);
@@ -123,6 +125,7 @@ class SQLiteDB: public Database {
     virtual MapblockCompressed* get_mapblock_compressed(MapPos<int> pos);
     virtual void set_mapblock(MapPos<int> pos, Mapblock *mb);
     virtual void set_mapblock_if_not_exists(MapPos<int> pos, Mapblock *mb);
+    virtual void set_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks);
     virtual void clean_cache();
     
     virtual NodeMeta* get_node_meta(MapPos<int> pos);
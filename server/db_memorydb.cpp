@@ -71,6 +71,18 @@ void MemoryDB::set_mapblock(MapPos<int> pos, Mapblock *mb) {
   datastore[pos] = mb_store;
 }
 
+void MemoryDB::set_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks) {
+  std::unique_lock<std::shared_mutex> d_lock(datastore_lock);
+  
+  for(auto it : mapblocks) {
+    auto search = datastore.find(it.first);
+    if(search != datastore.end()) {
+      delete search->second;
+    }
+    datastore[it.first] = new Mapblock(*it.second);
+  }
+}
+
 void MemoryDB::set_mapblock_if_not_exists(MapPos<int> pos, Mapblock *mb) {
   std::unique_lock<std::shared_mutex> d_lock(datastore_lock);
   
@@ -33,6 +33,18 @@ InvRef::InvRef(boost::property_tree::ptree pt)
   if(index_raw != "null")
     index = pt.get<int>("index");
 }
+InvRef::InvRef(const JSONValue& val)
+    : obj_type(val.get<std::string>("objType")), obj_id(std::nullopt),
+      list_name(val.get<std::string>("listName")), index(std::nullopt)
+{
+  const JSONValue& obj_id_val = val.child("objID");
+  if(!obj_id_val.is_null())
+    obj_id = obj_id_val.as<std::string>();
+  
+  const JSONValue& index_val = val.child("index");
+  if(!index_val.is_null())
+    index = index_val.as<int>();
+}
 
 bool InvRef::operator<(const InvRef& other) const {
   if(obj_type == other.obj_type) {
@@ -93,6 +105,26 @@ InvStack::InvStack(boost::property_tree::ptree pt) : is_nil(false) {
   else
     data = pt.get<std::string>("data");
 }
+InvStack::InvStack(const JSONValue& val) : is_nil(false) {
+  if(!val.is_object()) {
+    is_nil = true;
+    return;
+  }
+  
+  itemstring = val.get<std::string>("itemstring");
+  count = val.get<int>("count");
+  const JSONValue& wear_val = val.child("wear");
+  if(wear_val.is_null())
+    wear = std::nullopt;
+  else
+    wear = wear_val.as<int>();
+  
+  const JSONValue& data_val = val.child("data");
+  if(data_val.is_null())
+    data = std::nullopt;
+  else
+    data = data_val.as<std::string>();
+}
 std::string InvStack::to_json() const {
   if(is_nil)
     return "null";
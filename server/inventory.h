@@ -20,6 +20,7 @@
 #define __INVENTORY_H__
 
 #include "item.h"
+#include "json.h"
 
 #include <string>
 #include <map>
@@ -37,6 +38,7 @@ class InvStack {
     InvStack(std::string spec);
     InvStack(ItemDef def);
     InvStack(boost::property_tree::ptree pt);
+    InvStack(const JSONValue& val);
     
     bool operator==(const InvStack& other) const;
     bool operator!=(const InvStack& other) const;
@@ -62,6 +64,7 @@ class InvRef {
         : obj_type(_obj_type), obj_id(_obj_id), list_name(_list_name), index(_index) {};
     
     InvRef(boost::property_tree::ptree pt);
+    InvRef(const JSONValue& val);
     
     bool operator<(const InvRef& other) const;
     bool operator==(const InvRef& other) const;
@@ -19,6 +19,7 @@
 #include "json.h"
 
 #include <sstream>
+#include <charconv>
 
 std::string json_escape(std::string s) {
   std::ostringstream res;
@@ -51,3 +52,328 @@ std::string json_escape(std::string s) {
   }
   return res.str();
 }
+
+#define JSON_NO_NODE UINT32_MAX
+
+JSONDocument::JSONDocument(std::string_view text) : src(text), off(0) {
+  //Client messages average well over 8 bytes per value, so this usually avoids regrowing.
+  nodes.reserve(8 + text.size() / 8);
+  
+  skip_ws();
+  parse_value(0);
+  skip_ws();
+  if(off != src.size())
+    error("trailing characters");
+}
+
+void JSONDocument::error(const std::string& what) {
+  throw JSONError("JSON parse error: " + what + " at offset " + std::to_string(off));
+}
+
+void JSONDocument::skip_ws() {
+  while(off < src.size() && (src[off] == ' ' || src[off] == '\t' || src[off] == '\n' || src[off] == '\r'))
+    off++;
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static void append_utf8(std::string& out, uint32_t cp) {
+  if(cp < 0x80) {
+    out += (char) cp;
+  } else if(cp < 0x800) {
+    out += (char) (0xC0 | (cp >> 6));
+    out += (char) (0x80 | (cp & 0x3F));
+  } else if(cp < 0x10000) {
+    out += (char) (0xE0 | (cp >> 12));
+    out += (char) (0x80 | ((cp >> 6) & 0x3F));
+    out += (char) (0x80 | (cp & 0x3F));
+  } else {
+    out += (char) (0xF0 | (cp >> 18));
+    out += (char) (0x80 | ((cp >> 12) & 0x3F));
+    out += (char) (0x80 | ((cp >> 6) & 0x3F));
+    out += (char) (0x80 | (cp & 0x3F));
+  }
+}
+
+uint32_t JSONDocument::parse_value(int depth) {
+  if(depth > JSON_MAX_DEPTH)
+    error("nesting too deep");
+  if(off >= src.size())
+    error("unexpected end of input");
+  
+  //Indices rather than references: nodes may reallocate while children are parsed.
+  uint32_t index = nodes.size();
+  nodes.emplace_back();
+  nodes[index].doc = this;
+  nodes[index].m_type = JSONType::NUL;
+  nodes[index].boolean = false;
+  nodes[index].first = JSON_NO_NODE;
+  nodes[index].next = JSON_NO_NODE;
+  
+  char c = src[off];
+  if(c == '{' || c == '[') {
+    bool is_object = (c == '{');
+    char close = is_object ? '}' : ']';
+    nodes[index].m_type = is_object ? JSONType::OBJECT : JSONType::ARRAY;
+    off++;
+    skip_ws();
+    if(off < src.size() && src[off] == close) {
+      off++;
+      return index;
+    }
+    
+    uint32_t last = JSON_NO_NODE;
+    while(true) {
+      std::string_view key;
+      if(is_object) {
+        if(off >= src.size() || src[off] != '"')
+          error("expected object key");
+        key = parse_string();
+        skip_ws();
+        if(off >= src.size() || src[off] != ':')
+          error("expected ':'");
+        off++;
+        skip_ws();
+      }
+      
+      uint32_t child = parse_value(depth + 1);
+      nodes[child].m_key = key;
+      if(last == JSON_NO_NODE)
+        nodes[index].first = child;
+      else
+        nodes[last].next = child;
+      last = child;
+      
+      skip_ws();
+      if(off >= src.size())
+        error("unexpected end of input");
+      if(src[off] == ',') {
+        off++;
+        skip_ws();
+        continue;
+      }
+      if(src[off] == close) {
+        off++;
+        return index;
+      }
+      error("expected ',' or '" + std::string(1, close) + "'");
+    }
+  } else if(c == '"') {
+    nodes[index].m_type = JSONType::STRING;
+    std::string_view text = parse_string();
+    nodes[index].text = text;
+  } else if(src.compare(off, 4, "true") == 0) {
+    nodes[index].m_type = JSONType::BOOLEAN;
+    nodes[index].boolean = true;
+    off += 4;
+  } else if(src.compare(off, 5, "false") == 0) {
+    nodes[index].m_type = JSONType::BOOLEAN;
+    off += 5;
+  } else if(src.compare(off, 4, "null") == 0) {
+    off += 4;
+  } else {
+    size_t start = off;
+    if(src[off] == '-')
+      off++;
+    if(off < src.size() && src[off] == '0') {
+      off++;
+    } else if(off < src.size() && is_digit(src[off])) {
+      while(off < src.size() && is_digit(src[off])) { off++; }
+    } else {
+      error("invalid value");
+    }
+    if(off < src.size() && src[off] == '.') {
+      off++;
+      if(off >= src.size() || !is_digit(src[off]))
+        error("invalid number");
+      while(off < src.size() && is_digit(src[off])) { off++; }
+    }
+    if(off < src.size() && (src[off] == 'e' || src[off] == 'E')) {
+      off++;
+      if(off < src.size() && (src[off] == '+' || src[off] == '-'))
+        off++;
+      if(off >= src.size() || !is_digit(src[off]))
+        error("invalid number");
+      while(off < src.size() && is_digit(src[off])) { off++; }
+    }
+    nodes[index].m_type = JSONType::NUMBER;
+    nodes[index].text = src.substr(start, off - start);
+  }
+  
+  return index;
+}
+
+//Called at the opening quote; leaves off just past the closing one.
+std::string_view JSONDocument::parse_string() {
+  off++;
+  size_t start = off;
+  while(off < src.size() && src[off] != '"' && src[off] != '\\') {
+    if((unsigned char) src[off] < 0x20)
+      error("control character in string");
+    off++;
+  }
+  if(off >= src.size())
+    error("unterminated string");
+  if(src[off] == '"') {
+    off++;
+    return src.substr(start, off - 1 - start);
+  }
+  
+  //Has escapes, so it can't be a view into the source.
+  std::string out(src.substr(start, off - start));
+  while(true) {
+    if(off >= src.size())
+      error("unterminated string");
+    char c = src[off];
+    if(c == '"') {
+      off++;
+      break;
+    }
+    if((unsigned char) c < 0x20)
+      error("control character in string");
+    if(c != '\\') {
+      out += c;
+      off++;
+      continue;
+    }
+    
+    off++;
+    if(off >= src.size())
+      error("unterminated string");
+    char e = src[off++];
+    switch(e) {
+      case '"': out += '"'; break;
+      case '\\': out += '\\'; break;
+      case '/': out += '/'; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u': {
+        auto read_hex4 = [this]() -> uint32_t {
+          if(off + 4 > src.size())
+            error("truncated \\u escape");
+          uint32_t val = 0;
+          for(int i = 0; i < 4; i++) {
+            char h = src[off++];
+            val <<= 4;
+            if(h >= '0' && h <= '9') { val |= h - '0'; }
+            else if(h >= 'a' && h <= 'f') { val |= h - 'a' + 10; }
+            else if(h >= 'A' && h <= 'F') { val |= h - 'A' + 10; }
+            else { error("invalid \\u escape"); }
+          }
+          return val;
+        };
+        uint32_t cp = read_hex4();
+        if(cp >= 0xDC00 && cp <= 0xDFFF)
+          error("unpaired surrogate");
+        if(cp >= 0xD800 && cp <= 0xDBFF) {
+          if(src.compare(off, 2, "\\u") != 0)
+            error("unpaired surrogate");
+          off += 2;
+          uint32_t low = read_hex4();
+          if(low < 0xDC00 || low > 0xDFFF)
+            error("unpaired surrogate");
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+        append_utf8(out, cp);
+        break;
+      }
+      default:
+        off--;
+        error("invalid escape");
+    }
+  }
+  
+  decoded.push_back(std::move(out));
+  return decoded.back();
+}
+
+const JSONValue *JSONValue::find(std::string_view path) const {
+  const JSONValue *cur = this;
+  while(true) {
+    size_t dot = path.find('.');
+    std::string_view name = path.substr(0, dot);
+    if(cur->m_type != JSONType::OBJECT)
+      return NULL;
+    
+    const JSONValue *found = NULL;
+    for(const JSONValue *it = cur->first_child(); it != NULL; it = it->next_sibling()) {
+      if(it->m_key == name) {
+        found = it;
+        break;
+      }
+    }
+    if(found == NULL || dot == std::string_view::npos)
+      return found;
+    
+    cur = found;
+    path.remove_prefix(dot + 1);
+  }
+}
+
+const JSONValue& JSONValue::child(std::string_view path) const {
+  const JSONValue *found = find(path);
+  if(found == NULL)
+    throw JSONError("No such node (" + std::string(path) + ")");
+  return *found;
+}
+
+const JSONValue *JSONValue::first_child() const {
+  if(first == JSON_NO_NODE)
+    return NULL;
+  return &doc->nodes[first];
+}
+const JSONValue *JSONValue::next_sibling() const {
+  if(next == JSON_NO_NODE)
+    return NULL;
+  return &doc->nodes[next];
+}
+
+template<> std::string_view JSONValue::as<std::string_view>() const {
+  switch(m_type) {
+    case JSONType::STRING:
+    case JSONType::NUMBER:
+      return text;
+    case JSONType::BOOLEAN:
+      return boolean ? "true" : "false";
+    case JSONType::NUL:
+      return "null";
+    default:
+      throw JSONError("conversion of '" + std::string(m_key) + "' failed: not a scalar");
+  }
+}
+template<> std::string JSONValue::as<std::string>() const {
+  return std::string(as<std::string_view>());
+}
+
+template<class T> static T json_parse_number(std::string_view text, std::string_view key, const char *type_name) {
+  T val;
+  auto res = std::from_chars(text.data(), text.data() + text.size(), val);
+  if(res.ec != std::errc() || res.ptr != text.data() + text.size())
+    throw JSONError("conversion of '" + std::string(key) + "' to " + type_name + " failed");
+  return val;
+}
+
+template<> int JSONValue::as<int>() const {
+  return json_parse_number<int>(as<std::string_view>(), m_key, "int");
+}
+template<> unsigned int JSONValue::as<unsigned int>() const {
+  return json_parse_number<unsigned int>(as<std::string_view>(), m_key, "unsigned int");
+}
+template<> double JSONValue::as<double>() const {
+  return json_parse_number<double>(as<std::string_view>(), m_key, "double");
+}
+template<> bool JSONValue::as<bool>() const {
+  if(m_type == JSONType::BOOLEAN)
+    return boolean;
+  std::string_view val = as<std::string_view>();
+  if(val == "true" || val == "1")
+    return true;
+  if(val == "false" || val == "0")
+    return false;
+  throw JSONError("conversion of '" + std::string(m_key) + "' to bool failed");
+}
@@ -20,7 +20,94 @@
 #define __JSON_H__
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <stdexcept>
+
+//Deepest nesting of arrays/objects accepted by JSONDocument, to bound recursion on untrusted input
+#define JSON_MAX_DEPTH 64
 
 std::string json_escape(std::string s);
 
+class JSONError : public std::runtime_error {
+  public:
+    JSONError(const std::string& what) : std::runtime_error(what) {}
+};
+
+enum class JSONType : uint8_t {NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT};
+
+class JSONDocument;
+
+//A value inside a JSONDocument; only valid while the document is.
+//Accessors follow boost::property_tree so message handlers read the same way:
+//paths are dotted ("pos.x"), missing keys throw JSONError, and scalars convert
+//between strings and numbers (null reads as the string "null").
+class JSONValue {
+  public:
+    JSONType type() const { return m_type; }
+    bool is_null() const { return m_type == JSONType::NUL; }
+    bool is_object() const { return m_type == JSONType::OBJECT; }
+    bool is_array() const { return m_type == JSONType::ARRAY; }
+    
+    //Object key of this value, empty for array elements and the root
+    std::string_view key() const { return m_key; }
+    
+    //Walks a dotted path of object keys; find returns NULL where child throws.
+    const JSONValue *find(std::string_view path) const;
+    const JSONValue& child(std::string_view path) const;
+    
+    template<class T> T as() const;
+    template<class T> T get(std::string_view path) const { return child(path).as<T>(); }
+    
+    //Iteration over array elements or object members: first_child, then next_sibling until NULL.
+    const JSONValue *first_child() const;
+    const JSONValue *next_sibling() const;
+  
+  private:
+    friend class JSONDocument;
+    
+    const JSONDocument *doc;
+    JSONType m_type;
+    bool boolean;
+    std::string_view text; //number as written, or string contents with escapes decoded
+    std::string_view m_key;
+    uint32_t first;
+    uint32_t next;
+};
+
+template<> std::string JSONValue::as<std::string>() const;
+template<> std::string_view JSONValue::as<std::string_view>() const;
+template<> int JSONValue::as<int>() const;
+template<> unsigned int JSONValue::as<unsigned int>() const;
+template<> double JSONValue::as<double>() const;
+template<> bool JSONValue::as<bool>() const;
+
+//Parses JSON text in place, without the per-node allocations of a ptree: values
+//live in one array, and strings are views into the text unless they contain
+//escapes. The text must outlive the document.
+//Throws JSONError on malformed input.
+class JSONDocument {
+  public:
+    JSONDocument(std::string_view text);
+    JSONDocument(const JSONDocument&) = delete;
+    JSONDocument& operator=(const JSONDocument&) = delete;
+    
+    const JSONValue& root() const { return nodes[0]; }
+    
+  private:
+    friend class JSONValue;
+    
+    uint32_t parse_value(int depth);
+    std::string_view parse_string();
+    void skip_ws();
+    [[noreturn]] void error(const std::string& what);
+    
+    std::string_view src;
+    size_t off;
+    std::vector<JSONValue> nodes;
+    std::deque<std::string> decoded; //strings that had escapes; deque so views stay valid
+};
+
 #endif
@@ -0,0 +1,133 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "known_mapblocks.h"
+
+KnownMapblocks::KnownMapblocks() : slots(KNOWN_MAPBLOCKS_MIN_SLOTS, Entry()), count(0) {}
+
+size_t KnownMapblocks::hash(MapPos<int> pos) {
+  uint64_t h = (uint32_t) pos.x;
+  h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) pos.y;
+  h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) pos.z;
+  h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) pos.w;
+  h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) pos.world;
+  h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) pos.universe;
+  //Mix the high bits back down, since only the low ones pick the slot.
+  h ^= h >> 32;
+  h *= 0xD6E8FEB86659FD93ULL;
+  h ^= h >> 32;
+  return (size_t) h;
+}
+
+bool KnownMapblocks::matches(const Entry& entry, MapPos<int> pos) {
+  return entry.x == pos.x && entry.y == pos.y && entry.z == pos.z && entry.w == pos.w && entry.world == pos.world && entry.universe == pos.universe;
+}
+
+size_t KnownMapblocks::find_slot(MapPos<int> pos) const {
+  size_t mask = slots.size() - 1;
+  size_t i = hash(pos) & mask;
+  while(slots[i].used && !matches(slots[i], pos)) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+std::optional<MapblockUpdateInfo> KnownMapblocks::get(MapPos<int> pos) const {
+  const Entry& entry = slots[find_slot(pos)];
+  if(!entry.used) { return std::nullopt; }
+  
+  MapblockUpdateInfo info(pos);
+  info.update_num = entry.update_num;
+  info.light_update_num = entry.light_update_num;
+  info.light_needs_update = entry.light_needs_update;
+  return info;
+}
+
+bool KnownMapblocks::set(MapblockUpdateInfo info) {
+  size_t i = find_slot(info.pos);
+  bool inserted = !slots[i].used;
+  if(inserted && (count + 1) * 4 > slots.size() * 3) {
+    resize(slots.size() * 2);
+    i = find_slot(info.pos);
+  }
+  
+  Entry& entry = slots[i];
+  entry.x = info.pos.x;
+  entry.y = info.pos.y;
+  entry.z = info.pos.z;
+  entry.w = info.pos.w;
+  entry.world = info.pos.world;
+  entry.universe = info.pos.universe;
+  entry.update_num = info.update_num;
+  entry.light_update_num = info.light_update_num;
+  entry.light_needs_update = info.light_needs_update;
+  entry.used = true;
+  
+  if(inserted) { count++; }
+  return inserted;
+}
+
+bool KnownMapblocks::erase(MapPos<int> pos) {
+  size_t mask = slots.size() - 1;
+  size_t i = find_slot(pos);
+  if(!slots[i].used) { return false; }
+  
+  //Backward shift: pull later entries of the same run into the gap, as long as that doesn't move one
+  //before its home slot, so that every entry can still be found by probing from its home.
+  size_t j = i;
+  while(true) {
+    j = (j + 1) & mask;
+    if(!slots[j].used) { break; }
+    
+    size_t home = hash(slots[j].pos()) & mask;
+    //Whether 'home' is cyclically within (i, j], in which case the entry at j has to stay where it is.
+    bool stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+    if(!stays) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i].used = false;
+  count--;
+  
+  if(slots.size() > KNOWN_MAPBLOCKS_MIN_SLOTS && count * 8 < slots.size()) {
+    resize(slots.size() / 2);
+  }
+  return true;
+}
+
+void KnownMapblocks::clear() {
+  std::vector<Entry>(KNOWN_MAPBLOCKS_MIN_SLOTS, Entry()).swap(slots);
+  count = 0;
+}
+
+void KnownMapblocks::resize(size_t slot_count) {
+  std::vector<Entry> old(slot_count, Entry());
+  old.swap(slots);
+  
+  size_t mask = slots.size() - 1;
+  for(const Entry& entry : old) {
+    if(!entry.used) { continue; }
+    
+    size_t i = hash(entry.pos()) & mask;
+    while(slots[i].used) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = entry;
+  }
+}
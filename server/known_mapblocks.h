@@ -0,0 +1,81 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __KNOWN_MAPBLOCKS_H__
+#define __KNOWN_MAPBLOCKS_H__
+
+#include "vector.h"
+#include "mapblock.h"
+
+#include <cstdint>
+#include <vector>
+#include <optional>
+
+//Starting number of slots; always a power of two.
+#define KNOWN_MAPBLOCKS_MIN_SLOTS 64
+
+//The mapblocks a player has, and which version of each.
+//A flat hash table (open addressing, linear probing) of packed entries: 36 bytes each, where a
+//std::map<MapPos<int>, MapblockUpdateInfo> takes over 100 per mapblock, and a lookup is usually one cache line.
+//Grows at 3/4 full and shrinks at 1/8 full, so it gives memory back once mapblocks are forgotten.
+//Not thread safe; guarded by the player's lock.
+class KnownMapblocks {
+  public:
+    KnownMapblocks();
+    
+    size_t size() const { return count; }
+    
+    std::optional<MapblockUpdateInfo> get(MapPos<int> pos) const;
+    //Returns true if the mapblock wasn't known before.
+    bool set(MapblockUpdateInfo info);
+    //Returns true if the mapblock was known.
+    bool erase(MapPos<int> pos);
+    void clear();
+    
+    //Calls fn(MapPos<int>) for every known mapblock, in no particular order. fn must not change the table.
+    template<class F> void for_each(F fn) const {
+      for(const Entry& entry : slots) {
+        if(entry.used) {
+          fn(entry.pos());
+        }
+      }
+    }
+    
+  private:
+    class Entry {
+      public:
+        MapPos<int> pos() const { return MapPos<int>(x, y, z, w, world, universe); }
+        
+        int32_t x, y, z, w, world, universe;
+        uint32_t update_num;
+        uint32_t light_update_num;
+        int8_t light_needs_update; //only ever 0, 1, or 2
+        bool used;
+    };
+    
+    static size_t hash(MapPos<int> pos);
+    static bool matches(const Entry& entry, MapPos<int> pos);
+    //The slot holding 'pos', or else the empty slot where it would go.
+    size_t find_slot(MapPos<int> pos) const;
+    void resize(size_t slot_count);
+    
+    std::vector<Entry> slots;
+    size_t count;
+};
+
+#endif
@@ -33,7 +33,8 @@ std::map<LogSource, std::string> log_source_messages = {
   {LogSource::CONFIG, "config"},
   {LogSource::INIT, "init"},
   {LogSource::VECTOR, "vector"},
-  {LogSource::INVENTORY, "inventory"}
+  {LogSource::INVENTORY, "inventory"},
+  {LogSource::BENCHMARK, "benchmark"}
 };
 
 std::map<LogLevel, std::string> log_level_messages = {
@@ -33,7 +33,8 @@ enum class LogSource {
   CONFIG,
   INIT,
   VECTOR,
-  INVENTORY
+  INVENTORY,
+  BENCHMARK
 };
 
 //Based on https://en.wikipedia.org/wiki/Syslog#Severity_level
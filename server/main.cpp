@@ -21,6 +21,7 @@
 #include "server.h"
 #include "config.h"
 #include "arg_parse.h"
+#include "benchmark.h"
 
 #include <malloc.h>
 #include <time.h>
@@ -47,6 +48,11 @@ int main(int argc, char *argv[]) {
   load_item_defs(defs_pt);
   load_craft_defs(defs_pt);
   
+  std::string benchmark = get_config<std::string>("benchmark.name");
+  if(benchmark != "") {
+    return run_benchmark(benchmark);
+  }
+  
   Database *db;
   std::string db_backend = get_config<std::string>("database.backend");
   if(db_backend == "sqlite3") {
@@ -19,13 +19,18 @@
 #include "map.h"
 
 #include "log.h"
+#include "config.h"
 
 #include <algorithm>
+#include <cstdlib>
 
 #define SUNLIGHT_CHECK_DISTANCE 4
 
 Map::Map(Database& _db, std::map<int, World*> _worlds, boost::asio::io_context& _io_ctx)
-    : worlds(_worlds), db(_db), io_ctx(_io_ctx)
+    : worlds(_worlds), db(_db), io_ctx(_io_ctx),
+      set_node_timer(_io_ctx), set_node_timer_pending(false), set_node_window(get_config<int>("map.set_node_window")),
+      sent_mapblocks_count(0), sent_mapblocks_target(get_config<int>("map.delta_cache_target")),
+      frame_cache(get_config<int>("map.frame_cache_target")), fluid_tick_contents(NULL)
 {
   
 }
@@ -34,6 +39,18 @@ Node Map::get_node(MapPos<int> pos) {
   MapPos<int> mb_pos = global_to_mapblock(pos);
   MapPos<int> rel_pos = global_to_relative(pos);
   
+  //Changes that are queued (or being written) count as already made.
+  {
+    std::shared_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
+    for(auto queue : {&set_node_queue, &set_node_flushing}) {
+      auto search = queue->find(mb_pos);
+      if(search == queue->end()) { continue; }
+      for(auto it = search->second.rbegin(); it != search->second.rend(); it++) {
+        if(it->pos == pos) { return it->node; }
+      }
+    }
+  }
+  
   Mapblock *mb = get_mapblock(mb_pos);
   Node node = mb->get_node_rel(rel_pos);
   delete mb;
@@ -42,39 +59,96 @@ Node Map::get_node(MapPos<int> pos) {
 
 //High-level setting of a node.
 //Everything is handled automatically, including lighting.
+//Changes are queued, and written in batches a short time later (see flush_set_node_queue).
 void Map::set_node(MapPos<int> pos, Node node, Node expected) {
   MapPos<int> mb_pos = global_to_mapblock(pos);
   
   std::unique_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
   
-  auto search = set_node_queue.find(mb_pos);
-  if(search != set_node_queue.end()) {
-    search->second.push_back(NodeChange(pos, node, expected));
-  } else {
-    set_node_queue.insert(std::make_pair(mb_pos, std::vector{NodeChange(pos, node, expected)}));
-    
-    boost::asio::steady_timer timer(io_ctx, boost::asio::chrono::milliseconds(1000));
-    timer.async_wait(boost::bind(&Map::set_nodes_queued, this, mb_pos, boost::asio::placeholders::error));
+  set_node_queue[mb_pos].push_back(NodeChange(pos, node, expected));
+  set_node_counters.edits++;
+  
+  //Flush after set_node_window ms, or at the next tick if that comes first.
+  if(!set_node_timer_pending && set_node_window > 0) {
+    set_node_timer_pending = true;
+    set_node_timer.expires_after(boost::asio::chrono::milliseconds(set_node_window));
+    set_node_timer.async_wait(boost::bind(&Map::set_nodes_queued, this, boost::asio::placeholders::error));
   }
 }
 
-void Map::set_nodes_queued(MapPos<int> mb_pos, const boost::system::error_code& error) {
-  //Retrieve list of changes to make
-  std::unique_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
-  auto search = set_node_queue.find(mb_pos);
-  if(search == set_node_queue.end()) {
-    return;
+void Map::set_nodes_queued(const boost::system::error_code& error) {
+  if(error == boost::asio::error::operation_aborted) { return; }
+  
+  {
+    std::unique_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
+    set_node_timer_pending = false;
   }
-  std::vector<NodeChange> change_list = search->second;
-  set_node_queue.erase(search);
+  
+  flush_set_node_queue();
+}
+
+//Writes out every queued node change.
+//Mapblocks whose neighbourhoods overlap are handled together: locked once, written, and lit in a single pass.
+void Map::flush_set_node_queue() {
+  std::unique_lock<std::shared_mutex> flush_lock(set_node_flush_lock);
+  
+  std::unique_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
+  if(set_node_queue.size() == 0) { return; }
+  set_node_flushing.swap(set_node_queue);
+  set_node_counters.flushes++;
   queue_lock.unlock();
   
+  std::map<MapPos<int>, std::vector<NodeChange>> remaining(set_node_flushing);
+  while(remaining.size() > 0) {
+    //Changing a mapblock touches its 3x3x3 neighbourhood, so two mapblocks up to 2 apart share part of it.
+    std::map<MapPos<int>, std::vector<NodeChange>> group;
+    std::vector<MapPos<int>> to_visit{remaining.begin()->first};
+    group.insert(*remaining.begin());
+    remaining.erase(remaining.begin());
+    
+    while(to_visit.size() > 0) {
+      MapPos<int> mb_pos = to_visit.back();
+      to_visit.pop_back();
+      
+      auto it = remaining.begin();
+      while(it != remaining.end()) {
+        auto current = it++;
+        MapPos<int> other = current->first;
+        if(other.w == mb_pos.w && other.world == mb_pos.world && other.universe == mb_pos.universe &&
+           std::abs(other.x - mb_pos.x) <= 2 && std::abs(other.y - mb_pos.y) <= 2 && std::abs(other.z - mb_pos.z) <= 2) {
+          to_visit.push_back(other);
+          group.insert(*current);
+          remaining.erase(current);
+        }
+      }
+    }
+    
+    apply_node_changes(group);
+  }
+  
+  queue_lock.lock();
+  set_node_flushing.clear();
+}
+
+std::string Map::set_node_stats() {
+  std::shared_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
+  
+  return std::to_string(set_node_counters.edits) + " node edits (" + std::to_string(set_node_counters.edits_merged) + " merged) in "
+      + std::to_string(set_node_counters.flushes) + " flushes, " + std::to_string(set_node_counters.mapblocks_written) + " mapblock writes, "
+      + std::to_string(set_node_counters.light_passes) + " lighting passes";
+}
+
+//Applies a group of queued changes, all of which are within a few mapblocks of each other.
+void Map::apply_node_changes(std::map<MapPos<int>, std::vector<NodeChange>>& changes) {
   //Lock all mapblocks that may need to be changed
   std::set<MapPos<int>> locks;
-  for(int x = mb_pos.x - 1; x <= mb_pos.x + 1; x++) {
-    for(int y = mb_pos.y - 1; y <= mb_pos.y + 1; y++) {
-      for(int z = mb_pos.z - 1; z <= mb_pos.z + 1; z++) {
-        locks.insert(MapPos<int>(x, y, z, mb_pos.w, mb_pos.world, mb_pos.universe));
+  for(auto it : changes) {
+    MapPos<int> mb_pos = it.first;
+    for(int x = mb_pos.x - 1; x <= mb_pos.x + 1; x++) {
+      for(int y = mb_pos.y - 1; y <= mb_pos.y + 1; y++) {
+        for(int z = mb_pos.z - 1; z <= mb_pos.z + 1; z++) {
+          locks.insert(MapPos<int>(x, y, z, mb_pos.w, mb_pos.world, mb_pos.universe));
+        }
       }
     }
   }
@@ -82,64 +156,40 @@ void Map::set_nodes_queued(MapPos<int> mb_pos, const boost::system::error_code&
     db.lock_mapblock_unique(it_lock);
   }
   
-  Mapblock *mb = get_mapblock(mb_pos);
+  size_t merged = 0;
+  size_t written = 0;
   
-  //Pairs of (original node, final node) -- multiple changes could happen to a single node
-  std::map<MapPos<int>, std::pair<Node, Node>> changed_nodes;
-  for(auto change : change_list) {
-    MapPos<int> rel_pos = global_to_relative(change.pos);
-    
-    Node old_node = mb->get_node_rel(rel_pos);
-    Node new_node = change.node;
-    
-    auto search_c = changed_nodes.find(rel_pos);
-    if(search_c != changed_nodes.end()) {
-      search_c->second.second = new_node;
-    } else {
-      changed_nodes.insert(std::make_pair(rel_pos, std::make_pair(old_node, new_node)));
-    }
-  }
+  //Mapblocks that need their neighbourhood relit, and single nodes that can take the lighting fast-path.
+  std::set<MapPos<int>> light_full;
+  std::vector<std::pair<MapPos<int>, MapPos<int>>> light_fastpath;
   
-  int count_same = 0;
-  int count_no_light_change = 0;
-  int count_fastpath = 0;
-  int count_full = 0;
-  for(auto change : changed_nodes) {
-    MapPos<int> rel_pos = change.first;
-    
-    Node old_node = change.second.first;
-    NodeDef old_def = get_node_def(old_node.itemstring);
-    Node new_node = change.second.second;
-    NodeDef new_def = get_node_def(new_node.itemstring);
+  for(auto it : changes) {
+    MapPos<int> mb_pos = it.first;
+    std::vector<NodeChange>& change_list = it.second;
     
-    mb->set_node_rel(rel_pos, new_node);
+    Mapblock *mb = get_mapblock(mb_pos);
     
-    if(new_node == old_node) {
-      //No change to anything.
-      count_same++;
-    } else if(old_def.transparent == new_def.transparent && old_def.pass_sunlight == new_def.pass_sunlight && old_def.light_level == new_def.light_level) {
-      //No change to lighting.
-      count_no_light_change++;
-    } else if(new_def.transparent && new_def.pass_sunlight && old_def.light_level == 0) {
-      count_fastpath++;
-    } else {
-      count_full++;
+    //Pairs of (original node, final node) -- multiple changes could happen to a single node
+    std::map<MapPos<int>, std::pair<Node, Node>> changed_nodes;
+    for(auto change : change_list) {
+      MapPos<int> rel_pos = global_to_relative(change.pos);
+      
+      Node old_node = mb->get_node_rel(rel_pos);
+      Node new_node = change.node;
+      
+      auto search_c = changed_nodes.find(rel_pos);
+      if(search_c != changed_nodes.end()) {
+        search_c->second.second = new_node;
+        merged++;
+      } else {
+        changed_nodes.insert(std::make_pair(rel_pos, std::make_pair(old_node, new_node)));
+      }
     }
-  }
-  
-  if(count_no_light_change == 0 && count_fastpath == 0 && count_full == 0) {
-    //Nothing changed.
-  } else if(count_fastpath == 0 && count_full == 0) {
-    //Light did not change.
-    mb->update_num++;
-    mb->dirty = true;
-    db.set_mapblock(mb_pos, mb);
-  } else if(count_fastpath <= 3 && count_full == 0) {
-    //Fast-path lighting changes only.
-    mb->update_num++;
-    mb->dirty = true;
-    db.set_mapblock(mb_pos, mb);
     
+    int count_same = 0;
+    int count_no_light_change = 0;
+    int count_fastpath = 0;
+    int count_full = 0;
     for(auto change : changed_nodes) {
       MapPos<int> rel_pos = change.first;
       
@@ -148,31 +198,98 @@ void Map::set_nodes_queued(MapPos<int> mb_pos, const boost::system::error_code&
       Node new_node = change.second.second;
       NodeDef new_def = get_node_def(new_node.itemstring);
       
+      mb->set_node_rel(rel_pos, new_node);
+      
       if(new_node == old_node) {
         //No change to anything.
+        count_same++;
       } else if(old_def.transparent == new_def.transparent && old_def.pass_sunlight == new_def.pass_sunlight && old_def.light_level == new_def.light_level) {
         //No change to lighting.
+        count_no_light_change++;
       } else if(new_def.transparent && new_def.pass_sunlight && old_def.light_level == 0) {
-        //Fast-path.
-        update_mapblock_light_optimized_singlenode_transparent(locks, mb_pos, rel_pos);
+        count_fastpath++;
+      } else {
+        count_full++;
+      }
+      
+      if(new_node != old_node) {
+        wake_fluid_tick(mb_pos, rel_pos);
       }
     }
-  } else {
-    //Full.
-    //mb->light_needs_update = 2;
+    
+    if(count_no_light_change == 0 && count_fastpath == 0 && count_full == 0) {
+      //Nothing changed.
+      delete mb;
+      continue;
+    }
+    
     mb->update_num++;
     mb->dirty = true;
     db.set_mapblock(mb_pos, mb);
+    mapblock_changed(mb_pos);
+    written++;
     
-    //update_mapblock_light(MapblockUpdateInfo(mb));
-    update_mapblock_light(locks, mb_pos - MapPos<int>(1, 1, 1, 0, 0, 0), mb_pos + MapPos<int>(1, 1, 1, 0, 0, 0));
+    if(count_fastpath == 0 && count_full == 0) {
+      //Light did not change.
+    } else if(count_fastpath <= 3 && count_full == 0) {
+      //Fast-path lighting changes only.
+      for(auto change : changed_nodes) {
+        Node old_node = change.second.first;
+        NodeDef old_def = get_node_def(old_node.itemstring);
+        Node new_node = change.second.second;
+        NodeDef new_def = get_node_def(new_node.itemstring);
+        
+        if(new_node == old_node) {
+          //No change to anything.
+        } else if(old_def.transparent == new_def.transparent && old_def.pass_sunlight == new_def.pass_sunlight && old_def.light_level == new_def.light_level) {
+          //No change to lighting.
+        } else if(new_def.transparent && new_def.pass_sunlight && old_def.light_level == 0) {
+          light_fastpath.push_back(std::make_pair(mb_pos, change.first));
+        }
+      }
+    } else {
+      //Full.
+      light_full.insert(mb_pos);
+    }
+    
+    delete mb;
+  }
+  
+  //One lighting pass for the whole group.
+  size_t light_passes = 0;
+  if(light_full.size() > 0) {
+    //The full update covers any fast-path nodes too.
+    for(auto it : light_fastpath) {
+      light_full.insert(it.first);
+    }
+    
+    std::set<MapPos<int>> to_light;
+    for(auto mb_pos : light_full) {
+      for(int x = mb_pos.x - 1; x <= mb_pos.x + 1; x++) {
+        for(int y = mb_pos.y - 1; y <= mb_pos.y + 1; y++) {
+          for(int z = mb_pos.z - 1; z <= mb_pos.z + 1; z++) {
+            to_light.insert(MapPos<int>(x, y, z, mb_pos.w, mb_pos.world, mb_pos.universe));
+          }
+        }
+      }
+    }
+    update_mapblock_light(locks, to_light);
+    light_passes++;
+  } else if(light_fastpath.size() > 0) {
+    for(auto it : light_fastpath) {
+      update_mapblock_light_optimized_singlenode_transparent(locks, it.first, it.second);
+    }
+    light_passes++;
   }
   
   for(auto it_lock : locks) {
     db.unlock_mapblock_unique(it_lock);
   }
   
-  delete mb;
+  std::unique_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
+  set_node_counters.edits_merged += merged;
+  set_node_counters.mapblocks_written += written;
+  set_node_counters.light_passes += light_passes;
 }
 
 Mapblock* Map::get_mapblock(MapPos<int> mb_pos) {
@@ -194,6 +311,105 @@ MapblockCompressed* Map::get_mapblock_compressed(MapPos<int> mb_pos) {
   delete mb;
   return mbc_new;
 }
+//Keeps a copy of a mapblock that was just sent to a player, so that later versions can be sent to them as deltas.
+void Map::remember_sent_mapblock(MapblockCompressed *mbc) {
+  std::unique_lock<std::shared_mutex> sent_lock(sent_mapblocks_lock);
+  
+  auto search = sent_mapblocks.find(mbc->pos);
+  if(search == sent_mapblocks.end()) {
+    std::list<MapPos<int>>::iterator k = sent_mapblocks_hits.insert(sent_mapblocks_hits.end(), mbc->pos);
+    search = sent_mapblocks.insert(std::make_pair(mbc->pos, std::make_pair(std::vector<MapblockCompressed*>(), k))).first;
+  } else {
+    sent_mapblocks_hits.erase(search->second.second);
+    search->second.second = sent_mapblocks_hits.insert(sent_mapblocks_hits.end(), mbc->pos);
+  }
+  
+  std::vector<MapblockCompressed*>& versions = search->second.first;
+  for(auto it : versions) {
+    if(it->update_num == mbc->update_num && it->light_update_num == mbc->light_update_num) {
+      //Already have this one.
+      return;
+    }
+  }
+  
+  versions.push_back(new MapblockCompressed(*mbc));
+  sent_mapblocks_count++;
+  if(versions.size() > SENT_MAPBLOCK_VERSIONS) {
+    delete versions.front();
+    versions.erase(versions.begin());
+    sent_mapblocks_count--;
+  }
+  
+  //Forget about the least recently sent mapblocks.
+  while(sent_mapblocks_count > sent_mapblocks_target && sent_mapblocks_hits.size() > 1) {
+    auto search_old = sent_mapblocks.find(sent_mapblocks_hits.front());
+    for(auto it : search_old->second.first) {
+      delete it;
+    }
+    sent_mapblocks_count -= search_old->second.first.size();
+    sent_mapblocks.erase(search_old);
+    sent_mapblocks_hits.pop_front();
+  }
+}
+
+//Returns the version of a mapblock described by 'info', if it's still remembered from being sent, or NULL.
+Mapblock* Map::get_sent_mapblock(MapblockUpdateInfo info) {
+  std::shared_lock<std::shared_mutex> sent_lock(sent_mapblocks_lock);
+  
+  auto search = sent_mapblocks.find(info.pos);
+  if(search == sent_mapblocks.end()) { return NULL; }
+  
+  for(auto it : search->second.first) {
+    if(it->update_num == info.update_num && it->light_update_num == info.light_update_num) {
+      return it->decompress();
+    }
+  }
+  return NULL;
+}
+
+//The current version of a mapblock, encoded for sending to players.
+//Encoded once per version; until it changes, every player it's sent to gets the same copy.
+std::shared_ptr<const MapblockFrame> Map::get_mapblock_frame(MapPos<int> mb_pos) {
+  std::shared_ptr<const MapblockFrame> frame = frame_cache.get(get_mapblockupdateinfo(mb_pos));
+  if(frame != NULL) { return frame; }
+  
+  MapblockCompressed *mbc = get_mapblock_compressed(mb_pos);
+  frame = std::make_shared<const MapblockFrame>(MapblockUpdateInfo(*mbc), encode_mapblock(mbc));
+  frame_cache.put(frame);
+  remember_sent_mapblock(mbc);
+  delete mbc;
+  
+  return frame;
+}
+
+//The changes to a mapblock since version 'base', encoded for sending to players that have that version.
+//Returns NULL if 'base' is no longer known or the whole mapblock would be smaller; send get_mapblock_frame instead.
+std::shared_ptr<const MapblockFrame> Map::get_mapblock_delta_frame(MapblockUpdateInfo base) {
+  std::shared_ptr<const MapblockFrame> frame = frame_cache.get_delta(base, get_mapblockupdateinfo(base.pos));
+  if(frame != NULL) {
+    if(frame->data->empty()) { return NULL; }
+    return frame;
+  }
+  
+  Mapblock *base_mb = get_sent_mapblock(base);
+  if(base_mb == NULL) { return NULL; }
+  
+  MapblockCompressed *mbc = get_mapblock_compressed(base.pos);
+  MapblockUpdateInfo info(*mbc);
+  frame = std::make_shared<const MapblockFrame>(info, encode_mapblock_delta(base_mb, mbc));
+  //Also remembered when it isn't worth it, so the next player with this version doesn't try again.
+  frame_cache.put_delta(base, frame);
+  if(frame->data->empty() && frame_cache.get(info) == NULL) {
+    frame_cache.put(std::make_shared<const MapblockFrame>(info, encode_mapblock(mbc)));
+  }
+  remember_sent_mapblock(mbc);
+  delete base_mb;
+  delete mbc;
+  
+  if(frame->data->empty()) { return NULL; }
+  return frame;
+}
+
 Mapblock* Map::get_mapblock_known_nil(MapPos<int> mb_pos) {
   //The mapblock is not held by the database, so we got an empty one.
   //We must generate some data to fill it.
@@ -211,6 +427,14 @@ Mapblock* Map::get_mapblock_known_nil(MapPos<int> mb_pos) {
   for(auto it : generated) {
     db.set_mapblock_if_not_exists(it.first, it.second);
     
+    //Freshly generated fluid may not be at rest yet.
+    for(auto id_it : it.second->IDtoIS) {
+      if(get_node_def(id_it).is_fluid) {
+        wake_fluid_tick_mapblock(it.first);
+        break;
+      }
+    }
+    
     if(it.first != mb_pos) {
       delete it.second;
     }
@@ -237,6 +461,8 @@ void Map::set_mapblock(MapPos<int> mb_pos, Mapblock *mb) {
   mb->update_num++;
   mb->dirty = true;
   db.set_mapblock(mb_pos, mb);
+  mapblock_changed(mb_pos);
+  wake_fluid_tick_mapblock(mb_pos);
   
   //update_mapblock_light(MapblockUpdateInfo(mb));
   update_mapblock_light(locks, mb_pos - MapPos<int>(1, 1, 1, 0, 0, 0), mb_pos + MapPos<int>(1, 1, 1, 0, 0, 0));
@@ -261,6 +487,7 @@ void Map::update_mapblock_light(MapblockUpdateInfo info) {
   MapblockUpdateInfo new_info = db.get_mapblockupdateinfo(info.pos);
   new_info.light_needs_update = 0;
   db.set_mapblockupdateinfo(info.pos, new_info);
+  mapblock_changed(info.pos);
 }
 
 void Map::update_mapblock_light(std::set<MapPos<int>> prelocked, MapPos<int> min_pos, MapPos<int> max_pos) {
@@ -490,8 +717,12 @@ void Map::save_changed_lit_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks
       mb->light_update_num++;
       if(mb->light_needs_update == 1 && do_clear_light_needs_update) { mb->light_needs_update = 0; }
       db.set_mapblock(mb_pos, mb);
+      mapblock_changed(mb_pos);
+    } else if(mb->light_needs_update == 1 && do_clear_light_needs_update) {
+      mb->light_needs_update = 0;
+      db.set_mapblockupdateinfo(mb_pos, MapblockUpdateInfo(mb));
+      mapblock_changed(mb_pos);
     } else {
-      if(mb->light_needs_update == 1 && do_clear_light_needs_update) { mb->light_needs_update = 0; }
       db.set_mapblockupdateinfo(mb_pos, MapblockUpdateInfo(mb));
     }
   }
@@ -911,3 +1142,18 @@ void Map::update_mapblock_light_optimized_singlenode_transparent(std::set<MapPos
 MapblockUpdateInfo Map::get_mapblockupdateinfo(MapPos<int> mb_pos) {
   return db.get_mapblockupdateinfo(mb_pos);
 }
+
+void Map::mapblock_changed(MapPos<int> mb_pos) {
+  if(change_handler) {
+    change_handler(mb_pos);
+  }
+}
+
+//Sunlight level (0-15) at a node, as of the last lighting update.
+unsigned int Map::get_sunlight(MapPos<int> pos) {
+  MapPos<int> rel_pos = global_to_relative(pos);
+  Mapblock *mb = get_mapblock(global_to_mapblock(pos));
+  unsigned int sunlight = (mb->data[rel_pos.x][rel_pos.y][rel_pos.z] >> 27) & 15;
+  delete mb;
+  return sunlight;
+}
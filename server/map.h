@@ -24,14 +24,27 @@
 #include "node.h"
 #include "mapgen.h"
 #include "mapblock.h"
+#include "mapblock_frame.h"
 
 #include <map>
 #include <set>
+#include <list>
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
 #include <shared_mutex>
 
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 
+//How many versions of each mapblock to keep for sending deltas against (see Map::remember_sent_mapblock).
+//Players are updated one after another, so the version the slowest of them has needs to stay around for a bit.
+#define SENT_MAPBLOCK_VERSIONS 4
+
+class FluidBuffer;
+class FluidContentTable;
+
 class NodeChange {
   public:
     NodeChange(MapPos<int> _pos, Node _node, Node _expected) : pos(_pos), node(_node), expected(_expected) {}
@@ -41,6 +54,41 @@ class NodeChange {
     Node expected;
 };
 
+//Counters for the set_node queue, see Map::set_node_stats.
+class SetNodeStats {
+  public:
+    SetNodeStats() : edits(0), edits_merged(0), flushes(0), mapblocks_written(0), light_passes(0) {}
+    
+    unsigned long long edits;
+    unsigned long long edits_merged; //overwritten by a later edit to the same node before being written
+    unsigned long long flushes;
+    unsigned long long mapblocks_written;
+    unsigned long long light_passes;
+};
+
+//A box of nodes copied out of the map, see Map::copy_region and Map::paste_region.
+//Nodes are stored like in a mapblock, as (rot << 15) | id, with ids indexing into 'itemstrings'.
+class MapRegion {
+  public:
+    MapRegion() : size(0, 0, 0, 0, 0, 0) {}
+    MapRegion(MapPos<int> _size) : size(_size), data(_size.x * _size.y * _size.z, 0) {}
+    
+    size_t index(int x, int y, int z) const {
+      return ((size_t)x * size.y + y) * size.z + z;
+    }
+    size_t volume() const {
+      return data.size();
+    }
+    
+    MapPos<int> size;
+    std::vector<std::string> itemstrings;
+    std::vector<uint32_t> data;
+};
+
+//Called once for each mapblock in a region edit, with the part of the region inside that mapblock (global coordinates, inclusive).
+//Returns the number of nodes changed.
+typedef std::function<size_t(Mapblock *mb, MapPos<int> min_pos, MapPos<int> max_pos)> RegionEditFunc;
+
 class Map {
   public:
     Map(Database& _db, std::map<int, World*> worlds, boost::asio::io_context& _io_ctx);
@@ -49,26 +97,96 @@ class Map {
     void set_mapblock(MapPos<int> mb_pos, Mapblock *mb);
     Node get_node(MapPos<int> pos);
     void set_node(MapPos<int> pos, Node node, Node expected);
-    void set_nodes_queued(MapPos<int> pos, const boost::system::error_code& error);
+    void set_nodes_queued(const boost::system::error_code& error);
+    void flush_set_node_queue();
+    std::string set_node_stats();
     void update_mapblock_light(MapblockUpdateInfo info);
     void update_mapblock_light(std::set<MapPos<int>> prelocked, MapPos<int> min_pos, MapPos<int> max_pos);
     void update_mapblock_light(std::set<MapPos<int>> prelocked, std::set<MapPos<int>> mapblocks_to_update);
     MapPos<int> containing_mapblock(MapPos<int> pos);
     MapblockUpdateInfo get_mapblockupdateinfo(MapPos<int> mb_pos);
+    unsigned int get_sunlight(MapPos<int> pos);
+    void remember_sent_mapblock(MapblockCompressed *mbc);
+    Mapblock* get_sent_mapblock(MapblockUpdateInfo info);
+    std::shared_ptr<const MapblockFrame> get_mapblock_frame(MapPos<int> mb_pos);
+    std::shared_ptr<const MapblockFrame> get_mapblock_delta_frame(MapblockUpdateInfo base);
+    std::string frame_cache_stats() { return frame_cache.stats(); }
+    
+    //Called with the position of each mapblock whose update numbers (or light_needs_update) change, right after it's written.
+    //It may be called from any thread, with mapblock locks held, so it should be quick and take no locks but its own.
+    //Set before the map is used.
+    void set_change_handler(std::function<void(MapPos<int>)> handler) { change_handler = handler; }
+    
+    //Region edits write nodes directly, without going through the dig and place hooks. Instead, 'handler' is called
+    //with each node a region edit changed from or to one that 'has_meta', with the old node and the new one,
+    //once the edit is finished and no mapblocks are locked.
+    //Set before the map is used.
+    void set_region_meta_handler(std::function<bool(const std::string&)> has_meta, std::function<void(MapPos<int>, Node, Node)> handler) {
+      region_has_meta = has_meta;
+      region_meta_handler = handler;
+    }
+    
+    void tick_fluids(std::set<MapPos<int>> interested);
+    void begin_fluid_tick(std::set<MapPos<int>> interested);
+    bool step_fluid_tick(size_t max_mapblocks);
+    void wake_fluid_tick(MapPos<int> mb_pos, MapPos<int> rel_pos);
+    void wake_fluid_tick_mapblock(MapPos<int> mb_pos);
+    bool has_active_fluid();
     
-    void tick_fluids(std::set<MapPos<int>> mapblocks);
+    size_t fill_region(MapPos<int> min_pos, MapPos<int> max_pos, Node node);
+    size_t replace_region(MapPos<int> min_pos, MapPos<int> max_pos, std::string from, std::string to);
+    MapRegion copy_region(MapPos<int> min_pos, MapPos<int> max_pos);
+    size_t paste_region(MapPos<int> min_pos, const MapRegion& region);
     
     std::map<int, World*> worlds;
   private:
     Mapblock* get_mapblock_known_nil(MapPos<int> mb_pos);
     void update_mapblock_light_optimized_singlenode_transparent(std::set<MapPos<int>> prelocked, MapPos<int> mb_pos, MapPos<int> rel_pos);
+    void apply_node_changes(std::map<MapPos<int>, std::vector<NodeChange>>& changes);
+    void tick_fluids_mapblocks(std::set<MapPos<int>>& to_tick, std::set<MapPos<int>>& mapblocks);
+    void commit_fluid_tick();
     void save_changed_lit_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks, std::set<MapPos<int>>& mapblocks_to_update, bool do_clear_light_needs_update);
+    size_t edit_region(MapPos<int> min_pos, MapPos<int> max_pos, RegionEditFunc func);
+    void mapblock_changed(MapPos<int> mb_pos);
     
     Database& db;
     boost::asio::io_context& io_ctx;
     
+    //Node changes are queued per mapblock, and written in batches after set_node_window ms (or at the next tick).
     std::map<MapPos<int>, std::vector<NodeChange>> set_node_queue;
+    //Changes taken off the queue by the flush in progress, which get_node still has to see.
+    std::map<MapPos<int>, std::vector<NodeChange>> set_node_flushing;
+    boost::asio::steady_timer set_node_timer;
+    bool set_node_timer_pending;
+    int set_node_window;
+    SetNodeStats set_node_counters;
     std::shared_mutex set_node_queue_lock;
+    std::shared_mutex set_node_flush_lock;
+    
+    //Versions of mapblocks recently sent to players (oldest first), in least recently sent order.
+    std::map<MapPos<int>, std::pair<std::vector<MapblockCompressed*>, std::list<MapPos<int>>::iterator>> sent_mapblocks;
+    std::list<MapPos<int>> sent_mapblocks_hits;
+    size_t sent_mapblocks_count;
+    size_t sent_mapblocks_target;
+    std::shared_mutex sent_mapblocks_lock;
+    
+    //Encoded mapblocks, shared by every player they're sent to.
+    MapblockFrameCache frame_cache;
+    
+    //Mapblocks where fluid may still be flowing; only these are visited by tick_fluids.
+    std::set<MapPos<int>> active_fluid_mapblocks;
+    //Interested mapblocks as of the last tick_fluids, so that mapblocks coming back into view can be woken.
+    std::set<MapPos<int>> fluid_interested_mapblocks;
+    //Mapblocks still to be visited by the fluid tick in progress.
+    std::set<MapPos<int>> fluid_tick_pending;
+    //What the fluid tick in progress has read and written so far, see step_fluid_tick.
+    std::map<MapPos<int>, FluidBuffer*> fluid_tick_buffers;
+    FluidContentTable *fluid_tick_contents;
+    std::shared_mutex active_fluid_lock;
+    
+    std::function<void(MapPos<int>)> change_handler;
+    std::function<bool(const std::string&)> region_has_meta;
+    std::function<void(MapPos<int>, Node, Node)> region_meta_handler;
 };
 
 #endif
@@ -18,86 +18,278 @@
 
 #include "map.h"
 
-Node get_node_rel_prefetch(std::map<MapPos<int>, Mapblock*>& input_mapblocks, MapPos<int> mb_pos, MapPos<int> rel_pos) {
-  while(rel_pos.x < 0               ) { rel_pos.x += MAPBLOCK_SIZE_X; mb_pos.x--; }
-  while(rel_pos.x >= MAPBLOCK_SIZE_X) { rel_pos.x -= MAPBLOCK_SIZE_X; mb_pos.x++; }
-  while(rel_pos.y < 0               ) { rel_pos.y += MAPBLOCK_SIZE_Y; mb_pos.y--; }
-  while(rel_pos.y >= MAPBLOCK_SIZE_Y) { rel_pos.y -= MAPBLOCK_SIZE_Y; mb_pos.y++; }
-  while(rel_pos.z < 0               ) { rel_pos.z += MAPBLOCK_SIZE_Z; mb_pos.z--; }
-  while(rel_pos.z >= MAPBLOCK_SIZE_Z) { rel_pos.z -= MAPBLOCK_SIZE_Z; mb_pos.z++; }
-  if(rel_pos.w != 0) { mb_pos.w += rel_pos.w; rel_pos.w = 0; }
-  if(rel_pos.world != 0) { mb_pos.world += rel_pos.world; rel_pos.world = 0; }
-  if(rel_pos.universe != 0) { mb_pos.universe += rel_pos.universe; rel_pos.universe = 0; }
+#include <cstring>
+#include <cstdint>
+
+#define FLUID_CONTENT_NONE 0 //outside of any loaded mapblock (or an unknown node ID)
+#define FLUID_CONTENT_AIR 1
+
+#define FLUID_PADDED_SIZE_X (MAPBLOCK_SIZE_X + 2)
+#define FLUID_PADDED_SIZE_Y (MAPBLOCK_SIZE_Y + 2)
+#define FLUID_PADDED_SIZE_Z (MAPBLOCK_SIZE_Z + 2)
+#define FLUID_PADDED_STRIDE_X (FLUID_PADDED_SIZE_Y * FLUID_PADDED_SIZE_Z)
+#define FLUID_PADDED_STRIDE_Y FLUID_PADDED_SIZE_Z
+#define FLUID_PADDED_STRIDE_Z 1
+
+//Content IDs shared by every mapblock in a single fluid tick.
+//Mapblock node IDs are per-mapblock, so they can't be compared across mapblocks directly.
+class FluidContentTable {
+  public:
+    FluidContentTable() {
+      get("");
+      get("air");
+    }
+    
+    uint32_t get(std::string itemstring) {
+      auto search = ids.find(itemstring);
+      if(search != ids.end()) {
+        return search->second;
+      }
+      
+      uint32_t content = itemstrings.size();
+      itemstrings.push_back(itemstring);
+      ids[itemstring] = content;
+      is_fluid.push_back(content != FLUID_CONTENT_NONE && get_node_def(itemstring).is_fluid);
+      return content;
+    }
+    
+    std::vector<std::string> itemstrings;
+    std::map<std::string, uint32_t> ids;
+    std::vector<bool> is_fluid;
+};
+
+//Double-buffered fluid state for one mapblock.
+//Each cell is (content << 8) | rot, laid out the same way as Mapblock::data.
+//Reads come from `in` and writes go to `out`, so the order mapblocks are processed in doesn't affect what they see.
+//A buffer lasts for a whole fluid tick, which may be split over several steps; `in` is the mapblock as it was
+//when the tick first needed it, and nothing is written back to the map until the tick is done.
+class FluidBuffer {
+  public:
+    FluidBuffer(Mapblock *mb, FluidContentTable& contents) : has_fluid(false) {
+      std::vector<uint32_t> id_content = content_table(mb, contents);
+      for(uint32_t content : id_content) {
+        if(contents.is_fluid[content]) { has_fluid = true; }
+      }
+      
+      size_t i = 0;
+      for(size_t x = 0; x < MAPBLOCK_SIZE_X; x++) {
+        for(size_t y = 0; y < MAPBLOCK_SIZE_Y; y++) {
+          for(size_t z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+            in[i++] = cell(mb->data[x][y][z], id_content);
+          }
+        }
+      }
+      std::memcpy(out, in, sizeof(in));
+    }
+    
+    //Content ID for each of a mapblock's node IDs.
+    static std::vector<uint32_t> content_table(Mapblock *mb, FluidContentTable& contents) {
+      std::vector<uint32_t> id_content;
+      for(auto it : mb->IDtoIS) {
+        id_content.push_back(contents.get(it));
+      }
+      return id_content;
+    }
+    
+    static inline uint32_t cell(uint32_t val, const std::vector<uint32_t>& id_content) {
+      uint32_t id = val & 32767;
+      uint32_t content = id < id_content.size() ? id_content[id] : FLUID_CONTENT_NONE;
+      return (content << 8) | ((val >> 15) & 255);
+    }
+    
+    static inline size_t index(int x, int y, int z) {
+      return (x * MAPBLOCK_SIZE_Y + y) * MAPBLOCK_SIZE_Z + z;
+    }
+    
+    bool has_fluid;
+    uint32_t in[MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Y * MAPBLOCK_SIZE_Z];
+    uint32_t out[MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Y * MAPBLOCK_SIZE_Z];
+};
+
+//Writes a cell relative to `buf`, which may land in one of its neighbours (indexed the same as fluid_mapblock_faces).
+//Writes into mapblocks that aren't loaded are dropped.
+inline void fluid_write(FluidBuffer *buf, FluidBuffer **adj, int x, int y, int z, uint32_t cell) {
+  FluidBuffer *target = buf;
+  if(x < 0)                     { target = adj[0]; x += MAPBLOCK_SIZE_X; }
+  else if(x >= MAPBLOCK_SIZE_X) { target = adj[1]; x -= MAPBLOCK_SIZE_X; }
+  else if(y < 0)                { target = adj[2]; y += MAPBLOCK_SIZE_Y; }
+  else if(y >= MAPBLOCK_SIZE_Y) { target = adj[3]; y -= MAPBLOCK_SIZE_Y; }
+  else if(z < 0)                { target = adj[4]; z += MAPBLOCK_SIZE_Z; }
+  else if(z >= MAPBLOCK_SIZE_Z) { target = adj[5]; z -= MAPBLOCK_SIZE_Z; }
+  if(target == NULL) { return; }
   
-  auto search = input_mapblocks.find(mb_pos);
-  if(search == input_mapblocks.end()) {
-    return Node();
+  target->out[FluidBuffer::index(x, y, z)] = cell;
+}
+
+MapPos<int> fluid_mapblock_faces[6] = {
+  {-1, 0, 0, 0, 0, 0},
+  {1, 0, 0, 0, 0, 0},
+  {0, -1, 0, 0, 0, 0},
+  {0, 1, 0, 0, 0, 0},
+  {0, 0, -1, 0, 0, 0},
+  {0, 0, 1, 0, 0, 0}
+};
+
+//Fluid only looks one node away along each axis, so a change to a node can only
+//affect its own mapblock and whichever neighbouring mapblocks it sits against.
+void add_fluid_neighbours(std::set<MapPos<int>>& active, MapPos<int> mb_pos, MapPos<int> rel_pos) {
+  active.insert(mb_pos);
+  if(rel_pos.x == 0)                   { active.insert(mb_pos + fluid_mapblock_faces[0]); }
+  if(rel_pos.x == MAPBLOCK_SIZE_X - 1) { active.insert(mb_pos + fluid_mapblock_faces[1]); }
+  if(rel_pos.y == 0)                   { active.insert(mb_pos + fluid_mapblock_faces[2]); }
+  if(rel_pos.y == MAPBLOCK_SIZE_Y - 1) { active.insert(mb_pos + fluid_mapblock_faces[3]); }
+  if(rel_pos.z == 0)                   { active.insert(mb_pos + fluid_mapblock_faces[4]); }
+  if(rel_pos.z == MAPBLOCK_SIZE_Z - 1) { active.insert(mb_pos + fluid_mapblock_faces[5]); }
+}
+
+//Called whenever a node changes, so that any fluid next to it gets a chance to flow.
+void Map::wake_fluid_tick(MapPos<int> mb_pos, MapPos<int> rel_pos) {
+  std::unique_lock<std::shared_mutex> active_lock(active_fluid_lock);
+  add_fluid_neighbours(active_fluid_mapblocks, mb_pos, rel_pos);
+}
+
+//Called when an entire mapblock is replaced or generated.
+void Map::wake_fluid_tick_mapblock(MapPos<int> mb_pos) {
+  std::unique_lock<std::shared_mutex> active_lock(active_fluid_lock);
+  active_fluid_mapblocks.insert(mb_pos);
+  for(int i = 0; i < 6; i++) {
+    active_fluid_mapblocks.insert(mb_pos + fluid_mapblock_faces[i]);
   }
-  
-  Mapblock *mb = search->second;
-  return mb->get_node_rel(rel_pos);
 }
 
-void set_node_rel_prefetch(std::map<MapPos<int>, Mapblock*>& input_mapblocks, std::map<MapPos<int>, Mapblock*>& output_mapblocks, MapPos<int> mb_pos, MapPos<int> rel_pos, Node n) {
-  while(rel_pos.x < 0               ) { rel_pos.x += MAPBLOCK_SIZE_X; mb_pos.x--; }
-  while(rel_pos.x >= MAPBLOCK_SIZE_X) { rel_pos.x -= MAPBLOCK_SIZE_X; mb_pos.x++; }
-  while(rel_pos.y < 0               ) { rel_pos.y += MAPBLOCK_SIZE_Y; mb_pos.y--; }
-  while(rel_pos.y >= MAPBLOCK_SIZE_Y) { rel_pos.y -= MAPBLOCK_SIZE_Y; mb_pos.y++; }
-  while(rel_pos.z < 0               ) { rel_pos.z += MAPBLOCK_SIZE_Z; mb_pos.z--; }
-  while(rel_pos.z >= MAPBLOCK_SIZE_Z) { rel_pos.z -= MAPBLOCK_SIZE_Z; mb_pos.z++; }
-  if(rel_pos.w != 0) { mb_pos.w += rel_pos.w; rel_pos.w = 0; }
-  if(rel_pos.world != 0) { mb_pos.world += rel_pos.world; rel_pos.world = 0; }
-  if(rel_pos.universe != 0) { mb_pos.universe += rel_pos.universe; rel_pos.universe = 0; }
-  
-  auto search = output_mapblocks.find(mb_pos);
-  if(search != output_mapblocks.end()) {
-    Mapblock *mb = search->second;
-    mb->set_node_rel(rel_pos, n);
-    return;
+bool Map::has_active_fluid() {
+  std::shared_lock<std::shared_mutex> active_lock(active_fluid_lock);
+  return active_fluid_mapblocks.size() > 0;
+}
+
+//Runs a complete fluid tick in one go.
+void Map::tick_fluids(std::set<MapPos<int>> interested) {
+  begin_fluid_tick(interested);
+  while(!step_fluid_tick(SIZE_MAX)) {}
+}
+
+//Starts a fluid tick, which is then carried out in pieces by step_fluid_tick.
+void Map::begin_fluid_tick(std::set<MapPos<int>> interested) {
+  //Only tick active mapblocks that a player is near.
+  //Active mapblocks that nobody is near are dropped; they get woken again once they're back in view,
+  //so fluid that was flowing when everyone left picks up where it left off.
+  std::unique_lock<std::shared_mutex> active_lock(active_fluid_lock);
+  for(auto it : interested) {
+    if(fluid_interested_mapblocks.find(it) == fluid_interested_mapblocks.end()) {
+      active_fluid_mapblocks.insert(it);
+    }
   }
+  fluid_interested_mapblocks = interested;
   
-  
-  auto search_in = input_mapblocks.find(mb_pos);
-  if(search_in == input_mapblocks.end()) {
-    return;
+  for(auto it : active_fluid_mapblocks) {
+    if(interested.find(it) != interested.end()) {
+      fluid_tick_pending.insert(it);
+    }
   }
-  
-  Node old_n = search_in->second->get_node_rel(rel_pos);
-  if(old_n == n) { return; }
-  
-  Mapblock *mb = new Mapblock(*(search_in->second));
-  mb->set_node_rel(rel_pos, n);
-  output_mapblocks[mb_pos] = mb;
+  active_fluid_mapblocks.clear();
 }
 
-void Map::tick_fluids(std::set<MapPos<int>> mapblocks) {
-  std::map<MapPos<int>, Mapblock*> input_mapblocks;
-  std::map<MapPos<int>, Mapblock*> output_mapblocks;
-  
-  //Get locks (in order to avoid deadlocks).
-  for(auto it : mapblocks) {
-    db.lock_mapblock_unique(it);
+//Ticks up to max_mapblocks of the mapblocks left in the current fluid tick.
+//Returns true once there are none left.
+//Every step reads the map as it was before the tick: what the steps write is kept in fluid_tick_buffers
+//and written back all at once by the last one, so how the tick is split up doesn't change the flow.
+//Only one fluid tick may be in progress at a time.
+bool Map::step_fluid_tick(size_t max_mapblocks) {
+  std::set<MapPos<int>> to_tick;
+  std::set<MapPos<int>> mapblocks;
+  bool finished;
+  {
+    std::unique_lock<std::shared_mutex> active_lock(active_fluid_lock);
+    while(fluid_tick_pending.size() > 0 && to_tick.size() < max_mapblocks) {
+      to_tick.insert(*fluid_tick_pending.begin());
+      fluid_tick_pending.erase(fluid_tick_pending.begin());
+    }
+    finished = fluid_tick_pending.size() == 0;
+    
+    //Fluid reads from (and flows into) neighbouring mapblocks, so those are needed as well.
+    for(auto it : to_tick) {
+      mapblocks.insert(it);
+      for(int i = 0; i < 6; i++) {
+        MapPos<int> adj_pos = it + fluid_mapblock_faces[i];
+        if(fluid_interested_mapblocks.find(adj_pos) != fluid_interested_mapblocks.end()) {
+          mapblocks.insert(adj_pos);
+        }
+      }
+    }
   }
   
+  if(to_tick.size() > 0) {
+    tick_fluids_mapblocks(to_tick, mapblocks);
+  }
+  if(finished) {
+    commit_fluid_tick();
+  }
+  return finished;
+}
+
+//Ticks the mapblocks in to_tick, into fluid_tick_buffers.
+//`mapblocks` is to_tick plus any loaded neighbours; fluid can read from and flow into those too.
+void Map::tick_fluids_mapblocks(std::set<MapPos<int>>& to_tick, std::set<MapPos<int>>& mapblocks) {
+  if(fluid_tick_contents == NULL) {
+    fluid_tick_contents = new FluidContentTable();
+  }
+  FluidContentTable& contents = *fluid_tick_contents;
+  std::map<MapPos<int>, FluidBuffer*>& buffers = fluid_tick_buffers;
   for(const MapPos<int>& mb_pos : mapblocks) {
-    input_mapblocks[mb_pos] = get_mapblock(mb_pos);
+    if(buffers.find(mb_pos) != buffers.end()) { continue; }
+    
+    db.lock_mapblock_shared(mb_pos);
+    Mapblock *mb = get_mapblock(mb_pos);
+    db.unlock_mapblock_shared(mb_pos);
+    
+    buffers[mb_pos] = new FluidBuffer(mb, contents);
+    delete mb;
   }
   
-  MapPos<int> faces[4] = {
-    {-1, 0, 0, 0, 0, 0},
-    {1, 0, 0, 0, 0, 0},
-    {0, 0, -1, 0, 0, 0},
-    {0, 0, 1, 0, 0, 0}
-  };
+  //Offsets of the four (-X/+X/-Z/+Z) horizontally adjacent nodes, in the padded array and in mapblock coordinates.
+  const int adj_offsets[4] = {-FLUID_PADDED_STRIDE_X, FLUID_PADDED_STRIDE_X, -FLUID_PADDED_STRIDE_Z, FLUID_PADDED_STRIDE_Z};
+  const int adj_dx[4] = {-1, 1, 0, 0};
+  const int adj_dz[4] = {0, 0, -1, 1};
+  
+  //This mapblock, plus a one node border taken from its neighbours.
+  std::vector<uint32_t> padded(FLUID_PADDED_SIZE_X * FLUID_PADDED_SIZE_Y * FLUID_PADDED_SIZE_Z);
   
   //Update each fluid node
-  for(auto it : input_mapblocks) {
-    MapPos<int> mb_pos = it.first;
-    Mapblock *mb = it.second;
+  for(MapPos<int> mb_pos : to_tick) {
+    FluidBuffer *buf = buffers[mb_pos];
+    if(!buf->has_fluid) { continue; }
     
-    std::vector<bool> id_fluid;
-    for(auto id_it : mb->IDtoIS) {
-      id_fluid.push_back(get_node_def(id_it).is_fluid);
+    FluidBuffer *adj[6];
+    for(int i = 0; i < 6; i++) {
+      auto search = buffers.find(mb_pos + fluid_mapblock_faces[i]);
+      adj[i] = search == buffers.end() ? NULL : search->second;
+    }
+    
+    //Fill in the padded array.
+    //Only the faces of the border are ever read, so the edges and corners are left empty.
+    size_t p = 0;
+    for(int x = -1; x <= MAPBLOCK_SIZE_X; x++) {
+      for(int y = -1; y <= MAPBLOCK_SIZE_Y; y++) {
+        for(int z = -1; z <= MAPBLOCK_SIZE_Z; z++) {
+          int face = -1;
+          int outside = 0;
+          int sx = x, sy = y, sz = z;
+          if(x < 0)                { face = 0; outside++; sx += MAPBLOCK_SIZE_X; }
+          if(x >= MAPBLOCK_SIZE_X) { face = 1; outside++; sx -= MAPBLOCK_SIZE_X; }
+          if(y < 0)                { face = 2; outside++; sy += MAPBLOCK_SIZE_Y; }
+          if(y >= MAPBLOCK_SIZE_Y) { face = 3; outside++; sy -= MAPBLOCK_SIZE_Y; }
+          if(z < 0)                { face = 4; outside++; sz += MAPBLOCK_SIZE_Z; }
+          if(z >= MAPBLOCK_SIZE_Z) { face = 5; outside++; sz -= MAPBLOCK_SIZE_Z; }
+          
+          uint32_t cell = FLUID_CONTENT_NONE << 8;
+          if(outside == 0) {
+            cell = buf->in[FluidBuffer::index(sx, sy, sz)];
+          } else if(outside == 1 && adj[face] != NULL) {
+            cell = adj[face]->in[FluidBuffer::index(sx, sy, sz)];
+          }
+          padded[p++] = cell;
+        }
+      }
     }
     
     //Flowing fluids are basically a cellular automata.
@@ -107,22 +299,20 @@ void Map::tick_fluids(std::set<MapPos<int>> mapblocks) {
     //  - If the new height of this node is zero, replace it with air.
     //  - Spread the fluid to adjacent air nodes, giving them height - 2
     
-    for(size_t x = 0; x < MAPBLOCK_SIZE_X; x++) {
-      for(size_t y = 0; y < MAPBLOCK_SIZE_Y; y++) {
-        for(size_t z = 0; z < MAPBLOCK_SIZE_Z; z++) {
-          unsigned int data = mb->data[x][y][z];
-          unsigned int id = data & 32767;
-          if(id >= id_fluid.size()) { continue; }
-          if(!id_fluid[id]) { continue; }
+    for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+      for(int y = 0; y < MAPBLOCK_SIZE_Y; y++) {
+        for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+          int p = ((x + 1) * FLUID_PADDED_SIZE_Y + (y + 1)) * FLUID_PADDED_SIZE_Z + (z + 1);
+          uint32_t cell = padded[p];
+          uint32_t content = cell >> 8;
+          if(!contents.is_fluid[content]) { continue; }
           
           //it's a fluid
-          MapPos<int> rel_pos(x, y, z, 0, 0, 0);
+          uint32_t below = padded[p - FLUID_PADDED_STRIDE_Y];
+          uint32_t below_content = below >> 8;
+          unsigned int below_rot = below & 255;
           
-          Node n = mb->get_node_rel(rel_pos);
-          Node n_below = get_node_rel_prefetch(input_mapblocks, mb_pos, rel_pos + MapPos<int>(0, -1, 0, 0, 0, 0));
-          NodeDef n_below_def = get_node_def(n_below.itemstring);
-          
-          unsigned int old_rot = n.rot;
+          unsigned int old_rot = cell & 255;
           //0 is max height (1.0 physically), 15 is min height (0.0625 physically)
           int old_height = ((old_rot >> 4) & 15);
           bool is_source = (old_rot & 8) == 0 && old_height == 0;
@@ -137,14 +327,13 @@ void Map::tick_fluids(std::set<MapPos<int>> mapblocks) {
             int nearby_source_count = 0;
             
             for(int i = 0; i < 4; i++) {
-              MapPos<int> adj_pos = rel_pos + faces[i];
-              Node rel_n = get_node_rel_prefetch(input_mapblocks, mb_pos, adj_pos);
-              if(rel_n.itemstring != n.itemstring) { continue; }
-              int rel_height = ((rel_n.rot >> 4) & 15);
+              uint32_t adj_cell = padded[p + adj_offsets[i]];
+              if((adj_cell >> 8) != content) { continue; }
+              int rel_height = ((adj_cell >> 4) & 15);
               if(rel_height < largest_adj_height) {
                 largest_adj_height = rel_height;
               }
-              if((rel_n.rot & 8) == 0 && rel_height == 0) {
+              if((adj_cell & 8) == 0 && rel_height == 0) {
                 nearby_source_count++;
               }
             }
@@ -153,9 +342,9 @@ void Map::tick_fluids(std::set<MapPos<int>> mapblocks) {
             int target_height = make_source ? 0 : (largest_adj_height + 2);
             
             if(!make_source) {
-              Node rel_n_above = get_node_rel_prefetch(input_mapblocks, mb_pos, rel_pos + MapPos<int>(0, 1, 0, 0, 0, 0));
-              if(rel_n_above.itemstring == n.itemstring) {
-                int height_above = (rel_n_above.rot >> 4) & 15;
+              uint32_t above = padded[p + FLUID_PADDED_STRIDE_Y];
+              if((above >> 8) == content) {
+                int height_above = (above >> 4) & 15;
                 if(height_above < target_height) {
                   target_height = height_above;
                   visual_fullheight = true;
@@ -173,70 +362,130 @@ void Map::tick_fluids(std::set<MapPos<int>> mapblocks) {
           unsigned int new_rot = ((new_height & 15) << 4) | (make_source ? 0 : 8) | (visual_fullheight ? 4 : 0);
           
           if(do_destroy) {
-            set_node_rel_prefetch(input_mapblocks, output_mapblocks, mb_pos, rel_pos, Node("air"));
+            fluid_write(buf, adj, x, y, z, FLUID_CONTENT_AIR << 8);
           } else if(new_rot != old_rot) {
-            set_node_rel_prefetch(input_mapblocks, output_mapblocks, mb_pos, rel_pos, Node(n.itemstring, new_rot));
+            fluid_write(buf, adj, x, y, z, (content << 8) | new_rot);
           }
           
           //spreading
           int spread_height = new_height + 2;
           if(spread_height <= 15) {
             for(int i = 0; i < 4; i++) {
-              MapPos<int> adj_pos = rel_pos + faces[i];
-              Node rel_n = get_node_rel_prefetch(input_mapblocks, mb_pos, adj_pos);
-              if(rel_n.itemstring != "air") { continue; }
+              uint32_t adj_cell = padded[p + adj_offsets[i]];
+              if((adj_cell >> 8) != FLUID_CONTENT_AIR) { continue; }
               
               //Don't allow spreading horizontally if we're over an air/fluid block unless we're over a fluid source block
-              if(n_below.itemstring == "air" || n_below_def.is_fluid) {
-                /*Node rel_n_below = get_node_rel_prefetch(input_mapblocks, mb_pos, adj_pos + Vector3<int>(0, -1, 0));
-                NodeDef rel_n_below_def = get_node_def(rel_n_below.itemstring);
-                if(rel_n_below.itemstring == "air" ||
-                   (rel_n_below_def.isFluid && rel_n_below.itemstring != n.itemstring) ||
-                   (rel_n_below.itemstring == n.itemstring && (rel_n_below.rot & 8) != 0)
-                { continue; }*/
-                
-                if(n_below.itemstring == n.itemstring && (n_below.rot & 8) == 0 && ((n_below.rot >> 4) & 15) == 0) {
+              if(below_content == FLUID_CONTENT_AIR || contents.is_fluid[below_content]) {
+                if(below_content == content && (below_rot & 8) == 0 && ((below_rot >> 4) & 15) == 0) {
                   //fluid source: ok
                 } else {
                   continue;
                 }
               }
               
-              int rot = ((spread_height & 15) << 4) | 8;
+              unsigned int rot = ((spread_height & 15) << 4) | 8;
               
-              set_node_rel_prefetch(input_mapblocks, output_mapblocks, mb_pos, adj_pos, Node(n.itemstring, rot));
+              fluid_write(buf, adj, x + adj_dx[i], y, z + adj_dz[i], (content << 8) | rot);
             }
           }
           
           if(new_height <= 15) {
-            if(n_below.itemstring == "air" || n_below.itemstring == n.itemstring) {
+            if(below_content == FLUID_CONTENT_AIR || below_content == content) {
               //Don't spread if there's a source below
-              if((n_below.rot & 8) == 0 && n_below.itemstring == n.itemstring) { continue; }
+              if((below_rot & 8) == 0 && below_content == content) { continue; }
               //Spread down
               int height_below = new_height;
-              int rot = ((height_below & 15) << 4) | 8 | 4; //flags: not source, visual_fullheight
-              set_node_rel_prefetch(input_mapblocks, output_mapblocks, mb_pos, rel_pos + MapPos<int>(0, -1, 0, 0, 0, 0), Node(n.itemstring, rot));
+              unsigned int rot = ((height_below & 15) << 4) | 8 | 4; //flags: not source, visual_fullheight
+              fluid_write(buf, adj, x, y - 1, z, (content << 8) | rot);
             }
           }
         }
       }
     }
   }
+}
+
+//Writes back everything the fluid tick in progress changed, once all of its steps are done.
+//A node that was changed some other way since the tick read it is left alone; it gets woken by that change anyway.
+void Map::commit_fluid_tick() {
+  std::map<MapPos<int>, FluidBuffer*> buffers;
+  std::swap(buffers, fluid_tick_buffers);
+  if(fluid_tick_contents == NULL) { return; }
+  FluidContentTable& contents = *fluid_tick_contents;
   
-  //Clean up, save, and update lighting.
-  for(auto it : input_mapblocks) {
-    delete it.second;
+  //Get locks (in order to avoid deadlocks).
+  std::set<MapPos<int>> mapblocks;
+  for(auto it : buffers) {
+    mapblocks.insert(it.first);
+    db.lock_mapblock_unique(it.first);
   }
   
+  //Anything that changed (and anything touching it) gets another look next tick.
+  //Everything else has settled, and stays out of the active set until something wakes it.
+  std::set<MapPos<int>> woken;
   std::set<MapPos<int>> to_update;
-  for(auto it : output_mapblocks) {
+  for(auto it : buffers) {
     MapPos<int> mb_pos = it.first;
-    Mapblock *mb = it.second;
-    mb->light_needs_update = 1;
-    mb->update_num++;
-    db.set_mapblock(mb_pos, mb);
-    to_update.insert(mb_pos);
+    FluidBuffer *buf = it.second;
+    if(std::memcmp(buf->in, buf->out, sizeof(buf->in)) == 0) {
+      delete buf;
+      continue;
+    }
+    
+    Mapblock *mb = get_mapblock(mb_pos);
+    std::vector<uint32_t> id_content = FluidBuffer::content_table(mb, contents);
+    //Node ID in this mapblock for each content ID, filled in as they're used.
+    std::vector<int> content_ids;
+    
+    bool changed = false;
+    size_t i = 0;
+    for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+      for(int y = 0; y < MAPBLOCK_SIZE_Y; y++) {
+        for(int z = 0; z < MAPBLOCK_SIZE_Z; z++, i++) {
+          uint32_t cell = buf->out[i];
+          if(cell == buf->in[i]) { continue; }
+          if(FluidBuffer::cell(mb->data[x][y][z], id_content) != buf->in[i]) { continue; }
+          
+          uint32_t content = cell >> 8;
+          if(content >= content_ids.size()) {
+            content_ids.resize(content + 1, -1);
+          }
+          if(content_ids[content] == -1) {
+            content_ids[content] = mb->itemstring_to_id(contents.itemstrings[content]);
+          }
+          unsigned int id = content_ids[content] & 32767;
+          uint32_t light = (mb->data[x][y][z] >> 23) & 255;
+          mb->data[x][y][z] = (light << 23) | ((cell & 255) << 15) | id;
+          if(content != FLUID_CONTENT_AIR) {
+            mb->sunlit = false;
+          }
+          
+          add_fluid_neighbours(woken, mb_pos, MapPos<int>(x, y, z, 0, 0, 0));
+          changed = true;
+        }
+      }
+    }
+    
+    if(changed) {
+      mb->is_nil = false;
+      mb->dirty = true;
+      mb->light_needs_update = 1;
+      mb->update_num++;
+      db.set_mapblock(mb_pos, mb);
+      mapblock_changed(mb_pos);
+      to_update.insert(mb_pos);
+    }
+    
     delete mb;
+    delete buf;
+  }
+  
+  delete fluid_tick_contents;
+  fluid_tick_contents = NULL;
+  
+  if(woken.size() > 0) {
+    std::unique_lock<std::shared_mutex> active_lock(active_fluid_lock);
+    active_fluid_mapblocks.insert(woken.begin(), woken.end());
   }
   
   if(to_update.size() > 0) {
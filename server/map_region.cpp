@@ -0,0 +1,353 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "map.h"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <tuple>
+#include <memory>
+
+//Bits of a node's data that hold its content (id and rot), as opposed to its light.
+#define REGION_NODE_MASK 0x7FFFFF
+#define REGION_ID_MASK 32767
+#define REGION_ID_NONE UINT32_MAX
+#define REGION_ROT_SHIFT 15
+
+//Puts the smallest coordinates in 'min_pos' and the largest in 'max_pos'.
+static void sort_region_corners(MapPos<int>& min_pos, MapPos<int>& max_pos) {
+  if(min_pos.x > max_pos.x) { std::swap(min_pos.x, max_pos.x); }
+  if(min_pos.y > max_pos.y) { std::swap(min_pos.y, max_pos.y); }
+  if(min_pos.z > max_pos.z) { std::swap(min_pos.z, max_pos.z); }
+}
+
+//Carries out an edit on every mapblock touched by a box.
+//Each mapblock is locked, written to the database, and relit once for the whole edit, instead of once per node as with set_node.
+size_t Map::edit_region(MapPos<int> min_pos, MapPos<int> max_pos, RegionEditFunc func) {
+  //Anything still queued has to land first, or it would be written over the top of the edit.
+  flush_set_node_queue();
+  
+  MapPos<int> mb_min = global_to_mapblock(min_pos);
+  MapPos<int> mb_max = global_to_mapblock(max_pos);
+  
+  //Lock the mapblocks in the region plus the ones around it (which may need relighting).
+  //The set is ordered, so locks are always acquired in the same order.
+  std::set<MapPos<int>> locks;
+  for(int x = mb_min.x - 1; x <= mb_max.x + 1; x++) {
+    for(int y = mb_min.y - 1; y <= mb_max.y + 1; y++) {
+      for(int z = mb_min.z - 1; z <= mb_max.z + 1; z++) {
+        locks.insert(MapPos<int>(x, y, z, mb_min.w, mb_min.world, mb_min.universe));
+      }
+    }
+  }
+  for(auto it_lock : locks) {
+    db.lock_mapblock_unique(it_lock);
+  }
+  
+  size_t total = 0;
+  std::map<MapPos<int>, Mapblock*> changed;
+  //Nodes changed from or to one with meta: position, old node, new node
+  std::vector<std::tuple<MapPos<int>, Node, Node>> meta_changed;
+  //Each mapblock's nodes from before the edit, to find the ones with meta that it changed
+  auto old_data = std::make_unique<uint32_t[][MAPBLOCK_SIZE_Y][MAPBLOCK_SIZE_Z]>(MAPBLOCK_SIZE_X);
+  for(int x = mb_min.x; x <= mb_max.x; x++) {
+    for(int y = mb_min.y; y <= mb_max.y; y++) {
+      for(int z = mb_min.z; z <= mb_max.z; z++) {
+        MapPos<int> mb_pos(x, y, z, mb_min.w, mb_min.world, mb_min.universe);
+        
+        //Part of the region inside this mapblock
+        MapPos<int> from(std::max(min_pos.x, x * MAPBLOCK_SIZE_X),
+                         std::max(min_pos.y, y * MAPBLOCK_SIZE_Y),
+                         std::max(min_pos.z, z * MAPBLOCK_SIZE_Z),
+                         min_pos.w, min_pos.world, min_pos.universe);
+        MapPos<int> to(std::min(max_pos.x, (x + 1) * MAPBLOCK_SIZE_X - 1),
+                       std::min(max_pos.y, (y + 1) * MAPBLOCK_SIZE_Y - 1),
+                       std::min(max_pos.z, (z + 1) * MAPBLOCK_SIZE_Z - 1),
+                       min_pos.w, min_pos.world, min_pos.universe);
+        
+        Mapblock *mb = get_mapblock(mb_pos);
+        if(region_has_meta) {
+          std::memcpy(old_data.get(), mb->data, sizeof(mb->data));
+        }
+        size_t count = func(mb, from, to);
+        if(count == 0) {
+          delete mb;
+          continue;
+        }
+        
+        //IDs are only ever added to a mapblock's palette, so old and new IDs can be looked up in the same one.
+        if(region_has_meta) {
+          std::vector<bool> id_has_meta;
+          bool any_meta = false;
+          for(const std::string& itemstring : mb->IDtoIS) {
+            id_has_meta.push_back(region_has_meta(itemstring));
+            any_meta = any_meta || id_has_meta.back();
+          }
+          
+          MapPos<int> base(x * MAPBLOCK_SIZE_X, y * MAPBLOCK_SIZE_Y, z * MAPBLOCK_SIZE_Z, 0, 0, 0);
+          for(int nx = from.x - base.x; any_meta && nx <= to.x - base.x; nx++) {
+            for(int ny = from.y - base.y; ny <= to.y - base.y; ny++) {
+              for(int nz = from.z - base.z; nz <= to.z - base.z; nz++) {
+                uint32_t old_id = old_data[nx][ny][nz] & REGION_ID_MASK;
+                uint32_t new_id = mb->data[nx][ny][nz] & REGION_ID_MASK;
+                if(old_id == new_id) { continue; }
+                if(!(old_id < id_has_meta.size() && id_has_meta[old_id]) && !(new_id < id_has_meta.size() && id_has_meta[new_id])) { continue; }
+                
+                meta_changed.push_back(std::make_tuple(
+                    MapPos<int>(base.x + nx, base.y + ny, base.z + nz, min_pos.w, min_pos.world, min_pos.universe),
+                    Node(mb->id_to_itemstring(old_id), (old_data[nx][ny][nz] >> REGION_ROT_SHIFT) & 255),
+                    Node(mb->id_to_itemstring(new_id), (mb->data[nx][ny][nz] >> REGION_ROT_SHIFT) & 255)));
+              }
+            }
+          }
+        }
+        
+        mb->is_nil = false;
+        mb->dirty = true;
+        mb->update_num++;
+        changed[mb_pos] = mb;
+        total += count;
+      }
+    }
+  }
+  
+  //One database batch, then one lighting pass.
+  db.set_mapblocks(changed);
+  for(auto it : changed) {
+    mapblock_changed(it.first);
+  }
+  
+  std::set<MapPos<int>> to_light;
+  for(auto it : changed) {
+    MapPos<int> mb_pos = it.first;
+    for(int x = mb_pos.x - 1; x <= mb_pos.x + 1; x++) {
+      for(int y = mb_pos.y - 1; y <= mb_pos.y + 1; y++) {
+        for(int z = mb_pos.z - 1; z <= mb_pos.z + 1; z++) {
+          to_light.insert(MapPos<int>(x, y, z, mb_pos.w, mb_pos.world, mb_pos.universe));
+        }
+      }
+    }
+    wake_fluid_tick_mapblock(mb_pos);
+    delete it.second;
+  }
+  if(to_light.size() > 0) {
+    update_mapblock_light(locks, to_light);
+  }
+  
+  for(auto it_lock : locks) {
+    db.unlock_mapblock_unique(it_lock);
+  }
+  
+  for(const auto& it : meta_changed) {
+    region_meta_handler(std::get<0>(it), std::get<1>(it), std::get<2>(it));
+  }
+  
+  std::unique_lock<std::shared_mutex> queue_lock(set_node_queue_lock);
+  set_node_counters.mapblocks_written += changed.size();
+  if(to_light.size() > 0) {
+    set_node_counters.light_passes++;
+  }
+  
+  return total;
+}
+
+//Sets every node in a box to 'node'.
+//Returns the number of nodes changed.
+size_t Map::fill_region(MapPos<int> min_pos, MapPos<int> max_pos, Node node) {
+  sort_region_corners(min_pos, max_pos);
+  
+  bool is_air = node.itemstring == "air";
+  
+  return edit_region(min_pos, max_pos, [&node, is_air](Mapblock *mb, MapPos<int> from, MapPos<int> to) -> size_t {
+    MapPos<int> base(mb->pos.x * MAPBLOCK_SIZE_X, mb->pos.y * MAPBLOCK_SIZE_Y, mb->pos.z * MAPBLOCK_SIZE_Z, 0, 0, 0);
+    uint32_t val = ((node.rot & 255) << REGION_ROT_SHIFT) | (mb->itemstring_to_id(node.itemstring) & REGION_ID_MASK);
+    
+    size_t count = 0;
+    for(int x = from.x - base.x; x <= to.x - base.x; x++) {
+      for(int y = from.y - base.y; y <= to.y - base.y; y++) {
+        for(int z = from.z - base.z; z <= to.z - base.z; z++) {
+          uint32_t old_val = mb->data[x][y][z];
+          if((old_val & REGION_NODE_MASK) == val) { continue; }
+          
+          //Light is kept for now, the lighting pass will fix it.
+          mb->data[x][y][z] = (old_val & ~REGION_NODE_MASK) | val;
+          count++;
+        }
+      }
+    }
+    
+    if(count > 0 && !is_air) {
+      mb->sunlit = false;
+    }
+    return count;
+  });
+}
+
+//Changes every 'from' node in a box into a 'to' node, keeping its rotation.
+//Returns the number of nodes changed.
+size_t Map::replace_region(MapPos<int> min_pos, MapPos<int> max_pos, std::string from_itemstring, std::string to_itemstring) {
+  sort_region_corners(min_pos, max_pos);
+  
+  if(from_itemstring == to_itemstring) { return 0; }
+  
+  bool is_air = to_itemstring == "air";
+  
+  return edit_region(min_pos, max_pos, [&from_itemstring, &to_itemstring, is_air](Mapblock *mb, MapPos<int> from, MapPos<int> to) -> size_t {
+    auto search = mb->IStoID.find(from_itemstring);
+    if(search == mb->IStoID.end()) { return 0; }
+    uint32_t from_id = search->second;
+    uint32_t to_id = REGION_ID_NONE;
+    
+    MapPos<int> base(mb->pos.x * MAPBLOCK_SIZE_X, mb->pos.y * MAPBLOCK_SIZE_Y, mb->pos.z * MAPBLOCK_SIZE_Z, 0, 0, 0);
+    
+    size_t count = 0;
+    for(int x = from.x - base.x; x <= to.x - base.x; x++) {
+      for(int y = from.y - base.y; y <= to.y - base.y; y++) {
+        for(int z = from.z - base.z; z <= to.z - base.z; z++) {
+          uint32_t old_val = mb->data[x][y][z];
+          if((old_val & REGION_ID_MASK) != from_id) { continue; }
+          
+          //Only add to the mapblock's palette if it's actually used.
+          if(to_id == REGION_ID_NONE) {
+            to_id = mb->itemstring_to_id(to_itemstring) & REGION_ID_MASK;
+          }
+          mb->data[x][y][z] = (old_val & ~REGION_ID_MASK) | to_id;
+          count++;
+        }
+      }
+    }
+    
+    if(count > 0 && !is_air) {
+      mb->sunlit = false;
+    }
+    return count;
+  });
+}
+
+//Copies a box of nodes out of the map, to be put back with paste_region.
+MapRegion Map::copy_region(MapPos<int> min_pos, MapPos<int> max_pos) {
+  sort_region_corners(min_pos, max_pos);
+  
+  //Queued changes have to be in the database to be copied.
+  flush_set_node_queue();
+  
+  MapRegion region(MapPos<int>(max_pos.x - min_pos.x + 1, max_pos.y - min_pos.y + 1, max_pos.z - min_pos.z + 1, 0, 0, 0));
+  std::map<std::string, uint32_t> region_ids;
+  
+  MapPos<int> mb_min = global_to_mapblock(min_pos);
+  MapPos<int> mb_max = global_to_mapblock(max_pos);
+  
+  for(int mb_x = mb_min.x; mb_x <= mb_max.x; mb_x++) {
+    for(int mb_y = mb_min.y; mb_y <= mb_max.y; mb_y++) {
+      for(int mb_z = mb_min.z; mb_z <= mb_max.z; mb_z++) {
+        MapPos<int> mb_pos(mb_x, mb_y, mb_z, mb_min.w, mb_min.world, mb_min.universe);
+        MapPos<int> base(mb_x * MAPBLOCK_SIZE_X, mb_y * MAPBLOCK_SIZE_Y, mb_z * MAPBLOCK_SIZE_Z, 0, 0, 0);
+        
+        db.lock_mapblock_shared(mb_pos);
+        Mapblock *mb = get_mapblock(mb_pos);
+        db.unlock_mapblock_shared(mb_pos);
+        
+        //Mapblock ID -> region ID, filled in as IDs are seen.
+        std::vector<uint32_t> ids(mb->IDtoIS.size(), REGION_ID_NONE);
+        
+        int from_x = std::max(min_pos.x, base.x), to_x = std::min(max_pos.x, base.x + MAPBLOCK_SIZE_X - 1);
+        int from_y = std::max(min_pos.y, base.y), to_y = std::min(max_pos.y, base.y + MAPBLOCK_SIZE_Y - 1);
+        int from_z = std::max(min_pos.z, base.z), to_z = std::min(max_pos.z, base.z + MAPBLOCK_SIZE_Z - 1);
+        for(int x = from_x; x <= to_x; x++) {
+          for(int y = from_y; y <= to_y; y++) {
+            for(int z = from_z; z <= to_z; z++) {
+              uint32_t val = mb->data[x - base.x][y - base.y][z - base.z];
+              uint32_t id = val & REGION_ID_MASK;
+              
+              uint32_t region_id;
+              if(id < ids.size() && ids[id] != REGION_ID_NONE) {
+                region_id = ids[id];
+              } else {
+                std::string itemstring = mb->id_to_itemstring(id);
+                auto search = region_ids.find(itemstring);
+                if(search != region_ids.end()) {
+                  region_id = search->second;
+                } else {
+                  region_id = region.itemstrings.size();
+                  region.itemstrings.push_back(itemstring);
+                  region_ids[itemstring] = region_id;
+                }
+                if(id < ids.size()) { ids[id] = region_id; }
+              }
+              
+              region.data[region.index(x - min_pos.x, y - min_pos.y, z - min_pos.z)] = (val & REGION_NODE_MASK & ~REGION_ID_MASK) | region_id;
+            }
+          }
+        }
+        
+        delete mb;
+      }
+    }
+  }
+  
+  return region;
+}
+
+//Writes a region copied with copy_region into the map, with its lowest corner at 'min_pos'.
+//Returns the number of nodes changed.
+size_t Map::paste_region(MapPos<int> min_pos, const MapRegion& region) {
+  if(region.volume() == 0) { return 0; }
+  
+  MapPos<int> max_pos(min_pos.x + region.size.x - 1, min_pos.y + region.size.y - 1, min_pos.z + region.size.z - 1,
+                      min_pos.w, min_pos.world, min_pos.universe);
+  
+  std::vector<bool> is_air;
+  for(auto itemstring : region.itemstrings) {
+    is_air.push_back(itemstring == "air");
+  }
+  
+  return edit_region(min_pos, max_pos, [&region, &is_air, min_pos](Mapblock *mb, MapPos<int> from, MapPos<int> to) -> size_t {
+    MapPos<int> base(mb->pos.x * MAPBLOCK_SIZE_X, mb->pos.y * MAPBLOCK_SIZE_Y, mb->pos.z * MAPBLOCK_SIZE_Z, 0, 0, 0);
+    
+    //Region ID -> mapblock ID, filled in as IDs are used so that the palette doesn't collect unused entries.
+    std::vector<uint32_t> ids(region.itemstrings.size(), REGION_ID_NONE);
+    
+    size_t count = 0;
+    bool any_solid = false;
+    for(int x = from.x; x <= to.x; x++) {
+      for(int y = from.y; y <= to.y; y++) {
+        for(int z = from.z; z <= to.z; z++) {
+          uint32_t region_val = region.data[region.index(x - min_pos.x, y - min_pos.y, z - min_pos.z)];
+          uint32_t region_id = region_val & REGION_ID_MASK;
+          if(ids[region_id] == REGION_ID_NONE) {
+            ids[region_id] = mb->itemstring_to_id(region.itemstrings[region_id]) & REGION_ID_MASK;
+          }
+          uint32_t val = (region_val & ~REGION_ID_MASK) | ids[region_id];
+          
+          uint32_t old_val = mb->data[x - base.x][y - base.y][z - base.z];
+          if((old_val & REGION_NODE_MASK) == val) { continue; }
+          
+          mb->data[x - base.x][y - base.y][z - base.z] = (old_val & ~REGION_NODE_MASK) | val;
+          count++;
+          if(!is_air[region_id]) { any_solid = true; }
+        }
+      }
+    }
+    
+    if(any_solid) {
+      mb->sunlit = false;
+    }
+    return count;
+  });
+}
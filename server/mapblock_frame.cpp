@@ -0,0 +1,280 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mapblock_frame.h"
+
+#include <sstream>
+#include <cstring>
+
+//JSON array of IDtoIS[first], IDtoIS[first + 1], ...
+static std::string IDtoIS_as_json(const std::vector<std::string>& IDtoIS, size_t first) {
+  std::ostringstream IDtoIS_ss;
+  IDtoIS_ss << "[";
+  for(size_t i = first; i < IDtoIS.size(); i++) {
+    if(i != first) { IDtoIS_ss << ","; }
+    IDtoIS_ss << "\"" << IDtoIS[i] << "\"";
+  }
+  IDtoIS_ss << "]";
+  return IDtoIS_ss.str();
+}
+
+std::string encode_mapblock(MapblockCompressed *mbc) {
+  std::string IDtoIS_str = IDtoIS_as_json(mbc->IDtoIS, 0);
+  size_t IDtoIS_len = IDtoIS_str.size();
+  
+  //Format:
+  //0   Magic number (uint32_t)
+  //4   Position (6 * int32_t) -- x, y, z, w, world, universe
+  //28  updateNum (uint32_t)
+  //32  lightUpdateNum (uint32_t)
+  //36  lightNeedsUpdate (uint32_t)
+  //40  flags (uint32_t) -- lowest bit is 'sunlit', others are reserved
+  //44  data len (uint32_t)
+  //48  data (string of uint32_ts)
+  //?   light len (# of uint32_ts) (uint32_t)
+  //+4   light len (# of uint16_ts) (uint32_t)
+  //+8  light data (string of uint16_ts)
+  //?   IDtoIS len (uint32_t)
+  //+4  IDtoIS data (utf-8 chars)
+  
+  //Light data and IDtoIS are each zero-padded to the next whole uint32_t (always at least one byte of padding).
+  size_t light_words = (mbc->light_data_c_len * sizeof(uint16_t) / sizeof(uint32_t)) + 1;
+  size_t IDtoIS_words = (IDtoIS_len / sizeof(uint32_t)) + 1;
+  size_t len = 12 + mbc->data_c_len + 2 + light_words + 1 + IDtoIS_words;
+  
+  //Sized exactly, rather than for the largest possible mapblock.
+  std::string out(len * sizeof(uint32_t), '\0');
+  uint32_t *out_buf_32 = reinterpret_cast<uint32_t*>(&out[0]);
+  int32_t *out_buf_i32 = reinterpret_cast<int32_t*>(&out[0]);
+  
+  out_buf_32[0] = 0xABCD5678;
+  out_buf_i32[1] = mbc->pos.x;
+  out_buf_i32[2] = mbc->pos.y;
+  out_buf_i32[3] = mbc->pos.z;
+  out_buf_i32[4] = mbc->pos.w;
+  out_buf_i32[5] = mbc->pos.world;
+  out_buf_i32[6] = mbc->pos.universe;
+  out_buf_32[7] = mbc->update_num;
+  out_buf_32[8] = mbc->light_update_num;
+  out_buf_32[9] = mbc->light_needs_update;
+  out_buf_32[10] = mbc->sunlit ? 1 : 0;
+  out_buf_32[11] = mbc->data_c_len;
+  size_t arr_pos = 12;
+  memcpy(out_buf_32 + arr_pos, mbc->data_c.data(), mbc->data_c_len * sizeof(uint32_t));
+  arr_pos += mbc->data_c_len;
+  out_buf_32[arr_pos] = light_words;
+  arr_pos++;
+  out_buf_32[arr_pos] = mbc->light_data_c_len;
+  arr_pos++;
+  memcpy(out_buf_32 + arr_pos, mbc->light_data_c.data(), mbc->light_data_c_len * sizeof(uint16_t));
+  arr_pos += light_words;
+  out_buf_32[arr_pos] = IDtoIS_len;
+  arr_pos++;
+  memcpy(out_buf_32 + arr_pos, IDtoIS_str.data(), IDtoIS_len);
+  
+  return out;
+}
+
+std::string encode_mapblock_delta(Mapblock *base, MapblockCompressed *mbc) {
+  //IDs are only ever appended, so the old IDtoIS should be the start of the new one.
+  if(base->IDtoIS.size() > mbc->IDtoIS.size()) { return ""; }
+  for(size_t i = 0; i < base->IDtoIS.size(); i++) {
+    if(base->IDtoIS[i] != mbc->IDtoIS[i]) { return ""; }
+  }
+  
+  std::string IDtoIS_str = IDtoIS_as_json(mbc->IDtoIS, base->IDtoIS.size());
+  const uint8_t *IDtoIS_data = reinterpret_cast<const uint8_t*>(&IDtoIS_str[0]);
+  size_t IDtoIS_len = IDtoIS_str.size();
+  
+  //Size of the full message from encode_mapblock, in uint32_ts
+  size_t full_len = 12 + mbc->data_c_len
+                  + 2 + (mbc->light_data_c_len * sizeof(uint16_t) / sizeof(uint32_t)) + 1
+                  + 1 + (IDtoIS_as_json(mbc->IDtoIS, 0).size() / sizeof(uint32_t)) + 1;
+  //Header and IDtoIS
+  size_t fixed_len = 15 + 1 + (IDtoIS_len / sizeof(uint32_t)) + 1;
+  if(fixed_len >= full_len) { return ""; }
+  size_t max_changes = (full_len - fixed_len) / 2;
+  
+  //Format:
+  //0   Magic number (uint32_t)
+  //4   Position (6 * int32_t) -- x, y, z, w, world, universe
+  //28  base updateNum (uint32_t) -- the version this applies to
+  //32  base lightUpdateNum (uint32_t)
+  //36  updateNum (uint32_t)
+  //40  lightUpdateNum (uint32_t)
+  //44  lightNeedsUpdate (uint32_t)
+  //48  flags (uint32_t) -- lowest bit is 'sunlit', others are reserved
+  //52  base IDtoIS len (uint32_t) -- # of entries the player should already have
+  //56  change count (uint32_t)
+  //60  changes (pairs of uint32_t) -- index ((x * 16 + y) * 16 + z), node data including light
+  //?   new IDtoIS entries len (uint32_t)
+  //+4  new IDtoIS entries, to be appended (utf-8 chars)
+  
+  std::vector<uint32_t> out_buf(full_len, 0);
+  
+  size_t arr_pos = 15;
+  size_t changes = 0;
+  Mapblock *mb = mbc->decompress();
+  for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+    for(int y = 0; y < MAPBLOCK_SIZE_Y; y++) {
+      for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+        if(mb->data[x][y][z] == base->data[x][y][z]) { continue; }
+        
+        if(changes >= max_changes) {
+          //Too many to be worth it.
+          delete mb;
+          return "";
+        }
+        out_buf[arr_pos] = (x * MAPBLOCK_SIZE_Y + y) * MAPBLOCK_SIZE_Z + z;
+        out_buf[arr_pos + 1] = mb->data[x][y][z];
+        arr_pos += 2;
+        changes++;
+      }
+    }
+  }
+  delete mb;
+  
+  int32_t *out_buf_i32 = (int32_t*) out_buf.data();
+  out_buf[0] = 0xABCD5679;
+  out_buf_i32[1] = mbc->pos.x;
+  out_buf_i32[2] = mbc->pos.y;
+  out_buf_i32[3] = mbc->pos.z;
+  out_buf_i32[4] = mbc->pos.w;
+  out_buf_i32[5] = mbc->pos.world;
+  out_buf_i32[6] = mbc->pos.universe;
+  out_buf[7] = base->update_num;
+  out_buf[8] = base->light_update_num;
+  out_buf[9] = mbc->update_num;
+  out_buf[10] = mbc->light_update_num;
+  out_buf[11] = mbc->light_needs_update;
+  out_buf[12] = mbc->sunlit ? 1 : 0;
+  out_buf[13] = base->IDtoIS.size();
+  out_buf[14] = changes;
+  out_buf[arr_pos] = IDtoIS_len;
+  arr_pos++;
+  memcpy(out_buf.data() + arr_pos, IDtoIS_data, IDtoIS_len);
+  arr_pos += (IDtoIS_len / sizeof(uint32_t)) + 1;
+  
+  return std::string(reinterpret_cast<const char*>(out_buf.data()), arr_pos * sizeof(uint32_t));
+}
+
+//Whether 'a' is a version from before 'b'.
+static bool is_older(const MapblockUpdateInfo& a, const MapblockUpdateInfo& b) {
+  if(a.update_num != b.update_num) { return a.update_num < b.update_num; }
+  if(a.light_update_num != b.light_update_num) { return a.light_update_num < b.light_update_num; }
+  return a.light_needs_update > b.light_needs_update;
+}
+
+//Deltas only record the update numbers of the version they apply to.
+static bool same_base(const MapblockUpdateInfo& a, const MapblockUpdateInfo& b) {
+  return a.update_num == b.update_num && a.light_update_num == b.light_update_num;
+}
+
+MapblockFrameCache::MapblockFrameCache(size_t _target) : target(_target), hits(0), misses(0) {}
+
+std::shared_ptr<const MapblockFrame> MapblockFrameCache::get(MapblockUpdateInfo info) {
+  std::unique_lock<std::shared_mutex> cache_l(cache_lock);
+  
+  auto search = entries.find(info.pos);
+  if(search == entries.end() || search->second.info != info || search->second.full == NULL) {
+    misses++;
+    return NULL;
+  }
+  
+  Entry& entry = search->second;
+  entries_hits.erase(entry.hit);
+  entry.hit = entries_hits.insert(entries_hits.end(), info.pos);
+  hits++;
+  return entry.full;
+}
+
+std::shared_ptr<const MapblockFrame> MapblockFrameCache::get_delta(MapblockUpdateInfo base, MapblockUpdateInfo info) {
+  std::unique_lock<std::shared_mutex> cache_l(cache_lock);
+  
+  auto search = entries.find(info.pos);
+  if(search != entries.end() && !(search->second.info != info)) {
+    Entry& entry = search->second;
+    for(const auto& it : entry.deltas) {
+      if(same_base(it.first, base)) {
+        entries_hits.erase(entry.hit);
+        entry.hit = entries_hits.insert(entries_hits.end(), info.pos);
+        hits++;
+        return it.second;
+      }
+    }
+  }
+  misses++;
+  return NULL;
+}
+
+//The entry to store frames of version 'info' in, or NULL if a newer version is already cached.
+//Must hold cache_lock.
+MapblockFrameCache::Entry* MapblockFrameCache::entry_for(MapblockUpdateInfo info) {
+  auto search = entries.find(info.pos);
+  if(search == entries.end()) {
+    search = entries.insert(std::make_pair(info.pos, Entry())).first;
+    search->second.info = info;
+  } else {
+    entries_hits.erase(search->second.hit);
+  }
+  Entry& entry = search->second;
+  entry.hit = entries_hits.insert(entries_hits.end(), info.pos);
+  
+  if(entry.info != info) {
+    if(is_older(info, entry.info)) { return NULL; }
+    
+    entry.info = info;
+    entry.full = NULL;
+    entry.deltas.clear();
+  }
+  
+  //Forget about the least recently used mapblocks.
+  while(entries_hits.size() > target && entries_hits.size() > 1) {
+    entries.erase(entries_hits.front());
+    entries_hits.pop_front();
+  }
+  
+  return &entry;
+}
+
+void MapblockFrameCache::put(std::shared_ptr<const MapblockFrame> frame) {
+  std::unique_lock<std::shared_mutex> cache_l(cache_lock);
+  
+  Entry *entry = entry_for(frame->info);
+  if(entry == NULL) { return; }
+  entry->full = frame;
+}
+
+void MapblockFrameCache::put_delta(MapblockUpdateInfo base, std::shared_ptr<const MapblockFrame> frame) {
+  std::unique_lock<std::shared_mutex> cache_l(cache_lock);
+  
+  Entry *entry = entry_for(frame->info);
+  if(entry == NULL) { return; }
+  for(const auto& it : entry->deltas) {
+    if(same_base(it.first, base)) { return; }
+  }
+  entry->deltas.push_back(std::make_pair(base, frame));
+  if(entry->deltas.size() > MAPBLOCK_FRAME_CACHE_DELTAS) {
+    entry->deltas.erase(entry->deltas.begin());
+  }
+}
+
+std::string MapblockFrameCache::stats() {
+  std::shared_lock<std::shared_mutex> cache_l(cache_lock);
+  return std::to_string(entries.size()) + " mapblocks encoded for sending, " + std::to_string(hits) + " reused, " + std::to_string(misses) + " encoded";
+}
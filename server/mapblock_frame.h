@@ -0,0 +1,85 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MAPBLOCK_FRAME_H__
+#define __MAPBLOCK_FRAME_H__
+
+#include "vector.h"
+#include "mapblock.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+//Most deltas to keep for each mapblock; there's one per older version players might have (see SENT_MAPBLOCK_VERSIONS).
+#define MAPBLOCK_FRAME_CACHE_DELTAS 4
+
+//A mapblock, or the changes to one, encoded the way it's sent to clients.
+//Never changed once made, so one copy is shared by every player it's sent to.
+class MapblockFrame {
+  public:
+    MapblockFrame(MapblockUpdateInfo _info, std::string _data) : info(_info), data(std::make_shared<const std::string>(std::move(_data))) {}
+    
+    MapblockUpdateInfo info; //version the player has once they get this
+    std::shared_ptr<const std::string> data; //empty for a delta that wasn't worth sending
+};
+
+//Whole mapblock (magic number 0xABCD5678).
+std::string encode_mapblock(MapblockCompressed *mbc);
+//Changes from 'base' to 'mbc' (magic number 0xABCD5679), or an empty string if that wouldn't be smaller than the whole mapblock.
+std::string encode_mapblock_delta(Mapblock *base, MapblockCompressed *mbc);
+
+//The most recently encoded frames for each mapblock: the whole thing, and deltas to it from older versions.
+//Only the newest version of each mapblock is kept. Thread safe.
+class MapblockFrameCache {
+  public:
+    MapblockFrameCache(size_t _target);
+    
+    //Frame of the whole mapblock at version 'info', or NULL if there isn't one cached.
+    std::shared_ptr<const MapblockFrame> get(MapblockUpdateInfo info);
+    //Frame taking a player from version 'base' to version 'info', or NULL if there isn't one cached.
+    std::shared_ptr<const MapblockFrame> get_delta(MapblockUpdateInfo base, MapblockUpdateInfo info);
+    void put(std::shared_ptr<const MapblockFrame> frame);
+    void put_delta(MapblockUpdateInfo base, std::shared_ptr<const MapblockFrame> frame);
+    
+    //For /status
+    std::string stats();
+    
+  private:
+    class Entry {
+      public:
+        MapblockUpdateInfo info;
+        std::shared_ptr<const MapblockFrame> full;
+        std::vector<std::pair<MapblockUpdateInfo, std::shared_ptr<const MapblockFrame>>> deltas;
+        std::list<MapPos<int>>::iterator hit;
+    };
+    Entry* entry_for(MapblockUpdateInfo info);
+    
+    std::map<MapPos<int>, Entry> entries;
+    std::list<MapPos<int>> entries_hits; //least recently used first
+    size_t target;
+    size_t hits;
+    size_t misses;
+    std::shared_mutex cache_lock;
+};
+
+#endif
@@ -0,0 +1,186 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mapblock_stream.h"
+#include "config.h"
+
+#include <cmath>
+#include <algorithm>
+
+MapblockStream::MapblockStream()
+    : view_distance(0, 0, 0, 0, 0, 0), view_distance_set(false),
+      max_known(std::max(get_config<int>("player.max_known_mapblocks"), 1)),
+      order_valid(false), order_center(0, 0, 0, 0, 0, 0), order_sees_sky(false), sky_sees_sky(false), settled(false), busy(false),
+      rate(get_config<int>("player.stream_rate")), burst(get_config<int>("player.stream_burst")),
+      tokens(burst), last_refill(std::chrono::steady_clock::now())
+{
+  
+}
+
+void MapblockStream::set_view_distance(MapPos<int> dist) {
+  view_distance = dist;
+  view_distance_set = true;
+  order_valid = false;
+  forgotten_center = std::nullopt;
+}
+
+void MapblockStream::set_keep_distance(MapPos<int> dist) {
+  keep_distance = dist;
+  forgotten_center = std::nullopt;
+}
+
+std::vector<MapPos<int>> MapblockStream::forgotten(MapPos<int> center, const KnownMapblocks& known) {
+  std::vector<MapPos<int>> out;
+  
+  std::optional<MapPos<int>> keep_dist = keep_distance;
+  if(view_distance_set) {
+    if(!keep_dist) {
+      keep_dist = view_distance + MAPBLOCK_STREAM_KEEP_MARGIN;
+    }
+    //Forgetting anything in view would only have it streamed again.
+    keep_dist = MapPos<int>(std::max(keep_dist->x, view_distance.x), std::max(keep_dist->y, view_distance.y),
+                            std::max(keep_dist->z, view_distance.z), std::max(keep_dist->w, view_distance.w), 0, 0);
+  }
+  bool moved = keep_dist && !(forgotten_center && *forgotten_center == center);
+  bool too_many = known.size() > max_known;
+  if(!moved && !too_many) { return out; }
+  forgotten_center = center;
+  
+  std::optional<MapBox<int>> keep;
+  if(keep_dist) {
+    keep.emplace(center - *keep_dist, center + *keep_dist);
+  }
+  std::vector<std::pair<double, MapPos<int>>> kept;
+  known.for_each([&](MapPos<int> mb_pos) {
+    if(keep && !keep->contains(mb_pos)) {
+      out.push_back(mb_pos);
+    } else if(too_many) {
+      double dist;
+      if(mb_pos.world != center.world || mb_pos.universe != center.universe) {
+        dist = HUGE_VAL;
+      } else {
+        double dx = mb_pos.x - center.x;
+        double dy = mb_pos.y - center.y;
+        double dz = mb_pos.z - center.z;
+        dist = std::sqrt(dx * dx + dy * dy + dz * dz) + std::abs(mb_pos.w - center.w) * MAPBLOCK_STREAM_W_WEIGHT;
+      }
+      kept.push_back(std::make_pair(dist, mb_pos));
+    }
+  });
+  
+  //Trimmed well below the limit, so this doesn't have to happen again with every mapblock sent.
+  if(kept.size() > max_known) {
+    size_t target = max_known * 7 / 8;
+    std::nth_element(kept.begin(), kept.begin() + target, kept.end());
+    for(size_t i = target; i < kept.size(); i++) {
+      out.push_back(kept[i].second);
+    }
+  }
+  return out;
+}
+
+//Direction the player is looking in; the camera looks down -z before rotation.
+static Vector3<double> facing_direction(Quaternion rot) {
+  return Vector3<double>(-2 * (rot.x * rot.z + rot.w * rot.y),
+                         -2 * (rot.y * rot.z - rot.w * rot.x),
+                         -(1 - 2 * (rot.x * rot.x + rot.y * rot.y)));
+}
+
+//Still good if the player hasn't moved to another mapblock or turned much.
+bool MapblockStream::is_planned(MapPos<int> center, Quaternion rot) const {
+  Vector3<double> facing = facing_direction(rot);
+  return order_valid && center == order_center
+         && facing.x * order_facing.x + facing.y * order_facing.y + facing.z * order_facing.z >= MAPBLOCK_STREAM_REPLAN_TURN;
+}
+
+std::optional<bool> MapblockStream::sees_sky_at(MapPos<int> center) const {
+  if(sky_center && *sky_center == center) {
+    return sky_sees_sky;
+  }
+  return std::nullopt;
+}
+
+void MapblockStream::set_sees_sky(MapPos<int> center, bool sees_sky) {
+  sky_center = center;
+  sky_sees_sky = sees_sky;
+}
+
+const std::vector<MapPos<int>>& MapblockStream::plan(MapPos<int> center, MapPos<double> pos, Quaternion rot, bool sees_sky) {
+  if(is_planned(center, rot) && sees_sky == order_sees_sky) {
+    return order;
+  }
+  
+  Vector3<double> facing = facing_direction(rot);
+  
+  std::vector<std::pair<double, MapPos<int>>> scored;
+  for(int w = center.w - view_distance.w; w <= center.w + view_distance.w; w++) {
+    for(int x = center.x - view_distance.x; x <= center.x + view_distance.x; x++) {
+      for(int y = center.y - view_distance.y; y <= center.y + view_distance.y; y++) {
+        for(int z = center.z - view_distance.z; z <= center.z + view_distance.z; z++) {
+          MapPos<int> mb_pos(x, y, z, w, center.world, center.universe);
+          
+          //From the player to the middle of the mapblock, in mapblocks
+          double dx = (x * MAPBLOCK_SIZE_X + MAPBLOCK_SIZE_X / 2.0 - pos.x) / MAPBLOCK_SIZE_X;
+          double dy = (y * MAPBLOCK_SIZE_Y + MAPBLOCK_SIZE_Y / 2.0 - pos.y) / MAPBLOCK_SIZE_Y;
+          double dz = (z * MAPBLOCK_SIZE_Z + MAPBLOCK_SIZE_Z / 2.0 - pos.z) / MAPBLOCK_SIZE_Z;
+          double dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+          double score = dist + std::abs(w - center.w) * MAPBLOCK_STREAM_W_WEIGHT;
+          
+          //The ones right around the player are needed no matter which way they're facing.
+          if(dist > 1) {
+            double facing_cos = (facing.x * dx + facing.y * dy + facing.z * dz) / dist;
+            score *= 1 + MAPBLOCK_STREAM_BEHIND_WEIGHT * (1 - facing_cos) / 2;
+          }
+          
+          if((sees_sky && y < center.y - 1) || (!sees_sky && y > center.y + 1)) {
+            score *= MAPBLOCK_STREAM_HIDDEN_WEIGHT;
+          }
+          
+          scored.push_back(std::make_pair(score, mb_pos));
+        }
+      }
+    }
+  }
+  std::sort(scored.begin(), scored.end());
+  
+  order.clear();
+  for(const auto& it : scored) {
+    order.push_back(it.second);
+  }
+  order_valid = true;
+  settled = false;
+  order_center = center;
+  order_facing = facing;
+  order_sees_sky = sees_sky;
+  
+  return order;
+}
+
+double MapblockStream::available() {
+  std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - last_refill).count();
+  last_refill = now;
+  
+  tokens = std::min(burst, tokens + elapsed * rate);
+  return tokens;
+}
+
+//May go below zero; a mapblock is never split up, so the last one sent can overshoot the budget.
+void MapblockStream::spend(size_t bytes) {
+  tokens -= bytes;
+}
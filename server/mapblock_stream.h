@@ -0,0 +1,116 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MAPBLOCK_STREAM_H__
+#define __MAPBLOCK_STREAM_H__
+
+#include "vector.h"
+#include "mapblock.h"
+#include "known_mapblocks.h"
+
+#include <vector>
+#include <map>
+#include <chrono>
+#include <optional>
+
+//Most mapblocks to send (and light, and generate if needed) to one player per pass, so that a player
+//moving quickly can't take over a whole tick.
+#define MAPBLOCK_STREAM_MAX_PER_PASS 24
+//How much further away a mapblock directly behind the player is treated as being, relative to one straight ahead.
+#define MAPBLOCK_STREAM_BEHIND_WEIGHT 2.0
+//How much further away mapblocks on the far side of the ground are treated as being:
+//below the player when they can see the sky, above them when they can't.
+#define MAPBLOCK_STREAM_HIDDEN_WEIGHT 2.0
+//How far one step in w counts for, in mapblocks.
+#define MAPBLOCK_STREAM_W_WEIGHT 2.0
+//The order is worked out again once the player has turned this far (cosine of the angle).
+#define MAPBLOCK_STREAM_REPLAN_TURN 0.95
+//How far past the view distance known mapblocks are kept, for clients that don't say how far they keep them.
+#define MAPBLOCK_STREAM_KEEP_MARGIN MapPos<int>(2, 2, 2, 1, 0, 0)
+
+//Decides which mapblocks to push to a player, and when.
+//Mapblocks within the view distance the client asked for are sent in order of importance: near before far,
+//in front of the player before behind, and the same side of the ground as the player before the other side.
+//Sending is limited by a token bucket, refilled at player.stream_rate bytes per second and holding at most player.stream_burst.
+//Not thread safe; guarded by the player's lock.
+class MapblockStream {
+  public:
+    MapblockStream();
+    
+    //Streaming is off until the client sets a view distance.
+    void set_view_distance(MapPos<int> dist);
+    bool enabled() const { return view_distance_set; }
+    MapPos<int> get_view_distance() const { return view_distance; }
+    //The client drops mapblocks further away than this, so they have to be sent again on the way back.
+    //Without it, mapblocks are kept to MAPBLOCK_STREAM_KEEP_MARGIN past the view distance.
+    void set_keep_distance(MapPos<int> dist);
+    
+    //Known mapblocks to forget (and tell the client to drop): those beyond the keep distance, checked each time 'center' changes,
+    //and once there are more than player.max_known_mapblocks, the furthest away, down to 7/8 of that.
+    std::vector<MapPos<int>> forgotten(MapPos<int> center, const KnownMapblocks& known);
+    
+    //Every mapblock within view distance of 'center', most important first.
+    //'pos' and 'rot' are the player's position and facing, 'sees_sky' whether they're above ground.
+    const std::vector<MapPos<int>>& plan(MapPos<int> center, MapPos<double> pos, Quaternion rot, bool sees_sky);
+    //Whether plan would return the current order as is.
+    bool is_planned(MapPos<int> center, Quaternion rot) const;
+    
+    //Whether the player could see the sky, if it's been looked up since they entered mapblock 'center'.
+    //Looking it up loads a mapblock, so it's done on the player's work strand (see Server::stream_sky_work).
+    std::optional<bool> sees_sky_at(MapPos<int> center) const;
+    void set_sees_sky(MapPos<int> center, bool sees_sky);
+    
+    //Set once a pass finds nothing left to send. The mapblocks the player has are kept up to date as they change
+    //(see MapblockSubscribers), so there's nothing more to look for until the order changes or the player loses one.
+    bool is_settled() const { return settled; }
+    void set_settled(bool _settled) { settled = _settled; }
+    
+    //Set while a pass is being lit and encoded, or the sky looked up, on the player's work strand
+    //(see Server::send_mapblocks_work and Server::stream_sky_work).
+    //The next pass waits for it, so the same mapblocks aren't picked twice.
+    bool is_busy() const { return busy; }
+    void set_busy(bool _busy) { busy = _busy; }
+    
+    //Bytes that may be sent right now.
+    double available();
+    void spend(size_t bytes);
+    
+  private:
+    MapPos<int> view_distance;
+    bool view_distance_set;
+    std::optional<MapPos<int>> keep_distance;
+    std::optional<MapPos<int>> forgotten_center;
+    size_t max_known;
+    
+    std::vector<MapPos<int>> order;
+    bool order_valid;
+    MapPos<int> order_center;
+    Vector3<double> order_facing;
+    bool order_sees_sky;
+    std::optional<MapPos<int>> sky_center;
+    bool sky_sees_sky;
+    bool settled;
+    bool busy;
+    
+    double rate;
+    double burst;
+    double tokens;
+    std::chrono::time_point<std::chrono::steady_clock> last_refill;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mapblock_subscribers.h"
+
+MapblockSubscribers::MapblockSubscribers() : subscription_count(0) {}
+
+void MapblockSubscribers::subscribe(MapPos<int> mb_pos, std::weak_ptr<PlayerState> player) {
+  std::unique_lock<std::mutex> l(lock);
+  if(!subscribers[mb_pos].insert(player).second) { return; }
+  subscription_count++;
+  
+  //The version the player was sent was read before they subscribed, so a change in between would otherwise be missed.
+  changed_mapblocks.insert(mb_pos);
+}
+
+void MapblockSubscribers::unsubscribe(MapPos<int> mb_pos, std::weak_ptr<PlayerState> player) {
+  std::unique_lock<std::mutex> l(lock);
+  auto search = subscribers.find(mb_pos);
+  if(search == subscribers.end()) { return; }
+  if(search->second.erase(player) == 0) { return; }
+  subscription_count--;
+  
+  if(search->second.empty()) {
+    subscribers.erase(search);
+  }
+}
+
+void MapblockSubscribers::changed(MapPos<int> mb_pos) {
+  std::unique_lock<std::mutex> l(lock);
+  //Nobody has it, so nobody needs to hear about it.
+  if(subscribers.find(mb_pos) == subscribers.end()) { return; }
+  changed_mapblocks.insert(mb_pos);
+}
+
+std::vector<std::pair<std::shared_ptr<PlayerState>, std::vector<MapPos<int>>>> MapblockSubscribers::take_changes() {
+  std::unique_lock<std::mutex> l(lock);
+  std::map<std::weak_ptr<PlayerState>, std::vector<MapPos<int>>, std::owner_less<std::weak_ptr<PlayerState>>> by_player;
+  for(const MapPos<int>& mb_pos : changed_mapblocks) {
+    auto search = subscribers.find(mb_pos);
+    if(search == subscribers.end()) { continue; } //unsubscribed since
+    
+    for(const std::weak_ptr<PlayerState>& player : search->second) {
+      by_player[player].push_back(mb_pos);
+    }
+  }
+  changed_mapblocks.clear();
+  l.unlock();
+  
+  std::vector<std::pair<std::shared_ptr<PlayerState>, std::vector<MapPos<int>>>> out;
+  for(auto& it : by_player) {
+    std::shared_ptr<PlayerState> player = it.first.lock();
+    if(!player) { continue; } //gone; nothing more to send them
+    out.push_back(std::make_pair(player, std::move(it.second)));
+  }
+  return out;
+}
+
+std::string MapblockSubscribers::stats() {
+  std::unique_lock<std::mutex> l(lock);
+  return std::to_string(subscribers.size()) + " mapblocks, " + std::to_string(subscription_count) + " subscriptions, "
+         + std::to_string(changed_mapblocks.size()) + " changed";
+}
@@ -0,0 +1,64 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MAPBLOCK_SUBSCRIBERS_H__
+#define __MAPBLOCK_SUBSCRIBERS_H__
+
+#include "vector.h"
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+class PlayerState;
+
+//Which players have which mapblocks, so that a change to a mapblock only costs anything for the players who have it.
+//Players subscribe to a mapblock when they're sent it and unsubscribe when they no longer have it (see PlayerState::set_known_mapblock),
+//and the map reports each mapblock whose update numbers change (see Map::set_change_handler).
+//Players are held by weak pointer, so one that has gone away is never mixed up with a new one at the same address.
+//Thread safe. The lock is always taken last, so this can be called with a player's lock or mapblock locks held.
+class MapblockSubscribers {
+  public:
+    MapblockSubscribers();
+    
+    void subscribe(MapPos<int> mb_pos, std::weak_ptr<PlayerState> player);
+    void unsubscribe(MapPos<int> mb_pos, std::weak_ptr<PlayerState> player);
+    
+    //Called by the map, and for a mapblock that should be checked again.
+    void changed(MapPos<int> mb_pos);
+    
+    //Mapblocks changed since the last call, for each player subscribed to them who is still around.
+    //They may have disconnected since (see PlayerState::closed).
+    std::vector<std::pair<std::shared_ptr<PlayerState>, std::vector<MapPos<int>>>> take_changes();
+    
+    //For /status
+    std::string stats();
+    
+  private:
+    typedef std::set<std::weak_ptr<PlayerState>, std::owner_less<std::weak_ptr<PlayerState>>> SubscriberSet;
+    
+    std::map<MapPos<int>, SubscriberSet> subscribers;
+    size_t subscription_count;
+    std::set<MapPos<int>> changed_mapblocks;
+    std::mutex lock;
+};
+
+#endif
@@ -21,10 +21,17 @@
 
 #include "vector.h"
 #include "mapblock.h"
+#include "config.h"
 
 #include <map>
+#include <list>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
 
 #include "lib/PerlinNoise.hpp"
+#include "noise.h"
 
 class Mapgen {
   public:
@@ -35,28 +42,134 @@ class Mapgen {
     uint32_t seed;
 };
 
+//LRU cache of generation data that's expensive to compute and needed by more than one generate_near call,
+//such as 2D (per x/z column) data or tree shapes. Shared by all generate_near calls of a mapgen.
+template<class T> class MapgenCache {
+  public:
+    MapgenCache(std::string _target_config_key) : target_config_key(_target_config_key) {}
+    
+    //Returns a copy of the data for key, calling gen(key) if it isn't cached
+    T get(MapPos<int> key, std::function<T(MapPos<int>)> gen) {
+      std::unique_lock<std::mutex> cache_l(cache_lock);
+      auto search = cache.find(key);
+      if(search != cache.end()) {
+        //Move to front of cache
+        cache_hits.erase(search->second.second);
+        typename std::list<MapPos<int>>::iterator k = cache_hits.insert(cache_hits.end(), key);
+        search->second.second = k;
+        
+        return search->second.first;
+      }
+      cache_l.unlock();
+      
+      //generate without holding the lock; if another thread got here first, its copy wins (they're identical)
+      T data = gen(key);
+      
+      cache_l.lock();
+      if(cache.find(key) == cache.end()) {
+        typename std::list<MapPos<int>>::iterator k = cache_hits.insert(cache_hits.end(), key);
+        cache.insert(std::make_pair(key, std::make_pair(data, k)));
+        
+        size_t target_cache_count = get_config<int>(target_config_key);
+        while(cache_hits.size() > target_cache_count) {
+          cache.erase(cache_hits.front());
+          cache_hits.pop_front();
+        }
+      }
+      
+      return data;
+    }
+  
+  private:
+    std::string target_config_key;
+    std::map<MapPos<int>, std::pair<T, typename std::list<MapPos<int>>::iterator>> cache;
+    std::list<MapPos<int>> cache_hits;
+    std::mutex cache_lock;
+};
+
+//Writes decorations (trees etc.) into a set of mapblocks being generated.
+//The target mapblock is found by coordinate division into a dense array covering the
+//mapblocks' bounding box, and content IDs are looked up once per mapblock.
+class DecorationWriter {
+  public:
+    DecorationWriter(std::map<MapPos<int>, Mapblock*>& mapblocks);
+    
+    //Index for an itemstring, for use with id()
+    int content(std::string itemstring);
+    
+    //Index of the mapblock containing global position (x, y, z), or -1 if it isn't one being written.
+    //rel is set to the position within that mapblock.
+    int find(int x, int y, int z, MapPos<int>& rel) const;
+    
+    uint32_t get(int block, const MapPos<int>& rel) const {
+      return blocks[block]->data[rel.x][rel.y][rel.z];
+    }
+    void set(int block, const MapPos<int>& rel, uint32_t val) {
+      blocks[block]->data[rel.x][rel.y][rel.z] = val;
+    }
+    
+    //Content ID of a content index in a mapblock, adding it to the mapblock if needed
+    unsigned int id(int block, int content);
+    bool is_flower(int block, uint32_t id);
+  
+  private:
+    MapPos<int> min_pos;
+    int size_x;
+    int size_y;
+    int size_z;
+    std::vector<Mapblock*> blocks; //nullptr where there's no mapblock
+    
+    std::vector<std::string> contents;
+    std::vector<std::vector<int>> block_ids; //[block][content], -1 if not looked up yet
+    std::vector<std::vector<int8_t>> block_flower; //[block][id], -1 if not checked yet
+};
+
 class MapgenDefault : public Mapgen {
   public:
     MapgenDefault(uint32_t _seed) : Mapgen(_seed) {};
     virtual std::map<MapPos<int>, Mapblock*> generate_near(MapPos<int> pos);
 };
 
+class TreePath;
+
+class MapgenAlphaColumn {
+  public:
+    int height[MAPBLOCK_SIZE_X][MAPBLOCK_SIZE_Z];
+    bool flower[MAPBLOCK_SIZE_X][MAPBLOCK_SIZE_Z]; //flowers/grass if there's room above the surface
+    bool tree[MAPBLOCK_SIZE_X][MAPBLOCK_SIZE_Z]; //tree root if the height is suitable
+};
+
 class MapgenAlpha : public Mapgen {
   public:
-    MapgenAlpha(uint32_t _seed) : Mapgen(_seed), perlin(_seed) {};
+    MapgenAlpha(uint32_t _seed) : Mapgen(_seed), perlin(_seed), perlin_batch(perlin), column_cache("map.column_cache_target"), tree_cache("map.tree_cache_target") {};
     virtual std::map<MapPos<int>, Mapblock*> generate_near(MapPos<int> pos);
   
   private:
+    MapgenAlphaColumn generate_column(MapPos<int> column_pos);
+    std::shared_ptr<const TreePath> generate_tree(MapPos<int> root_pos);
+    
     siv::PerlinNoise perlin;
+    PerlinNoiseBatch perlin_batch;
+    MapgenCache<MapgenAlphaColumn> column_cache;
+    MapgenCache<std::shared_ptr<const TreePath>> tree_cache;
+};
+
+class MapgenHeckColumn {
+  public:
+    int height[MAPBLOCK_SIZE_X][MAPBLOCK_SIZE_Z];
 };
 
 class MapgenHeck : public Mapgen {
   public:
-    MapgenHeck(uint32_t _seed) : Mapgen(_seed), perlin(_seed) {};
+    MapgenHeck(uint32_t _seed) : Mapgen(_seed), perlin(_seed), perlin_batch(perlin), column_cache("map.column_cache_target") {};
     virtual std::map<MapPos<int>, Mapblock*> generate_near(MapPos<int> pos);
   
   private:
+    MapgenHeckColumn generate_column(MapPos<int> column_pos);
+    
     siv::PerlinNoise perlin;
+    PerlinNoiseBatch perlin_batch;
+    MapgenCache<MapgenHeckColumn> column_cache;
 };
 
 
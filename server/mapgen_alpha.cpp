@@ -22,6 +22,8 @@
 
 #include <cmath>
 #include <math.h>
+#include <set>
+#include <tuple>
 
 #define PI 3.14159265
 
@@ -63,7 +65,7 @@ class TreeDef {
         : start(_start), rules(_rules), place_rules(_place_rules), angle(_angle)
     {}
     
-    std::string expand(unsigned int depth, uint32_t seed) {
+    std::string expand(unsigned int depth, uint32_t seed) const {
       std::mt19937 rng(seed);
       std::uniform_real_distribution<double> rng_dist;
       
@@ -109,15 +111,75 @@ class TreeGenState {
     double z;
 };
 
+//cos/sin of whole-degree angles in [-90, 450), same values as computing cos(deg*PI/180) each time
+class DegreeTrig {
+  public:
+    DegreeTrig() {
+      for(int deg = -90; deg < 450; deg++) {
+        cos_table[deg + 90] = cos(deg*PI/180);
+        sin_table[deg + 90] = sin(deg*PI/180);
+      }
+    }
+    
+    double cos_deg(int deg) const { return cos_table[deg + 90]; }
+    double sin_deg(int deg) const { return sin_table[deg + 90]; }
+  
+  private:
+    double cos_table[540];
+    double sin_table[540];
+};
+const DegreeTrig degree_trig;
+
+//One node written by a tree: a trunk replaces air, leaves, and flowers; leaves only replace air.
+class TreePathNode {
+  public:
+    TreePathNode(int _x, int _y, int _z, bool _is_trunk, int _trunk, int _leaves)
+        : x(_x), y(_y), z(_z), is_trunk(_is_trunk), trunk(_trunk), leaves(_leaves) {}
+    
+    int x;
+    int y;
+    int z;
+    bool is_trunk;
+    int trunk; //index into TreePath::itemstrings
+    int leaves; //index into TreePath::itemstrings, "air" for trunks without leaves
+};
+
+//The nodes a tree writes, in order, in global coordinates.
+//Depends only on the tree's root position, so it's cached and reused by every
+//generate_near call that the tree reaches into.
+class TreePath {
+  public:
+    TreePath() : itemstrings({"air"}) {}
+    
+    int content(std::string itemstring) {
+      for(size_t i = 0; i < itemstrings.size(); i++) {
+        if(itemstrings[i] == itemstring) {
+          return i;
+        }
+      }
+      itemstrings.push_back(itemstring);
+      return itemstrings.size() - 1;
+    }
+    
+    std::vector<std::string> itemstrings; //[0] is air
+    std::vector<TreePathNode> nodes;
+};
+
 class TreeGenerator {
   public:
-    TreeGenerator(MapPos<int> _root_pos, uint32_t _seed, TreeDef _def)
+    TreeGenerator(MapPos<int> _root_pos, uint32_t _seed, const TreeDef& _def)
         : root_pos(_root_pos), seed(_seed), def(_def)
     {
       actions = def.expand(TREE_ITERATION_DEPTH, seed);
     }
     
-    void write_to_mapblocks(std::map<MapPos<int>, Mapblock*>& mapblocks) {
+    //Runs the turtle, recording the nodes that would be written.
+    //A leaf write to a position already written with the same leaves is dropped:
+    //it could only ever replace air, and there can't be air there anymore.
+    TreePath generate_path() {
+      TreePath path;
+      std::set<std::tuple<int, int, int, int>> written;
+      
       TreeGenState s(root_pos.x, root_pos.y, root_pos.z);
       
       std::mt19937 rng(seed);
@@ -187,9 +249,9 @@ class TreeGenerator {
         
         if(do_move) {
           //https://learnopengl.com/Getting-started/Camera
-          move_x = cos(s.yaw*PI/180) * cos(s.pitch*PI/180);
-          move_y = sin(s.pitch*PI/180);
-          move_z = sin(s.yaw*PI/180) * cos(s.pitch*PI/180);
+          move_x = degree_trig.cos_deg(s.yaw) * degree_trig.cos_deg(s.pitch);
+          move_y = degree_trig.sin_deg(s.pitch);
+          move_z = degree_trig.sin_deg(s.yaw) * degree_trig.cos_deg(s.pitch);
           s.x += move_x;
           s.y += move_y;
           s.z += move_z;
@@ -198,15 +260,13 @@ class TreeGenerator {
         if(to_place.trunk != "") {
           //place the requested node
           
-          std::string air_is = "air";
-          
-          std::string trunk_is = to_place.trunk;
-          std::string leaf_is = air_is;
+          int trunk = path.content(to_place.trunk);
+          int leaves = 0;
           Vector3<double> leaf_amount(0, 0, 0);
           Vector3<double> leaf_fuzz(0, 0, 0);
           bool has_leaves = false;
           if(to_place.leaves != "") {
-            leaf_is = to_place.leaves;
+            leaves = path.content(to_place.leaves);
             leaf_amount = to_place.leaf_amount;
             leaf_fuzz = to_place.leaf_fuzz;
             has_leaves = true;
@@ -222,35 +282,19 @@ class TreeGenerator {
             int place_z = round(old_z + move_z * prop);
             if(place_x == new_x && place_y == new_y && place_z == new_z) { continue; }
             
-            for(auto it : mapblocks) {
-              Mapblock *mb = it.second;
-              MapPos<int> lower(it.first.x * MAPBLOCK_SIZE_X, it.first.y * MAPBLOCK_SIZE_Y, it.first.z * MAPBLOCK_SIZE_Z, it.first.w, it.first.world, it.first.universe);
-              MapPos<int> upper(lower.x + MAPBLOCK_SIZE_X, lower.y + MAPBLOCK_SIZE_Y, lower.z + MAPBLOCK_SIZE_Z, lower.w, lower.world, lower.universe);
-              if(place_x >= lower.x && place_x < upper.x &&
-                 place_y >= lower.y && place_y < upper.y &&
-                 place_z >= lower.z && place_z < upper.z) {
-                unsigned int air_id = mb->itemstring_to_id(air_is);
-                unsigned int trunk_id = mb->itemstring_to_id(trunk_is);
-                unsigned int leaf_id = mb->itemstring_to_id(leaf_is);
-                unsigned int old_id = mb->data[place_x - lower.x][place_y - lower.y][place_z - lower.z];
-                std::string old_is = mb->id_to_itemstring(old_id);
-                if(old_id == air_id || old_id == leaf_id || old_is.rfind("flowers:", 0) == 0) {
-                  mb->data[place_x - lower.x][place_y - lower.y][place_z - lower.z] = trunk_id;
-                }
-                break;
-              }
-            }
+            path.nodes.push_back(TreePathNode(place_x, place_y, place_z, true, trunk, leaves));
+            written.insert(std::make_tuple(place_x, place_y, place_z, leaves));
             
             if(has_leaves) {
-              Vector3<double> x_vec(cos(s.yaw*PI/180) * cos((s.pitch - 90)*PI/180),
-                                    sin((s.pitch - 90)*PI/180),
-                                    sin(s.yaw*PI/180) * cos((s.pitch - 90)*PI/180));
-              Vector3<double> y_vec(cos(s.yaw*PI/180) * cos(s.pitch*PI/180),
-                                    sin(s.pitch*PI/180),
-                                    sin(s.yaw*PI/180) * cos(s.pitch*PI/180));
-              Vector3<double> z_vec(cos((s.yaw + 90)*PI/180) * cos((s.pitch - 90)*PI/180),
-                                    sin((s.pitch - 90)*PI/180),
-                                    sin((s.yaw + 90)*PI/180) * cos((s.pitch - 90)*PI/180));
+              Vector3<double> x_vec(degree_trig.cos_deg(s.yaw) * degree_trig.cos_deg(s.pitch - 90),
+                                    degree_trig.sin_deg(s.pitch - 90),
+                                    degree_trig.sin_deg(s.yaw) * degree_trig.cos_deg(s.pitch - 90));
+              Vector3<double> y_vec(degree_trig.cos_deg(s.yaw) * degree_trig.cos_deg(s.pitch),
+                                    degree_trig.sin_deg(s.pitch),
+                                    degree_trig.sin_deg(s.yaw) * degree_trig.cos_deg(s.pitch));
+              Vector3<double> z_vec(degree_trig.cos_deg(s.yaw + 90) * degree_trig.cos_deg(s.pitch - 90),
+                                    degree_trig.sin_deg(s.pitch - 90),
+                                    degree_trig.sin_deg(s.yaw + 90) * degree_trig.cos_deg(s.pitch - 90));
               
               double fuzz[6];
               for(int i = 0; i < 6; i += 3) {
@@ -269,20 +313,8 @@ class TreeGenerator {
                     int y = round(place_y + x_vec.y*x_delta*x_fuzz + y_vec.y*y_delta*y_fuzz + z_vec.y*z_delta*z_fuzz);
                     int z = round(place_z + x_vec.z*x_delta*x_fuzz + y_vec.z*y_delta*y_fuzz + z_vec.z*z_delta*z_fuzz);
                     
-                    for(auto it : mapblocks) {
-                      Mapblock *mb = it.second;
-                      MapPos<int> lower(it.first.x * MAPBLOCK_SIZE_X, it.first.y * MAPBLOCK_SIZE_Y, it.first.z * MAPBLOCK_SIZE_Z, it.first.w, it.first.world, it.first.universe);
-                      MapPos<int> upper(lower.x + MAPBLOCK_SIZE_X, lower.y + MAPBLOCK_SIZE_Y, lower.z + MAPBLOCK_SIZE_Z, lower.w, lower.world, lower.universe);
-                      if(x >= lower.x && x < upper.x &&
-                         y >= lower.y && y < upper.y &&
-                         z >= lower.z && z < upper.z) {
-                        unsigned int air_id = mb->itemstring_to_id(air_is);
-                        unsigned int leaf_id = mb->itemstring_to_id(leaf_is);
-                        if(mb->data[x - lower.x][y - lower.y][z - lower.z] == air_id) {
-                          mb->data[x - lower.x][y - lower.y][z - lower.z] = leaf_id;
-                        }
-                        break;
-                      }
+                    if(written.insert(std::make_tuple(x, y, z, leaves)).second) {
+                      path.nodes.push_back(TreePathNode(x, y, z, false, leaves, leaves));
                     }
                   }
                 }
@@ -291,15 +323,48 @@ class TreeGenerator {
           }
         }
       }
+      
+      return path;
     }
   
   private:
     MapPos<int> root_pos;
     uint32_t seed;
-    TreeDef def;
+    const TreeDef& def;
     std::string actions;
 };
 
+void write_tree(DecorationWriter& writer, const TreePath& path) {
+  std::vector<int> contents;
+  for(const auto& itemstring : path.itemstrings) {
+    contents.push_back(writer.content(itemstring));
+  }
+  int air = contents[0];
+  
+  //IDs are looked up in the same order as they always have been, so mapblock ID tables come out the same
+  for(const auto& node : path.nodes) {
+    MapPos<int> rel;
+    int block = writer.find(node.x, node.y, node.z, rel);
+    if(block == -1) { continue; }
+    
+    if(node.is_trunk) {
+      unsigned int air_id = writer.id(block, air);
+      unsigned int trunk_id = writer.id(block, contents[node.trunk]);
+      unsigned int leaf_id = writer.id(block, contents[node.leaves]);
+      uint32_t old_id = writer.get(block, rel);
+      if(old_id == air_id || old_id == leaf_id || writer.is_flower(block, old_id)) {
+        writer.set(block, rel, trunk_id);
+      }
+    } else {
+      unsigned int air_id = writer.id(block, air);
+      unsigned int leaf_id = writer.id(block, contents[node.leaves]);
+      if(writer.get(block, rel) == air_id) {
+        writer.set(block, rel, leaf_id);
+      }
+    }
+  }
+}
+
 TreeDef tree_regular("TTTT&A+B+A+A+B+A",
       {
         {'A', std::make_pair(0.5, "[LLL]")},
@@ -336,6 +401,57 @@ class OreSpec {
     int min_depth;
 };
 
+std::shared_ptr<const TreePath> MapgenAlpha::generate_tree(MapPos<int> t) {
+  double num = (t.x % 2345) * 312.32 + (t.z % 690) * 123.45 + (t.w % 53) * 234.67;
+  double n = num - (long)num; //[0, 1)
+  if(n < 0) { n += 1; }
+  
+  const TreeDef& def = (n < 0.3) ? tree_aspen : ((n < 0.5) ? tree_pine : tree_regular);
+  TreeGenerator gen(t, t.x * 3897 + t.z + t.w * 42, def);
+  return std::make_shared<const TreePath>(gen.generate_path());
+}
+
+MapgenAlphaColumn MapgenAlpha::generate_column(MapPos<int> column_pos) {
+  MapgenAlphaColumn col;
+  int global_x = column_pos.x * MAPBLOCK_SIZE_X;
+  int global_z = column_pos.z * MAPBLOCK_SIZE_Z;
+  int w = column_pos.w;
+  
+  const int count = MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Z;
+  double height_noise[count];
+  perlin_batch.octave_noise_3d_grid(global_x, global_z, MAPBLOCK_SIZE_X, MAPBLOCK_SIZE_Z, 500.0, w, 300.0, 6, height_noise);
+  
+  double nx[count], nz[count], nw[count];
+  double flower_noise[count];
+  double tree_noise[count];
+  for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+    for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+      nx[x * MAPBLOCK_SIZE_Z + z] = (x + global_x) / 2.0;
+      nz[x * MAPBLOCK_SIZE_Z + z] = (z + global_z) / 2.0;
+      nw[x * MAPBLOCK_SIZE_Z + z] = w / 2.0;
+    }
+  }
+  perlin_batch.noise_3d(nx, nz, nw, count, flower_noise);
+  for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+    for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+      nx[x * MAPBLOCK_SIZE_Z + z] = (x + global_x) / 1.5;
+      nz[x * MAPBLOCK_SIZE_Z + z] = (z + global_z) / 1.5;
+      nw[x * MAPBLOCK_SIZE_Z + z] = w / 1.5;
+    }
+  }
+  perlin_batch.noise_3d(nx, nz, nw, count, tree_noise);
+  
+  for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+    for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+      col.height[x][z] = std::floor(height_noise[x * MAPBLOCK_SIZE_Z + z] * 50);
+      col.flower[x][z] = flower_noise[x * MAPBLOCK_SIZE_Z + z] > 0.4;
+      col.tree[x][z] = tree_noise[x * MAPBLOCK_SIZE_Z + z] > 0.7;
+    }
+  }
+  
+  return col;
+}
+
 std::map<MapPos<int>, Mapblock*> MapgenAlpha::generate_near(MapPos<int> pos) {
   int water_depth = get_config<int>("map.water_depth");
   int sand_depth = get_config<int>("map.sand_depth");
@@ -381,18 +497,12 @@ std::map<MapPos<int>, Mapblock*> MapgenAlpha::generate_near(MapPos<int> pos) {
     flower_total += it.second;
   }
   
-  int height_map[MAPBLOCK_SIZE_X][MAPBLOCK_SIZE_Z];
-  for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
-    for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
-      double val = perlin.accumulatedOctaveNoise3D((x + global_offset.x) / 500.0, (z + global_offset.z) / 500.0, global_offset.w / 300.0, 6);
-      int height = std::floor(val * 50);
-      height_map[x][z] = height;
-    }
-  }
+  auto gen = std::bind(&MapgenAlpha::generate_column, this, std::placeholders::_1);
+  MapgenAlphaColumn col = column_cache.get(MapPos<int>(pos.x, 0, pos.z, pos.w, pos.world, pos.universe), gen);
   
   for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
     for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
-      int height = height_map[x][z];
+      int height = col.height[x][z];
       for(int mb_y = start_y; mb_y < end_y; mb_y++) {
         MapPos<int> where(pos.x, mb_y, pos.z, pos.w, pos.world, pos.universe);
         if(height >= where.y * MAPBLOCK_SIZE_Y || where.y * MAPBLOCK_SIZE_Y < water_depth) {
@@ -422,8 +532,7 @@ std::map<MapPos<int>, Mapblock*> MapgenAlpha::generate_near(MapPos<int> pos) {
                 mb->data[x][y][z] = water_id;
               } else if(global_y == height + 1 && global_y > sand_depth) {
                 //possibly flowers/grass, otherwise air
-                double flowerNoise = perlin.noise3D((x + global_offset.x) / 2.0, (z + global_offset.z) / 2.0, global_offset.w / 2.0);
-                if(flowerNoise > 0.4) {
+                if(col.flower[x][z]) {
                   double n = rng_dist(rng);
                   n *= flower_total;
                   
@@ -492,27 +601,36 @@ std::map<MapPos<int>, Mapblock*> MapgenAlpha::generate_near(MapPos<int> pos) {
   if(end_y * MAPBLOCK_SIZE_Y > -100 && global_offset.y < 100) {
     //trees
     
-    std::vector<MapPos<int>> tree_list;
+    //trees can spread in from neighbouring columns, up to one column away
     MapPos<int> max_tree_spread_down(12, 1, 12, 0, 0, 0);
     MapPos<int> max_tree_spread_up(12, 20, 12, 0, 0, 0);
+    
+    std::vector<MapPos<int>> tree_list;
     for(int w = global_offset.w - max_tree_spread_down.w; w <= global_offset.w + max_tree_spread_up.w; w++) {
-      for(int x = global_offset.x - max_tree_spread_down.x; x < global_offset.x + MAPBLOCK_SIZE_X + max_tree_spread_up.x; x++) {
-        for(int z = global_offset.z - max_tree_spread_down.z; z < global_offset.z + MAPBLOCK_SIZE_Z + max_tree_spread_up.z; z++) {
-          int height;
-          if(w == global_offset.w && x >= global_offset.x && x < global_offset.x + MAPBLOCK_SIZE_X && z >= global_offset.z && z < global_offset.z + MAPBLOCK_SIZE_Z) {
-            height = height_map[x - global_offset.x][z - global_offset.z];
+      MapgenAlphaColumn neighbors[3][3];
+      for(int cx = 0; cx < 3; cx++) {
+        for(int cz = 0; cz < 3; cz++) {
+          if(cx == 1 && cz == 1 && w == global_offset.w) {
+            neighbors[cx][cz] = col;
           } else {
-            double val = perlin.accumulatedOctaveNoise3D(x / 500.0, z / 500.0, w / 300.0, 6);
-            height = std::floor(val * 50);
+            neighbors[cx][cz] = column_cache.get(MapPos<int>(pos.x + cx - 1, 0, pos.z + cz - 1, w, pos.world, pos.universe), gen);
           }
+        }
+      }
+      
+      for(int x = global_offset.x - max_tree_spread_down.x; x < global_offset.x + MAPBLOCK_SIZE_X + max_tree_spread_up.x; x++) {
+        for(int z = global_offset.z - max_tree_spread_down.z; z < global_offset.z + MAPBLOCK_SIZE_Z + max_tree_spread_up.z; z++) {
+          int rel_x = x - global_offset.x + MAPBLOCK_SIZE_X;
+          int rel_z = z - global_offset.z + MAPBLOCK_SIZE_Z;
+          const MapgenAlphaColumn& n = neighbors[rel_x / MAPBLOCK_SIZE_X][rel_z / MAPBLOCK_SIZE_Z];
+          int height = n.height[rel_x % MAPBLOCK_SIZE_X][rel_z % MAPBLOCK_SIZE_Z];
           
           //no trees below shoreline
           if(height <= sand_depth) { continue; }
           
           if(height < global_offset.y - max_tree_spread_up.y || height > end_y * MAPBLOCK_SIZE_Y + MAPBLOCK_SIZE_Y + max_tree_spread_down.y) { continue; }
           
-          double treeNoise = perlin.noise3D(x / 1.5, z / 1.5, w / 1.5);
-          if(treeNoise > 0.7) {
+          if(n.tree[rel_x % MAPBLOCK_SIZE_X][rel_z % MAPBLOCK_SIZE_Z]) {
             tree_list.push_back(MapPos<int>(x, height + 1, z, w, global_offset.world, global_offset.universe));
           }
         }
@@ -521,24 +639,13 @@ std::map<MapPos<int>, Mapblock*> MapgenAlpha::generate_near(MapPos<int> pos) {
     
     
     
+    DecorationWriter writer(to_generate);
+    auto gen_tree = std::bind(&MapgenAlpha::generate_tree, this, std::placeholders::_1);
     for(size_t i = 0; i < tree_list.size(); i++) {
       MapPos t = tree_list[i];
       if(t.w != global_offset.w) { continue; }
       
-      double num = (t.x % 2345) * 312.32 + (t.z % 690) * 123.45 + (t.w % 53) * 234.67;
-      double n = num - (long)num; //[0, 1)
-      if(n < 0) { n += 1; }
-      
-      if(n < 0.3) {
-        TreeGenerator gen(t, t.x * 3897 + t.z + t.w * 42, tree_aspen);
-        gen.write_to_mapblocks(to_generate);
-      } else if(n < 0.5) {
-        TreeGenerator gen(t, t.x * 3897 + t.z + t.w * 42, tree_pine);
-        gen.write_to_mapblocks(to_generate);
-      } else {
-        TreeGenerator gen(t, t.x * 3897 + t.z + t.w * 42, tree_regular);
-        gen.write_to_mapblocks(to_generate);
-      }
+      write_tree(writer, *tree_cache.get(t, gen_tree));
     }
   }
   
@@ -0,0 +1,96 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mapgen.h"
+
+DecorationWriter::DecorationWriter(std::map<MapPos<int>, Mapblock*>& mapblocks) : size_x(0), size_y(0), size_z(0) {
+  if(mapblocks.empty()) { return; }
+  
+  //bounding box; all of the mapblocks are in the same w/world/universe
+  min_pos = mapblocks.begin()->first;
+  MapPos<int> max_pos = min_pos;
+  for(auto it : mapblocks) {
+    min_pos = MapPos<int>(std::min(min_pos.x, it.first.x), std::min(min_pos.y, it.first.y), std::min(min_pos.z, it.first.z), min_pos.w, min_pos.world, min_pos.universe);
+    max_pos = MapPos<int>(std::max(max_pos.x, it.first.x), std::max(max_pos.y, it.first.y), std::max(max_pos.z, it.first.z), max_pos.w, max_pos.world, max_pos.universe);
+  }
+  size_x = max_pos.x - min_pos.x + 1;
+  size_y = max_pos.y - min_pos.y + 1;
+  size_z = max_pos.z - min_pos.z + 1;
+  
+  blocks.resize(size_x * size_y * size_z, nullptr);
+  for(auto it : mapblocks) {
+    blocks[((it.first.x - min_pos.x) * size_y + (it.first.y - min_pos.y)) * size_z + (it.first.z - min_pos.z)] = it.second;
+  }
+  block_ids.resize(blocks.size());
+  block_flower.resize(blocks.size());
+}
+
+int DecorationWriter::content(std::string itemstring) {
+  for(size_t i = 0; i < contents.size(); i++) {
+    if(contents[i] == itemstring) {
+      return i;
+    }
+  }
+  contents.push_back(itemstring);
+  return contents.size() - 1;
+}
+
+int DecorationWriter::find(int x, int y, int z, MapPos<int>& rel) const {
+  MapPos<int> global(x, y, z, 0, 0, 0);
+  MapPos<int> mb_pos = global_to_mapblock(global);
+  int ix = mb_pos.x - min_pos.x;
+  int iy = mb_pos.y - min_pos.y;
+  int iz = mb_pos.z - min_pos.z;
+  if(ix < 0 || ix >= size_x || iy < 0 || iy >= size_y || iz < 0 || iz >= size_z) {
+    return -1;
+  }
+  
+  int index = (ix * size_y + iy) * size_z + iz;
+  if(blocks[index] == nullptr) {
+    return -1;
+  }
+  
+  rel = global_to_relative(global);
+  return index;
+}
+
+unsigned int DecorationWriter::id(int block, int content) {
+  std::vector<int>& ids = block_ids[block];
+  if((size_t) content >= ids.size()) {
+    ids.resize(contents.size(), -1);
+  }
+  if(ids[content] == -1) {
+    ids[content] = blocks[block]->itemstring_to_id(contents[content]);
+  }
+  return ids[content];
+}
+
+bool DecorationWriter::is_flower(int block, uint32_t id) {
+  if(id >= blocks[block]->IDtoIS.size()) {
+    return false;
+  }
+  
+  std::vector<int8_t>& flower = block_flower[block];
+  if(id >= flower.size()) {
+    flower.resize(id + 1, -1);
+  }
+  if(flower[id] == -1) {
+    flower[id] = blocks[block]->id_to_itemstring(id).rfind("flowers:", 0) == 0;
+  }
+  return flower[id];
+}
@@ -19,6 +19,23 @@
 #include "mapgen.h"
 #include "log.h"
 
+#include <cmath>
+
+MapgenHeckColumn MapgenHeck::generate_column(MapPos<int> column_pos) {
+  MapgenHeckColumn col;
+  
+  double noise[MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Z];
+  perlin_batch.octave_noise_3d_grid(column_pos.x * MAPBLOCK_SIZE_X, column_pos.z * MAPBLOCK_SIZE_Z, MAPBLOCK_SIZE_X, MAPBLOCK_SIZE_Z, 50.0, column_pos.w, 30.0, 3, noise);
+  
+  for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
+    for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
+      col.height[x][z] = std::floor(noise[x * MAPBLOCK_SIZE_Z + z] * 50);
+    }
+  }
+  
+  return col;
+}
+
 std::map<MapPos<int>, Mapblock*> MapgenHeck::generate_near(MapPos<int> pos) {
   Mapblock *mb = new Mapblock(pos);
   MapPos<int> global_offset = MapPos<int>(pos.x * MAPBLOCK_SIZE_X, pos.y * MAPBLOCK_SIZE_Y, pos.z * MAPBLOCK_SIZE_Z, pos.w, pos.world, pos.universe);
@@ -26,11 +43,11 @@ std::map<MapPos<int>, Mapblock*> MapgenHeck::generate_near(MapPos<int> pos) {
   unsigned int brick_id = mb->itemstring_to_id("default:brick");
   unsigned int iron_block_id = mb->itemstring_to_id("default:iron_block");
   
+  MapgenHeckColumn col = column_cache.get(MapPos<int>(pos.x, 0, pos.z, pos.w, pos.world, pos.universe), std::bind(&MapgenHeck::generate_column, this, std::placeholders::_1));
+  
   for(int x = 0; x < MAPBLOCK_SIZE_X; x++) {
     for(int z = 0; z < MAPBLOCK_SIZE_Z; z++) {
-      double val = perlin.accumulatedOctaveNoise3D((x + global_offset.x) / 50.0, (z + global_offset.z) / 50.0, global_offset.w / 30.0, 3);
-      
-      int height = std::floor(val * 50);
+      int height = col.height[x][z];
       height -= global_offset.y;
       
       if(height >= 0) {
@@ -0,0 +1,62 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "message_binary.h"
+
+#include <cstring>
+
+//The values are copied out with memcpy, as they may not be aligned.
+//Like the mapblock messages the server sends, this assumes a little-endian machine.
+void BinaryMessageReader::read_raw(void *out, size_t count) {
+  if(count > len - cursor) {
+    throw BinaryMessageError("message too short (" + std::to_string(len) + " bytes)");
+  }
+  std::memcpy(out, data + cursor, count);
+  cursor += count;
+}
+
+uint16_t BinaryMessageReader::read_u16() {
+  uint16_t val;
+  read_raw(&val, sizeof(val));
+  return val;
+}
+uint32_t BinaryMessageReader::read_u32() {
+  uint32_t val;
+  read_raw(&val, sizeof(val));
+  return val;
+}
+int32_t BinaryMessageReader::read_i32() {
+  int32_t val;
+  read_raw(&val, sizeof(val));
+  return val;
+}
+double BinaryMessageReader::read_f64() {
+  double val;
+  read_raw(&val, sizeof(val));
+  return val;
+}
+
+std::string BinaryMessageReader::read_string() {
+  uint32_t str_len = read_u32();
+  if(str_len > len - cursor) {
+    throw BinaryMessageError("string too long (" + std::to_string(str_len) + " bytes)");
+  }
+  std::string str(data + cursor, str_len);
+  cursor += str_len;
+  return str;
+}
@@ -0,0 +1,91 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MESSAGE_BINARY_H__
+#define __MESSAGE_BINARY_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+
+//Binary encoding for the most frequent messages from the client, which would otherwise be JSON.
+//The server announces the newest version it understands with a 'binary_protocol' message once a player is logged in;
+//clients that understand it send these messages as binary frames from then on. JSON is always still accepted.
+//
+//All values are little-endian. Every message starts with:
+//0   Magic number (uint32_t)
+//4   Version (uint16_t)
+//6   Type (uint16_t)
+//
+//set_player_pos:
+//8   pos.x, pos.y, pos.z (3 * double)
+//32  pos.w (int32_t)
+//36  vel.x, vel.y, vel.z (3 * double)
+//60  rot.x, rot.y, rot.z, rot.w (4 * double)
+//
+//req_mapblock:
+//8   pos.x, pos.y, pos.z, pos.w (4 * int32_t)
+//
+//req_mapblocks (version 2+), answered with a single frame holding all of the mapblocks that have changed:
+//8   count (uint32_t)
+//12  for each mapblock:
+//      pos.x, pos.y, pos.z, pos.w (4 * int32_t)
+//      updateNum, lightUpdateNum of the version the client already has, or 0xFFFFFFFF for none (2 * uint32_t)
+//
+//dig_node (node is the one expected to be there) and place_node (node is the one to place):
+//8   pos.x, pos.y, pos.z, pos.w, pos.world, pos.universe (6 * int32_t)
+//32  wield (int32_t)
+//36  node rot (uint32_t)
+//40  node itemstring length (uint32_t)
+//44  node itemstring (utf-8 chars)
+
+#define BINARY_MESSAGE_MAGIC 0x4D433442
+#define BINARY_MESSAGE_VERSION 2
+#define BINARY_MESSAGE_UNKNOWN_VERSION 0xFFFFFFFF
+
+enum class BinaryMessageType : uint16_t {SET_PLAYER_POS = 1, REQ_MAPBLOCK = 2, DIG_NODE = 3, PLACE_NODE = 4, REQ_MAPBLOCKS = 5};
+
+class BinaryMessageError : public std::runtime_error {
+  public:
+    BinaryMessageError(std::string msg) : runtime_error(msg.c_str()) {}
+};
+
+//Reads values in order directly out of a message payload, without copying it.
+//Throws BinaryMessageError when reading past the end.
+class BinaryMessageReader {
+  public:
+    BinaryMessageReader(const std::string& payload) : data(payload.data()), len(payload.size()), cursor(0) {}
+    
+    uint16_t read_u16();
+    uint32_t read_u32();
+    int32_t read_i32();
+    double read_f64();
+    std::string read_string();
+    
+    bool at_end() const { return cursor == len; }
+    
+  private:
+    void read_raw(void *out, size_t count);
+    
+    const char *data;
+    size_t len;
+    size_t cursor;
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "noise.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+//Samples are processed in chunks of this many; must be a multiple of the SIMD width.
+#define NOISE_CHUNK 64
+
+namespace {
+  //Each backend provides a vector of doubles and the few operations the kernel needs.
+  //floor() must match std::floor exactly (including the sign of zero), and grad() must
+  //match siv::BasicPerlinNoise::Grad exactly; negation is done by flipping the sign bit.
+
+  struct ScalarOps {
+    typedef double vd;
+    static const int lanes = 1;
+    static vd load(const double *a) { return *a; }
+    static void store(double *a, vd v) { *a = v; }
+    static vd set1(double d) { return d; }
+    static vd add(vd a, vd b) { return a + b; }
+    static vd sub(vd a, vd b) { return a - b; }
+    static vd mul(vd a, vd b) { return a * b; }
+    static vd floor(vd a) { return std::floor(a); }
+    static void store_int(int32_t *a, vd v) { *a = static_cast<int32_t>(v); }
+    static vd grad(const int32_t *hash, vd x, vd y, vd z) {
+      const int32_t h = *hash;
+      const double u = h < 8 ? x : y;
+      const double v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+      return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+    }
+  };
+
+#if defined(__AVX2__)
+  struct SimdOps {
+    typedef __m256d vd;
+    static const int lanes = 4;
+    static vd load(const double *a) { return _mm256_loadu_pd(a); }
+    static void store(double *a, vd v) { _mm256_storeu_pd(a, v); }
+    static vd set1(double d) { return _mm256_set1_pd(d); }
+    static vd add(vd a, vd b) { return _mm256_add_pd(a, b); }
+    static vd sub(vd a, vd b) { return _mm256_sub_pd(a, b); }
+    static vd mul(vd a, vd b) { return _mm256_mul_pd(a, b); }
+    static vd floor(vd a) { return _mm256_floor_pd(a); }
+    static void store_int(int32_t *a, vd v) { _mm_storeu_si128((__m128i*) a, _mm256_cvttpd_epi32(v)); }
+    static vd grad(const int32_t *hash, vd x, vd y, vd z) {
+      __m256i h = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) hash));
+      __m256i sign_bit = _mm256_set1_epi64x(INT64_MIN);
+      vd lt8 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(8), h));
+      vd lt4 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(4), h));
+      vd v_is_x = _mm256_castsi256_pd(_mm256_or_si256(_mm256_cmpeq_epi64(h, _mm256_set1_epi64x(12)),
+                                                      _mm256_cmpeq_epi64(h, _mm256_set1_epi64x(14))));
+      vd neg_u = _mm256_castsi256_pd(_mm256_slli_epi64(h, 63));
+      vd neg_v = _mm256_castsi256_pd(_mm256_and_si256(_mm256_slli_epi64(h, 62), sign_bit));
+
+      vd u = _mm256_blendv_pd(y, x, lt8);
+      vd v = _mm256_blendv_pd(_mm256_blendv_pd(z, x, v_is_x), y, lt4);
+      return _mm256_add_pd(_mm256_xor_pd(u, neg_u), _mm256_xor_pd(v, neg_v));
+    }
+  };
+  #define NOISE_SIMD_NAME "AVX2"
+#elif defined(__SSE2__)
+  struct SimdOps {
+    typedef __m128d vd;
+    static const int lanes = 2;
+    static vd load(const double *a) { return _mm_loadu_pd(a); }
+    static void store(double *a, vd v) { _mm_storeu_pd(a, v); }
+    static vd set1(double d) { return _mm_set1_pd(d); }
+    static vd add(vd a, vd b) { return _mm_add_pd(a, b); }
+    static vd sub(vd a, vd b) { return _mm_sub_pd(a, b); }
+    static vd mul(vd a, vd b) { return _mm_mul_pd(a, b); }
+    static vd select(vd mask, vd a, vd b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+    static vd floor(vd a) {
+      //no roundpd before SSE4.1: round |a| to nearest with the 2^52 trick, put the sign back,
+      //then step down where that rounded up. Values >= 2^52 are already integers.
+      const vd sign_bit = _mm_set1_pd(-0.0);
+      const vd two52 = _mm_set1_pd(4503599627370496.0);
+      vd abs = _mm_andnot_pd(sign_bit, a);
+      vd r = _mm_or_pd(_mm_sub_pd(_mm_add_pd(abs, two52), two52), _mm_and_pd(a, sign_bit));
+      r = _mm_sub_pd(r, _mm_and_pd(_mm_cmpgt_pd(r, a), _mm_set1_pd(1)));
+      return select(_mm_cmplt_pd(abs, two52), r, a);
+    }
+    static void store_int(int32_t *a, vd v) { _mm_storel_epi64((__m128i*) a, _mm_cvttpd_epi32(v)); }
+    static vd grad(const int32_t *hash, vd x, vd y, vd z) {
+      //no 64-bit compares in SSE2, so put the hash in both halves of each lane and use 32-bit ones
+      __m128i h = _mm_loadl_epi64((const __m128i*) hash);
+      h = _mm_unpacklo_epi32(h, h);
+      __m128i sign_bit = _mm_set1_epi64x(INT64_MIN);
+      vd lt8 = _mm_castsi128_pd(_mm_cmpgt_epi32(_mm_set1_epi32(8), h));
+      vd lt4 = _mm_castsi128_pd(_mm_cmpgt_epi32(_mm_set1_epi32(4), h));
+      vd v_is_x = _mm_castsi128_pd(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+                                                _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+      vd neg_u = _mm_castsi128_pd(_mm_slli_epi64(h, 63));
+      vd neg_v = _mm_castsi128_pd(_mm_and_si128(_mm_slli_epi64(h, 62), sign_bit));
+
+      vd u = select(lt8, x, y);
+      vd v = select(lt4, y, select(v_is_x, x, z));
+      return _mm_add_pd(_mm_xor_pd(u, neg_u), _mm_xor_pd(v, neg_v));
+    }
+  };
+  #define NOISE_SIMD_NAME "SSE2"
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  struct SimdOps {
+    typedef float64x2_t vd;
+    static const int lanes = 2;
+    static vd load(const double *a) { return vld1q_f64(a); }
+    static void store(double *a, vd v) { vst1q_f64(a, v); }
+    static vd set1(double d) { return vdupq_n_f64(d); }
+    static vd add(vd a, vd b) { return vaddq_f64(a, b); }
+    static vd sub(vd a, vd b) { return vsubq_f64(a, b); }
+    static vd mul(vd a, vd b) { return vmulq_f64(a, b); }
+    static vd floor(vd a) { return vrndmq_f64(a); }
+    static void store_int(int32_t *a, vd v) { vst1_s32(a, vmovn_s64(vcvtq_s64_f64(v))); }
+    static vd grad(const int32_t *hash, vd x, vd y, vd z) {
+      int64x2_t h = vmovl_s32(vld1_s32(hash));
+      uint64x2_t lt8 = vcltq_s64(h, vdupq_n_s64(8));
+      uint64x2_t lt4 = vcltq_s64(h, vdupq_n_s64(4));
+      uint64x2_t v_is_x = vorrq_u64(vceqq_s64(h, vdupq_n_s64(12)), vceqq_s64(h, vdupq_n_s64(14)));
+      uint64x2_t neg_u = vshlq_n_u64(vreinterpretq_u64_s64(h), 63);
+      uint64x2_t neg_v = vandq_u64(vshlq_n_u64(vreinterpretq_u64_s64(h), 62), vdupq_n_u64(1ULL << 63));
+
+      vd u = vbslq_f64(lt8, x, y);
+      vd v = vbslq_f64(lt4, y, vbslq_f64(v_is_x, x, z));
+      return vaddq_f64(vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(u), neg_u)),
+                       vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(v), neg_v)));
+    }
+  };
+  #define NOISE_SIMD_NAME "NEON"
+#else
+  typedef ScalarOps SimdOps;
+  #define NOISE_SIMD_NAME "scalar"
+#endif
+
+  template<class V> inline typename V::vd fade(typename V::vd t) {
+    //t * t * t * (t * (t * 6 - 15) + 10)
+    return V::mul(V::mul(V::mul(t, t), t),
+                  V::add(V::mul(t, V::sub(V::mul(t, V::set1(6)), V::set1(15))), V::set1(10)));
+  }
+
+  template<class V> inline typename V::vd lerp(typename V::vd t, typename V::vd a, typename V::vd b) {
+    return V::add(a, V::mul(t, V::sub(b, a)));
+  }
+
+  //Same computation as siv::BasicPerlinNoise::noise3D, split into three passes:
+  //lattice cell + fractional position (SIMD), permutation table lookups (scalar),
+  //then gradients and interpolation (SIMD).
+  //x, y, z, and out must have room for count rounded up to a multiple of V::lanes; count <= NOISE_CHUNK.
+  template<class V> void noise_3d_chunk(const uint8_t *p, const double *x, const double *y, const double *z, int count, double *out) {
+    typedef typename V::vd vd;
+
+    double fx[NOISE_CHUNK];
+    double fy[NOISE_CHUNK];
+    double fz[NOISE_CHUNK];
+    int32_t cell[3][NOISE_CHUNK];
+    int32_t hash[8][NOISE_CHUNK];
+
+    int padded = (count + V::lanes - 1) / V::lanes * V::lanes;
+    for(int i = 0; i < padded; i += V::lanes) {
+      vd x0 = V::load(x + i);
+      vd y0 = V::load(y + i);
+      vd z0 = V::load(z + i);
+      vd floor_x = V::floor(x0);
+      vd floor_y = V::floor(y0);
+      vd floor_z = V::floor(z0);
+      V::store_int(cell[0] + i, floor_x);
+      V::store_int(cell[1] + i, floor_y);
+      V::store_int(cell[2] + i, floor_z);
+      V::store(fx + i, V::sub(x0, floor_x));
+      V::store(fy + i, V::sub(y0, floor_y));
+      V::store(fz + i, V::sub(z0, floor_z));
+    }
+
+    //neighbouring samples usually fall in the same lattice cell, so reuse the last cell's hashes
+    int32_t last_X = -1, last_Y = -1, last_Z = -1;
+    int32_t h[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for(int i = 0; i < padded; i++) {
+      const int32_t X = cell[0][i] & 255;
+      const int32_t Y = cell[1][i] & 255;
+      const int32_t Z = cell[2][i] & 255;
+      if(X != last_X || Y != last_Y || Z != last_Z) {
+        const int32_t A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+        const int32_t B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+        h[0] = p[AA] & 15;
+        h[1] = p[BA] & 15;
+        h[2] = p[AB] & 15;
+        h[3] = p[BB] & 15;
+        h[4] = p[AA + 1] & 15;
+        h[5] = p[BA + 1] & 15;
+        h[6] = p[AB + 1] & 15;
+        h[7] = p[BB + 1] & 15;
+        last_X = X;
+        last_Y = Y;
+        last_Z = Z;
+      }
+      for(int c = 0; c < 8; c++) {
+        hash[c][i] = h[c];
+      }
+    }
+
+    const vd one = V::set1(1);
+    for(int i = 0; i < padded; i += V::lanes) {
+      vd x0 = V::load(fx + i);
+      vd y0 = V::load(fy + i);
+      vd z0 = V::load(fz + i);
+      vd x1 = V::sub(x0, one);
+      vd y1 = V::sub(y0, one);
+      vd z1 = V::sub(z0, one);
+
+      vd u = fade<V>(x0);
+      vd v = fade<V>(y0);
+      vd w = fade<V>(z0);
+
+      vd r = lerp<V>(w, lerp<V>(v, lerp<V>(u, V::grad(hash[0] + i, x0, y0, z0),
+                                              V::grad(hash[1] + i, x1, y0, z0)),
+                                   lerp<V>(u, V::grad(hash[2] + i, x0, y1, z0),
+                                              V::grad(hash[3] + i, x1, y1, z0))),
+                        lerp<V>(v, lerp<V>(u, V::grad(hash[4] + i, x0, y0, z1),
+                                              V::grad(hash[5] + i, x1, y0, z1)),
+                                   lerp<V>(u, V::grad(hash[6] + i, x0, y1, z1),
+                                              V::grad(hash[7] + i, x1, y1, z1))));
+      V::store(out + i, r);
+    }
+  }
+
+  //Evaluates (octave noise of) one chunk, copying in and out of padded buffers.
+  template<class V> void octave_noise_3d_chunk(const uint8_t *p, const double *x, const double *y, const double *z, int count, int octaves, double *out) {
+    double cx[NOISE_CHUNK];
+    double cy[NOISE_CHUNK];
+    double cz[NOISE_CHUNK];
+    double n[NOISE_CHUNK];
+    double result[NOISE_CHUNK];
+
+    int padded = (count + V::lanes - 1) / V::lanes * V::lanes;
+    for(int i = 0; i < padded; i++) {
+      cx[i] = i < count ? x[i] : 0;
+      cy[i] = i < count ? y[i] : 0;
+      cz[i] = i < count ? z[i] : 0;
+      result[i] = 0;
+    }
+
+    //same accumulation order as accumulatedOctaveNoise3D
+    double amp = 1;
+    for(int o = 0; o < octaves; o++) {
+      noise_3d_chunk<V>(p, cx, cy, cz, count, n);
+      for(int i = 0; i < padded; i++) {
+        result[i] += n[i] * amp;
+        cx[i] *= 2;
+        cy[i] *= 2;
+        cz[i] *= 2;
+      }
+      amp /= 2;
+    }
+
+    for(int i = 0; i < count; i++) {
+      out[i] = result[i];
+    }
+  }
+}
+
+PerlinNoiseBatch::PerlinNoiseBatch(const siv::PerlinNoise& source) {
+  std::array<uint8_t, 256> perm;
+  source.serialize(perm);
+  for(size_t i = 0; i < 256; i++) {
+    p[i] = perm[i];
+    p[256 + i] = perm[i];
+  }
+}
+
+void PerlinNoiseBatch::noise_3d(const double *x, const double *y, const double *z, int count, double *out) const {
+  double cx[NOISE_CHUNK];
+  double cy[NOISE_CHUNK];
+  double cz[NOISE_CHUNK];
+  double n[NOISE_CHUNK];
+
+  for(int i = 0; i < count; i += NOISE_CHUNK) {
+    int chunk = std::min(NOISE_CHUNK, count - i);
+    for(int j = 0; j < NOISE_CHUNK; j++) {
+      cx[j] = j < chunk ? x[i + j] : 0;
+      cy[j] = j < chunk ? y[i + j] : 0;
+      cz[j] = j < chunk ? z[i + j] : 0;
+    }
+    noise_3d_chunk<SimdOps>(p, cx, cy, cz, chunk, n);
+    for(int j = 0; j < chunk; j++) {
+      out[i + j] = n[j];
+    }
+  }
+}
+
+void PerlinNoiseBatch::octave_noise_3d(const double *x, const double *y, const double *z, int count, int octaves, double *out) const {
+  for(int i = 0; i < count; i += NOISE_CHUNK) {
+    octave_noise_3d_chunk<SimdOps>(p, x + i, y + i, z + i, std::min(NOISE_CHUNK, count - i), octaves, out + i);
+  }
+}
+
+void PerlinNoiseBatch::octave_noise_3d_grid(int x0, int z0, int size_x, int size_z, double scale_xz, int w, double scale_w, int octaves, double *out) const {
+  double cx[NOISE_CHUNK];
+  double cy[NOISE_CHUNK];
+  double cz[NOISE_CHUNK];
+
+  int count = size_x * size_z;
+  for(int i = 0; i < count; i += NOISE_CHUNK) {
+    int chunk = std::min(NOISE_CHUNK, count - i);
+    for(int j = 0; j < chunk; j++) {
+      cx[j] = (x0 + (i + j) / size_z) / scale_xz;
+      cy[j] = (z0 + (i + j) % size_z) / scale_xz;
+      cz[j] = w / scale_w;
+    }
+    octave_noise_3d_chunk<SimdOps>(p, cx, cy, cz, chunk, octaves, out + i);
+  }
+}
+
+std::string PerlinNoiseBatch::simd_name() {
+  return NOISE_SIMD_NAME;
+}
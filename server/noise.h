@@ -0,0 +1,52 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __NOISE_H__
+#define __NOISE_H__
+
+#include <cstdint>
+#include <string>
+
+#include "lib/PerlinNoise.hpp"
+
+//Batched version of siv::PerlinNoise, for use by mapgen.
+//Evaluates many samples per call, using SIMD (AVX2, SSE2, or NEON) where available.
+//Results are bit-for-bit identical to the scalar siv::PerlinNoise it was built from:
+//same permutation table, same floating point operations in the same order.
+class PerlinNoiseBatch {
+  public:
+    PerlinNoiseBatch(const siv::PerlinNoise& source);
+
+    //out[i] = noise3D(x[i], y[i], z[i])
+    void noise_3d(const double *x, const double *y, const double *z, int count, double *out) const;
+
+    //out[i] = accumulatedOctaveNoise3D(x[i], y[i], z[i], octaves)
+    void octave_noise_3d(const double *x, const double *y, const double *z, int count, int octaves, double *out) const;
+
+    //Evaluates a size_x by size_z grid of integer sample positions, stored as out[i * size_z + j]:
+    //  accumulatedOctaveNoise3D((x0 + i) / scale_xz, (z0 + j) / scale_xz, w / scale_w, octaves)
+    void octave_noise_3d_grid(int x0, int z0, int size_x, int size_z, double scale_xz, int w, double scale_w, int octaves, double *out) const;
+
+    //Name of the instruction set used, for logging
+    static std::string simd_name();
+
+  private:
+    uint8_t p[512];
+};
+
+#endif
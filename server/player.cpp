@@ -19,10 +19,15 @@
 #include "player.h"
 
 #include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <set>
 #include <algorithm>
 
-PlayerState::PlayerState(connection_hdl hdl, WsServer& server)
-    : auth(false), auth_guest(false), just_tp(false), m_connection_hdl(hdl), m_tag(boost::uuids::random_generator()()), m_name(get_tag()), m_sender(server)
+PlayerState::PlayerState(connection_hdl hdl, WsServer& server, MapblockSubscribers& _mapblock_subscribers)
+    : auth(false), auth_guest(false), closed(false), just_tp(false), entities_behind(false), entity_sent(false), entity_moving(false),
+      strand(boost::asio::make_strand(server.get_io_service())), work_strand(boost::asio::make_strand(server.get_io_service())), m_connection_hdl(hdl), m_tag(boost::uuids::random_generator()()), m_name(get_tag()), m_sender(server),
+      mapblock_subscribers(_mapblock_subscribers)
 {
   try {
     auto con = server.get_con_from_hdl(hdl);
@@ -57,6 +62,43 @@ std::string PlayerState::entity_data_as_json() {
   return out.str();
 }
 
+//Changes below the PLAYER_ENTITY_UPDATE_* thresholds are measured from the last
+//time the player moved enough, so slow movement still adds up to an update eventually.
+//Until then the previous serialized data is reused.
+EntitySnapshot PlayerState::entity_snapshot() {
+  bool moved = !entity_sent
+      || pos.w != entity_sent_pos.w || pos.world != entity_sent_pos.world || pos.universe != entity_sent_pos.universe
+      || std::abs(pos.x - entity_sent_pos.x) > PLAYER_ENTITY_UPDATE_DISTANCE
+      || std::abs(pos.y - entity_sent_pos.y) > PLAYER_ENTITY_UPDATE_DISTANCE
+      || std::abs(pos.z - entity_sent_pos.z) > PLAYER_ENTITY_UPDATE_DISTANCE
+      || std::abs(vel.x - entity_sent_vel.x) > PLAYER_ENTITY_UPDATE_VEL
+      || std::abs(vel.y - entity_sent_vel.y) > PLAYER_ENTITY_UPDATE_VEL
+      || std::abs(vel.z - entity_sent_vel.z) > PLAYER_ENTITY_UPDATE_VEL
+      || std::abs(rot.x - entity_sent_rot.x) > PLAYER_ENTITY_UPDATE_ROT
+      || std::abs(rot.y - entity_sent_rot.y) > PLAYER_ENTITY_UPDATE_ROT
+      || std::abs(rot.z - entity_sent_rot.z) > PLAYER_ENTITY_UPDATE_ROT
+      || std::abs(rot.w - entity_sent_rot.w) > PLAYER_ENTITY_UPDATE_ROT;
+  
+  if(moved) {
+    entity_sent = true;
+    entity_sent_data = std::make_shared<const std::string>(entity_data_as_json());
+    entity_sent_pos = pos;
+    entity_sent_vel = vel;
+    entity_sent_rot = rot;
+  }
+  
+  EntitySnapshot snapshot;
+  snapshot.pos = pos;
+  snapshot.tag = get_tag();
+  snapshot.data = entity_sent_data;
+  //Clients extrapolate from the last two updates, so once the player stops,
+  //the same data is sent one more time to bring the entity to a stop.
+  snapshot.changed = moved || entity_moving;
+  entity_moving = moved;
+  
+  return snapshot;
+}
+
 std::string PlayerState::privs_as_json() {
   std::ostringstream out;
   
@@ -78,13 +120,101 @@ std::string PlayerState::opts_as_json() {
 }
 
 void PlayerState::send_pos() {
-  send(pos_as_json());
+  send_coalesced("pos", pos_as_json(), SendClass::CONTROL);
 }
 void PlayerState::send_privs() {
-  send(privs_as_json());
+  send_coalesced("privs", privs_as_json(), SendClass::CONTROL);
 }
 void PlayerState::send_opts() {
-  send(opts_as_json());
+  send_coalesced("opts", opts_as_json(), SendClass::CONTROL);
+}
+
+void PlayerState::send(std::string msg, SendClass send_class) {
+  queue_send(send_class, OutboundMessage(std::move(msg), false));
+}
+void PlayerState::send_coalesced(std::string key, std::string msg, SendClass send_class) {
+  OutboundMessage out(std::move(msg), false);
+  out.coalesce_key = key;
+  queue_send(send_class, std::move(out));
+}
+
+void PlayerState::queue_send(SendClass send_class, OutboundMessage msg) {
+  std::unique_lock<std::mutex> send_l(send_lock);
+  forget_dropped_mapblocks(send_queue.push(send_class, std::move(msg)));
+  send_queued();
+}
+
+void PlayerState::flush_sends() {
+  std::unique_lock<std::mutex> send_l(send_lock);
+  send_queued();
+  
+  bool was_slow = send_queue.is_slow();
+  std::vector<OutboundMessage> dropped = send_queue.check_slow();
+  if(send_queue.is_slow() && !was_slow) {
+    log(LogSource::PLAYER, LogLevel::NOTICE, "Connection to player '" + get_name() + "' is slow, holding back mapblocks (" + std::to_string(dropped.size()) + " dropped)");
+  }
+  forget_dropped_mapblocks(dropped);
+}
+
+bool PlayerState::send_pending(SendClass send_class) {
+  std::unique_lock<std::mutex> send_l(send_lock);
+  return send_queue.count(send_class) > 0;
+}
+
+std::string PlayerState::send_queue_status() {
+  std::unique_lock<std::mutex> send_l(send_lock);
+  std::ostringstream out;
+  out << "control " << send_queue.count(SendClass::CONTROL) << " (" << send_queue.bytes(SendClass::CONTROL) << " B), "
+      << "ui " << send_queue.count(SendClass::UI) << " (" << send_queue.bytes(SendClass::UI) << " B), "
+      << "entities " << send_queue.count(SendClass::ENTITIES) << " (" << send_queue.bytes(SendClass::ENTITIES) << " B), "
+      << "mapblocks " << send_queue.count(SendClass::MAPBLOCKS) << " (" << send_queue.bytes(SendClass::MAPBLOCKS) << " B); "
+      << send_queue.mapblocks_dropped() << " mapblocks dropped";
+  if(send_queue.is_slow()) {
+    out << "; slow";
+  }
+  return out.str();
+}
+
+//Hands queued messages to websocketpp until it has SEND_BUFFER_TARGET bytes buffered.
+//Called with send_lock held.
+void PlayerState::send_queued() {
+  size_t buffered;
+  try {
+    buffered = m_sender.get_con_from_hdl(m_connection_hdl)->get_buffered_amount();
+  } catch(websocketpp::exception const& e) {
+    return; //closed; on_close will clean up
+  }
+  
+  OutboundMessage msg;
+  while(buffered < SEND_BUFFER_TARGET && send_queue.pop(msg)) {
+    try {
+      m_sender.send(m_connection_hdl, msg.data->data(), msg.data->size(), msg.binary ? websocketpp::frame::opcode::binary : websocketpp::frame::opcode::text);
+    } catch(websocketpp::exception const& e) {
+      log(LogSource::PLAYER, LogLevel::ERR, "Socket send error");
+    }
+    buffered += msg.data->size();
+  }
+}
+
+//The player never got these, so go back to what they had before: an older version, which is
+//checked again along with the next changes, or nothing, in which case the client asks again after a while.
+void PlayerState::forget_dropped_mapblocks(const std::vector<OutboundMessage>& dropped) {
+  std::set<MapPos<int>> seen;
+  for(const auto& msg : dropped) {
+    for(const auto& mb : msg.mapblocks) {
+      //Oldest first, so the first one for each mapblock has what the player actually has.
+      if(!seen.insert(mb.pos).second) { continue; }
+      
+      if(mb.prev) {
+        //Unless it's been forgotten since, in which case the client was told to drop it.
+        if(!known_mapblocks.get(mb.pos)) { continue; }
+        set_known_mapblock(*mb.prev);
+        mapblock_subscribers.changed(mb.pos);
+      } else {
+        forget_mapblock(mb.pos);
+      }
+    }
+  }
 }
 
 void PlayerState::interest_inventory(InvRef ref) {
@@ -116,93 +246,110 @@ InvStack PlayerState::inv_get(std::string list_name, int index) {
 }*/
 
 bool PlayerState::needs_mapblock_update(MapblockUpdateInfo info) {
-  auto search = known_mapblocks.find(info.pos);
-  if(search != known_mapblocks.end()) {
-    MapblockUpdateInfo curr_info = search->second;
-    return info != curr_info;
+  std::optional<MapblockUpdateInfo> curr_info = known_mapblocks.get(info.pos);
+  if(curr_info) {
+    return info != *curr_info;
   }
   return true;
 }
 
-unsigned int PlayerState::send_mapblock_compressed(MapblockCompressed *mbc) {
-  known_mapblocks[mbc->pos] = MapblockUpdateInfo(*mbc);
-  
-  std::ostringstream IDtoIS_ss;
-  IDtoIS_ss << "[";
-  for(size_t i = 0; i < mbc->IDtoIS.size(); i++) {
-    if(i != 0) { IDtoIS_ss << ","; }
-    IDtoIS_ss << "\"" << mbc->IDtoIS[i] << "\"";
+//Returns what the player had before.
+std::optional<MapblockUpdateInfo> PlayerState::mark_mapblock_known(MapblockUpdateInfo info) {
+  std::optional<MapblockUpdateInfo> prev = known_mapblocks.get(info.pos);
+  set_known_mapblock(info);
+  return prev;
+}
+
+void PlayerState::set_known_mapblock(MapblockUpdateInfo info) {
+  bool inserted = known_mapblocks.set(info);
+  //Once closed, forget_all_mapblocks has already run, and nothing would unsubscribe them.
+  if(inserted && !closed) {
+    mapblock_subscribers.subscribe(info.pos, weak_from_this());
   }
-  IDtoIS_ss << "]";
-  std::string IDtoIS_str = IDtoIS_ss.str();
-  const uint8_t *IDtoIS_data = reinterpret_cast<const uint8_t*>(&IDtoIS_str[0]);
-  size_t IDtoIS_len = IDtoIS_str.size();
-  
-  //Format:
-  //0   Magic number (uint32_t)
-  //4   Position (6 * int32_t) -- x, y, z, w, world, universe
-  //28  updateNum (uint32_t)
-  //32  lightUpdateNum (uint32_t)
-  //36  lightNeedsUpdate (uint32_t)
-  //40  flags (uint32_t) -- lowest bit is 'sunlit', others are reserved
-  //44  data len (uint32_t)
-  //48  data (string of uint32_ts)
-  //?   light len (# of uint32_ts) (uint32_t)
-  //+4   light len (# of uint16_ts) (uint32_t)
-  //+8  light data (string of uint16_ts)
-  //?   IDtoIS len (uint32_t)
-  //+4  IDtoIS data (utf-8 chars)
-  
-  uint8_t out_buf[sizeof(uint32_t) +
-                  sizeof(int32_t) * 6 +
-                  sizeof(uint32_t) +
-                  sizeof(uint32_t) +
-                  sizeof(uint32_t) +
-                  sizeof(uint32_t) +
-                  sizeof(uint32_t) +
-                  MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Y * MAPBLOCK_SIZE_Z * sizeof(uint32_t) + 4 +
-                  sizeof(uint32_t) +
-                  sizeof(uint32_t) +
-                  MAPBLOCK_SIZE_X * MAPBLOCK_SIZE_Y * MAPBLOCK_SIZE_Z * sizeof(uint16_t) + 4 +
-                  sizeof(uint32_t) +
-                  IDtoIS_len + 4] = {0};
+}
+
+void PlayerState::forget_mapblock(MapPos<int> mb_pos) {
+  if(!known_mapblocks.erase(mb_pos)) { return; }
+  mapblock_subscribers.unsubscribe(mb_pos, weak_from_this());
+  //It may have to be streamed again.
+  stream.set_settled(false);
+}
+
+void PlayerState::forget_all_mapblocks() {
+  std::weak_ptr<PlayerState> self = weak_from_this();
+  known_mapblocks.for_each([this, &self](MapPos<int> mb_pos) {
+    mapblock_subscribers.unsubscribe(mb_pos, self);
+  });
+  known_mapblocks.clear();
+}
+
+//Forgets mapblocks and tells the client to drop them as well. The two have to stay in step: a mapblock
+//the client kept after it was forgotten here would never be updated again.
+void PlayerState::forget_mapblocks(const std::vector<MapPos<int>>& mapblocks) {
+  if(mapblocks.size() == 0) { return; }
   
-  uint32_t *out_buf_32 = (uint32_t*) out_buf;
-  int32_t *out_buf_i32 = (int32_t*) out_buf;
+  {
+    //No use sending what's about to be forgotten. This also makes sure no version of them arrives after the message.
+    std::unique_lock<std::mutex> send_l(send_lock);
+    forget_dropped_mapblocks(send_queue.drop(std::set<MapPos<int>>(mapblocks.begin(), mapblocks.end())));
+  }
   
-  out_buf_32[0] = 0xABCD5678;
-  out_buf_i32[1] = mbc->pos.x;
-  out_buf_i32[2] = mbc->pos.y;
-  out_buf_i32[3] = mbc->pos.z;
-  out_buf_i32[4] = mbc->pos.w;
-  out_buf_i32[5] = mbc->pos.world;
-  out_buf_i32[6] = mbc->pos.universe;
-  out_buf_32[7] = mbc->update_num;
-  out_buf_32[8] = mbc->light_update_num;
-  out_buf_32[9] = mbc->light_needs_update;
-  out_buf_32[10] = mbc->sunlit ? 1 : 0;
-  out_buf_32[11] = mbc->data_c_len;
-  size_t arr_pos = 12;
-  memcpy(out_buf_32 + arr_pos, mbc->data_c.data(), mbc->data_c_len * sizeof(uint32_t));
-  arr_pos += mbc->data_c_len;
-  out_buf_32[arr_pos] = (mbc->light_data_c_len * sizeof(uint16_t) / sizeof(uint32_t)) + 1;
-  arr_pos++;
-  out_buf_32[arr_pos] = mbc->light_data_c_len;
-  arr_pos++;
-  memcpy(out_buf_32 + arr_pos, mbc->light_data_c.data(), mbc->light_data_c_len * sizeof(uint16_t));
-  arr_pos += (mbc->light_data_c_len * sizeof(uint16_t) / sizeof(uint32_t)) + 1;
-  out_buf_32[arr_pos] = IDtoIS_len;
-  arr_pos++;
-  memcpy(out_buf_32 + arr_pos, IDtoIS_data, IDtoIS_len);
-  arr_pos += (IDtoIS_len / sizeof(uint32_t)) + 1;
+  std::string out = "{\"type\":\"forget_mapblocks\",\"mapblocks\":[";
+  bool first = true;
+  for(MapPos<int> mb_pos : mapblocks) {
+    forget_mapblock(mb_pos);
+    
+    if(!first) { out += ","; }
+    first = false;
+    out += mb_pos.to_json();
+  }
+  out += "]}";
+  //Not SendClass::MAPBLOCKS, as those may be dropped.
+  send(out, SendClass::CONTROL);
+}
+
+//Forgets mapblocks beyond the keep distance or over the limit, see MapblockStream::forgotten.
+void PlayerState::forget_far_mapblocks() {
+  forget_mapblocks(stream.forgotten(containing_mapblock(), known_mapblocks));
+}
+
+void PlayerState::send_mapblock_frame(std::vector<OutboundMapblock> mapblocks, std::shared_ptr<const std::string> data) {
+  OutboundMessage msg(data, true);
+  msg.mapblocks = std::move(mapblocks);
+  queue_send(SendClass::MAPBLOCKS, std::move(msg));
+}
+
+//Sends a frame from Map::get_mapblock_frame or Map::get_mapblock_delta_frame.
+unsigned int PlayerState::send_mapblock(std::shared_ptr<const MapblockFrame> frame) {
+  send_mapblock_frame({OutboundMapblock(frame->info.pos, mark_mapblock_known(frame->info))}, frame->data);
+  return frame->data->size();
+}
+
+//Sends several mapblock frames as one.
+//Format:
+//0   Magic number (uint32_t)
+//4   Mapblock count (uint32_t)
+//8   For each mapblock: length in bytes (uint32_t), followed by the frame
+unsigned int PlayerState::send_mapblock_batch(const std::vector<std::shared_ptr<const MapblockFrame>>& frames) {
+  std::vector<OutboundMapblock> mapblocks;
+  size_t total_len = 2 * sizeof(uint32_t);
+  for(const auto& frame : frames) {
+    total_len += sizeof(uint32_t) + frame->data->size();
+    mapblocks.push_back(OutboundMapblock(frame->info.pos, mark_mapblock_known(frame->info)));
+  }
   
-  try {
-    m_sender.send(m_connection_hdl, out_buf, arr_pos * sizeof(uint32_t), websocketpp::frame::opcode::binary);
-  } catch(websocketpp::exception const& e) {
-    log(LogSource::PLAYER, LogLevel::ERR, "Socket send error");
+  std::string out;
+  out.reserve(total_len);
+  auto append_u32 = [&out](uint32_t val) { out.append(reinterpret_cast<const char*>(&val), sizeof(uint32_t)); };
+  append_u32(0xABCD567A);
+  append_u32(frames.size());
+  for(const auto& frame : frames) {
+    append_u32(frame->data->size());
+    out += *frame->data;
   }
   
-  return arr_pos * sizeof(uint32_t);
+  send_mapblock_frame(std::move(mapblocks), std::make_shared<const std::string>(std::move(out)));
+  return total_len;
 }
 
 void PlayerState::prepare_mapblocks(std::vector<MapPos<int>> mapblock_list, Map& map) {
@@ -224,7 +371,7 @@ void PlayerState::prepare_mapblocks(std::vector<MapPos<int>> mapblock_list, Map&
     auto end = std::chrono::steady_clock::now();
     auto diff = end - start;
     double ms = std::chrono::duration<double, std::milli>(diff).count();
-    std::cout << "prepped " << mb_need_light.size() << " mapblocks for " << get_name() << " in " << ms << " ms" << std::endl;
+    std::cout << "prepped " << mb_need_light.size() << " mapblocks in " << ms << " ms" << std::endl;
 #endif
   }
 }
@@ -233,7 +380,7 @@ void PlayerState::prepare_mapblocks(std::vector<MapPos<int>> mapblock_list, Map&
 //mb_radius_outer indicates the radius of a sort of 3-dimensional plus shape extending outward from this cube
 //  (if at least two dimensions are within the bounds of the inner cube, the mapblocks will be loaded)
 //  this is used because mapblock rendering on the client requires access all 6 mapblocks immediately adjacent to the one being rendered
-void PlayerState::prepare_nearby_mapblocks(int mb_radius, int mb_radius_outer, int mb_radius_w, Map& map) {
+std::vector<MapPos<int>> PlayerState::nearby_mapblocks(int mb_radius, int mb_radius_outer, int mb_radius_w) {
   MapPos<int> mb_pos = containing_mapblock();
   MapPos<int> min_inner(mb_pos.x - mb_radius, mb_pos.y - mb_radius, mb_pos.z - mb_radius, mb_pos.w - mb_radius_w, mb_pos.world, mb_pos.universe);
   MapPos<int> max_inner(mb_pos.x + mb_radius, mb_pos.y + mb_radius, mb_pos.z + mb_radius, mb_pos.w + mb_radius_w, mb_pos.world, mb_pos.universe);
@@ -259,46 +406,77 @@ void PlayerState::prepare_nearby_mapblocks(int mb_radius, int mb_radius_outer, i
     }
   }
   
-  prepare_mapblocks(mb_to_update, map);
+  return mb_to_update;
 }
 
-void PlayerState::update_mapblocks(std::vector<MapPos<int>> mapblock_list, Map& map) {
-  prepare_mapblocks(mapblock_list, map);
+//Whether nearby_mapblocks would include mb_pos if the player were in mapblock 'center'.
+static bool is_nearby(MapPos<int> mb_pos, MapPos<int> center, int mb_radius, int mb_radius_outer, int mb_radius_w) {
+  if(mb_pos.world != center.world || mb_pos.universe != center.universe) { return false; }
+  if(std::abs(mb_pos.w - center.w) > mb_radius_w) { return false; }
   
-  for(size_t i = 0; i < mapblock_list.size(); i++) {
-    MapPos<int> mb_pos = mapblock_list[i];
-    MapblockUpdateInfo info = map.get_mapblockupdateinfo(mb_pos);
-    if(needs_mapblock_update(info)) {
-      MapblockCompressed *mbc = map.get_mapblock_compressed(mb_pos);
-      send_mapblock_compressed(mbc);
-      delete mbc;
-    }
-  }
+  int dx = std::abs(mb_pos.x - center.x);
+  int dy = std::abs(mb_pos.y - center.y);
+  int dz = std::abs(mb_pos.z - center.z);
+  if(dx > mb_radius_outer || dy > mb_radius_outer || dz > mb_radius_outer) { return false; }
+  
+  int inner = (dx <= mb_radius) + (dy <= mb_radius) + (dz <= mb_radius);
+  return inner >= 2;
 }
 
+//The mapblocks lit ahead of time around a player who isn't streamed to: nearby_mapblocks(2, 3, 0) and nearby_mapblocks(1, 2, 1).
+//If 'from' is given, only the ones that weren't already among those when the player was in that mapblock;
+//crossing into the next mapblock over, that's one face of each shape instead of all of it.
+std::vector<MapPos<int>> PlayerState::entered_mapblocks(std::optional<MapPos<int>> from) {
+  std::vector<MapPos<int>> candidates = nearby_mapblocks(2, 3, 0);
+  std::vector<MapPos<int>> candidates_w = nearby_mapblocks(1, 2, 1);
+  candidates.insert(candidates.end(), candidates_w.begin(), candidates_w.end());
+  
+  std::set<MapPos<int>> entered;
+  for(const MapPos<int>& mb_pos : candidates) {
+    if(from && (is_nearby(mb_pos, *from, 2, 3, 0) || is_nearby(mb_pos, *from, 1, 2, 1))) { continue; }
+    entered.insert(mb_pos);
+  }
+  return std::vector<MapPos<int>>(entered.begin(), entered.end());
+}
 
-
-void PlayerState::update_nearby_mapblocks(int mb_radius, int mb_radius_w, Map& map) {
-  MapPos<int> mb_pos = containing_mapblock();
-  MapPos<int> min_pos(mb_pos.x - mb_radius, mb_pos.y - mb_radius, mb_pos.z - mb_radius, mb_pos.w - mb_radius_w, mb_pos.world, mb_pos.universe);
-  MapPos<int> max_pos(mb_pos.x + mb_radius, mb_pos.y + mb_radius, mb_pos.z + mb_radius, mb_pos.w + mb_radius_w, mb_pos.world, mb_pos.universe);
+//Picks the mapblocks within the player's view distance that they don't have the current version of,
+//most important first, along with the version they do have of each. See MapblockStream.
+//Lighting and sending them is up to the caller (see Server::send_mapblocks_work), which uses the bandwidth budget.
+//If 'sky_pos' is set on return, whether the player can see the sky from there has to be looked up first
+//(see Server::stream_sky_work); that isn't done here, as it loads a mapblock.
+std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> PlayerState::stream_mapblocks(Map& map, std::optional<MapPos<int>>& sky_pos) {
+  forget_far_mapblocks();
   
-  std::vector<MapPos<int>> mb_to_update;
-  for(int universe = min_pos.universe; universe <= max_pos.universe; universe++) {
-    for(int world = min_pos.world; world <= max_pos.world; world++) {
-      for(int w = min_pos.w; w <= max_pos.w; w++) {
-        for(int x = min_pos.x; x <= max_pos.x; x++) {
-          for(int y = min_pos.y; y <= max_pos.y; y++) {
-            for(int z = min_pos.z; z <= max_pos.z; z++) {
-              mb_to_update.push_back(MapPos<int>(x, y, z, w, world, universe));
-            }
-          }
-        }
-      }
+  if(!stream.enabled()) { return {}; }
+  if(stream.is_busy()) { return {}; }
+  MapPos<int> center = containing_mapblock();
+  if(stream.is_settled() && stream.is_planned(center, rot)) { return {}; }
+  //Let what was sent last time go out first, so the order stays up to date.
+  if(send_pending(SendClass::MAPBLOCKS)) { return {}; }
+  
+  if(stream.available() <= 0) { return {}; }
+  
+  std::optional<bool> sees_sky = stream.sees_sky_at(center);
+  if(!sees_sky) {
+    sky_pos = MapPos<int>((int) std::floor(pos.x), (int) std::floor(pos.y) + 1, (int) std::floor(pos.z), pos.w, pos.world, pos.universe);
+    return {};
+  }
+  const std::vector<MapPos<int>>& order = stream.plan(center, pos, rot, *sees_sky);
+  if(stream.is_settled()) { return {}; }
+  
+  std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> to_send;
+  for(const MapPos<int>& mb_pos : order) {
+    if(to_send.size() >= MAPBLOCK_STREAM_MAX_PER_PASS) { break; }
+    if(needs_mapblock_update(map.get_mapblockupdateinfo(mb_pos))) {
+      to_send.push_back(std::make_pair(mb_pos, known_mapblocks.get(mb_pos)));
     }
   }
-  update_mapblocks(mb_to_update, map);
+  if(to_send.size() == 0) {
+    stream.set_settled(true);
+  }
+  return to_send;
 }
+
 std::vector<MapPos<int>> PlayerState::list_nearby_known_mapblocks(int mb_radius, int mb_radius_w) {
   MapPos<int> mb_pos = containing_mapblock();
   MapPos<int> min_pos(mb_pos.x - mb_radius, mb_pos.y - mb_radius, mb_pos.z - mb_radius, mb_pos.w - mb_radius_w, mb_pos.world, mb_pos.universe);
@@ -313,8 +491,7 @@ std::vector<MapPos<int>> PlayerState::list_nearby_known_mapblocks(int mb_radius,
           for(int y = min_pos.y; y <= max_pos.y; y++) {
             for(int z = min_pos.z; z <= max_pos.z; z++) {
               MapPos<int> where(x, y, z, w, world, universe);
-              auto search = known_mapblocks.find(where);
-              if(search != known_mapblocks.end()) {
+              if(known_mapblocks.get(where)) {
                 mb_to_update.push_back(where);
               }
             }
@@ -326,13 +503,6 @@ std::vector<MapPos<int>> PlayerState::list_nearby_known_mapblocks(int mb_radius,
   
   return mb_to_update;
 }
-void PlayerState::update_nearby_known_mapblocks(int mb_radius, int mb_radius_w, Map& map) {
-  std::vector<MapPos<int>> mb_to_update = list_nearby_known_mapblocks(mb_radius, mb_radius_w);
-  update_mapblocks(mb_to_update, map);
-}
-void PlayerState::update_nearby_known_mapblocks(std::vector<MapPos<int>> mb_to_update, Map& map) {
-  update_mapblocks(mb_to_update, map);
-}
 
 
 MapPos<int> PlayerState::containing_mapblock() {
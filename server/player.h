@@ -24,19 +24,30 @@
 #include "vector.h"
 #include "mapblock.h"
 #include "map.h"
+#include "mapblock_frame.h"
 #include "json.h"
 #include "player_data.h"
 #include "player_auth.h"
 #include "log.h"
 #include "inventory.h"
+#include "send_queue.h"
+#include "mapblock_stream.h"
+#include "mapblock_subscribers.h"
+#include "known_mapblocks.h"
+#include "rate_limit.h"
 
 #include <chrono>
+#include <atomic>
+#include <mutex>
 #include <shared_mutex>
 #include <map>
+#include <memory>
+#include <optional>
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <boost/asio.hpp>
 
 #ifdef TLS
 #include <websocketpp/config/asio.hpp>
@@ -52,11 +63,25 @@ using WsServer = websocketpp::server<websocketpp::config::asio>;
 #endif
 using websocketpp::connection_hdl;
 
+typedef boost::asio::strand<boost::asio::io_context::executor_type> PlayerStrand;
 
+//How far a player has to move, turn, or change speed before other players are sent an entity update.
+#define PLAYER_ENTITY_UPDATE_DISTANCE 0.01
+#define PLAYER_ENTITY_UPDATE_VEL 0.05
+#define PLAYER_ENTITY_UPDATE_ROT 0.001 //per quaternion component
 
-class PlayerState {
+//A player's entity state for one tick, serialized once and shared by everyone who can see them.
+class EntitySnapshot {
   public:
-    PlayerState(connection_hdl hdl, WsServer& server);
+    MapPos<double> pos;
+    std::string tag;
+    std::shared_ptr<const std::string> data; //entity_data_as_json()
+    bool changed; //worth sending as an update to players who already know about this one
+};
+
+class PlayerState : public std::enable_shared_from_this<PlayerState> {
+  public:
+    PlayerState(connection_hdl hdl, WsServer& server, MapblockSubscribers& _mapblock_subscribers);
     
     bool operator<(const PlayerState& other) const {
       return m_tag < other.m_tag;
@@ -83,6 +108,7 @@ class PlayerState {
     
     std::string pos_as_json();
     std::string entity_data_as_json();
+    EntitySnapshot entity_snapshot();
     std::string privs_as_json();
     std::string opts_as_json();
     
@@ -97,26 +123,40 @@ class PlayerState {
     InvStack inv_get(std::string list_name, int index);
     
     bool needs_mapblock_update(MapblockUpdateInfo info);
-    unsigned int send_mapblock_compressed(MapblockCompressed *mbc);
-    
-    void prepare_mapblocks(std::vector<MapPos<int>> mapblock_list, Map& map);
-    void prepare_nearby_mapblocks(int mb_radius, int mb_radius_outer, int mb_radius_w, Map& map);
+    unsigned int send_mapblock(std::shared_ptr<const MapblockFrame> frame);
+    unsigned int send_mapblock_batch(const std::vector<std::shared_ptr<const MapblockFrame>>& frames);
+    
+    //Lights the mapblocks that need it. Only touches the map, so it doesn't need the player's lock.
+    static void prepare_mapblocks(std::vector<MapPos<int>> mapblock_list, Map& map);
+    std::vector<MapPos<int>> nearby_mapblocks(int mb_radius, int mb_radius_outer, int mb_radius_w);
+    std::vector<MapPos<int>> entered_mapblocks(std::optional<MapPos<int>> from);
+    std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> stream_mapblocks(Map& map, std::optional<MapPos<int>>& sky_pos);
+    
+    //Every change to known_mapblocks goes through these, so that the player stays subscribed to exactly the mapblocks they have.
+    void set_known_mapblock(MapblockUpdateInfo info);
+    void forget_mapblock(MapPos<int> mb_pos);
+    //On disconnect, with 'closed' already set.
+    void forget_all_mapblocks();
+    void forget_mapblocks(const std::vector<MapPos<int>>& mapblocks);
+    void forget_far_mapblocks();
     
   private:
-    void update_mapblocks(std::vector<MapPos<int>> mapblock_list, Map& map);
-    void update_nearby_mapblocks(int mb_radius, int mb_radius_w, Map& map);
+    std::optional<MapblockUpdateInfo> mark_mapblock_known(MapblockUpdateInfo info);
+    void send_mapblock_frame(std::vector<OutboundMapblock> mapblocks, std::shared_ptr<const std::string> data);
+    void queue_send(SendClass send_class, OutboundMessage msg);
+    void send_queued();
+    void forget_dropped_mapblocks(const std::vector<OutboundMessage>& dropped);
   public:
     std::vector<MapPos<int>> list_nearby_known_mapblocks(int mb_radius, int mb_radius_w);
-    void update_nearby_known_mapblocks(int mb_radius, int mb_radius_w, Map& map);
-    void update_nearby_known_mapblocks(std::vector<MapPos<int>> mb_to_update, Map& map);
-    
-    void send(std::string msg) {
-      try {
-        m_sender.send(m_connection_hdl, msg, websocketpp::frame::opcode::text);
-      } catch(websocketpp::exception const& e) {
-        log(LogSource::PLAYER, LogLevel::ERR, "Socket send error");
-      }
-    }
+    
+    //Messages are queued by class and handed to the connection as it has room for them, see send_queue.h.
+    void send(std::string msg, SendClass send_class = SendClass::UI);
+    //Replaces any queued message with the same key that hasn't gone out yet.
+    void send_coalesced(std::string key, std::string msg, SendClass send_class);
+    //Sends queued messages the connection now has room for, and drops mapblocks if it's slow.
+    void flush_sends();
+    bool send_pending(SendClass send_class);
+    std::string send_queue_status();
     
     void load_data(PlayerData _data) {
       data = _data;
@@ -139,6 +179,9 @@ class PlayerState {
     
     bool auth;
     bool auth_guest;
+    //Disconnected, and only still around because something holds a PlayerRef to it.
+    //Set with the lock held, but atomic so that the tick can check other players without taking theirs.
+    std::atomic<bool> closed;
     
     //Stores the player's physical position.
     //Once 'auth' is set to true, these will contain valid data.
@@ -149,10 +192,29 @@ class PlayerState {
     std::list<std::pair<std::chrono::time_point<std::chrono::steady_clock>, MapPos<double>>> pos_history;
     bool just_tp;
     
-    std::map<MapPos<int>, MapblockUpdateInfo> known_mapblocks;
+    //Mapblock the player was in when the mapblocks around them were last lit, see Server::prepare_entered_mapblocks.
+    std::optional<MapPos<int>> prepared_center;
+    
+    //Only changed through set_known_mapblock and forget_mapblock.
+    KnownMapblocks known_mapblocks;
+    MapblockStream stream;
     std::set<std::string> known_player_tags;
+    bool entities_behind; //an entity update was skipped, so the next one should include everything
+    
+    //Entity state as of the last time it moved enough to be sent, see entity_snapshot.
+    bool entity_sent;
+    bool entity_moving; //moved as of the last snapshot
+    std::shared_ptr<const std::string> entity_sent_data;
+    MapPos<double> entity_sent_pos;
+    MapPos<double> entity_sent_vel;
+    Quaternion entity_sent_rot;
     
     std::set<InvRef> known_inventories;
+    
+    RateLimiter rate_limit;
+    
+    //Filled by /copy, written back by /paste.
+    MapRegion clipboard;
     std::map<std::string, std::pair<std::shared_mutex*, std::shared_mutex*>> inventory_lock;
     
     PlayerAuthenticator auth_state;
@@ -163,11 +225,21 @@ class PlayerState {
     
     std::shared_mutex lock;
     
+    //Messages from this player are handled in order on 'strand'. Slow work on their behalf (lighting,
+    //mapblock encoding, saving) runs in order on 'work_strand', and anything to send is posted back to 'strand'.
+    //This way a busy player ties up at most two threads, and holds 'lock' only for the quick parts.
+    PlayerStrand strand;
+    PlayerStrand work_strand;
+    
     connection_hdl m_connection_hdl;
   private:
+    SendQueue send_queue;
+    std::mutex send_lock;
+    
     boost::uuids::uuid m_tag;
     std::string m_name;
     WsServer& m_sender;
+    MapblockSubscribers& mapblock_subscribers;
 };
 
 #endif
@@ -23,11 +23,6 @@
 #include "log.h"
 #include "config.h"
 
-#include <sstream>
-
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
-
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -83,22 +78,19 @@ std::string hash_password(std::string password, std::string salt) {
 }
 
 
-bool PlayerAuthenticator::step(std::string message, WsServer& server, connection_hdl& hdl, Database& db) {
+bool PlayerAuthenticator::step(const std::string& message, WsServer& server, connection_hdl& hdl, Database& db) {
   try {
-    std::stringstream ss;
-    ss << message;
+    JSONDocument doc(message);
+    const JSONValue& json = doc.root();
     
-    boost::property_tree::ptree pt;
-    boost::property_tree::read_json(ss, pt);
-    
-    std::string type = pt.get<std::string>("type");
+    std::string type = json.get<std::string>("type");
     
     if(type == "auth_list") {
       //TODO
       
       return false;
     } else {
-      std::string backend = pt.get<std::string>("backend");
+      std::string backend = json.get<std::string>("backend");
       if(!has_backend || backend != auth_backend_name) {
         if(has_backend) {
           has_backend = false;
@@ -120,7 +112,7 @@ bool PlayerAuthenticator::step(std::string message, WsServer& server, connection
       server.send(hdl, "{\"type\":\"auth_err\",\"reason\":\"bad_auth_mode\"}", websocketpp::frame::opcode::text);
       return false;
     }
-  } catch(boost::property_tree::ptree_error const& e) {
+  } catch(JSONError const& e) {
     log(LogSource::AUTH, LogLevel::ERR, "JSON parse error: " + std::string(e.what()) + " message=" + message);
     return false;
   }
@@ -134,18 +126,15 @@ std::string PlayerAuthenticator::result() {
 }
 
 
-bool PlayerPasswordAuthenticator::step(std::string message, WsServer& server, connection_hdl& hdl, Database& db) {
+bool PlayerPasswordAuthenticator::step(const std::string& message, WsServer& server, connection_hdl& hdl, Database& db) {
   try {
-    std::stringstream ss;
-    ss << message;
-    
-    boost::property_tree::ptree pt;
-    boost::property_tree::read_json(ss, pt);
+    JSONDocument doc(message);
+    const JSONValue& json = doc.root();
     
-    std::string type = pt.get<std::string>("type");
+    std::string type = json.get<std::string>("type");
     
     if(type == "auth_step") {
-      std::string step = pt.get<std::string>("step");
+      std::string step = json.get<std::string>("step");
       
       if(step == "register") {
         if(!get_config<bool>("auth.allow_register")) {
@@ -153,9 +142,9 @@ bool PlayerPasswordAuthenticator::step(std::string message, WsServer& server, co
           return false;
         }
         
-        std::string login_name = pt.get<std::string>("login_name");
-        std::string client_salt = pt.get<std::string>("client_salt");
-        std::string password = pt.get<std::string>("password");
+        std::string login_name = json.get<std::string>("login_name");
+        std::string client_salt = json.get<std::string>("client_salt");
+        std::string password = json.get<std::string>("password");
         
         if(!validate_player_name(login_name)) {
           server.send(hdl, "{\"type\":\"auth_err\",\"reason\":\"register_login_name_invalid\"}", websocketpp::frame::opcode::text);
@@ -209,8 +198,8 @@ bool PlayerPasswordAuthenticator::step(std::string message, WsServer& server, co
       }
       
       if(step == "login") {
-        std::string login_name = pt.get<std::string>("login_name");
-        std::string password = pt.get<std::string>("password");
+        std::string login_name = json.get<std::string>("login_name");
+        std::string password = json.get<std::string>("password");
         
         std::vector<PlayerAuthInfo> search = db.fetch_pw_info(login_name, "password-plain");
         if(search.size() == 0) {
@@ -220,13 +209,10 @@ bool PlayerPasswordAuthenticator::step(std::string message, WsServer& server, co
         
         for(auto& it : search) {
           std::string pw_json = it.data;
-          std::stringstream pw_ss;
-          pw_ss << pw_json;
-          boost::property_tree::ptree pw_pt;
-          boost::property_tree::read_json(pw_ss, pw_pt);
+          JSONDocument pw_doc(pw_json);
           
-          std::string salt = pw_pt.get<std::string>("salt");
-          std::string password_hashed = pw_pt.get<std::string>("password_hashed");
+          std::string salt = pw_doc.root().get<std::string>("salt");
+          std::string password_hashed = pw_doc.root().get<std::string>("password_hashed");
           
           std::string input_pw_hashed = hash_password(password, salt);
           if(input_pw_hashed == "") {
@@ -254,9 +240,9 @@ bool PlayerPasswordAuthenticator::step(std::string message, WsServer& server, co
           return false;
         }
         
-        std::string login_name = pt.get<std::string>("login_name");
-        std::string client_salt = pt.get<std::string>("client_salt");
-        std::string password = pt.get<std::string>("password");
+        std::string login_name = json.get<std::string>("login_name");
+        std::string client_salt = json.get<std::string>("client_salt");
+        std::string password = json.get<std::string>("password");
         
         if(!validate_player_name(login_name)) {
           server.send(hdl, "{\"type\":\"auth_err\",\"reason\":\"update_login_name_invalid\"}", websocketpp::frame::opcode::text);
@@ -295,7 +281,7 @@ bool PlayerPasswordAuthenticator::step(std::string message, WsServer& server, co
       server.send(hdl, "{\"type\":\"auth_err\",\"reason\":\"unknown_command\"}", websocketpp::frame::opcode::text);
       return false;
     }
-  } catch(boost::property_tree::ptree_error const& e) {
+  } catch(JSONError const& e) {
     log(LogSource::AUTH, LogLevel::ERR, "JSON parse error: " + std::string(e.what()) + " message=" + message);
     return false;
   }
@@ -38,14 +38,14 @@ using websocketpp::connection_hdl;
 class PlayerGenericAuthenticator {
   public:
     virtual ~PlayerGenericAuthenticator() {}
-    virtual bool step(std::string message, WsServer& server, connection_hdl& hdl, Database& db) = 0;
+    virtual bool step(const std::string& message, WsServer& server, connection_hdl& hdl, Database& db) = 0;
     virtual std::string result() = 0;
 };
 
 class PlayerPasswordAuthenticator : public PlayerGenericAuthenticator {
   public:
     PlayerPasswordAuthenticator() : auth_success(false) {}
-    virtual bool step(std::string message, WsServer& server, connection_hdl& hdl, Database& db);
+    virtual bool step(const std::string& message, WsServer& server, connection_hdl& hdl, Database& db);
     virtual std::string result();
   
   private:
@@ -59,7 +59,7 @@ class PlayerAuthenticator {
   public:
     PlayerAuthenticator() : has_backend(false), auth_backend(NULL) {}
     ~PlayerAuthenticator() { if(has_backend) { delete auth_backend; } };
-    bool step(std::string message, WsServer& server, connection_hdl& hdl, Database& db);
+    bool step(const std::string& message, WsServer& server, connection_hdl& hdl, Database& db);
     std::string result();
   
   private:
@@ -0,0 +1,94 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "player_grid.h"
+
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+
+MapPos<int> PlayerGrid::cell_of(const MapPos<double>& pos) const {
+  return MapPos<int>(std::floor(pos.x / cell_size), std::floor(pos.y / cell_size), std::floor(pos.z / cell_size), pos.w, pos.world, pos.universe);
+}
+
+void PlayerGrid::update(PlayerState *player, const MapPos<double>& pos) {
+  MapPos<int> cell = cell_of(pos);
+  
+  std::unique_lock<std::shared_mutex> grid_lock(lock);
+  
+  auto search = player_cells.find(player);
+  if(search != player_cells.end()) {
+    if(search->second == cell) { return; }
+    
+    std::vector<PlayerState*>& old_cell = cells[search->second];
+    auto it = std::find(old_cell.begin(), old_cell.end(), player);
+    if(it != old_cell.end()) {
+      *it = old_cell.back();
+      old_cell.pop_back();
+    }
+    if(old_cell.empty()) {
+      cells.erase(search->second);
+    }
+    search->second = cell;
+  } else {
+    player_cells[player] = cell;
+  }
+  
+  cells[cell].push_back(player);
+}
+
+void PlayerGrid::remove(PlayerState *player) {
+  std::unique_lock<std::shared_mutex> grid_lock(lock);
+  
+  auto search = player_cells.find(player);
+  if(search == player_cells.end()) { return; }
+  
+  std::vector<PlayerState*>& cell = cells[search->second];
+  auto it = std::find(cell.begin(), cell.end(), player);
+  if(it != cell.end()) {
+    *it = cell.back();
+    cell.pop_back();
+  }
+  if(cell.empty()) {
+    cells.erase(search->second);
+  }
+  player_cells.erase(search);
+}
+
+std::vector<PlayerState*> PlayerGrid::query(const MapPos<double>& pos, double radius) const {
+  MapPos<double> min_pos(pos.x - radius, pos.y - radius, pos.z - radius, pos.w, pos.world, pos.universe);
+  MapPos<double> max_pos(pos.x + radius, pos.y + radius, pos.z + radius, pos.w, pos.world, pos.universe);
+  MapPos<int> min_cell = cell_of(min_pos);
+  MapPos<int> max_cell = cell_of(max_pos);
+  
+  std::vector<PlayerState*> res;
+  
+  std::shared_lock<std::shared_mutex> grid_lock(lock);
+  for(int x = min_cell.x; x <= max_cell.x; x++) {
+    for(int y = min_cell.y; y <= max_cell.y; y++) {
+      for(int z = min_cell.z; z <= max_cell.z; z++) {
+        auto search = cells.find(MapPos<int>(x, y, z, pos.w, pos.world, pos.universe));
+        if(search != cells.end()) {
+          res.insert(res.end(), search->second.begin(), search->second.end());
+        }
+      }
+    }
+  }
+  
+  return res;
+}
@@ -0,0 +1,66 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PLAYER_GRID_H__
+#define __PLAYER_GRID_H__
+
+#include "vector.h"
+
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+
+class PlayerState;
+
+struct PlayerGridCellHash {
+  size_t operator()(const MapPos<int>& cell) const {
+    size_t h = (size_t) cell.x * 73856093u;
+    h ^= (size_t) cell.y * 19349663u;
+    h ^= (size_t) cell.z * 83492791u;
+    h ^= (size_t) cell.w * 2654435761u;
+    h ^= ((size_t) cell.world << 20) ^ ((size_t) cell.universe << 40);
+    return h;
+  }
+};
+
+//Uniform grid of player positions, so that finding the players near a point
+//only looks at a few cells instead of every connected player.
+//Cells are keyed by w, world, and universe as well, since players in different
+//ones can never see each other.
+//Has its own lock, which is only held inside these methods; callers may hold player locks.
+class PlayerGrid {
+  public:
+    PlayerGrid(double _cell_size) : cell_size(_cell_size) {}
+    
+    //Adds the player, or moves them to the cell for their new position.
+    void update(PlayerState *player, const MapPos<double>& pos);
+    void remove(PlayerState *player);
+    
+    //Every player in a cell within radius of pos. May include players further than radius away.
+    std::vector<PlayerState*> query(const MapPos<double>& pos, double radius) const;
+    
+  private:
+    MapPos<int> cell_of(const MapPos<double>& pos) const;
+    
+    double cell_size;
+    std::unordered_map<MapPos<int>, std::vector<PlayerState*>, PlayerGridCellHash> cells;
+    std::unordered_map<PlayerState*, MapPos<int>> player_cells;
+    mutable std::shared_mutex lock;
+};
+
+#endif
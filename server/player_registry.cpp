@@ -0,0 +1,118 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "player_registry.h"
+
+#include <algorithm>
+
+PlayerRef PlayerSnapshot::get(connection_hdl hdl) const {
+  auto search = by_hdl.find(hdl);
+  return search == by_hdl.end() ? NULL : search->second;
+}
+
+PlayerRef PlayerSnapshot::get_by_tag(const std::string& tag) const {
+  auto search = by_tag.find(tag);
+  return search == by_tag.end() ? NULL : search->second;
+}
+
+PlayerRef PlayerSnapshot::get_by_name(const std::string& name) const {
+  auto search = by_name.find(name);
+  return search == by_name.end() ? NULL : search->second;
+}
+
+PlayerRef PlayerSnapshot::get_by_auth_id(const std::string& auth_id) const {
+  auto search = by_auth_id.find(auth_id);
+  return search == by_auth_id.end() ? NULL : search->second;
+}
+
+PlayerRef PlayerSnapshot::find(const std::string& name_or_id) const {
+  PlayerRef found = get_by_name(name_or_id);
+  if(found) { return found; }
+  found = get_by_tag(name_or_id);
+  if(found) { return found; }
+  return get_by_auth_id(name_or_id);
+}
+
+PlayerRegistry::PlayerRegistry() : current(std::make_shared<const PlayerSnapshot>()) {}
+
+std::shared_ptr<const PlayerSnapshot> PlayerRegistry::snapshot() const {
+  return std::atomic_load(&current);
+}
+
+void PlayerRegistry::publish(std::shared_ptr<PlayerSnapshot> next) {
+  std::atomic_store(&current, std::shared_ptr<const PlayerSnapshot>(next));
+}
+
+//The player's old name and auth id are gone by the time they change, so their entries are found by value.
+void PlayerRegistry::unindex_name(PlayerSnapshot& snapshot, const PlayerRef& player) {
+  for(auto index : {&snapshot.by_name, &snapshot.by_auth_id}) {
+    for(auto it = index->begin(); it != index->end();) {
+      if(it->second == player) {
+        it = index->erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+}
+
+//The new player's name is its tag until it logs in, see reindex.
+void PlayerRegistry::add(PlayerRef player) {
+  std::unique_lock<std::mutex> lock(write_lock);
+  
+  std::shared_ptr<PlayerSnapshot> next = std::make_shared<PlayerSnapshot>(*snapshot());
+  next->players.push_back(player);
+  next->by_hdl[player->m_connection_hdl] = player;
+  next->by_tag[player->get_tag()] = player;
+  next->by_name[player->get_name()] = player;
+  publish(next);
+}
+
+PlayerRef PlayerRegistry::remove(connection_hdl hdl) {
+  std::unique_lock<std::mutex> lock(write_lock);
+  
+  std::shared_ptr<const PlayerSnapshot> prev = snapshot();
+  PlayerRef player = prev->get(hdl);
+  if(!player) { return NULL; }
+  
+  std::shared_ptr<PlayerSnapshot> next = std::make_shared<PlayerSnapshot>(*prev);
+  next->players.erase(std::find(next->players.begin(), next->players.end(), player));
+  next->by_hdl.erase(hdl);
+  next->by_tag.erase(player->get_tag());
+  unindex_name(*next, player);
+  publish(next);
+  
+  return player;
+}
+
+void PlayerRegistry::reindex(PlayerState *player) {
+  std::unique_lock<std::mutex> lock(write_lock);
+  
+  std::shared_ptr<const PlayerSnapshot> prev = snapshot();
+  auto search = prev->by_tag.find(player->get_tag());
+  if(search == prev->by_tag.end()) { return; }
+  PlayerRef ref = search->second;
+  
+  std::shared_ptr<PlayerSnapshot> next = std::make_shared<PlayerSnapshot>(*prev);
+  unindex_name(*next, ref);
+  next->by_name[player->get_name()] = ref;
+  if(player->auth) {
+    next->by_auth_id[player->data.auth_id] = ref;
+  }
+  publish(next);
+}
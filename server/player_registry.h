@@ -0,0 +1,85 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PLAYER_REGISTRY_H__
+#define __PLAYER_REGISTRY_H__
+
+#include "player.h"
+
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+
+typedef std::shared_ptr<PlayerState> PlayerRef;
+
+//The connected players as of one moment, with indexes for finding them. Never changes once published.
+class PlayerSnapshot {
+  public:
+    //NULL if not found
+    PlayerRef get(connection_hdl hdl) const;
+    PlayerRef get_by_tag(const std::string& tag) const;
+    PlayerRef get_by_name(const std::string& name) const;
+    PlayerRef get_by_auth_id(const std::string& auth_id) const;
+    //By name, tag, or auth id (logged in players only), in that order.
+    PlayerRef find(const std::string& name_or_id) const;
+    
+    size_t size() const { return players.size(); }
+    const PlayerRef& operator[](size_t index) const { return players[index]; }
+    std::vector<PlayerRef>::const_iterator begin() const { return players.begin(); }
+    std::vector<PlayerRef>::const_iterator end() const { return players.end(); }
+    
+  private:
+    friend class PlayerRegistry;
+    
+    std::vector<PlayerRef> players; //in the order they connected
+    std::map<connection_hdl, PlayerRef, std::owner_less<connection_hdl>> by_hdl;
+    std::map<std::string, PlayerRef> by_tag;
+    std::map<std::string, PlayerRef> by_name;
+    std::map<std::string, PlayerRef> by_auth_id;
+};
+
+//Every connected player. Readers take a snapshot, which costs a reference count and never waits for
+//joins or leaves; writers copy the current snapshot, change the copy, and publish it, one at a time.
+//A snapshot keeps its players alive, so a PlayerState is only deleted once nobody can reach it.
+//Players in an old snapshot may have disconnected since: check PlayerState::closed, with the player's
+//lock held, before doing anything on their behalf.
+//The registry never takes player locks, so it can be used with one held.
+class PlayerRegistry {
+  public:
+    PlayerRegistry();
+    
+    std::shared_ptr<const PlayerSnapshot> snapshot() const;
+    
+    void add(PlayerRef player);
+    //Returns the removed player, or NULL if there was none.
+    PlayerRef remove(connection_hdl hdl);
+    //Updates the name and auth id indexes after the player's name or login changed.
+    //Call with the player's lock held.
+    void reindex(PlayerState *player);
+    
+  private:
+    void publish(std::shared_ptr<PlayerSnapshot> next);
+    static void unindex_name(PlayerSnapshot& snapshot, const PlayerRef& player);
+    
+    std::shared_ptr<const PlayerSnapshot> current; //only accessed with std::atomic_load/std::atomic_store
+    std::mutex write_lock;
+};
+
+#endif
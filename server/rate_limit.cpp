@@ -0,0 +1,94 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "rate_limit.h"
+#include "config.h"
+
+#include <algorithm>
+#include <sstream>
+
+TokenBucket::TokenBucket() : TokenBucket(0, 0) {}
+
+TokenBucket::TokenBucket(double _rate, double _burst)
+    : rate(_rate), burst(std::max(_burst, 1.0)), tokens(burst), last_refill(std::chrono::steady_clock::now()) {}
+
+bool TokenBucket::take(double count, std::chrono::time_point<std::chrono::steady_clock> now) {
+  if(rate <= 0) {
+    return true;
+  }
+  
+  double elapsed = std::chrono::duration<double>(now - last_refill).count();
+  last_refill = now;
+  tokens = std::min(burst, tokens + elapsed * rate);
+  
+  if(tokens < count) {
+    return false;
+  }
+  tokens -= count;
+  return true;
+}
+
+RateLimiter::RateLimiter()
+    : violations{0, 0, 0, 0},
+      kick_violations(get_config<int>("ratelimit.kick_violations")),
+      window_start(std::chrono::steady_clock::now()), window_violations(0) {
+  for(int i = 0; i < RATE_ACTION_COUNT; i++) {
+    std::string name = action_name((RateAction) i);
+    buckets[i] = TokenBucket(get_config<int>("ratelimit." + name + "_rate"), get_config<int>("ratelimit." + name + "_burst"));
+  }
+}
+
+bool RateLimiter::allow(RateAction action, double count) {
+  std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+  if(buckets[(int) action].take(count, now)) {
+    return true;
+  }
+  
+  violations[(int) action]++;
+  if(now - window_start > std::chrono::seconds(RATE_LIMIT_KICK_WINDOW)) {
+    window_start = now;
+    window_violations = 0;
+  }
+  window_violations++;
+  return false;
+}
+
+bool RateLimiter::should_kick() const {
+  return kick_violations > 0 && window_violations > kick_violations;
+}
+
+std::string RateLimiter::action_name(RateAction action) {
+  switch(action) {
+    case RateAction::SET_PLAYER_POS: return "set_player_pos";
+    case RateAction::REQ_MAPBLOCK: return "req_mapblock";
+    case RateAction::DIG_NODE: return "dig_node";
+    case RateAction::PLACE_NODE: return "place_node";
+  }
+  return "unknown";
+}
+
+std::string RateLimiter::status() const {
+  std::ostringstream out;
+  for(int i = 0; i < RATE_ACTION_COUNT; i++) {
+    if(i > 0) {
+      out << ", ";
+    }
+    out << action_name((RateAction) i) << " " << violations[i];
+  }
+  return out.str();
+}
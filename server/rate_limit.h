@@ -0,0 +1,78 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RATE_LIMIT_H__
+#define __RATE_LIMIT_H__
+
+#include <string>
+#include <chrono>
+
+//Player actions that cost the server enough to be limited.
+enum class RateAction {SET_PLAYER_POS, REQ_MAPBLOCK, DIG_NODE, PLACE_NODE};
+#define RATE_ACTION_COUNT 4
+
+//Length of the rolling interval over which violations are counted towards ratelimit.kick_violations, in seconds.
+#define RATE_LIMIT_KICK_WINDOW 10
+
+//Allows 'rate' actions per second on average, with up to 'burst' at once after a quiet spell.
+//A rate of zero means no limit.
+class TokenBucket {
+  public:
+    TokenBucket();
+    TokenBucket(double _rate, double _burst);
+    
+    bool take(double count, std::chrono::time_point<std::chrono::steady_clock> now);
+  
+  private:
+    double rate;
+    double burst;
+    double tokens;
+    std::chrono::time_point<std::chrono::steady_clock> last_refill;
+};
+
+//Per-player limits on each kind of RateAction, set by the ratelimit.* config keys.
+//Actions over the limit are dropped and counted as violations; too many violations in
+//RATE_LIMIT_KICK_WINDOW seconds means the player should be kicked.
+//Not thread safe; guarded by the player's lock.
+class RateLimiter {
+  public:
+    RateLimiter();
+    
+    //Whether the action may go ahead now. 'count' is how many actions it stands for,
+    //such as the number of mapblocks in a batched request.
+    bool allow(RateAction action, double count = 1);
+    
+    //Whether the last violation was the first in its window, so that it's logged once rather than every time.
+    bool first_violation() const { return window_violations == 1; }
+    //Whether there have been more than ratelimit.kick_violations violations in the window; never if that's zero.
+    bool should_kick() const;
+    
+    static std::string action_name(RateAction action);
+    //Violation counts since login, for /who
+    std::string status() const;
+  
+  private:
+    TokenBucket buckets[RATE_ACTION_COUNT];
+    unsigned long violations[RATE_ACTION_COUNT];
+    
+    int kick_violations;
+    std::chrono::time_point<std::chrono::steady_clock> window_start;
+    int window_violations;
+};
+
+#endif
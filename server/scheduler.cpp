@@ -0,0 +1,103 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "scheduler.h"
+
+#include <map>
+#include <sstream>
+
+std::map<WorkClass, std::string> work_class_names = {
+  {WorkClass::MAPBLOCK_STREAM, "mapblock_stream"},
+  {WorkClass::MAPBLOCK_PREP, "mapblock_prep"},
+  {WorkClass::FLUIDS, "fluids"},
+  {WorkClass::FURNACES, "furnaces"},
+  {WorkClass::BACKGROUND, "background"}
+};
+
+WorkScheduler::WorkScheduler()
+    : last_total(std::chrono::steady_clock::duration::zero())
+{
+  for(int i = 0; i < WORK_CLASS_COUNT; i++) {
+    last_used[i] = std::chrono::steady_clock::duration::zero();
+  }
+}
+
+void WorkScheduler::add(WorkClass work_class, std::string name, WorkStep step) {
+  std::unique_lock<std::shared_mutex> l(lock);
+  queues[static_cast<int>(work_class)].push_back(WorkJob(name, step));
+}
+
+bool WorkScheduler::has_work(WorkClass work_class) {
+  std::shared_lock<std::shared_mutex> l(lock);
+  return queues[static_cast<int>(work_class)].size() > 0;
+}
+
+void WorkScheduler::run(std::chrono::steady_clock::duration budget) {
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + budget;
+  
+  for(int i = 0; i < WORK_CLASS_COUNT; i++) {
+    last_used[i] = std::chrono::steady_clock::duration::zero();
+  }
+  
+  //Strict priority: a class only gets time once every class above it has run out of work.
+  //At least one step is always run, so that something makes progress even if the budget is tiny.
+  bool first = true;
+  for(int i = 0; i < WORK_CLASS_COUNT; i++) {
+    while(first || std::chrono::steady_clock::now() < deadline) {
+      std::unique_lock<std::shared_mutex> l(lock);
+      if(queues[i].size() == 0) { break; }
+      WorkJob job = queues[i].front();
+      queues[i].pop_front();
+      l.unlock();
+      
+      //Jobs may queue more work, so the lock isn't held while they run.
+      auto step_start = std::chrono::steady_clock::now();
+      bool done = job.step();
+      last_used[i] += std::chrono::steady_clock::now() - step_start;
+      first = false;
+      
+      if(!done) {
+        //Not finished; it keeps its place at the front of the queue.
+        l.lock();
+        queues[i].push_front(job);
+      }
+    }
+  }
+  
+  last_total = std::chrono::steady_clock::now() - start;
+}
+
+std::string WorkScheduler::last_run_summary() {
+  std::shared_lock<std::shared_mutex> l(lock);
+  
+  std::ostringstream out;
+  for(int i = 0; i < WORK_CLASS_COUNT; i++) {
+    if(i > 0) { out << ", "; }
+    out << work_class_names[static_cast<WorkClass>(i)] << " "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(last_used[i]).count() << " ms";
+    if(queues[i].size() > 0) {
+      out << " (" << queues[i].size() << " waiting)";
+    }
+  }
+  return out.str();
+}
+
+std::chrono::steady_clock::duration WorkScheduler::last_run_duration() {
+  return last_total;
+}
@@ -0,0 +1,74 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <string>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+
+//Priority classes for deferred work, highest priority first.
+enum class WorkClass {
+  MAPBLOCK_STREAM,
+  MAPBLOCK_PREP,
+  FLUIDS,
+  FURNACES,
+  BACKGROUND
+};
+#define WORK_CLASS_COUNT 5
+
+//A job is called repeatedly, doing a bounded slice of its work each time,
+//and returns true once it has finished.
+typedef std::function<bool()> WorkStep;
+
+class WorkJob {
+  public:
+    WorkJob(std::string _name, WorkStep _step) : name(_name), step(_step) {}
+    
+    std::string name;
+    WorkStep step;
+};
+
+//Cooperative scheduler for work that doesn't have to finish within a single tick.
+//Each call to run() steps through queued jobs, highest priority class first, until the time budget is used up.
+//Whatever is left over picks up where it left off on the next call.
+class WorkScheduler {
+  public:
+    WorkScheduler();
+    
+    void add(WorkClass work_class, std::string name, WorkStep step);
+    bool has_work(WorkClass work_class);
+    
+    void run(std::chrono::steady_clock::duration budget);
+    
+    //Time spent on each class during the last run(), and anything still waiting, for logging.
+    std::string last_run_summary();
+    std::chrono::steady_clock::duration last_run_duration();
+    
+  private:
+    std::deque<WorkJob> queues[WORK_CLASS_COUNT];
+    std::chrono::steady_clock::duration last_used[WORK_CLASS_COUNT];
+    std::chrono::steady_clock::duration last_total;
+    std::shared_mutex lock;
+};
+
+#endif
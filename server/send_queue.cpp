@@ -0,0 +1,168 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "send_queue.h"
+
+#include <algorithm>
+
+SendQueue::SendQueue() : next_seq(0), slow(false), dropped(0) {
+  for(int i = 0; i < SEND_CLASS_COUNT; i++) {
+    queue_bytes[i] = 0;
+  }
+}
+
+bool SendQueue::empty() const {
+  for(int i = 0; i < SEND_CLASS_COUNT; i++) {
+    if(!queues[i].empty()) { return false; }
+  }
+  return true;
+}
+
+std::vector<OutboundMessage> SendQueue::push(SendClass send_class, OutboundMessage msg) {
+  std::vector<OutboundMessage> out;
+  std::deque<OutboundMessage>& queue = queues[(int) send_class];
+  size_t& bytes = queue_bytes[(int) send_class];
+  
+  if(empty()) {
+    waiting_since = std::chrono::steady_clock::now();
+  }
+  msg.seq = next_seq++;
+  
+  if(msg.coalesce_key != "") {
+    for(auto& it : queue) {
+      if(it.coalesce_key == msg.coalesce_key) {
+        bytes -= it.data->size();
+        bytes += msg.data->size();
+        it = std::move(msg);
+        return out;
+      }
+    }
+  }
+  
+  if(send_class == SendClass::MAPBLOCKS) {
+    if(slow) {
+      //Anything still queued for these mapblocks was already dropped when the connection turned slow.
+      dropped += msg.mapblocks.size();
+      out.push_back(std::move(msg));
+      return out;
+    }
+    
+    while(!queue.empty() && bytes + msg.data->size() > SEND_QUEUE_MAPBLOCK_LIMIT) {
+      std::set<MapPos<int>> oldest;
+      for(const auto& it : queue.front().mapblocks) {
+        oldest.insert(it.pos);
+      }
+      drop_mapblocks(oldest, out);
+    }
+    //This may be a delta against one of the dropped versions, so it has to go too.
+    for(const auto& it : out) {
+      for(const auto& mb : it.mapblocks) {
+        for(const auto& msg_mb : msg.mapblocks) {
+          if(mb.pos == msg_mb.pos) {
+            dropped += msg.mapblocks.size();
+            out.push_back(std::move(msg));
+            return out;
+          }
+        }
+      }
+    }
+  }
+  
+  bytes += msg.data->size();
+  queue.push_back(std::move(msg));
+  return out;
+}
+
+//Drops every queued version of the given mapblocks. Versions after a dropped one may be deltas against it,
+//and messages can carry several mapblocks, so this keeps going until nothing queued carries any of them.
+void SendQueue::drop_mapblocks(std::set<MapPos<int>> positions, std::vector<OutboundMessage>& out) {
+  std::deque<OutboundMessage>& queue = queues[(int) SendClass::MAPBLOCKS];
+  size_t first_out = out.size();
+  
+  bool found = true;
+  while(found) {
+    found = false;
+    for(auto it = queue.begin(); it != queue.end();) {
+      bool carries = false;
+      for(const auto& mb : it->mapblocks) {
+        if(positions.find(mb.pos) != positions.end()) {
+          carries = true;
+          break;
+        }
+      }
+      if(!carries) {
+        it++;
+        continue;
+      }
+      
+      for(const auto& mb : it->mapblocks) {
+        positions.insert(mb.pos);
+      }
+      queue_bytes[(int) SendClass::MAPBLOCKS] -= it->data->size();
+      dropped += it->mapblocks.size();
+      out.push_back(std::move(*it));
+      it = queue.erase(it);
+      found = true;
+    }
+  }
+  
+  std::sort(out.begin() + first_out, out.end(), [](const OutboundMessage& a, const OutboundMessage& b) { return a.seq < b.seq; });
+}
+
+std::vector<OutboundMessage> SendQueue::drop(std::set<MapPos<int>> positions) {
+  std::vector<OutboundMessage> out;
+  drop_mapblocks(positions, out);
+  return out;
+}
+
+bool SendQueue::pop(OutboundMessage& msg) {
+  for(int i = 0; i < SEND_CLASS_COUNT; i++) {
+    if(queues[i].empty()) { continue; }
+    
+    msg = std::move(queues[i].front());
+    queues[i].pop_front();
+    queue_bytes[i] -= msg.data->size();
+    
+    if(empty()) {
+      slow = false;
+    }
+    return true;
+  }
+  return false;
+}
+
+std::vector<OutboundMessage> SendQueue::check_slow() {
+  std::vector<OutboundMessage> out;
+  if(empty()) {
+    slow = false;
+    return out;
+  }
+  if(slow || std::chrono::steady_clock::now() - waiting_since < SEND_QUEUE_SLOW_TIME) {
+    return out;
+  }
+  
+  slow = true;
+  std::set<MapPos<int>> all;
+  for(const auto& it : queues[(int) SendClass::MAPBLOCKS]) {
+    for(const auto& mb : it.mapblocks) {
+      all.insert(mb.pos);
+    }
+  }
+  drop_mapblocks(all, out);
+  return out;
+}
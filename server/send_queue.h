@@ -0,0 +1,110 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SEND_QUEUE_H__
+#define __SEND_QUEUE_H__
+
+#include "vector.h"
+#include "mapblock.h"
+
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <set>
+#include <optional>
+#include <chrono>
+
+//Classes of outbound messages, highest priority first.
+enum class SendClass {
+  CONTROL,  //position corrections, privileges, protocol setup, time
+  UI,       //inventory, UI windows, chat
+  ENTITIES,
+  MAPBLOCKS
+};
+#define SEND_CLASS_COUNT 4
+
+//Messages are only handed to websocketpp while it has less than this many bytes buffered for the connection.
+#define SEND_BUFFER_TARGET (256 * 1024)
+//Most bytes of mapblocks that can be queued for one player; the oldest are dropped to make room.
+#define SEND_QUEUE_MAPBLOCK_LIMIT (2 * 1024 * 1024)
+//A connection whose queue hasn't emptied for this long is considered slow, and gets no mapblocks until it catches up.
+#define SEND_QUEUE_SLOW_TIME std::chrono::seconds(2)
+
+//A mapblock carried by a message, and the version the player had before it, so that can be restored if the message is dropped.
+class OutboundMapblock {
+  public:
+    OutboundMapblock(MapPos<int> _pos, std::optional<MapblockUpdateInfo> _prev) : pos(_pos), prev(_prev) {}
+    
+    MapPos<int> pos;
+    std::optional<MapblockUpdateInfo> prev;
+};
+
+class OutboundMessage {
+  public:
+    OutboundMessage() : binary(false), seq(0) {}
+    OutboundMessage(std::string _data, bool _binary) : data(std::make_shared<const std::string>(std::move(_data))), binary(_binary), seq(0) {}
+    OutboundMessage(std::shared_ptr<const std::string> _data, bool _binary) : data(_data), binary(_binary), seq(0) {}
+    
+    std::shared_ptr<const std::string> data; //may be shared with other players' queues
+    bool binary;
+    
+    //If set, a newer message with the same key replaces this one while it's still queued.
+    std::string coalesce_key;
+    
+    //Mapblock messages only
+    std::vector<OutboundMapblock> mapblocks;
+    
+    uint64_t seq; //order queued in, set by SendQueue
+};
+
+//Per-player queue of messages waiting for the connection to have room for them.
+//Not thread safe; PlayerState guards it with its send lock.
+class SendQueue {
+  public:
+    SendQueue();
+    
+    //Returns any mapblock messages dropped to make room (possibly including this one), oldest first.
+    std::vector<OutboundMessage> push(SendClass send_class, OutboundMessage msg);
+    //Takes the oldest message of the highest priority class that has any.
+    bool pop(OutboundMessage& msg);
+    
+    //Checks for a slow connection, dropping all queued mapblocks (returned oldest first) if it is one.
+    std::vector<OutboundMessage> check_slow();
+    //Drops every queued version of these mapblocks, returning the dropped messages oldest first.
+    //Other mapblocks carried by the same messages go with them.
+    std::vector<OutboundMessage> drop(std::set<MapPos<int>> positions);
+    
+    bool empty() const;
+    bool is_slow() const { return slow; }
+    size_t count(SendClass send_class) const { return queues[(int) send_class].size(); }
+    size_t bytes(SendClass send_class) const { return queue_bytes[(int) send_class]; }
+    size_t mapblocks_dropped() const { return dropped; }
+    
+  private:
+    void drop_mapblocks(std::set<MapPos<int>> positions, std::vector<OutboundMessage>& out);
+    
+    std::deque<OutboundMessage> queues[SEND_CLASS_COUNT];
+    uint64_t next_seq;
+    size_t queue_bytes[SEND_CLASS_COUNT];
+    std::chrono::time_point<std::chrono::steady_clock> waiting_since;
+    bool slow;
+    size_t dropped;
+};
+
+#endif
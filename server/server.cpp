@@ -23,14 +23,24 @@
 #include "player_util.h"
 
 #include <thread>
+#include <algorithm>
 
 
 
 Server::Server(Database& _db, std::map<int, World*> _worlds)
-    : m_timer(m_io, boost::asio::chrono::milliseconds(SERVER_TICK_INTERVAL)), db(_db), map(_db, _worlds, m_io),
-      mapblock_tick_counter(0), fluid_tick_counter(0), slow_tick_counter(0),
-      last_tick(std::chrono::steady_clock::now()),
-      halt(false)
+    : player_grid(PLAYER_GRID_CELL_SIZE),
+      db(_db), map(_db, _worlds, m_io),
+      mapblock_tick_counter(0), fluid_tick_counter(0), slow_tick_counter(0), interact_tick_counter(0),
+      mapblock_tick_ratio(std::max(get_config<int>("server.mapblock_tick_ratio"), 1)),
+      fluid_tick_ratio(std::max(get_config<int>("server.fluid_tick_ratio"), 1)),
+      slow_tick_ratio(std::max(get_config<int>("server.slow_tick_ratio"), 1)),
+      interact_tick_ratio(std::max(get_config<int>("server.interact_tick_ratio"), 1)),
+      tick_scheduler(std::chrono::milliseconds(std::max(get_config<int>("server.tick_interval"), 1)),
+                     TickScheduler::parse_policy(get_config<std::string>("server.tick_policy")),
+                     get_config<int>("server.tick_max_catch_up")),
+      tick_work_budget(get_config<int>("server.tick_work_budget")), tick_pool(get_config<int>("server.tick_threads")),
+      interest_tick_next(0), change_tick_next(0), change_tick_started(false), stream_tick_next(0), fluid_tick_started(false),
+      interact_tick_started(false), interact_tick_last(0, 0, 0, 0, 0, 0)
 #ifdef DEBUG_NET
     , mb_out_count(0), mb_out_len(0)
 #endif
@@ -44,6 +54,10 @@ Server::Server(Database& _db, std::map<int, World*> _worlds)
   
   m_server.init_asio(&m_io);
   
+  map.set_change_handler(std::bind(&MapblockSubscribers::changed, &mapblock_subscribers, std::placeholders::_1));
+  map.set_region_meta_handler(std::bind(&Server::has_node_meta, this, std::placeholders::_1),
+                              std::bind(&Server::on_region_edit_node, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+  
   m_server.set_message_handler(
       websocketpp::lib::bind(&Server::on_message, this, ::_1, ::_2));
   m_server.set_open_handler(
@@ -59,7 +73,7 @@ Server::Server(Database& _db, std::map<int, World*> _worlds)
 }
 
 void Server::run(uint16_t port) {
-  m_timer.async_wait(boost::bind(&Server::tick, this, boost::asio::placeholders::error));
+  tick_scheduler.start(std::bind(&Server::tick, this));
   
   m_server.listen(port);
   m_server.start_accept();
@@ -93,6 +107,9 @@ void Server::run(uint16_t port) {
       threads[i].join();
     }
   }
+  
+  tick_scheduler.stop();
+  tick_scheduler.join();
 }
 
 #ifdef TLS
@@ -143,27 +160,21 @@ void Server::terminate() {
   terminate(get_config<std::string>("server.default_terminate_message"));
 }
 void Server::terminate(std::string message) {
-  //std::unique_lock<std::shared_mutex> list_lock(m_players_lock);
   log(LogSource::SERVER, LogLevel::NOTICE, "Server terminating: " + message);
   chat_send("server", "Server terminating: " + message);
   
-  std::unique_lock<std::shared_mutex> tick_info_l(tick_info_lock);
-  halt = true;
-  tick_info_l.unlock();
+  tick_scheduler.stop();
   
   m_server.stop_listening();
   
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  for(auto p : m_players) {
-    connection_hdl hdl = p.first;
-    PlayerState *player = p.second;
-    
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
+  for(const PlayerRef& player : *players) {
     {
       std::unique_lock<std::shared_mutex> player_lock(player->lock);
       
       try {
         //on_close will be run later, so no worries about deadlocks
-        m_server.close(hdl, websocketpp::close::status::going_away, message);
+        m_server.close(player->m_connection_hdl, websocketpp::close::status::going_away, message);
       } catch(websocketpp::exception const& e) {
         log(LogSource::SERVER, LogLevel::ERR, "Socket error: " + std::string(e.what()));
       }
@@ -174,17 +185,17 @@ void Server::terminate(std::string message) {
 }
 
 std::string Server::status() const {
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
   
-  std::string s = "-- Server v" + std::string(VERSION) + "; " + std::to_string(m_players.size()) + " players {";
+  std::string s = "-- Server v" + std::string(VERSION) + "; " + std::to_string(players->size()) + " players {";
   
   bool first = true;
-  for(auto const& x : m_players) {
+  for(const PlayerRef& player : *players) {
     if(!first) { s += ", "; }
     first = false;
     
-    std::shared_lock<std::shared_mutex> player_lock(x.second->lock);
-    s += x.second->get_name();
+    std::shared_lock<std::shared_mutex> player_lock(player->lock);
+    s += player->get_name();
   }
   
   s += "}";
@@ -198,12 +209,10 @@ std::string Server::status() const {
 }
 
 std::string Server::list_status_json() const {
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  
   std::ostringstream out;
   
   out << "{\"version\":\"" << json_escape(std::string(VERSION)) << "\","
-      << "\"players\":" << m_players.size() << ",";
+      << "\"players\":" << m_players.snapshot()->size() << ",";
   
   int player_limit = get_config<int>("server.max_players");
   if(player_limit < 0) {
@@ -227,11 +236,8 @@ void Server::chat_send(std::string channel, std::string from, std::string messag
             << "\"message\":\"" << json_escape(message) << "\"}";
   std::string broadcast_str = broadcast.str();
   
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  
-  for(auto p : m_players) {
-    PlayerState *receiver = p.second;
-    
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
+  for(const PlayerRef& receiver : *players) {
     std::shared_lock<std::shared_mutex> player_lock(receiver->lock);
     receiver->send(broadcast_str);
   }
@@ -246,11 +252,8 @@ void Server::chat_send(std::string channel, std::string message) {
             << "\"message\":\"" << json_escape(message) << "\"}";
   std::string broadcast_str = broadcast.str();
   
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  
-  for(auto p : m_players) {
-    PlayerState *receiver = p.second;
-    
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
+  for(const PlayerRef& receiver : *players) {
     std::shared_lock<std::shared_mutex> player_lock(receiver->lock);
     receiver->send(broadcast_str);
   }
@@ -283,42 +286,11 @@ void Server::set_time(int hours, int minutes) {
   out << "{\"type\":\"set_time\",\"hours\":" << server_time.hours << ",\"minutes\":" << server_time.minutes << "}";
   std::string out_str = out.str();
   
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  for(auto p : m_players) {
-    PlayerState *receiver = p.second;
-    
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
+  for(const PlayerRef& receiver : *players) {
     std::shared_lock<std::shared_mutex> player_lock(receiver->lock);
-    receiver->send(out_str);
+    receiver->send_coalesced("time", out_str, SendClass::CONTROL);
   }
   
   log(LogSource::SERVER, LogLevel::INFO, "Time set to " + std::to_string(server_time.hours) + ":" + (server_time.minutes < 10 ? "0" : "") + std::to_string(server_time.minutes) + ".");
 }
-
-PlayerState* Server::get_player_by_tag(std::string tag) {
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  
-  for(auto p : m_players) {
-    PlayerState *check = p.second;
-    if(check->get_tag() == tag)
-      return check;
-  }
-  return NULL;
-}
-
-PlayerState* Server::find_player(std::string name_or_id) {
-  PlayerState *target = NULL;
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  for(auto it : m_players) {
-    PlayerState *player_check = it.second;
-    std::shared_lock<std::shared_mutex> player_lock_shared(player_check->lock);
-    if(player_check->get_name() == name_or_id ||
-       player_check->get_tag() == name_or_id ||
-       (player_check->auth && player_check->data.auth_id == name_or_id))
-    {
-      target = player_check;
-      break;
-    }
-  }
-  
-  return target;
-}
@@ -20,12 +20,15 @@
 #define __SERVER_H__
 
 #define VERSION "0.4.10-dev1"
-#define SERVER_TICK_INTERVAL 250
-#define SERVER_MAPBLOCK_TICK_RATIO 2
-#define SERVER_FLUID_TICK_RATIO 8
-#define SERVER_SLOW_TICK_RATIO 1 //number of ticks to each slow tick
-#define SERVER_INTERACT_TICK_RATIO 8
+//How much of each kind of deferred work to do per step; the scheduler checks its time budget between steps.
+#define SERVER_INTEREST_STEP_PLAYERS 8
+#define SERVER_CHANGE_STEP_PLAYERS 8
+#define SERVER_STREAM_STEP_PLAYERS 4
+#define SERVER_FLUID_STEP_MAPBLOCKS 32
+#define SERVER_INTERACT_STEP_NODES 32
 #define PLAYER_ENTITY_VISIBILE_DISTANCE 200
+//Must be at least the visible distance, so visibility checks only need the 27 cells around a player
+#define PLAYER_GRID_CELL_SIZE PLAYER_ENTITY_VISIBILE_DISTANCE
 #define PLAYER_MAPBLOCK_INTEREST_DISTANCE 2
 #define PLAYER_MAPBLOCK_INTEREST_DISTANCE_W 0
 #define PLAYER_MAPBLOCK_INTEREST_DISTANCE_SMALL 1
@@ -34,6 +37,8 @@
 #include "vector.h"
 
 #define PLAYER_LIMIT_VIEW_DISTANCE MapPos<int>(3, 3, 3, 1, 0, 0)
+//Most mapblocks that can be asked for in one req_mapblocks message
+#define PLAYER_MAX_MAPBLOCK_BATCH 512
 
 //Client-side reach distance is 10, max player speed is 16 m/s (fast + sprint), and the client sends position updates every 0.25 seconds.
 //Minimum server-side reach distance would then be 14, more added just in case.
@@ -53,6 +58,7 @@
 #include <map>
 #include <sstream>
 #include <set>
+#include <unordered_map>
 #include <chrono>
 #include <cmath>
 #include <shared_mutex>
@@ -81,8 +87,13 @@
 #include "craft.h"
 #include "database.h"
 #include "ui.h"
+#include "scheduler.h"
+#include "tick_pool.h"
+#include "tick_scheduler.h"
 
 #include "player.h"
+#include "player_grid.h"
+#include "player_registry.h"
 #include "player_data.h"
 #include "player_auth.h"
 
@@ -140,6 +151,22 @@ class Server {
     
   private:
     void on_message(connection_hdl hdl, websocketpp::config::asio::message_type::ptr msg);
+    void handle_message(PlayerRef player_ref, websocketpp::config::asio::message_type::ptr msg);
+    void on_binary_message(PlayerState *player, std::unique_lock<std::shared_mutex>& player_lock_unique, const std::string& payload);
+    bool check_rate_limit(PlayerState *player, RateAction action, double count = 1);
+    void save_player(PlayerState *player);
+    void handle_req_mapblock(PlayerState *player, MapPos<int> mb_pos);
+    void handle_req_mapblocks(PlayerState *player, const std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>>& requests);
+    void req_mapblocks_work(PlayerRef player, std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> requests, bool batch);
+    void prepare_entered_mapblocks(PlayerState *player);
+    void req_mapblocks_done(PlayerRef player, std::vector<MapblockUpdateInfo> unchanged, std::vector<std::shared_ptr<const MapblockFrame>> frames, bool batch);
+    void stream_sky_work(PlayerRef player, MapPos<int> center, MapPos<int> sky_pos);
+    void stream_sky_done(PlayerRef player, MapPos<int> center, bool sees_sky);
+    void send_mapblocks_work(PlayerRef player, std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> mapblocks, bool stream);
+    void send_mapblocks_done(PlayerRef player, std::vector<std::pair<std::optional<MapblockUpdateInfo>, std::shared_ptr<const MapblockFrame>>> frames, bool stream);
+    void handle_set_player_pos(PlayerState *player, MapPos<double> pos, Vector3<double> vel, Quaternion rot);
+    void handle_dig_node(PlayerState *player, std::unique_lock<std::shared_mutex>& player_lock_unique, MapPos<int> pos, int wield_index, Node existing);
+    void handle_place_node(PlayerState *player, std::unique_lock<std::shared_mutex>& player_lock_unique, MapPos<int> pos, int wield_index, Node to_place);
     
     void cmd_help(PlayerState *player, std::vector<std::string> args);
     void cmd_nick(PlayerState *player, std::vector<std::string> args);
@@ -161,6 +188,10 @@ class Server {
     void cmd_clearinv(PlayerState *player, std::vector<std::string> args);
     void cmd_creative(PlayerState *player, std::vector<std::string> args);
     void cmd_kick(PlayerState *player, std::vector<std::string> args);
+    void cmd_fill(PlayerState *player, std::vector<std::string> args);
+    void cmd_replace(PlayerState *player, std::vector<std::string> args);
+    void cmd_copy(PlayerState *player, std::vector<std::string> args);
+    void cmd_paste(PlayerState *player, std::vector<std::string> args);
     
     std::map<std::string, ServerCommand> commands_list{
       {"/help", {
@@ -296,6 +327,38 @@ class Server {
         "/kick <player> [<message>] : disconnect a player\n"
         "\n"
         "'kick' privilege required."
+      }},
+      {"/fill", {
+        std::bind(&Server::cmd_fill, this, std::placeholders::_1, std::placeholders::_2),
+        "fill a box with one node",
+        "/fill <x1> <y1> <z1> <x2> <y2> <z2> <itemstring> [<rot>] : set every node in a box\n"
+        "\n"
+        "The box includes both corners, and is in your current w, world, and universe.\n"
+        "For example:\n"
+        "  /fill 0 0 0 9 0 9 default:stone\n"
+        "'worldedit' privilege required."
+      }},
+      {"/replace", {
+        std::bind(&Server::cmd_replace, this, std::placeholders::_1, std::placeholders::_2),
+        "replace one node with another in a box",
+        "/replace <x1> <y1> <z1> <x2> <y2> <z2> <from> <to> : replace every <from> node in a box with <to>\n"
+        "\n"
+        "Replaced nodes keep their rotation.\n"
+        "'worldedit' privilege required."
+      }},
+      {"/copy", {
+        std::bind(&Server::cmd_copy, this, std::placeholders::_1, std::placeholders::_2),
+        "copy a box of nodes",
+        "/copy <x1> <y1> <z1> <x2> <y2> <z2> : copy a box of nodes, for use with /paste\n"
+        "\n"
+        "'worldedit' privilege required."
+      }},
+      {"/paste", {
+        std::bind(&Server::cmd_paste, this, std::placeholders::_1, std::placeholders::_2),
+        "paste a box of nodes",
+        "/paste <x> <y> <z> : paste the nodes from /copy, with their lowest corner at <x> <y> <z>\n"
+        "\n"
+        "'worldedit' privilege required."
       }}
     };
     
@@ -308,14 +371,21 @@ class Server {
     websocketpp::lib::shared_ptr<websocketpp::lib::asio::ssl::context> on_tls_init(connection_hdl hdl);
 #endif
     
-    void tick(const boost::system::error_code&);
+    void tick();
+    bool interest_tick_step();
+    bool mapblock_change_step();
+    bool stream_tick_step();
+    void send_entity_updates(PlayerState *player, const EntitySnapshot& own, const std::unordered_map<PlayerState*, const EntitySnapshot*>& entity_snapshots);
+    bool fluid_tick_step();
     void slow_tick();
-    void interact_tick();
+    bool interact_tick_step();
     
     bool lock_unlock_invlist(InvRef ref, bool do_lock, PlayerState *player_hint);
     
     bool on_place_node(Node node, MapPos<int> pos);
     bool on_dig_node(Node node, MapPos<int> pos);
+    bool has_node_meta(const std::string& itemstring);
+    void on_region_edit_node(MapPos<int> pos, Node old_node, Node new_node);
     
     void open_ui(PlayerState *player, UIInstance instance);
     void update_ui(PlayerState *player, const UIInstance& instance);
@@ -328,17 +398,16 @@ class Server {
     std::set<MapPos<int>> active_interact_tick;
     mutable std::shared_mutex active_interact_tick_lock;
     
-    PlayerState* get_player_by_tag(std::string tag);
-    PlayerState* find_player(std::string name_or_id);
-    
-    typedef std::map<connection_hdl, PlayerState*, std::owner_less<connection_hdl>> player_list;
-    
     WsServer m_server;
     boost::asio::io_context m_io;
-    boost::asio::steady_timer m_timer;
     
-    player_list m_players;
-    mutable std::shared_mutex m_players_lock;
+    PlayerRegistry m_players;
+    
+    //Positions of logged in players, for entity visibility.
+    PlayerGrid player_grid;
+    
+    //Which players have which mapblocks, so changes can be sent to just them.
+    MapblockSubscribers mapblock_subscribers;
     
     Database& db;
     Map map;
@@ -355,9 +424,41 @@ class Server {
     int fluid_tick_counter;
     int slow_tick_counter;
     int interact_tick_counter;
-    std::chrono::time_point<std::chrono::steady_clock> last_tick;
-    bool halt;
-    std::shared_mutex tick_info_lock;
+    //Number of ticks to each run of the subsystem, from the server.*_tick_ratio config keys.
+    int mapblock_tick_ratio;
+    int fluid_tick_ratio;
+    int slow_tick_ratio;
+    int interact_tick_ratio;
+    
+    //Runs tick() every server.tick_interval ms, on its own thread.
+    TickScheduler tick_scheduler;
+    
+    //Work that can be spread over several ticks; see tick().
+    WorkScheduler work;
+    std::chrono::milliseconds tick_work_budget;
+    //Threads the tick spreads per-player work over, see TickPool.
+    TickPool tick_pool;
+    
+    //State of the interest pass in progress.
+    std::shared_ptr<const PlayerSnapshot> interest_tick_players;
+    size_t interest_tick_next;
+    std::set<MapPos<int>> interest_tick_mapblocks;
+    //Result of the last complete interest pass.
+    std::set<MapPos<int>> interested_mapblocks;
+    
+    //Changed mapblocks still to be sent, for each player who has them.
+    std::vector<std::pair<PlayerRef, std::vector<MapPos<int>>>> change_tick_players;
+    size_t change_tick_next;
+    bool change_tick_started;
+    
+    //State of the mapblock streaming pass in progress.
+    std::shared_ptr<const PlayerSnapshot> stream_tick_players;
+    size_t stream_tick_next;
+    
+    bool fluid_tick_started;
+    
+    bool interact_tick_started;
+    MapPos<int> interact_tick_last;
     
 #ifdef DEBUG_NET
     unsigned int mb_out_count;
@@ -106,11 +106,8 @@ void Server::cmd_nick(PlayerState *player, std::vector<std::string> args) {
   if(!validate_player_name(new_nick))
     throw CommandError(BAD_PLAYER_NAME_MESSAGE);
   
-  for(auto p : m_players) {
-    PlayerState *check = p.second;
-    if(check->get_name() == new_nick)
-      throw CommandError("that nickname is already in use, try another one?");
-  }
+  if(m_players.snapshot()->get_by_name(new_nick))
+    throw CommandError("that nickname is already in use, try another one?");
   if(player->data.name == new_nick) {
     //all good, it's the player's own nickname
   } else if(db.player_data_name_used(new_nick)) {
@@ -119,17 +116,25 @@ void Server::cmd_nick(PlayerState *player, std::vector<std::string> args) {
   
   std::string old_nick = player->get_name();
   player->set_name(new_nick);
+  m_players.reindex(player);
   
   player_lock_unique.unlock();
   chat_send("server", "*** " + old_nick + " changed name to " + new_nick);
 }
 
 void Server::cmd_status(PlayerState *player, std::vector<std::string> args) {
-  chat_send_player(player, "server", status());
+  std::string s = status();
+  if(player->has_priv("admin")) {
+    s += "\n-- Map: " + map.set_node_stats();
+    s += "\n-- Mapblock frames: " + map.frame_cache_stats();
+    s += "\n-- Mapblock subscribers: " + mapblock_subscribers.stats();
+    s += "\n-- Tick: " + tick_scheduler.stats();
+  }
+  chat_send_player(player, "server", s);
 }
 
 void Server::cmd_who(PlayerState *player, std::vector<std::string> args) {
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
   
   if(player->has_priv("admin")) {
     std::optional<std::string> target_search_name = std::nullopt;
@@ -141,18 +146,18 @@ void Server::cmd_who(PlayerState *player, std::vector<std::string> args) {
     if(!target_search_name) {
       who_text << "Online players:\n\n";
       
-      for(auto const& x : m_players) {
-        std::shared_lock<std::shared_mutex> player_lock(x.second->lock);
+      for(const PlayerRef& x : *players) {
+        std::shared_lock<std::shared_mutex> player_lock(x->lock);
         // TODO function to escape {{ etc.?
-        who_text << "{{" << x.second->get_name() << "|/who " << x.second->get_tag() << "}}";
-        if(x.second->auth) {
-          who_text << " [id " << x.second->data.auth_id << "]\n";
+        who_text << "{{" << x->get_name() << "|/who " << x->get_tag() << "}}";
+        if(x->auth) {
+          who_text << " [id " << x->data.auth_id << "]\n";
         } else {
-          who_text << " [guest, tag " << x.second->get_tag() << "]\n";
+          who_text << " [guest, tag " << x->get_tag() << "]\n";
         }
       }
     } else {
-      PlayerState *target = find_player(*target_search_name);
+      PlayerRef target = players->find(*target_search_name);
       if(target != NULL) {
         std::shared_lock<std::shared_mutex> target_lock(target->lock);
         
@@ -177,6 +182,9 @@ void Server::cmd_who(PlayerState *player, std::vector<std::string> args) {
         
         who_text << "pos: " << target->pos << "\n";
         who_text << "creative_mode: " << std::boolalpha << target->data.creative_mode << "\n";
+        who_text << "send queue: " << target->send_queue_status() << "\n";
+        who_text << "known mapblocks: " << target->known_mapblocks.size() << "\n";
+        who_text << "rate limit violations: " << target->rate_limit.status() << "\n";
         who_text << "\n";
         who_text << "Actions:\n";
         who_text << "  {{/kick " << target->get_tag() << "|/kick " << target->get_tag() << "}}";
@@ -206,12 +214,12 @@ void Server::cmd_who(PlayerState *player, std::vector<std::string> args) {
     s << "{";
     
     bool first = true;
-    for(auto const& x : m_players) {
+    for(const PlayerRef& x : *players) {
       if(!first) { s << ", "; }
       first = false;
       
-      std::shared_lock<std::shared_mutex> player_lock(x.second->lock);
-      s << x.second->get_name();
+      std::shared_lock<std::shared_mutex> player_lock(x->lock);
+      s << x->get_name();
     }
     
     s << "}";
@@ -301,13 +309,14 @@ void Server::cmd_tp(PlayerState *player, std::vector<std::string> args) {
     player->pos.w = w;
   }
   player->just_tp = true;
+  player_grid.update(player, player->pos);
   //print ints, not doubles
   player_lock_unique.unlock();
   chat_send_player(player, "server", "Teleported to " + MapPos<int>(x, y, z, player->pos.w, player->pos.world, player->pos.universe).to_string() + "!");
   player_lock_unique.lock();
   player->send_pos();
   if(player->auth) {
-    db.update_player_data(player->get_data());
+    save_player(player);
   }
 }
 
@@ -328,12 +337,13 @@ void Server::cmd_tp_world(PlayerState *player, std::vector<std::string> args) {
       }
       player->pos.world = it.first;
       player->just_tp = true;
+      player_grid.update(player, player->pos);
       player_lock_unique.unlock();
       chat_send_player(player, "server", "Welcome to " + it.second->name + "!");
       player_lock_unique.lock();
       player->send_pos();
       if(player->auth) {
-        db.update_player_data(player->get_data());
+        save_player(player);
       }
       return;
     }
@@ -364,12 +374,13 @@ void Server::cmd_tp_universe(PlayerState *player, std::vector<std::string> args)
   } else {
     player->pos.universe = universe;
     player->just_tp = true;
+    player_grid.update(player, player->pos);
     player_lock_unique.unlock();
     chat_send_player(player, "server", "Welcome to universe " + std::to_string(player->pos.universe) + "!");
     player_lock_unique.lock();
     player->send_pos();
     if(player->auth) {
-      db.update_player_data(player->get_data());
+      save_player(player);
     }
   }
 }
@@ -440,7 +451,8 @@ void Server::grant_revoke_common(PlayerState *player, std::string target_search_
   }
   
   //Find the requested player.
-  PlayerState *target = find_player(target_search_name);
+  PlayerRef target_ref = m_players.snapshot()->find(target_search_name);
+  PlayerState *target = target_ref.get(); //target_ref keeps them around until we're done
   
   //TODO offline players
   
@@ -448,6 +460,8 @@ void Server::grant_revoke_common(PlayerState *player, std::string target_search_
     throw CommandError("unknown or offline player '" + target_search_name + "'");
   
   std::unique_lock<std::shared_mutex> player_lock_unique(target->lock);
+  if(target->closed)
+    throw CommandError("player '" + target_search_name + "' has disconnected");
   std::string target_name = target->get_name();
   
   // do grants
@@ -484,7 +498,7 @@ void Server::grant_revoke_common(PlayerState *player, std::string target_search_
   if(do_grant.size() > 0 || do_revoke.size() > 0) {
     target->send_privs();
     if(target->auth)
-      db.update_player_data(target->get_data());
+      save_player(target);
   }
   
   player_lock_unique.unlock();
@@ -609,7 +623,7 @@ void Server::cmd_privs(PlayerState *player, std::vector<std::string> args) {
   std::string player_name = args[1];
   
   //Find the requested player.
-  PlayerState *player_found = find_player(player_name);
+  PlayerRef player_found = m_players.snapshot()->find(player_name);
   
   //TODO offline players
   
@@ -687,7 +701,7 @@ void Server::cmd_give(PlayerState *player, std::vector<std::string> args) {
   std::string player_name = args[1];
   
   //Find the requested player.
-  PlayerState *player_found = find_player(player_name);
+  PlayerRef player_found = m_players.snapshot()->find(player_name);
   
   //TODO offline players?
   
@@ -695,6 +709,8 @@ void Server::cmd_give(PlayerState *player, std::vector<std::string> args) {
     throw CommandError("unknown or offline player '" + player_name + "'");
   
   std::unique_lock<std::shared_mutex> target_lock_unique(player_found->lock);
+  if(player_found->closed)
+    throw CommandError("player '" + player_name + "' has disconnected");
   
   std::string itemstring = args[2];
   ItemDef def = get_item_def(itemstring);
@@ -721,7 +737,7 @@ void Server::cmd_give(PlayerState *player, std::vector<std::string> args) {
   }
   
   target_lock_unique.unlock();
-  bool res = inv_apply_patch(*give_patch, player_found);
+  bool res = inv_apply_patch(*give_patch, player_found.get());
   
   if(!res) {
     chat_send_player(player, "server", "unable to give '" + to_give.spec() + "' to '" + player_name + "'");
@@ -729,7 +745,7 @@ void Server::cmd_give(PlayerState *player, std::vector<std::string> args) {
   }
   
   chat_send_player(player, "server", "gave '" + to_give.spec() + "' to '" + player_name + "'");
-  chat_send_player(player_found, "server", self_name + " gave you '" + to_give.spec() + "'");
+  chat_send_player(player_found.get(), "server", self_name + " gave you '" + to_give.spec() + "'");
 }
 
 void Server::cmd_clearinv(PlayerState *player, std::vector<std::string> args) {
@@ -787,7 +803,7 @@ void Server::cmd_creative(PlayerState *player, std::vector<std::string> args) {
   
   if(player->data.creative_mode != old_creative_mode) {
     if(player->auth) {
-      db.update_player_data(player->get_data());
+      save_player(player);
     }
     player->send_opts();
     
@@ -810,7 +826,7 @@ void Server::cmd_kick(PlayerState *player, std::vector<std::string> args) {
   if(args.size() >= 3)
     message = args[2];
   
-  PlayerState *target = find_player(target_search_name);
+  PlayerRef target = m_players.snapshot()->find(target_search_name);
   
   if(target == NULL)
     throw CommandError("unknown or offline player '" + target_search_name + "'");
@@ -830,3 +846,122 @@ void Server::cmd_kick(PlayerState *player, std::vector<std::string> args) {
     }
   }
 }
+
+//Parses args[first] through args[first + count - 1] as integers, for the region commands.
+static void parse_int_args(std::vector<std::string>& args, size_t first, size_t count, int *out) {
+  for(size_t i = 0; i < count; i++) {
+    try {
+      out[i] = stoi(args[first + i]);
+    } catch(std::invalid_argument const& e) {
+      throw CommandError("not a number: " + args[first + i]);
+    } catch(std::out_of_range const& e) {
+      throw CommandError("invalid (too large) number: " + args[first + i]);
+    }
+  }
+}
+
+//Throws if a region is larger than map.region_edit_max_nodes.
+static void check_region_size(long long size_x, long long size_y, long long size_z) {
+  long long volume = size_x * size_y * size_z;
+  long long max_volume = get_config<int>("map.region_edit_max_nodes");
+  if(volume > max_volume)
+    throw CommandError("region is too large (" + std::to_string(volume) + " nodes, limit is " + std::to_string(max_volume) + ")");
+}
+
+//Reads the two corners of a region from args[1] through args[6], in the player's current w, world, and universe.
+static std::pair<MapPos<int>, MapPos<int>> parse_region_args(PlayerState *player, std::vector<std::string>& args) {
+  int coords[6];
+  parse_int_args(args, 1, 6, coords);
+  
+  std::shared_lock<std::shared_mutex> player_lock(player->lock);
+  MapPos<int> pos_1(coords[0], coords[1], coords[2], player->pos.w, player->pos.world, player->pos.universe);
+  MapPos<int> pos_2(coords[3], coords[4], coords[5], player->pos.w, player->pos.world, player->pos.universe);
+  player_lock.unlock();
+  
+  check_region_size(std::abs((long long)pos_2.x - pos_1.x) + 1, std::abs((long long)pos_2.y - pos_1.y) + 1, std::abs((long long)pos_2.z - pos_1.z) + 1);
+  
+  return std::make_pair(pos_1, pos_2);
+}
+
+void Server::cmd_fill(PlayerState *player, std::vector<std::string> args) {
+  must_have_privs(player, {"worldedit"});
+  
+  if(args.size() < 8 || args.size() > 9)
+    throw CommandError("usage: '/fill <x1> <y1> <z1> <x2> <y2> <z2> <itemstring> [<rot>]'");
+  
+  std::string itemstring = args[7];
+  if(get_node_def(itemstring).itemstring == "nothing")
+    throw CommandError("unknown node '" + itemstring + "'");
+  
+  int rot = 0;
+  if(args.size() >= 9) {
+    parse_int_args(args, 8, 1, &rot);
+    if(rot < 0 || rot > 255)
+      throw CommandError("invalid rotation: " + args[8]);
+  }
+  
+  std::pair<MapPos<int>, MapPos<int>> region = parse_region_args(player, args);
+  
+  size_t count = map.fill_region(region.first, region.second, Node(itemstring, rot));
+  chat_send_player(player, "server", std::to_string(count) + " nodes changed.");
+}
+
+void Server::cmd_replace(PlayerState *player, std::vector<std::string> args) {
+  must_have_privs(player, {"worldedit"});
+  
+  if(args.size() != 9)
+    throw CommandError("usage: '/replace <x1> <y1> <z1> <x2> <y2> <z2> <from> <to>'");
+  
+  std::string from = args[7];
+  std::string to = args[8];
+  if(get_node_def(from).itemstring == "nothing")
+    throw CommandError("unknown node '" + from + "'");
+  if(get_node_def(to).itemstring == "nothing")
+    throw CommandError("unknown node '" + to + "'");
+  
+  std::pair<MapPos<int>, MapPos<int>> region = parse_region_args(player, args);
+  
+  size_t count = map.replace_region(region.first, region.second, from, to);
+  chat_send_player(player, "server", std::to_string(count) + " nodes changed.");
+}
+
+void Server::cmd_copy(PlayerState *player, std::vector<std::string> args) {
+  must_have_privs(player, {"worldedit"});
+  
+  if(args.size() != 7)
+    throw CommandError("usage: '/copy <x1> <y1> <z1> <x2> <y2> <z2>'");
+  
+  std::pair<MapPos<int>, MapPos<int>> region = parse_region_args(player, args);
+  
+  MapRegion copied = map.copy_region(region.first, region.second);
+  size_t volume = copied.volume();
+  
+  std::unique_lock<std::shared_mutex> player_lock_unique(player->lock);
+  player->clipboard = std::move(copied);
+  player_lock_unique.unlock();
+  
+  chat_send_player(player, "server", std::to_string(volume) + " nodes copied.");
+}
+
+void Server::cmd_paste(PlayerState *player, std::vector<std::string> args) {
+  must_have_privs(player, {"worldedit"});
+  
+  if(args.size() != 4)
+    throw CommandError("usage: '/paste <x> <y> <z>'");
+  
+  int coords[3];
+  parse_int_args(args, 1, 3, coords);
+  
+  std::shared_lock<std::shared_mutex> player_lock(player->lock);
+  if(player->clipboard.volume() == 0)
+    throw CommandError("nothing to paste, use /copy first");
+  MapPos<int> pos(coords[0], coords[1], coords[2], player->pos.w, player->pos.world, player->pos.universe);
+  MapRegion region = player->clipboard;
+  player_lock.unlock();
+  
+  //The limit may have been lowered since the copy.
+  check_region_size(region.size.x, region.size.y, region.size.z);
+  
+  size_t count = map.paste_region(pos, region);
+  chat_send_player(player, "server", std::to_string(count) + " nodes changed.");
+}
@@ -23,7 +23,7 @@
 #include "player_util.h"
 
 std::pair<websocketpp::close::status::value, std::string> Server::validate_connection(connection_hdl hdl) {
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
   
   std::string address_and_port;
   std::string address;
@@ -41,12 +41,12 @@ std::pair<websocketpp::close::status::value, std::string> Server::validate_conne
   //overall player limit
   int max_players = get_config<int>("server.max_players");
   
-  if(max_players > 0 && (int)m_players.size() >= max_players) {
+  if(max_players > 0 && (int)players->size() >= max_players) {
     log(LogSource::SERVER, LogLevel::INFO, "Connection from " + address_and_port + " rejected because server is full (" +
-                                           std::to_string(m_players.size()) + "/" + std::to_string(max_players) + ") players");
+                                           std::to_string(players->size()) + "/" + std::to_string(max_players) + ") players");
     
     return std::make_pair(websocketpp::close::status::try_again_later,
-                          "server is full (" + std::to_string(m_players.size()) + "/" + std::to_string(max_players) + ") players, try again later.");
+                          "server is full (" + std::to_string(players->size()) + "/" + std::to_string(max_players) + ") players, try again later.");
   }
   
   //per-ip player limit
@@ -54,8 +54,7 @@ std::pair<websocketpp::close::status::value, std::string> Server::validate_conne
   
   if(max_players_from_address > 0) {
     int players_with_same_address = 0;
-    for(auto p : m_players) {
-      PlayerState *check = p.second;
+    for(const PlayerRef& check : *players) {
       std::shared_lock<std::shared_mutex> check_lock(check->lock);
       if(check->address == address) {
         players_with_same_address++;
@@ -88,70 +87,64 @@ void Server::on_open(connection_hdl hdl) {
     return;
   }
   
-  std::unique_lock<std::shared_mutex> list_lock(m_players_lock);
-  
-  PlayerState *player = new PlayerState(hdl, m_server);
-  
-  std::unique_lock<std::shared_mutex> player_lock(player->lock);
-  m_players[hdl] = player;
+  m_players.add(std::make_shared<PlayerState>(hdl, m_server, mapblock_subscribers));
   
   //player is by default auth=false, auth_guest=false
   //player will be authenticated later at the client's request
 }
 
 void Server::on_close(connection_hdl hdl) {
-  std::unique_lock<std::shared_mutex> list_lock(m_players_lock);
-  
-  auto search = m_players.find(hdl);
-  if(search == m_players.end()) {
+  //Gone from the registry first, so nothing new finds them; anything still holding a PlayerRef sees 'closed'.
+  PlayerRef player = m_players.remove(hdl);
+  if(!player) {
     //player was never accepted
     return;
   }
   
-  PlayerState *player = search->second;
+  std::unique_lock<std::shared_mutex> player_lock(player->lock);
   
-  {
-    std::unique_lock<std::shared_mutex> player_lock(player->lock);
-    
-    m_players.erase(hdl);
+  player->closed = true;
+  player_grid.remove(player.get());
+  player->forget_all_mapblocks();
+  
+  if(player->auth) {
+    save_player(player.get());
+  }
+  
+  if(player->auth || player->auth_guest) {
+    std::string tag = player->get_tag();
+    std::string name = player->get_name();
+    std::string entity_data = player->entity_data_as_json();
     
-    if(player->auth) {
-      db.update_player_data(player->get_data());
-    }
+    //Not held while taking other players' locks, so this can't deadlock with them.
+    player_lock.unlock();
     
-    if(player->auth || player->auth_guest) {
-      //Clean up entities.
-      for(auto p : m_players) {
-        PlayerState *receiver = p.second;
+    //Clean up entities.
+    //The tick checks 'closed' with the receiver's lock held before creating this one, so it can't come back after this.
+    std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
+    for(const PlayerRef& receiver : *players) {
+      std::unique_lock<std::shared_mutex> receiver_lock(receiver->lock);
+      
+      //Player should *not* know about candidate entity
+      if(receiver->known_player_tags.find(tag) != receiver->known_player_tags.end()) {
+        //...but they do
+        //so delete it
         
-        std::shared_lock<std::shared_mutex> receiver_lock(receiver->lock);
+        std::ostringstream out;
+        out << "{\"type\":\"update_entities\",\"actions\":[";
+        out << "{\"type\":\"delete\",\"data\":" << entity_data << "}";
+        out << "]}";
+        receiver->send(out.str(), SendClass::ENTITIES);
         
-        //Player should *not* know about candidate entity
-        if(receiver->known_player_tags.find(player->get_tag()) != receiver->known_player_tags.end()) {
-          //...but they do
-          //so delete it
-          
-          std::ostringstream out;
-          out << "{\"type\":\"update_entities\",\"actions\":[";
-          out << "{\"type\":\"delete\",\"data\":" << player->entity_data_as_json() << "}";
-          out << "]}";
-          receiver->send(out.str());
-          
-          receiver->known_player_tags.erase(player->get_tag());
-        }
+        receiver->known_player_tags.erase(tag);
       }
-      
-      std::string name = player->get_name();
-      
-      player_lock.unlock();
-      list_lock.unlock();
-      
-      log(LogSource::SERVER, LogLevel::INFO, name + " disconnected.");
-      chat_send("server", "*** " + name + " left the server.");
     }
+    
+    log(LogSource::SERVER, LogLevel::INFO, name + " disconnected.");
+    chat_send("server", "*** " + name + " left the server.");
   }
   
-  delete player;
+  //The PlayerState itself is deleted once the last snapshot holding it is let go.
   
 #ifdef EXIT_AFTER_PLAYER_DISCONNECT
   exit(0);
@@ -78,3 +78,28 @@ bool Server::on_dig_node(Node node, MapPos<int> pos) {
   
   return true;
 }
+
+bool Server::has_node_meta(const std::string& itemstring) {
+  return init_inventories.find(itemstring) != init_inventories.end();
+}
+
+//Called by the map for each node a region edit changed from or to one with meta (see Map::set_region_meta_handler).
+//Unlike digging, the old node's meta is dropped even if its inventory isn't empty.
+void Server::on_region_edit_node(MapPos<int> pos, Node old_node, Node new_node) {
+  if(has_node_meta(old_node.itemstring)) {
+    db.lock_node_meta(pos);
+    
+    NodeMeta *meta = db.get_node_meta(pos);
+    meta->is_nil = true;
+    db.set_node_meta(pos, meta);
+    delete meta;
+    
+    db.unlock_node_meta(pos);
+  }
+  
+  if(has_node_meta(new_node.itemstring)) {
+    on_place_node(new_node, pos);
+  }
+  
+  wake_interact_tick(pos);
+}
@@ -144,11 +144,10 @@ bool Server::inv_apply_patch(InvPatch patch, PlayerState *requesting_player) {
     requesting_player->send(patch.to_json("inv_patch_accept"));
   
   //Inform interested players (possibly with only partial patches)
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
   
-  for(auto it : m_players) {
-    PlayerState *check = it.second;
-    if(check == requesting_player)
+  for(const PlayerRef& check : *players) {
+    if(check.get() == requesting_player)
       continue;
     
     std::shared_lock<std::shared_mutex> check_lock(check->lock);
@@ -181,19 +180,10 @@ bool Server::lock_unlock_invlist(InvRef ref, bool do_lock, PlayerState *player_h
   if(ref.obj_type == "player") {
     PlayerState *player = player_hint;
     
-    std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-    
+    PlayerRef found; //keeps the player around until we're done
     if(player == NULL && ref.obj_id) {
-      std::string player_id = *ref.obj_id;
-      
-      for(auto it : m_players) {
-        PlayerState *check = it.second;
-        std::shared_lock<std::shared_mutex> player_lock(check->lock);
-        if(check->get_tag() != player_id)
-          continue;
-        player = check;
-        break;
-      }
+      found = m_players.snapshot()->get_by_tag(*ref.obj_id);
+      player = found.get();
     }
     
     if(player == NULL)
@@ -297,18 +287,10 @@ InvList Server::get_invlist(InvRef ref, PlayerState *player_hint) {
   if(ref.obj_type == "player") {
     PlayerState *player = player_hint;
     
+    PlayerRef found; //keeps the player around until we're done
     if(player == NULL && ref.obj_id) {
-      std::string player_id = *ref.obj_id;
-      
-      std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-      for(auto it : m_players) {
-        PlayerState *check = it.second;
-        std::shared_lock<std::shared_mutex> player_lock(check->lock);
-        if(check->get_tag() != player_id)
-          continue;
-        player = check;
-        break;
-      }
+      found = m_players.snapshot()->get_by_tag(*ref.obj_id);
+      player = found.get();
     }
     
     if(player == NULL)
@@ -341,18 +323,10 @@ bool Server::set_invlist(InvRef ref, InvList list, PlayerState *player_hint) {
   if(ref.obj_type == "player") {
     PlayerState *player = player_hint;
     
+    PlayerRef found; //keeps the player around until we're done
     if(player == NULL && ref.obj_id) {
-      std::string player_id = *ref.obj_id;
-      
-      std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-      for(auto it : m_players) {
-        PlayerState *check = it.second;
-        std::shared_lock<std::shared_mutex> player_lock(check->lock);
-        if(check->get_tag() != player_id)
-          continue;
-        player = check;
-        break;
-      }
+      found = m_players.snapshot()->get_by_tag(*ref.obj_id);
+      player = found.get();
     }
     
     if(player == NULL)
@@ -364,7 +338,7 @@ bool Server::set_invlist(InvRef ref, InvList list, PlayerState *player_hint) {
       return false;
     
     if(player->auth) {
-      db.update_player_data(player->get_data());
+      save_player(player);
     }
     return true;
   }
@@ -24,6 +24,10 @@
 #include "tool.h"
 #include "craft.h"
 #include "except.h"
+#include "message_binary.h"
+#include "json.h"
+
+#include <algorithm>
 
 std::optional<std::pair<InvStack, InvStack>> inv_calc_distribute(InvStack stack1, int qty1, InvStack stack2, int qty2) {
   if(stack1.is_nil && stack2.is_nil)
@@ -253,25 +257,45 @@ std::optional<InvPatch> update_craft_if_needed(const InvRef& ref1, const InvRef&
   return std::nullopt;
 }
 
+//Hands the message to the player's strand, which handles their messages one at a time in the order they came in.
 void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_type::ptr msg) {
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-  auto search = m_players.find(hdl);
-  if(search == m_players.end()) {
+  PlayerRef player_ref = m_players.snapshot()->get(hdl);
+  if(!player_ref) {
     log(LogSource::SERVER, LogLevel::ERR, "Unable to find player state for connection!");
     return;
   }
-  PlayerState *player = search->second;
+  
+  boost::asio::post(player_ref->strand, std::bind(&Server::handle_message, this, player_ref, msg));
+}
+
+//Runs on the player's strand.
+void Server::handle_message(PlayerRef player_ref, websocketpp::config::asio::message_type::ptr msg) {
+  PlayerState *player = player_ref.get(); //player_ref keeps it around until we're done
+  connection_hdl hdl = player->m_connection_hdl;
   
   std::unique_lock<std::shared_mutex> player_lock_unique(player->lock);
+  if(player->closed) {
+    return;
+  }
   
-  try {
-    std::stringstream ss;
-    ss << msg->get_payload();
+  if(msg->get_opcode() == websocketpp::frame::opcode::binary) {
+    if(!player->auth && !player->auth_guest) {
+      return;
+    }
     
-    boost::property_tree::ptree pt;
-    boost::property_tree::read_json(ss, pt);
+    try {
+      on_binary_message(player, player_lock_unique, msg->get_payload());
+    } catch(BinaryMessageError const& e) {
+      log(LogSource::SERVER, LogLevel::ERR, "Binary message error from player '" + player->get_name() + "': " + std::string(e.what()));
+    }
+    return;
+  }
+  
+  try {
+    JSONDocument doc(msg->get_payload());
+    const JSONValue& json = doc.root();
     
-    std::string type = pt.get<std::string>("type");
+    std::string type = json.get<std::string>("type");
     
     if(!player->auth && !player->auth_guest) {
       //TODO send reply saying unauthorized (if not an auth message)
@@ -284,15 +308,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
           if(!validate_player_name(name))
             continue;
           
-          bool used = false;
-          for(auto p : m_players) {
-            PlayerState *check = p.second;
-            if(check->get_name() == name) {
-              used = true;
-              break;
-            }
-          }
-          if(used)
+          if(m_players.snapshot()->get_by_name(name))
             continue;
           
           if(db.player_data_name_used(name))
@@ -306,6 +322,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         player->load_data(new_data);
         
         player->auth_guest = true;
+        m_players.reindex(player);
         
         m_server.send(hdl, "{\"type\":\"auth_guest\",\"message\":\"guest_ok\"}", websocketpp::frame::opcode::text);
       } else {
@@ -315,18 +332,16 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         if(is_auth) {
           std::string auth_id = player->auth_state.result();
           
-          for(auto it : m_players) {
-            PlayerState *p = it.second;
-            if(p->auth && p->data.auth_id == auth_id) {
-              player_lock_unique.unlock();
-              chat_send_player(player, "server", "ERROR: player '" + p->data.name + "' is already connected");
-              websocketpp::lib::error_code ec;
-              m_server.close(hdl, websocketpp::close::status::policy_violation, "kick", ec);
-              if(ec) {
-                log(LogSource::SERVER, LogLevel::ERR, "error closing connection: " + ec.message());
-              }
-              return;
+          PlayerRef p = m_players.snapshot()->get_by_auth_id(auth_id);
+          if(p) {
+            player_lock_unique.unlock();
+            chat_send_player(player, "server", "ERROR: player '" + p->data.name + "' is already connected");
+            websocketpp::lib::error_code ec;
+            m_server.close(hdl, websocketpp::close::status::policy_violation, "kick", ec);
+            if(ec) {
+              log(LogSource::SERVER, LogLevel::ERR, "error closing connection: " + ec.message());
             }
+            return;
           }
           
           PlayerData pdata = db.fetch_player_data(auth_id);
@@ -338,20 +353,23 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
           }
           player->load_data(pdata);
           player->auth = true;
+          m_players.reindex(player);
         }
       }
       
       if(player->auth || player->auth_guest) {
+        player_grid.update(player, player->pos);
         player->send_pos();
         player->send_privs();
         player->send_opts();
+        player->send("{\"type\":\"binary_protocol\",\"version\":" + std::to_string(BINARY_MESSAGE_VERSION) + "}", SendClass::CONTROL);
         
         std::ostringstream time_s;
         time_s << "{\"type\":\"set_time\",\"hours\":" << server_time.hours << ",\"minutes\":" << server_time.minutes << "}";
-        player->send(time_s.str());
+        player->send_coalesced("time", time_s.str(), SendClass::CONTROL);
         
-        player->prepare_nearby_mapblocks(2, 3, 0, map);
-        player->prepare_nearby_mapblocks(1, 2, 1, map);
+        player->prepared_center = std::nullopt;
+        prepare_entered_mapblocks(player);
         
         player_lock_unique.unlock();
         
@@ -369,362 +387,76 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
     if(type.rfind("auth", 0) == 0 && player->auth) {
       bool is_auth = player->auth_state.step(msg->get_payload(), m_server, hdl, db);
       if(!is_auth) {
-        db.update_player_data(player->get_data());
+        save_player(player);
         player->auth = false;
+        m_players.reindex(player);
       }
       
       return;
     }
     
     if(type == "req_mapblock") {
-      MapPos<int> mb_pos(pt.get<int>("pos.x"), pt.get<int>("pos.y"), pt.get<int>("pos.z"), pt.get<int>("pos.w"), player->pos.world, player->pos.universe);
-      
-      MapPos<int> player_mb = player->containing_mapblock();
-      MapBox<int> bounding(player_mb - PLAYER_LIMIT_VIEW_DISTANCE, player_mb + PLAYER_LIMIT_VIEW_DISTANCE);
-      if(!bounding.contains(mb_pos)) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' requests out of bounds mapblock at " + mb_pos.to_string());
-        return;
-      }
-      
-      MapblockUpdateInfo info = map.get_mapblockupdateinfo(mb_pos);
-      if(info.light_needs_update > 0) {
-#ifdef DEBUG_PERF
-        std::cout << "single mapblock prep for " << player->get_name() << std::endl;
-#endif
-        map.update_mapblock_light(info);
-      }
-      MapblockCompressed *mbc = map.get_mapblock_compressed(mb_pos);
-#ifdef DEBUG_NET
-      unsigned int len = player->send_mapblock_compressed(mbc);
-      
-      {
-        std::unique_lock<std::shared_mutex> net_lock(net_debug_lock);
-        mb_out_len += len;
-        mb_out_count++;
-      }
-#else
-      player->send_mapblock_compressed(mbc);
-#endif
-      delete mbc;
-    } else if(type == "set_player_pos") {
-      if(player->just_tp) {
-        //Clear position history and ignore this position update.
-        player->pos_history.clear();
-        player->just_tp = false;
-        return;
-      }
-      
-      MapPos<double> pos(pt.get<double>("pos.x"), pt.get<double>("pos.y"), pt.get<double>("pos.z"), pt.get<int>("pos.w"), player->pos.world, player->pos.universe);
-      
-      std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
-      
-#ifndef DISABLE_PLAYER_SPEED_LIMIT
-      //Validate that the player hasn't moved too far since their last position update
-      //FIXME: doesn't handle falling players
-      bool violation = false;
-      
-      if(player->pos_history.size() > 0) {
-        MapPos<double> total_distance(0, 0, 0, 0, 0, 0);
-        MapPos<double> total_distance_sign(0, 0, 0, 0, 0, 0);
-        MapPos<double> previous = pos;
-        for(auto it : player->pos_history) {
-          total_distance += (previous - it.second).abs();
-          total_distance_sign += (previous - it.second);
-          previous = it.second;
-        }
-        
-        std::chrono::time_point<std::chrono::steady_clock> oldest = player->pos_history.back().first;
-        double diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest).count() / 10000.0; //milliseconds -> tens of seconds
-        if(diff > 0) {
-          MapPos<double> vel(total_distance.x / diff, total_distance.y / diff, total_distance.z / diff,
-                             total_distance.w / diff, total_distance.world / diff, total_distance.universe / diff);
-          MapPos<double> vel_sign(total_distance_sign.x / diff, total_distance_sign.y / diff, total_distance_sign.z / diff,
-                                  total_distance_sign.w / diff, total_distance_sign.world / diff, total_distance_sign.universe / diff);
-          
-          MapPos<int> limit = PLAYER_LIMIT_VEL;
-          if(player->data.has_priv("fast")) {
-            limit = PLAYER_LIMIT_VEL_FAST;
-          }
-          
-          if(vel_sign.y < -limit.y) {
-            //falling player, probably
-            //FIXME
-            limit.y *= 5;
-          }
-          
-          if(vel.x > limit.x || vel.y > limit.y || vel.z > limit.z ||
-             vel.w > limit.w || vel.world > limit.world || vel.universe > limit.universe) {
-            violation = true;
-          }
-        }
-      }
-      
-      if(violation) {
-        log(LogSource::SERVER, LogLevel::WARNING, "player '" + player->get_name() + "' tried to move too fast");
-        player->send_pos(); //pull them back
-        return; //don't accept the new position
-      }
-#endif
-      
-      player->pos_history.push_front(std::make_pair(now, pos));
-      if(player->pos_history.size() > 8) {
-        player->pos_history.pop_back();
-      }
-      
-      player->pos = pos;
-      player->vel.set(pt.get<double>("vel.x"), pt.get<double>("vel.y"), pt.get<double>("vel.z"), player->vel.w, player->vel.world, player->vel.universe);
-      player->rot.set(pt.get<double>("rot.x"), pt.get<double>("rot.y"), pt.get<double>("rot.z"), pt.get<double>("rot.w"));
-      
-      if(player->auth) {
-        db.update_player_data(player->get_data());
-      }
-      
-      player->prepare_nearby_mapblocks(2, 3, 0, map);
-      player->prepare_nearby_mapblocks(1, 2, 1, map);
-    } else if(type == "dig_node") {
-      if(!player->has_priv("touch")) {
-        player_lock_unique.unlock();
-        chat_send_player(player, "server", "you can't dig nodes, you haven't got the 'touch' privilege!");
-        return;
-      }
-      
-      MapPos<int> pos(pt.get<int>("pos.x"), pt.get<int>("pos.y"), pt.get<int>("pos.z"), pt.get<int>("pos.w"), pt.get<int>("pos.world"), pt.get<int>("pos.universe"));
-      int wield_index = pt.get<int>("wield");
-      Node existing(pt.get<std::string>("existing.itemstring"), pt.get<unsigned int>("existing.rot"));
-      
-      InvStack wield_stack = player->inv_get("main", wield_index);
-      Node target = map.get_node(pos);
-      
-      if(existing != target) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
-                                                 + " attempted to dig node '" + existing.itemstring + "' at " + pos.to_string() + " but it has since changed");
-        //TODO tell the client
-        return;
-      }
-      
-      MapPos<int> player_pos_int((int)std::round(player->pos.x), (int)std::round(player->pos.y), (int)std::round(player->pos.z), player->pos.w, player->pos.world, player->pos.universe);
-      MapBox<int> bounding(player_pos_int - PLAYER_LIMIT_REACH_DISTANCE, player_pos_int + PLAYER_LIMIT_REACH_DISTANCE);
-      if(!bounding.contains(pos)) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' at " + player_pos_int.to_string()
-                                                 + " attempted to dig node '" + target.itemstring + "' far away at " + pos.to_string());
-        return;
-      }
-      
-      NodeDef target_def = get_node_def(target.itemstring);
-      if(target_def.itemstring == "nothing") {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to dig nonexistent node '" + target.itemstring + "' at " + pos.to_string());
-        return;
-      }
-      
-      if(!target_def.breakable) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to dig unbreakable node '" + target.itemstring + "' at " + pos.to_string());
-        return;
-      }
-      
-      std::optional<double> break_time_tool = calc_dig_time(target, wield_stack);
-      std::optional<double> break_time_hand = calc_dig_time(target, InvStack());
-      
-      if(!player->data.creative_mode) {
-        if(!break_time_tool && !break_time_hand) {
-          log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to dig with inadequate tools node '" + target.itemstring + "' at " + pos.to_string());
+      if(!check_rate_limit(player, RateAction::REQ_MAPBLOCK)) { return; }
+      MapPos<int> mb_pos(json.get<int>("pos.x"), json.get<int>("pos.y"), json.get<int>("pos.z"), json.get<int>("pos.w"), player->pos.world, player->pos.universe);
+      handle_req_mapblock(player, mb_pos);
+    } else if(type == "req_mapblocks") {
+      std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> requests;
+      for(const JSONValue *it = json.child("mapblocks").first_child(); it != NULL; it = it->next_sibling()) {
+        if(requests.size() >= PLAYER_MAX_MAPBLOCK_BATCH) {
+          log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' requests too many mapblocks at once");
           return;
         }
-      }
-      
-      //Does extra stuff, like manage metadata.
-      //true = must go through with the dig
-      //false = abort
-      bool do_continue = on_dig_node(target, pos);
-      if(!do_continue)
-        return;
-      
-      log(LogSource::SERVER, LogLevel::EXTRA, "Player '" + player->get_name() + "' digs '" + target.itemstring + "' at " + pos.to_string());
-      
-#ifdef DEBUG_PERF
-      auto start = std::chrono::steady_clock::now();
-#endif
-      
-      map.set_node(pos, Node("air"), target);
-      
-#ifdef DEBUG_PERF
-      auto end = std::chrono::steady_clock::now();
-      auto diff = end - start;
-      
-      std::cout << "dig_node in " << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
-#endif
-      
-      InvPatch combined_patch;
-      
-      if(!player->data.creative_mode) {
-        //consume tool
-        InvPatch use_tool_patch;
-        if(break_time_tool) {
-          bool do_consume = true;
-          if(break_time_hand) {
-            if(*break_time_hand <= *break_time_tool)
-              do_consume = false;
-          }
-          if(do_consume && wield_stack.wear) {
-            InvStack new_wield_stack(wield_stack);
-            new_wield_stack.wear = *new_wield_stack.wear - 1;
-            if(new_wield_stack.wear <= 0)
-              new_wield_stack = InvStack();
-            
-            use_tool_patch.diffs.push_back(InvDiff(
-                InvRef("player", std::nullopt, "main", wield_index),
-                wield_stack,
-                new_wield_stack));
-          }
-        }
         
-        combined_patch += use_tool_patch;
-      }
-      
-      //give the dug node to the player
-      InvStack to_give;
-      if(target_def.drops != "")
-        to_give = InvStack(target_def.drops);
-      else if(get_item_def(target.itemstring).itemstring != "nothing")
-        to_give = InvStack(target.itemstring, 1, std::nullopt, std::nullopt);
-      //else
-      //  log(LogSource::SERVER, LogLevel::NOTICE, "node '" + target.itemstring + "' drops nothing");
-      
-      if(!to_give.is_nil) {
-        bool should_give = true;
-        if(player->data.creative_mode && !to_give.data) {
-          const InvList& main_list = player->inv_get("main");
-          for(const auto& stack : main_list.list) {
-            if(stack.itemstring == to_give.itemstring) {
-              should_give = false;
-              break;
-            }
-          }
-        }
-        
-        if(should_give) {
-          std::optional<InvPatch> give_patch = inv_calc_give(
-              InvRef("player", std::nullopt, "main", std::nullopt),
-              player->inv_get("main"),
-              to_give);
-          
-          if(give_patch) {
-            combined_patch += *give_patch;
-          } else {
-            //couldn't give
-            //TODO
-          }
+        MapPos<int> mb_pos(it->get<int>("pos.x"), it->get<int>("pos.y"), it->get<int>("pos.z"), it->get<int>("pos.w"), player->pos.world, player->pos.universe);
+        std::optional<MapblockUpdateInfo> known;
+        if(it->find("updateNum") != NULL && !it->child("updateNum").is_null()) {
+          known = MapblockUpdateInfo(mb_pos);
+          known->update_num = it->get<unsigned int>("updateNum");
+          known->light_update_num = it->get<unsigned int>("lightUpdateNum");
+          known->light_needs_update = 0;
         }
+        requests.push_back(std::make_pair(mb_pos, known));
       }
-      
-      if(combined_patch.diffs.size() > 0) {
-        player_lock_unique.unlock();
-        bool res = inv_apply_patch(combined_patch, player);
-        if(!res) {
-          //TODO
-        }
+      if(!check_rate_limit(player, RateAction::REQ_MAPBLOCK, requests.size())) { return; }
+      handle_req_mapblocks(player, requests);
+    } else if(type == "set_view_distance") {
+      //How far around the player to stream mapblocks, in mapblocks
+      MapPos<int> limit = PLAYER_LIMIT_VIEW_DISTANCE;
+      MapPos<int> dist(std::clamp(json.get<int>("dist.x"), 0, limit.x),
+                       std::clamp(json.get<int>("dist.y"), 0, limit.y),
+                       std::clamp(json.get<int>("dist.z"), 0, limit.z),
+                       std::clamp(json.get<int>("dist.w"), 0, limit.w), 0, 0);
+      player->stream.set_view_distance(dist);
+      
+      //How far away the client keeps mapblocks before dropping them, if it does
+      if(json.find("keep") != NULL) {
+        player->stream.set_keep_distance(MapPos<int>(json.get<int>("keep.x"), json.get<int>("keep.y"), json.get<int>("keep.z"), json.get<int>("keep.w"), 0, 0));
       }
+    } else if(type == "set_player_pos") {
+      if(!check_rate_limit(player, RateAction::SET_PLAYER_POS)) { return; }
+      MapPos<double> pos(json.get<double>("pos.x"), json.get<double>("pos.y"), json.get<double>("pos.z"), json.get<int>("pos.w"), 0, 0);
+      Vector3<double> vel(json.get<double>("vel.x"), json.get<double>("vel.y"), json.get<double>("vel.z"));
+      Quaternion rot(json.get<double>("rot.x"), json.get<double>("rot.y"), json.get<double>("rot.z"), json.get<double>("rot.w"));
+      handle_set_player_pos(player, pos, vel, rot);
+    } else if(type == "dig_node") {
+      if(!check_rate_limit(player, RateAction::DIG_NODE)) { return; }
+      MapPos<int> pos(json.get<int>("pos.x"), json.get<int>("pos.y"), json.get<int>("pos.z"), json.get<int>("pos.w"), json.get<int>("pos.world"), json.get<int>("pos.universe"));
+      int wield_index = json.get<int>("wield");
+      Node existing(json.get<std::string>("existing.itemstring"), json.get<unsigned int>("existing.rot"));
+      handle_dig_node(player, player_lock_unique, pos, wield_index, existing);
     } else if(type == "place_node") {
-      if(!player->has_priv("touch")) {
-        player_lock_unique.unlock();
-        chat_send_player(player, "server", "you can't place nodes, you haven't got the 'touch' privilege!");
-        return;
-      }
-      
-      MapPos<int> pos(pt.get<int>("pos.x"), pt.get<int>("pos.y"), pt.get<int>("pos.z"), pt.get<int>("pos.w"), pt.get<int>("pos.world"), pt.get<int>("pos.universe"));
-      int wield_index = pt.get<int>("wield");
-      Node to_place(pt.get<std::string>("data.itemstring"), pt.get<unsigned int>("data.rot"));
-      
-      InvStack wield_stack = player->inv_get("main", wield_index);
-      
-      //FIXME this should be handled by 'expected' in set_node
-      Node existing = map.get_node(pos);
-      NodeDef existing_def = get_node_def(existing);
-      if(!existing_def.can_place_inside) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
-                                                 + " attempted to place node '" + to_place.itemstring + "' over '" + existing.itemstring + "'");
-        //TODO tell the client
-        return;
-      }
-      
-      if(wield_stack.is_nil) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
-                                                 + " attempted to place node '" + to_place.itemstring + "' but they are not wielding anything");
-        //TODO tell the client
-        return;
-      }
-      if(to_place.itemstring != wield_stack.itemstring) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
-                                                 + " attempted to place node '" + to_place.itemstring + "' but they are really wielding '" + wield_stack.itemstring + "'");
-        //TODO tell the client
-        return;
-      }
-      
-      MapPos<int> player_pos_int((int)std::round(player->pos.x), (int)std::round(player->pos.y), (int)std::round(player->pos.z), player->pos.w, player->pos.world, player->pos.universe);
-      MapBox<int> bounding(player_pos_int - PLAYER_LIMIT_REACH_DISTANCE, player_pos_int + PLAYER_LIMIT_REACH_DISTANCE);
-      if(!bounding.contains(pos)) {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' at " + player_pos_int.to_string()
-                                                 + " attempted to place node '" + to_place.itemstring + "' far away at " + pos.to_string());
-        return;
-      }
-      
-      NodeDef to_place_def = get_node_def(to_place.itemstring);
-      if(to_place_def.itemstring == "nothing") {
-        log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to place nonexistent node '" + to_place.itemstring + "' at " + pos.to_string());
-        return;
-      }
-      
-      std::optional<InvPatch> take_patch = std::nullopt;
-      if(!player->data.creative_mode) {
-        //take the dug node from the player
-        InvStack to_take(to_place.itemstring, 1, std::nullopt, std::nullopt);
-        
-        take_patch = inv_calc_take_at(
-            InvRef("player", std::nullopt, "main", wield_index),
-            player->inv_get("main"),
-            to_take);
-        
-        if(!take_patch) {
-          log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to place '" + to_place.itemstring + " but they don't have any in inventory");
-          return;
-        }
-      }
-      
-      //Does extra stuff, like manage metadata.
-      //true = must go through with the place
-      //false = abort
-      bool do_continue = on_place_node(to_place, pos);
-      if(!do_continue)
-        return;
-      
-      log(LogSource::SERVER, LogLevel::EXTRA, "Player '" + player->get_name() + "' places '" + to_place.itemstring + "' at " + pos.to_string());
-      
-#ifdef DEBUG_PERF
-      auto start = std::chrono::steady_clock::now();
-#endif
-      
-      map.set_node(pos, to_place, existing);
-      
-#ifdef DEBUG_PERF
-      auto end = std::chrono::steady_clock::now();
-      auto diff = end - start;
-      
-      std::cout << "place_node in " << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
-#endif
-      
-      if(!player->data.creative_mode) {
-        player_lock_unique.unlock();
-        bool res = inv_apply_patch(*take_patch, player);
-        if(!res) {
-          //TODO
-        }
-      }
+      if(!check_rate_limit(player, RateAction::PLACE_NODE)) { return; }
+      MapPos<int> pos(json.get<int>("pos.x"), json.get<int>("pos.y"), json.get<int>("pos.z"), json.get<int>("pos.w"), json.get<int>("pos.world"), json.get<int>("pos.universe"));
+      int wield_index = json.get<int>("wield");
+      Node to_place(json.get<std::string>("data.itemstring"), json.get<unsigned int>("data.rot"));
+      handle_place_node(player, player_lock_unique, pos, wield_index, to_place);
     } else if(type == "inv_swap") {
-      InvRef ref1(pt.get_child("ref1"));
-      InvRef ref2(pt.get_child("ref2"));
-      InvStack orig1(pt.get_child("orig1"));
-      InvStack orig2(pt.get_child("orig2"));
-      std::string req_id = pt.get<std::string>("reqID");
-      std::string craft_patch_id = pt.get<std::string>("craftPatchID");
+      InvRef ref1(json.child("ref1"));
+      InvRef ref2(json.child("ref2"));
+      InvStack orig1(json.child("orig1"));
+      InvStack orig2(json.child("orig2"));
+      std::string req_id = json.get<std::string>("reqID");
+      std::string craft_patch_id = json.get<std::string>("craftPatchID");
       
       //TODO: access control (incl. accessing only own player's inventory)
       if(ref1.obj_type == "player")
@@ -767,14 +499,14 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         inv_apply_patch(*craft_patch, player);
       }
     } else if(type == "inv_distribute") {
-      InvRef ref1(pt.get_child("ref1"));
-      InvRef ref2(pt.get_child("ref2"));
-      InvStack orig1(pt.get_child("orig1"));
-      InvStack orig2(pt.get_child("orig2"));
-      int qty1 = pt.get<int>("qty1");
-      int qty2 = pt.get<int>("qty2");
-      std::string req_id = pt.get<std::string>("reqID");
-      std::string craft_patch_id = pt.get<std::string>("craftPatchID");
+      InvRef ref1(json.child("ref1"));
+      InvRef ref2(json.child("ref2"));
+      InvStack orig1(json.child("orig1"));
+      InvStack orig2(json.child("orig2"));
+      int qty1 = json.get<int>("qty1");
+      int qty2 = json.get<int>("qty2");
+      std::string req_id = json.get<std::string>("reqID");
+      std::string craft_patch_id = json.get<std::string>("craftPatchID");
       
       //TODO: access control (incl. accessing only own player's inventory)
       if(ref1.obj_type == "player")
@@ -844,7 +576,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         inv_apply_patch(*craft_patch, player);
       }
     } else if(type == "inv_pulverize") {
-      int wield_index = pt.get<int>("wield");
+      int wield_index = json.get<int>("wield");
       InvStack wield_stack = player->inv_get("main", wield_index);
       
       if(wield_stack.is_nil) {
@@ -876,8 +608,8 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
       }
       
       std::string from = player->get_name();
-      std::string channel = pt.get<std::string>("channel");
-      std::string message = pt.get<std::string>("message");
+      std::string channel = json.get<std::string>("channel");
+      std::string message = json.get<std::string>("message");
       
       //TODO: validate channel, access control, etc.
       channel = "main";
@@ -893,7 +625,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         return;
       }
       
-      MapPos<int> pos(pt.get<int>("pos.x"), pt.get<int>("pos.y"), pt.get<int>("pos.z"), pt.get<int>("pos.w"), pt.get<int>("pos.world"), pt.get<int>("pos.universe"));
+      MapPos<int> pos(json.get<int>("pos.x"), json.get<int>("pos.y"), json.get<int>("pos.z"), json.get<int>("pos.w"), json.get<int>("pos.world"), json.get<int>("pos.universe"));
       Node node = map.get_node(pos);
       
       MapPos<int> player_pos_int((int)std::round(player->pos.x), (int)std::round(player->pos.y), (int)std::round(player->pos.z), player->pos.w, player->pos.world, player->pos.universe);
@@ -926,8 +658,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         std::string player_tag = player->get_tag();
         
         chest_ui_instance.close_callback = [this, chest_ref, player_tag]() {
-          std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-          PlayerState *found_player = get_player_by_tag(player_tag);
+          PlayerRef found_player = m_players.snapshot()->get_by_tag(player_tag);
           if(found_player == NULL)
             return;
           std::unique_lock<std::shared_mutex> found_player_lock(found_player->lock);
@@ -1037,8 +768,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         std::string player_tag = player->get_tag();
         
         furnace_ui_instance.close_callback = [this, furnace_ref_in, furnace_ref_fuel, furnace_ref_out, player_tag]() {
-          std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
-          PlayerState *found_player = get_player_by_tag(player_tag);
+          PlayerRef found_player = m_players.snapshot()->get_by_tag(player_tag);
           if(found_player == NULL)
             return;
           std::unique_lock<std::shared_mutex> found_player_lock(found_player->lock);
@@ -1081,7 +811,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
     } else if(type == "ui_close") {
       player_lock_unique.unlock();
       
-      std::string id = pt.get<std::string>("id");
+      std::string id = json.get<std::string>("id");
       UIInstance search_instance(id);
       
       std::unique_lock<std::shared_mutex> ui_list_lock(active_ui_lock);
@@ -1094,7 +824,7 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
       
       active_ui.erase(search);
     } else if(type == "chat_command") {
-      std::string command = pt.get<std::string>("command");
+      std::string command = json.get<std::string>("command");
       
       std::vector<std::string> tokens;
       boost::char_separator<char> sep(" ", "");
@@ -1126,7 +856,560 @@ void Server::on_message(connection_hdl hdl, websocketpp::config::asio::message_t
         chat_send_player(player, "server", e.what());
       }
     }
-  } catch(boost::property_tree::ptree_error const& e) {
+  } catch(JSONError const& e) {
     log(LogSource::SERVER, LogLevel::ERR, "JSON parse error: " + std::string(e.what()) + " payload=" + msg->get_payload());
   }
 }
+
+//Same as the JSON messages of the same names, see message_binary.h for the format.
+void Server::on_binary_message(PlayerState *player, std::unique_lock<std::shared_mutex>& player_lock_unique, const std::string& payload) {
+  BinaryMessageReader reader(payload);
+  
+  uint32_t magic = reader.read_u32();
+  uint16_t version = reader.read_u16();
+  BinaryMessageType type = (BinaryMessageType) reader.read_u16();
+  if(magic != BINARY_MESSAGE_MAGIC) {
+    throw BinaryMessageError("bad magic number");
+  }
+  if(version < 1 || version > BINARY_MESSAGE_VERSION) {
+    throw BinaryMessageError("unsupported version " + std::to_string(version));
+  }
+  
+  if(type == BinaryMessageType::REQ_MAPBLOCK) {
+    if(!check_rate_limit(player, RateAction::REQ_MAPBLOCK)) { return; }
+    int x = reader.read_i32();
+    int y = reader.read_i32();
+    int z = reader.read_i32();
+    int w = reader.read_i32();
+    handle_req_mapblock(player, MapPos<int>(x, y, z, w, player->pos.world, player->pos.universe));
+  } else if(type == BinaryMessageType::REQ_MAPBLOCKS) {
+    uint32_t count = reader.read_u32();
+    if(count > PLAYER_MAX_MAPBLOCK_BATCH) {
+      throw BinaryMessageError("too many mapblocks requested (" + std::to_string(count) + ")");
+    }
+    if(!check_rate_limit(player, RateAction::REQ_MAPBLOCK, count)) { return; }
+    
+    std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> requests;
+    requests.reserve(count);
+    for(uint32_t i = 0; i < count; i++) {
+      int x = reader.read_i32();
+      int y = reader.read_i32();
+      int z = reader.read_i32();
+      int w = reader.read_i32();
+      uint32_t update_num = reader.read_u32();
+      uint32_t light_update_num = reader.read_u32();
+      
+      MapPos<int> mb_pos(x, y, z, w, player->pos.world, player->pos.universe);
+      std::optional<MapblockUpdateInfo> known;
+      if(update_num != BINARY_MESSAGE_UNKNOWN_VERSION) {
+        known = MapblockUpdateInfo(mb_pos);
+        known->update_num = update_num;
+        known->light_update_num = light_update_num;
+        known->light_needs_update = 0;
+      }
+      requests.push_back(std::make_pair(mb_pos, known));
+    }
+    handle_req_mapblocks(player, requests);
+  } else if(type == BinaryMessageType::SET_PLAYER_POS) {
+    if(!check_rate_limit(player, RateAction::SET_PLAYER_POS)) { return; }
+    double pos_x = reader.read_f64();
+    double pos_y = reader.read_f64();
+    double pos_z = reader.read_f64();
+    int pos_w = reader.read_i32();
+    double vel_x = reader.read_f64();
+    double vel_y = reader.read_f64();
+    double vel_z = reader.read_f64();
+    double rot_x = reader.read_f64();
+    double rot_y = reader.read_f64();
+    double rot_z = reader.read_f64();
+    double rot_w = reader.read_f64();
+    handle_set_player_pos(player, MapPos<double>(pos_x, pos_y, pos_z, pos_w, 0, 0), Vector3<double>(vel_x, vel_y, vel_z), Quaternion(rot_x, rot_y, rot_z, rot_w));
+  } else if(type == BinaryMessageType::DIG_NODE || type == BinaryMessageType::PLACE_NODE) {
+    if(!check_rate_limit(player, type == BinaryMessageType::DIG_NODE ? RateAction::DIG_NODE : RateAction::PLACE_NODE)) { return; }
+    int x = reader.read_i32();
+    int y = reader.read_i32();
+    int z = reader.read_i32();
+    int w = reader.read_i32();
+    int world = reader.read_i32();
+    int universe = reader.read_i32();
+    int wield_index = reader.read_i32();
+    unsigned int rot = reader.read_u32();
+    std::string itemstring = reader.read_string();
+    
+    MapPos<int> pos(x, y, z, w, world, universe);
+    if(type == BinaryMessageType::DIG_NODE) {
+      handle_dig_node(player, player_lock_unique, pos, wield_index, Node(itemstring, rot));
+    } else {
+      handle_place_node(player, player_lock_unique, pos, wield_index, Node(itemstring, rot));
+    }
+  } else {
+    throw BinaryMessageError("unknown message type " + std::to_string((int) type));
+  }
+}
+
+//Called before handling a rate limited action, with the player's lock held. Returns whether to go ahead;
+//if not, the message is dropped, and the player is kicked if they keep it up.
+bool Server::check_rate_limit(PlayerState *player, RateAction action, double count) {
+  if(player->rate_limit.allow(action, count)) {
+    return true;
+  }
+  
+  if(player->rate_limit.first_violation()) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' is over the rate limit for " + RateLimiter::action_name(action));
+  }
+  if(player->rate_limit.should_kick()) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Kicking player '" + player->get_name() + "' for exceeding rate limits");
+    websocketpp::lib::error_code ec;
+    m_server.close(player->m_connection_hdl, websocketpp::close::status::policy_violation, "kick: too many requests", ec);
+  }
+  return false;
+}
+
+void Server::handle_req_mapblock(PlayerState *player, MapPos<int> mb_pos) {
+  MapPos<int> player_mb = player->containing_mapblock();
+  MapBox<int> bounding(player_mb - PLAYER_LIMIT_VIEW_DISTANCE, player_mb + PLAYER_LIMIT_VIEW_DISTANCE);
+  if(!bounding.contains(mb_pos)) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' requests out of bounds mapblock at " + mb_pos.to_string());
+    return;
+  }
+  
+  std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> requests;
+  requests.push_back(std::make_pair(mb_pos, std::nullopt));
+  boost::asio::post(player->work_strand, std::bind(&Server::req_mapblocks_work, this, player->shared_from_this(), requests, false));
+}
+
+//Answers a whole list of mapblock requests with one frame (see PlayerState::send_mapblock_batch).
+//'known' is the version the client already has of each one, if any; those that haven't changed since aren't sent again.
+//Lighting and encoding happen on the player's work strand, without their lock; see req_mapblocks_work.
+void Server::handle_req_mapblocks(PlayerState *player, const std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>>& requests) {
+  if(requests.size() > PLAYER_MAX_MAPBLOCK_BATCH) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' requests too many mapblocks at once (" + std::to_string(requests.size()) + ")");
+    return;
+  }
+  
+  MapPos<int> player_mb = player->containing_mapblock();
+  MapBox<int> bounding(player_mb - PLAYER_LIMIT_VIEW_DISTANCE, player_mb + PLAYER_LIMIT_VIEW_DISTANCE);
+  
+  std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> to_send;
+  for(const auto& req : requests) {
+    MapPos<int> mb_pos = req.first;
+    if(!bounding.contains(mb_pos)) {
+      log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' requests out of bounds mapblock at " + mb_pos.to_string());
+      continue;
+    }
+    to_send.push_back(req);
+  }
+  if(to_send.size() == 0) { return; }
+  
+  boost::asio::post(player->work_strand, std::bind(&Server::req_mapblocks_work, this, player->shared_from_this(), to_send, true));
+}
+
+//Runs on the player's work strand: lights the requested mapblocks and gets their frames, then posts them
+//back to the player's strand to be sent. Only touches the map, so the player's lock isn't needed.
+void Server::req_mapblocks_work(PlayerRef player, std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> requests, bool batch) {
+  std::set<MapPos<int>> need_light;
+  for(const auto& req : requests) {
+    MapblockUpdateInfo info = map.get_mapblockupdateinfo(req.first);
+    if(info.light_needs_update == 1) {
+      need_light.insert(req.first);
+    } else if(info.light_needs_update > 1) {
+      //Needs its neighbors relit too, which the batch update doesn't do.
+      map.update_mapblock_light(info);
+    }
+  }
+  
+  if(need_light.size() > 0) {
+#ifdef DEBUG_PERF
+    std::cout << "batch mapblock prep (" << need_light.size() << ") for " << player->get_tag() << std::endl;
+#endif
+    map.update_mapblock_light(std::set<MapPos<int>>(), need_light);
+  }
+  
+  std::vector<MapblockUpdateInfo> unchanged;
+  std::vector<std::shared_ptr<const MapblockFrame>> frames;
+  for(const auto& req : requests) {
+    const std::optional<MapblockUpdateInfo>& known = req.second;
+    if(known) {
+      MapblockUpdateInfo info = map.get_mapblockupdateinfo(req.first);
+      if(known->update_num == info.update_num && known->light_update_num == info.light_update_num) {
+        //Client already has this version
+        unchanged.push_back(info);
+        continue;
+      }
+    }
+    
+    std::shared_ptr<const MapblockFrame> frame;
+    if(known) {
+      frame = map.get_mapblock_delta_frame(*known);
+    }
+    if(frame == NULL) {
+      frame = map.get_mapblock_frame(req.first);
+    }
+    frames.push_back(frame);
+  }
+  
+  boost::asio::post(player->strand, std::bind(&Server::req_mapblocks_done, this, player, std::move(unchanged), std::move(frames), batch));
+}
+
+//Runs on the player's strand, with the results of req_mapblocks_work.
+void Server::req_mapblocks_done(PlayerRef player, std::vector<MapblockUpdateInfo> unchanged, std::vector<std::shared_ptr<const MapblockFrame>> frames, bool batch) {
+  std::unique_lock<std::shared_mutex> player_lock(player->lock);
+  if(player->closed) { return; }
+  
+  for(const MapblockUpdateInfo& info : unchanged) {
+    player->set_known_mapblock(info);
+  }
+  if(frames.size() == 0) { return; }
+  
+  unsigned int len = 0;
+  if(batch) {
+    len += player->send_mapblock_batch(frames);
+  } else {
+    for(const auto& frame : frames) {
+      len += player->send_mapblock(frame);
+    }
+  }
+  player->forget_far_mapblocks();
+  
+#ifdef DEBUG_NET
+  std::unique_lock<std::shared_mutex> net_lock(net_debug_lock);
+  mb_out_len += len;
+  mb_out_count += frames.size();
+#endif
+}
+
+//Only x, y, z, and w of 'pos' are used; players can't change world or universe this way.
+void Server::handle_set_player_pos(PlayerState *player, MapPos<double> pos, Vector3<double> vel, Quaternion rot) {
+  if(player->just_tp) {
+    //Clear position history and ignore this position update.
+    player->pos_history.clear();
+    player->just_tp = false;
+    return;
+  }
+  
+  pos.world = player->pos.world;
+  pos.universe = player->pos.universe;
+  
+  std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+  
+#ifndef DISABLE_PLAYER_SPEED_LIMIT
+  //Validate that the player hasn't moved too far since their last position update
+  //FIXME: doesn't handle falling players
+  bool violation = false;
+  
+  if(player->pos_history.size() > 0) {
+    MapPos<double> total_distance(0, 0, 0, 0, 0, 0);
+    MapPos<double> total_distance_sign(0, 0, 0, 0, 0, 0);
+    MapPos<double> previous = pos;
+    for(auto it : player->pos_history) {
+      total_distance += (previous - it.second).abs();
+      total_distance_sign += (previous - it.second);
+      previous = it.second;
+    }
+    
+    std::chrono::time_point<std::chrono::steady_clock> oldest = player->pos_history.back().first;
+    double diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest).count() / 10000.0; //milliseconds -> tens of seconds
+    if(diff > 0) {
+      MapPos<double> vel(total_distance.x / diff, total_distance.y / diff, total_distance.z / diff,
+                         total_distance.w / diff, total_distance.world / diff, total_distance.universe / diff);
+      MapPos<double> vel_sign(total_distance_sign.x / diff, total_distance_sign.y / diff, total_distance_sign.z / diff,
+                              total_distance_sign.w / diff, total_distance_sign.world / diff, total_distance_sign.universe / diff);
+      
+      MapPos<int> limit = PLAYER_LIMIT_VEL;
+      if(player->data.has_priv("fast")) {
+        limit = PLAYER_LIMIT_VEL_FAST;
+      }
+      
+      if(vel_sign.y < -limit.y) {
+        //falling player, probably
+        //FIXME
+        limit.y *= 5;
+      }
+      
+      if(vel.x > limit.x || vel.y > limit.y || vel.z > limit.z ||
+         vel.w > limit.w || vel.world > limit.world || vel.universe > limit.universe) {
+        violation = true;
+      }
+    }
+  }
+  
+  if(violation) {
+    log(LogSource::SERVER, LogLevel::WARNING, "player '" + player->get_name() + "' tried to move too fast");
+    player->send_pos(); //pull them back
+    return; //don't accept the new position
+  }
+#endif
+  
+  player->pos_history.push_front(std::make_pair(now, pos));
+  if(player->pos_history.size() > 8) {
+    player->pos_history.pop_back();
+  }
+  
+  player->pos = pos;
+  player->vel.set(vel.x, vel.y, vel.z, player->vel.w, player->vel.world, player->vel.universe);
+  player->rot = rot;
+  player_grid.update(player, pos);
+  
+  if(player->auth) {
+    save_player(player);
+  }
+  
+  //Players being streamed to get their mapblocks lit as they're sent.
+  if(!player->stream.enabled()) {
+    prepare_entered_mapblocks(player);
+  }
+}
+
+//Lights the mapblocks a player has just come into range of (see PlayerState::entered_mapblocks) on their work strand.
+//Nothing to do until they cross into another mapblock, so most position updates cost only the comparison.
+//Called with the player's lock held.
+void Server::prepare_entered_mapblocks(PlayerState *player) {
+  MapPos<int> center = player->containing_mapblock();
+  if(player->prepared_center && *player->prepared_center == center) { return; }
+  
+  std::vector<MapPos<int>> entered = player->entered_mapblocks(player->prepared_center);
+  player->prepared_center = center;
+  if(entered.size() == 0) { return; }
+  
+  boost::asio::post(player->work_strand, [this, entered]() { PlayerState::prepare_mapblocks(entered, map); });
+}
+
+//Saves the player's data on their work strand, so that the database write happens without their lock,
+//and in the same order as any other saves of theirs. Called with the player's lock held.
+void Server::save_player(PlayerState *player) {
+  PlayerData data = player->get_data();
+  boost::asio::post(player->work_strand, [this, data]() { db.update_player_data(data); });
+}
+
+void Server::handle_dig_node(PlayerState *player, std::unique_lock<std::shared_mutex>& player_lock_unique, MapPos<int> pos, int wield_index, Node existing) {
+  if(!player->has_priv("touch")) {
+    player_lock_unique.unlock();
+    chat_send_player(player, "server", "you can't dig nodes, you haven't got the 'touch' privilege!");
+    return;
+  }
+  
+  InvStack wield_stack = player->inv_get("main", wield_index);
+  Node target = map.get_node(pos);
+  
+  if(existing != target) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
+                                             + " attempted to dig node '" + existing.itemstring + "' at " + pos.to_string() + " but it has since changed");
+    //TODO tell the client
+    return;
+  }
+  
+  MapPos<int> player_pos_int((int)std::round(player->pos.x), (int)std::round(player->pos.y), (int)std::round(player->pos.z), player->pos.w, player->pos.world, player->pos.universe);
+  MapBox<int> bounding(player_pos_int - PLAYER_LIMIT_REACH_DISTANCE, player_pos_int + PLAYER_LIMIT_REACH_DISTANCE);
+  if(!bounding.contains(pos)) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' at " + player_pos_int.to_string()
+                                             + " attempted to dig node '" + target.itemstring + "' far away at " + pos.to_string());
+    return;
+  }
+  
+  NodeDef target_def = get_node_def(target.itemstring);
+  if(target_def.itemstring == "nothing") {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to dig nonexistent node '" + target.itemstring + "' at " + pos.to_string());
+    return;
+  }
+  
+  if(!target_def.breakable) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to dig unbreakable node '" + target.itemstring + "' at " + pos.to_string());
+    return;
+  }
+  
+  std::optional<double> break_time_tool = calc_dig_time(target, wield_stack);
+  std::optional<double> break_time_hand = calc_dig_time(target, InvStack());
+  
+  if(!player->data.creative_mode) {
+    if(!break_time_tool && !break_time_hand) {
+      log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to dig with inadequate tools node '" + target.itemstring + "' at " + pos.to_string());
+      return;
+    }
+  }
+  
+  //Does extra stuff, like manage metadata.
+  //true = must go through with the dig
+  //false = abort
+  bool do_continue = on_dig_node(target, pos);
+  if(!do_continue)
+    return;
+  
+  log(LogSource::SERVER, LogLevel::EXTRA, "Player '" + player->get_name() + "' digs '" + target.itemstring + "' at " + pos.to_string());
+  
+#ifdef DEBUG_PERF
+  auto start = std::chrono::steady_clock::now();
+#endif
+  
+  map.set_node(pos, Node("air"), target);
+  
+#ifdef DEBUG_PERF
+  auto end = std::chrono::steady_clock::now();
+  auto diff = end - start;
+  
+  std::cout << "dig_node in " << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
+#endif
+  
+  InvPatch combined_patch;
+  
+  if(!player->data.creative_mode) {
+    //consume tool
+    InvPatch use_tool_patch;
+    if(break_time_tool) {
+      bool do_consume = true;
+      if(break_time_hand) {
+        if(*break_time_hand <= *break_time_tool)
+          do_consume = false;
+      }
+      if(do_consume && wield_stack.wear) {
+        InvStack new_wield_stack(wield_stack);
+        new_wield_stack.wear = *new_wield_stack.wear - 1;
+        if(new_wield_stack.wear <= 0)
+          new_wield_stack = InvStack();
+        
+        use_tool_patch.diffs.push_back(InvDiff(
+            InvRef("player", std::nullopt, "main", wield_index),
+            wield_stack,
+            new_wield_stack));
+      }
+    }
+    
+    combined_patch += use_tool_patch;
+  }
+  
+  //give the dug node to the player
+  InvStack to_give;
+  if(target_def.drops != "")
+    to_give = InvStack(target_def.drops);
+  else if(get_item_def(target.itemstring).itemstring != "nothing")
+    to_give = InvStack(target.itemstring, 1, std::nullopt, std::nullopt);
+  //else
+  //  log(LogSource::SERVER, LogLevel::NOTICE, "node '" + target.itemstring + "' drops nothing");
+  
+  if(!to_give.is_nil) {
+    bool should_give = true;
+    if(player->data.creative_mode && !to_give.data) {
+      const InvList& main_list = player->inv_get("main");
+      for(const auto& stack : main_list.list) {
+        if(stack.itemstring == to_give.itemstring) {
+          should_give = false;
+          break;
+        }
+      }
+    }
+    
+    if(should_give) {
+      std::optional<InvPatch> give_patch = inv_calc_give(
+          InvRef("player", std::nullopt, "main", std::nullopt),
+          player->inv_get("main"),
+          to_give);
+      
+      if(give_patch) {
+        combined_patch += *give_patch;
+      } else {
+        //couldn't give
+        //TODO
+      }
+    }
+  }
+  
+  if(combined_patch.diffs.size() > 0) {
+    player_lock_unique.unlock();
+    bool res = inv_apply_patch(combined_patch, player);
+    if(!res) {
+      //TODO
+    }
+  }
+}
+
+void Server::handle_place_node(PlayerState *player, std::unique_lock<std::shared_mutex>& player_lock_unique, MapPos<int> pos, int wield_index, Node to_place) {
+  if(!player->has_priv("touch")) {
+    player_lock_unique.unlock();
+    chat_send_player(player, "server", "you can't place nodes, you haven't got the 'touch' privilege!");
+    return;
+  }
+  
+  InvStack wield_stack = player->inv_get("main", wield_index);
+  
+  //FIXME this should be handled by 'expected' in set_node
+  Node existing = map.get_node(pos);
+  NodeDef existing_def = get_node_def(existing);
+  if(!existing_def.can_place_inside) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
+                                             + " attempted to place node '" + to_place.itemstring + "' over '" + existing.itemstring + "'");
+    //TODO tell the client
+    return;
+  }
+  
+  if(wield_stack.is_nil) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
+                                             + " attempted to place node '" + to_place.itemstring + "' but they are not wielding anything");
+    //TODO tell the client
+    return;
+  }
+  if(to_place.itemstring != wield_stack.itemstring) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name()
+                                             + " attempted to place node '" + to_place.itemstring + "' but they are really wielding '" + wield_stack.itemstring + "'");
+    //TODO tell the client
+    return;
+  }
+  
+  MapPos<int> player_pos_int((int)std::round(player->pos.x), (int)std::round(player->pos.y), (int)std::round(player->pos.z), player->pos.w, player->pos.world, player->pos.universe);
+  MapBox<int> bounding(player_pos_int - PLAYER_LIMIT_REACH_DISTANCE, player_pos_int + PLAYER_LIMIT_REACH_DISTANCE);
+  if(!bounding.contains(pos)) {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' at " + player_pos_int.to_string()
+                                             + " attempted to place node '" + to_place.itemstring + "' far away at " + pos.to_string());
+    return;
+  }
+  
+  NodeDef to_place_def = get_node_def(to_place.itemstring);
+  if(to_place_def.itemstring == "nothing") {
+    log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to place nonexistent node '" + to_place.itemstring + "' at " + pos.to_string());
+    return;
+  }
+  
+  std::optional<InvPatch> take_patch = std::nullopt;
+  if(!player->data.creative_mode) {
+    //take the dug node from the player
+    InvStack to_take(to_place.itemstring, 1, std::nullopt, std::nullopt);
+    
+    take_patch = inv_calc_take_at(
+        InvRef("player", std::nullopt, "main", wield_index),
+        player->inv_get("main"),
+        to_take);
+    
+    if(!take_patch) {
+      log(LogSource::SERVER, LogLevel::NOTICE, "Player '" + player->get_name() + "' attempted to place '" + to_place.itemstring + " but they don't have any in inventory");
+      return;
+    }
+  }
+  
+  //Does extra stuff, like manage metadata.
+  //true = must go through with the place
+  //false = abort
+  bool do_continue = on_place_node(to_place, pos);
+  if(!do_continue)
+    return;
+  
+  log(LogSource::SERVER, LogLevel::EXTRA, "Player '" + player->get_name() + "' places '" + to_place.itemstring + "' at " + pos.to_string());
+  
+#ifdef DEBUG_PERF
+  auto start = std::chrono::steady_clock::now();
+#endif
+  
+  map.set_node(pos, to_place, existing);
+  
+#ifdef DEBUG_PERF
+  auto end = std::chrono::steady_clock::now();
+  auto diff = end - start;
+  
+  std::cout << "place_node in " << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
+#endif
+  
+  if(!player->data.creative_mode) {
+    player_lock_unique.unlock();
+    bool res = inv_apply_patch(*take_patch, player);
+    if(!res) {
+      //TODO
+    }
+  }
+}
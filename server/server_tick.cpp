@@ -22,132 +22,117 @@
 #include "config.h"
 #include "player_util.h"
 
-void Server::tick(const boost::system::error_code&) {
-  std::unique_lock<std::shared_mutex> tick_info_l(tick_info_lock);
-  std::shared_lock<std::shared_mutex> list_lock(m_players_lock);
+#include <algorithm>
+#include <unordered_map>
+#include <optional>
+
+//Called by tick_scheduler, on its own thread, every server.tick_interval ms.
+void Server::tick() {
+  std::shared_ptr<const PlayerSnapshot> players = m_players.snapshot();
   
-  std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
-  int diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_tick).count(); //milliseconds
-  last_tick = now;
+  //Write out any node changes still waiting for their window to close.
+  {
+    TickPhaseTimer timer(tick_scheduler, "set_node");
+    map.flush_set_node_queue();
+  }
   
-  if(diff > SERVER_TICK_INTERVAL * 2 || diff < SERVER_TICK_INTERVAL / 2) {
-    log(LogSource::SERVER, LogLevel::WARNING, "Tick took " + std::to_string(diff) + " ms (expected " + std::to_string(SERVER_TICK_INTERVAL) + " ms)!");
+  //Anything that can take a while is queued as deferred work, which is run at the end of the tick within a time budget.
+  //A new pass of each kind is only queued once the last one has finished.
+  if(!work.has_work(WorkClass::MAPBLOCK_STREAM)) {
+    stream_tick_players = players;
+    stream_tick_next = 0;
+    work.add(WorkClass::MAPBLOCK_STREAM, "stream", std::bind(&Server::stream_tick_step, this));
   }
   
   mapblock_tick_counter++;
   fluid_tick_counter++;
-  if(mapblock_tick_counter >= SERVER_MAPBLOCK_TICK_RATIO) {
-    std::set<MapPos<int>> interested_mapblocks;
-    
-    for(auto p : m_players) {
-      PlayerState *player = p.second;
-      std::shared_lock<std::shared_mutex> player_lock(player->lock);
-      
-      if(!player->auth && !player->auth_guest) { continue; }
-      
-      std::vector<MapPos<int>> nearby_known_mapblocks_1 = player->list_nearby_known_mapblocks(PLAYER_MAPBLOCK_INTEREST_DISTANCE, PLAYER_MAPBLOCK_INTEREST_DISTANCE_W);
-      std::vector<MapPos<int>> nearby_known_mapblocks_2 = player->list_nearby_known_mapblocks(PLAYER_MAPBLOCK_INTEREST_DISTANCE_SMALL, PLAYER_MAPBLOCK_INTEREST_DISTANCE_SMALL_W);
-      
-      std::set<MapPos<int>> nearby_known_mapblocks_set(nearby_known_mapblocks_1.begin(), nearby_known_mapblocks_1.end());
-      nearby_known_mapblocks_set.insert(nearby_known_mapblocks_2.begin(), nearby_known_mapblocks_2.end());
-      
-      std::vector<MapPos<int>> nearby_known_mapblocks(nearby_known_mapblocks_set.begin(), nearby_known_mapblocks_set.end());
-      
-      player->update_nearby_known_mapblocks(nearby_known_mapblocks, map);
-      
-      for(size_t i = 0; i < nearby_known_mapblocks.size(); i++) {
-        interested_mapblocks.insert(nearby_known_mapblocks[i]);
-      }
+  if(mapblock_tick_counter >= mapblock_tick_ratio) {
+    if(!work.has_work(WorkClass::MAPBLOCK_PREP)) {
+      change_tick_started = false;
+      work.add(WorkClass::MAPBLOCK_PREP, "changes", std::bind(&Server::mapblock_change_step, this));
     }
     
-    if(fluid_tick_counter >= SERVER_FLUID_TICK_RATIO) {
-#ifdef DEBUG_PERF
-      auto start = std::chrono::steady_clock::now();
-#endif
-      
-      map.tick_fluids(interested_mapblocks);
-      
-#ifdef DEBUG_PERF
-      auto end = std::chrono::steady_clock::now();
-      auto diff = end - start;
-      
-      std::cout << "tick_fluids in " << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
-#endif
+    if(fluid_tick_counter >= fluid_tick_ratio) {
+      if(!work.has_work(WorkClass::FLUIDS)) {
+        //The interest pass is higher priority, so it finishes before the fluid tick starts.
+        interest_tick_players = players;
+        interest_tick_next = 0;
+        interest_tick_mapblocks.clear();
+        work.add(WorkClass::MAPBLOCK_PREP, "interest", std::bind(&Server::interest_tick_step, this));
+        
+        fluid_tick_started = false;
+        work.add(WorkClass::FLUIDS, "fluids", std::bind(&Server::fluid_tick_step, this));
+      }
       fluid_tick_counter = 0;
     }
     
     mapblock_tick_counter = 0;
   }
   
-  for(auto p : m_players) {
-    PlayerState *player = p.second;
-    std::shared_lock<std::shared_mutex> player_lock(player->lock);
-    
-    if(!player->auth && !player->auth_guest) { continue; }
+  //The per-player work below is done in phases, each spread over tick_pool, with a barrier between them.
+  size_t player_count = players->size();
+  
+  //Serialize every player's entity data once; each observer's update is then put together from these
+  //without touching the other players' locks.
+  std::vector<std::optional<EntitySnapshot>> entity_snapshots(player_count);
+  std::optional<TickPhaseTimer> timer;
+  timer.emplace(tick_scheduler, "entities");
+  tick_pool.run(player_count, [&players, &entity_snapshots](size_t i) {
+    PlayerState *player = (*players)[i].get();
+    std::unique_lock<std::shared_mutex> player_lock(player->lock);
     
-    std::ostringstream out;
-    out << "{\"type\":\"update_entities\",\"actions\":[";
+    if(player->closed) { return; }
+    if(!player->auth && !player->auth_guest) { return; }
     
-    bool first = true;
-    for(auto p_sub : m_players) {
-      PlayerState *candidate = p_sub.second;
-      if(candidate == player) { continue; }
-      
-      std::shared_lock<std::shared_mutex> candidate_lock(candidate->lock);
-      
-      std::string candidate_tag = candidate->get_tag();
-      
-      double distance = player->pos.distance_to(candidate->pos);
-      if(distance <= PLAYER_ENTITY_VISIBILE_DISTANCE) {
-        //Player should know about candidate entity
-        if(player->known_player_tags.find(candidate_tag) == player->known_player_tags.end()) {
-          //...but they don't
-          //so create it
-          
-          if(!first) { out << ","; }
-          first = false;
-          out << "{\"type\":\"create\",\"data\":" << candidate->entity_data_as_json() << "}";
-          
-          player->known_player_tags.insert(candidate_tag);
-        } else {
-          //update it
-          
-          if(!first) { out << ","; }
-          first = false;
-          out << "{\"type\":\"update\",\"data\":" << candidate->entity_data_as_json() << "}";
-        }
-      } else {
-        //Player should *not* know about candidate entity
-        if(player->known_player_tags.find(candidate_tag) != player->known_player_tags.end()) {
-          //...but they do
-          //so delete it
-          
-          if(!first) { out << ","; }
-          first = false;
-          out << "{\"type\":\"delete\",\"data\":" << candidate->entity_data_as_json() << "}";
-          
-          player->known_player_tags.erase(candidate_tag);
-        }
-      }
+    entity_snapshots[i] = player->entity_snapshot();
+  });
+  
+  std::unordered_map<PlayerState*, const EntitySnapshot*> entity_index;
+  for(size_t i = 0; i < player_count; i++) {
+    if(entity_snapshots[i]) {
+      entity_index[(*players)[i].get()] = &*entity_snapshots[i];
     }
-    
-    out << "]}";
-    
-    player->send(out.str());
   }
   
+  tick_pool.run(player_count, [this, &players, &entity_snapshots, &entity_index](size_t i) {
+    if(!entity_snapshots[i]) { return; }
+    send_entity_updates((*players)[i].get(), *entity_snapshots[i], entity_index);
+  });
+  
+  //Send whatever was held back for connections that were busy.
+  timer.emplace(tick_scheduler, "flush_sends");
+  tick_pool.run(player_count, [&players](size_t i) {
+    PlayerState *player = (*players)[i].get();
+    std::unique_lock<std::shared_mutex> player_lock(player->lock);
+    player->flush_sends();
+  });
+  timer.reset();
+  
   slow_tick_counter++;
-  if(slow_tick_counter >= SERVER_SLOW_TICK_RATIO) {
-    slow_tick();
+  if(slow_tick_counter >= slow_tick_ratio) {
+    if(!work.has_work(WorkClass::BACKGROUND)) {
+      work.add(WorkClass::BACKGROUND, "slow_tick", [this]() { slow_tick(); return true; });
+    }
     slow_tick_counter = 0;
   }
   
   interact_tick_counter++;
-  if(interact_tick_counter >= SERVER_INTERACT_TICK_RATIO) {
-    interact_tick();
+  if(interact_tick_counter >= interact_tick_ratio) {
+    if(!work.has_work(WorkClass::FURNACES)) {
+      interact_tick_started = false;
+      work.add(WorkClass::FURNACES, "interact", std::bind(&Server::interact_tick_step, this));
+    }
     interact_tick_counter = 0;
   }
   
+  timer.emplace(tick_scheduler, "deferred");
+  work.run(tick_work_budget);
+  timer.reset();
+  if(work.last_run_duration() > tick_work_budget * 2) {
+    log(LogSource::SERVER, LogLevel::WARNING, "Deferred work took " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(work.last_run_duration()).count())
+        + " ms (budget " + std::to_string(tick_work_budget.count()) + " ms): " + work.last_run_summary());
+  }
+  
 #ifdef DEBUG_NET
   //FIXME doesn't include *all* mapblocks sent
   {
@@ -157,11 +142,279 @@ void Server::tick(const boost::system::error_code&) {
     }
   }
 #endif
+}
+
+//Tells the player about other players coming into view, moving, and going out of view, from this tick's snapshots.
+//Only takes this player's lock, so it can be done for every player at once.
+void Server::send_entity_updates(PlayerState *player, const EntitySnapshot& own, const std::unordered_map<PlayerState*, const EntitySnapshot*>& entity_snapshots) {
+  std::unique_lock<std::shared_mutex> player_lock(player->lock);
+  
+  if(player->closed) { return; }
+  
+  //The last update is still waiting to go out. Rather than queue up another behind it,
+  //skip this one and make the next include everyone.
+  if(player->send_pending(SendClass::ENTITIES)) {
+    player->entities_behind = true;
+    return;
+  }
+  bool refresh = player->entities_behind;
+  player->entities_behind = false;
+  
+  std::string out = "{\"type\":\"update_entities\",\"actions\":[";
+  bool first = true;
+  auto add_action = [&out, &first](const char *type, const std::string& data) {
+    if(!first) { out += ","; }
+    first = false;
+    out += "{\"type\":\"";
+    out += type;
+    out += "\",\"data\":";
+    out += data;
+    out += "}";
+  };
+  
+  std::set<std::string> visible_tags;
+  for(PlayerState *candidate : player_grid.query(own.pos, PLAYER_ENTITY_VISIBILE_DISTANCE)) {
+    if(candidate == player) { continue; }
+    
+    auto search = entity_snapshots.find(candidate);
+    if(search == entity_snapshots.end()) { continue; }
+    const EntitySnapshot& snapshot = *search->second;
+    
+    //Disconnected since the snapshot; on_close deletes it from everyone who knows about it,
+    //and checking here with this player's lock held makes sure it isn't created again afterwards.
+    if(candidate->closed) { continue; }
+    
+    if(own.pos.distance_to(snapshot.pos) > PLAYER_ENTITY_VISIBILE_DISTANCE) { continue; }
+    
+    visible_tags.insert(snapshot.tag);
+    
+    //Player should know about candidate entity
+    if(player->known_player_tags.find(snapshot.tag) == player->known_player_tags.end()) {
+      //...but they don't
+      //so create it
+      add_action("create", *snapshot.data);
+      player->known_player_tags.insert(snapshot.tag);
+    } else if(snapshot.changed || refresh) {
+      //update it
+      add_action("update", *snapshot.data);
+    }
+  }
+  
+  //Everything else the player knows about is out of range now, so delete it.
+  //Those players weren't looked at, but the client only needs the id.
+  for(auto tag_it = player->known_player_tags.begin(); tag_it != player->known_player_tags.end();) {
+    if(visible_tags.find(*tag_it) != visible_tags.end()) {
+      tag_it++;
+      continue;
+    }
+    
+    add_action("delete", "{\"id\":\"" + json_escape(*tag_it) + "\"}");
+    tag_it = player->known_player_tags.erase(tag_it);
+  }
   
-  if(!halt) {
-    m_timer.expires_at(m_timer.expiry() + boost::asio::chrono::milliseconds(SERVER_TICK_INTERVAL));
-    m_timer.async_wait(boost::bind(&Server::tick, this, boost::asio::placeholders::error));
+  //Nothing to say, so don't send an empty update.
+  if(first) { return; }
+  
+  out += "]}";
+  player->send(out, SendClass::ENTITIES);
+}
+
+//Works out which mapblocks players are interested in, a few players at a time (SERVER_INTEREST_STEP_PLAYERS
+//for each thread in tick_pool). Once every player has been visited, the result is used by the fluid tick.
+//Called from tick.
+bool Server::interest_tick_step() {
+  size_t begin = interest_tick_next;
+  size_t end = std::min(begin + SERVER_INTEREST_STEP_PLAYERS * tick_pool.size(), interest_tick_players->size());
+  std::vector<std::vector<MapPos<int>>> results(end - begin);
+  tick_pool.run(end - begin, [this, begin, &results](size_t i) {
+    const PlayerRef& player = (*interest_tick_players)[begin + i];
+    std::unique_lock<std::shared_mutex> player_lock(player->lock);
+    
+    if(player->closed) { return; } //disconnected since the pass started
+    if(!player->auth && !player->auth_guest) { return; }
+    
+    std::vector<MapPos<int>> nearby_known_mapblocks_1 = player->list_nearby_known_mapblocks(PLAYER_MAPBLOCK_INTEREST_DISTANCE, PLAYER_MAPBLOCK_INTEREST_DISTANCE_W);
+    std::vector<MapPos<int>> nearby_known_mapblocks_2 = player->list_nearby_known_mapblocks(PLAYER_MAPBLOCK_INTEREST_DISTANCE_SMALL, PLAYER_MAPBLOCK_INTEREST_DISTANCE_SMALL_W);
+    
+    std::set<MapPos<int>> nearby_known_mapblocks_set(nearby_known_mapblocks_1.begin(), nearby_known_mapblocks_1.end());
+    nearby_known_mapblocks_set.insert(nearby_known_mapblocks_2.begin(), nearby_known_mapblocks_2.end());
+    
+    results[i] = std::vector<MapPos<int>>(nearby_known_mapblocks_set.begin(), nearby_known_mapblocks_set.end());
+  });
+  interest_tick_next = end;
+  
+  for(const auto& it : results) {
+    interest_tick_mapblocks.insert(it.begin(), it.end());
   }
+  
+  if(interest_tick_next < interest_tick_players->size()) { return false; }
+  
+  interested_mapblocks = interest_tick_mapblocks;
+  return true;
+}
+
+//Sends mapblocks that have changed to the players who have them (see MapblockSubscribers), a few players at a time
+//(SERVER_CHANGE_STEP_PLAYERS for each thread in tick_pool). Players with nothing changed cost nothing.
+//Called from tick.
+bool Server::mapblock_change_step() {
+  if(!change_tick_started) {
+    //Started here rather than when queued, so it gets all the changes up to now.
+    change_tick_players = mapblock_subscribers.take_changes();
+    change_tick_next = 0;
+    change_tick_started = true;
+  }
+  
+  size_t begin = change_tick_next;
+  size_t end = std::min(begin + SERVER_CHANGE_STEP_PLAYERS * tick_pool.size(), change_tick_players.size());
+  tick_pool.run(end - begin, [this, begin](size_t i) {
+    const auto& it = change_tick_players[begin + i];
+    std::unique_lock<std::shared_mutex> player_lock(it.first->lock);
+    
+    if(it.first->closed) { return; }
+    if(!it.first->auth && !it.first->auth_guest) { return; }
+    
+    //Some may have been forgotten (and the client told to drop them) since the changes were taken.
+    std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> still_known;
+    for(const MapPos<int>& mb_pos : it.second) {
+      std::optional<MapblockUpdateInfo> known = it.first->known_mapblocks.get(mb_pos);
+      if(known) {
+        still_known.push_back(std::make_pair(mb_pos, known));
+      }
+    }
+    if(still_known.size() == 0) { return; }
+    
+    boost::asio::post(it.first->work_strand, std::bind(&Server::send_mapblocks_work, this, it.first, std::move(still_known), false));
+  });
+  change_tick_next = end;
+  
+  if(change_tick_next < change_tick_players.size()) { return false; }
+  
+  change_tick_players.clear();
+  return true;
+}
+
+//Pushes mapblocks to players within their view distance (see PlayerState::stream_mapblocks), a few players at a time
+//(SERVER_STREAM_STEP_PLAYERS for each thread in tick_pool).
+//Called from tick.
+bool Server::stream_tick_step() {
+  size_t begin = stream_tick_next;
+  size_t end = std::min(begin + SERVER_STREAM_STEP_PLAYERS * tick_pool.size(), stream_tick_players->size());
+  tick_pool.run(end - begin, [this, begin](size_t i) {
+    const PlayerRef& player = (*stream_tick_players)[begin + i];
+    std::unique_lock<std::shared_mutex> player_lock(player->lock);
+    
+    if(player->closed) { return; } //disconnected since the pass started
+    if(!player->auth && !player->auth_guest) { return; }
+    
+    std::optional<MapPos<int>> sky_pos;
+    std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> to_send = player->stream_mapblocks(map, sky_pos);
+    if(sky_pos) {
+      player->stream.set_busy(true);
+      boost::asio::post(player->work_strand, std::bind(&Server::stream_sky_work, this, player, player->containing_mapblock(), *sky_pos));
+      return;
+    }
+    if(to_send.size() == 0) { return; }
+    
+    player->stream.set_busy(true);
+    boost::asio::post(player->work_strand, std::bind(&Server::send_mapblocks_work, this, player, std::move(to_send), true));
+  });
+  stream_tick_next = end;
+  
+  return stream_tick_next >= stream_tick_players->size();
+}
+
+//Runs on the player's work strand: finds out whether a streaming player can see the sky from 'sky_pos' (see MapblockStream::plan),
+//once each time they enter another mapblock, 'center'.
+void Server::stream_sky_work(PlayerRef player, MapPos<int> center, MapPos<int> sky_pos) {
+  bool sees_sky = map.get_sunlight(sky_pos) > 0;
+  boost::asio::post(player->strand, std::bind(&Server::stream_sky_done, this, player, center, sees_sky));
+}
+
+//Runs on the player's strand, with the result of stream_sky_work. The next stream pass picks up from there.
+void Server::stream_sky_done(PlayerRef player, MapPos<int> center, bool sees_sky) {
+  std::unique_lock<std::shared_mutex> player_lock(player->lock);
+  player->stream.set_busy(false);
+  player->stream.set_sees_sky(center, sees_sky);
+}
+
+//Runs on the player's work strand: lights mapblocks picked by the stream or change step and gets their frames,
+//then posts them back to the player's strand to be sent. Like req_mapblocks_work, only touches the map, so the player's lock
+//isn't held while mapblocks are loaded or lit. Each mapblock comes with the version the player had when it was picked,
+//which a delta is made from.
+void Server::send_mapblocks_work(PlayerRef player, std::vector<std::pair<MapPos<int>, std::optional<MapblockUpdateInfo>>> mapblocks, bool stream) {
+  std::vector<MapPos<int>> mapblock_list;
+  for(const auto& it : mapblocks) {
+    mapblock_list.push_back(it.first);
+  }
+  PlayerState::prepare_mapblocks(mapblock_list, map);
+  
+  std::vector<std::pair<std::optional<MapblockUpdateInfo>, std::shared_ptr<const MapblockFrame>>> frames;
+  for(const auto& it : mapblocks) {
+    const std::optional<MapblockUpdateInfo>& known = it.second;
+    if(known && !(*known != map.get_mapblockupdateinfo(it.first))) { continue; } //changed back, or was already relit
+    
+    std::shared_ptr<const MapblockFrame> frame;
+    if(known) {
+      frame = map.get_mapblock_delta_frame(*known);
+    }
+    if(frame == NULL) {
+      frame = map.get_mapblock_frame(it.first);
+    }
+    frames.push_back(std::make_pair(known, frame));
+  }
+  
+  boost::asio::post(player->strand, std::bind(&Server::send_mapblocks_done, this, player, std::move(frames), stream));
+}
+
+//Runs on the player's strand, with the results of send_mapblocks_work. A mapblock is only sent if the player still has
+//the version it was picked at: otherwise it's been sent some other way in the meantime, or forgotten (and the client
+//told to drop it), and either way the frame no longer applies. Streamed mapblocks are sent as far as the budget allows;
+//the rest are picked again next pass.
+void Server::send_mapblocks_done(PlayerRef player, std::vector<std::pair<std::optional<MapblockUpdateInfo>, std::shared_ptr<const MapblockFrame>>> frames, bool stream) {
+  std::unique_lock<std::shared_mutex> player_lock(player->lock);
+  if(stream) {
+    player->stream.set_busy(false);
+  }
+  if(player->closed) { return; }
+  
+  double budget = stream ? player->stream.available() : 0;
+  for(const auto& it : frames) {
+    if(stream && budget <= 0) { break; }
+    
+    const std::optional<MapblockUpdateInfo>& picked = it.first;
+    std::optional<MapblockUpdateInfo> known = player->known_mapblocks.get(it.second->info.pos);
+    if(known.has_value() != picked.has_value() || (known && *known != *picked)) { continue; }
+    
+    unsigned int len = player->send_mapblock(it.second);
+    if(stream) {
+      player->stream.spend(len);
+      budget -= len;
+    }
+  }
+}
+
+//Called from tick.
+bool Server::fluid_tick_step() {
+  if(!fluid_tick_started) {
+    //Started here rather than when queued, so it gets the latest interest pass.
+    map.begin_fluid_tick(interested_mapblocks);
+    fluid_tick_started = true;
+  }
+  
+#ifdef DEBUG_PERF
+  auto start = std::chrono::steady_clock::now();
+#endif
+  
+  bool finished = map.step_fluid_tick(SERVER_FLUID_STEP_MAPBLOCKS);
+  
+#ifdef DEBUG_PERF
+  auto end = std::chrono::steady_clock::now();
+  auto diff = end - start;
+  
+  std::cout << "step_fluid_tick in " << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
+#endif
+  
+  return finished;
 }
 
 void Server::slow_tick() {
@@ -182,13 +435,21 @@ void Server::wake_interact_tick(MapPos<int> node_pos) {
   active_interact_tick.erase(node_pos);
 }
 
-void Server::interact_tick() {
+//Ticks active furnaces, a few at a time, resuming after the last one visited.
+//Called from tick.
+bool Server::interact_tick_step() {
   std::unique_lock<std::shared_mutex> list_lock(active_interact_tick_lock);
   
-  auto it = active_interact_tick.begin();
+  auto it = interact_tick_started ? active_interact_tick.upper_bound(interact_tick_last) : active_interact_tick.begin();
+  interact_tick_started = true;
+  size_t count = 0;
   while(it != active_interact_tick.end()) {
+    if(count >= SERVER_INTERACT_STEP_NODES) { return false; }
+    count++;
+    
     auto current = it++;
     MapPos<int> node_pos = *current;
+    interact_tick_last = node_pos;
     Node node = map.get_node(node_pos);
     
     if(node.itemstring == "default:furnace" || node.itemstring == "default:furnace_active") {
@@ -348,4 +609,6 @@ void Server::interact_tick() {
     
     active_interact_tick.erase(current);
   }
+  
+  return true;
 }
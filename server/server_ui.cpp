@@ -43,7 +43,7 @@ void Server::update_ui(PlayerState *player, const UIInstance& instance) {
 }
 void Server::update_ui(const UIInstance& instance) {
   std::unique_lock<std::shared_mutex> ui_list_lock(active_ui_lock);
-  PlayerState *player = get_player_by_tag(instance.player_tag);
+  PlayerRef player = m_players.snapshot()->get_by_tag(instance.player_tag);
   
   if(player == NULL) {
     active_ui.erase(instance);
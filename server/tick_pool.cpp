@@ -0,0 +1,100 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tick_pool.h"
+#include "log.h"
+
+#include <exception>
+
+TickPool::TickPool(int threads) : phase(0), count(0), next(0), remaining(0), stopping(false) {
+  if(threads < 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  for(int i = 1; i < threads; i++) {
+    workers.emplace_back(&TickPool::worker, this);
+  }
+}
+
+TickPool::~TickPool() {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for(auto& it : workers) {
+    it.join();
+  }
+}
+
+//Runs the work for one index. An exception only loses that index, the same whether it ran on a worker or inline.
+static void run_index(const std::function<void(size_t)>& fn, size_t index) {
+  try {
+    fn(index);
+  } catch(std::exception const& e) {
+    log(LogSource::SERVER, LogLevel::ERR, "Exception in tick phase: " + std::string(e.what()));
+  }
+}
+
+void TickPool::run(size_t _count, std::function<void(size_t)> _fn) {
+  if(workers.size() == 0 || _count <= 1) {
+    for(size_t i = 0; i < _count; i++) {
+      run_index(_fn, i);
+    }
+    return;
+  }
+  
+  std::unique_lock<std::mutex> l(lock);
+  phase++;
+  fn = _fn;
+  count = _count;
+  next = 0;
+  remaining = _count;
+  start_cv.notify_all();
+  
+  work_on(l, phase);
+  done_cv.wait(l, [this]() { return remaining == 0; });
+  fn = NULL;
+}
+
+void TickPool::worker() {
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> l(lock);
+  while(true) {
+    start_cv.wait(l, [this, seen]() { return stopping || phase != seen; });
+    if(stopping) { return; }
+    
+    seen = phase;
+    work_on(l, seen);
+  }
+}
+
+//Indexes are handed out one at a time under the lock; the work for each one (a player) is far bigger than that.
+//Checking the phase means a thread that's late to one phase can't take indexes from the next.
+void TickPool::work_on(std::unique_lock<std::mutex>& l, unsigned long work_phase) {
+  while(phase == work_phase && next < count) {
+    size_t index = next++;
+    l.unlock();
+    run_index(fn, index);
+    l.lock();
+    
+    remaining--;
+    if(remaining == 0) {
+      done_cv.notify_all();
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TICK_POOL_H__
+#define __TICK_POOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//Threads for spreading one phase of the tick over players.
+//run() calls fn(0) through fn(count - 1) across the pool and the calling thread, and only returns once
+//they've all finished; so each call is one phase, with a barrier before the next one starts.
+//The calls within a phase may run in any order and at the same time, so they mustn't share anything unguarded.
+class TickPool {
+  public:
+    //'threads' includes the calling thread, so 0 or 1 runs everything on it and starts no threads.
+    //Less than 0 means one for each CPU.
+    TickPool(int threads);
+    ~TickPool();
+    
+    void run(size_t count, std::function<void(size_t)> fn);
+    
+    size_t size() const { return workers.size() + 1; }
+    
+  private:
+    void worker();
+    //Runs indexes of phase 'phase' until there are none left. Called with 'lock' held.
+    void work_on(std::unique_lock<std::mutex>& l, unsigned long phase);
+    
+    std::vector<std::thread> workers;
+    
+    std::mutex lock;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    
+    //Current phase, guarded by 'lock'
+    unsigned long phase;
+    std::function<void(size_t)> fn;
+    size_t count;
+    size_t next; //next index to hand out
+    size_t remaining; //not finished yet
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tick_scheduler.h"
+#include "log.h"
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+TickHistogram::TickHistogram() : buckets{}, count(0), total(0), max(0) {}
+
+void TickHistogram::add(std::chrono::steady_clock::duration duration) {
+  double ms = std::chrono::duration<double, std::milli>(duration).count();
+  int bucket = 0;
+  while(bucket < TICK_HISTOGRAM_BUCKETS - 1 && ms >= (1 << bucket)) {
+    bucket++;
+  }
+  buckets[bucket]++;
+  
+  count++;
+  total += duration;
+  if(duration > max) {
+    max = duration;
+  }
+}
+
+std::string TickHistogram::to_string() const {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << count << " runs, avg " << (count > 0 ? std::chrono::duration<double, std::milli>(total).count() / count : 0.0) << " ms, "
+      << "max " << std::chrono::duration<double, std::milli>(max).count() << " ms; ";
+  for(int i = 0; i < TICK_HISTOGRAM_BUCKETS; i++) {
+    if(i > 0) { out << " "; }
+    if(i < TICK_HISTOGRAM_BUCKETS - 1) {
+      out << "<" << (1 << i) << ":" << buckets[i];
+    } else {
+      out << (1 << (i - 1)) << "+:" << buckets[i];
+    }
+  }
+  return out.str();
+}
+
+TickScheduler::TickScheduler(std::chrono::milliseconds _interval, TickPolicy _policy, int _max_catch_up)
+    : interval(std::max(_interval, std::chrono::milliseconds(1))), policy(_policy), max_catch_up(_max_catch_up),
+      stopping(false), ticks_run(0), ticks_late(0), ticks_skipped(0) {}
+
+TickScheduler::~TickScheduler() {
+  stop();
+  join();
+}
+
+void TickScheduler::start(std::function<void()> _tick) {
+  tick = _tick;
+  thread = std::thread(&TickScheduler::loop, this);
+}
+
+void TickScheduler::stop() {
+  std::unique_lock<std::mutex> l(lock);
+  stopping = true;
+  stop_cv.notify_all();
+}
+
+void TickScheduler::join() {
+  if(thread.joinable()) {
+    thread.join();
+  }
+}
+
+void TickScheduler::loop() {
+  std::chrono::time_point<std::chrono::steady_clock> next = std::chrono::steady_clock::now() + interval;
+  int caught_up = 0;
+  
+  std::unique_lock<std::mutex> l(lock);
+  while(true) {
+    if(stop_cv.wait_until(l, next, [this]() { return stopping; })) { return; }
+    l.unlock();
+    
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    tick();
+    std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+    
+    l.lock();
+    phases["total"].add(end - start);
+    ticks_run++;
+    
+    next += interval;
+    if(next > end) {
+      caught_up = 0;
+      continue;
+    }
+    
+    //Overran; the next tick's time has already passed.
+    if(policy == TickPolicy::CATCH_UP && caught_up < max_catch_up) {
+      caught_up++;
+      ticks_late++;
+      continue;
+    }
+    
+    unsigned long skip = (end - next) / interval + 1;
+    next += skip * interval;
+    ticks_skipped += skip;
+    caught_up = 0;
+    log(LogSource::SERVER, LogLevel::WARNING, "Ticks fell " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(end - (next - skip * interval)).count()) + " ms behind "
+        + "(last took " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()) + " ms, interval " + std::to_string(interval.count()) + " ms), "
+        + "skipping " + std::to_string(skip) + " tick" + (skip == 1 ? "" : "s"));
+  }
+}
+
+void TickScheduler::record(const std::string& phase, std::chrono::steady_clock::duration duration) {
+  std::unique_lock<std::mutex> l(lock);
+  phases[phase].add(duration);
+}
+
+std::string TickScheduler::stats() {
+  std::unique_lock<std::mutex> l(lock);
+  std::ostringstream out;
+  out << "every " << interval.count() << " ms (" << (policy == TickPolicy::CATCH_UP ? "catch up" : "skip") << "); "
+      << ticks_run << " run, " << ticks_late << " late, " << ticks_skipped << " skipped";
+  for(const auto& it : phases) {
+    out << "\n  " << it.first << ": " << it.second.to_string();
+  }
+  return out.str();
+}
+
+TickPolicy TickScheduler::parse_policy(const std::string& config) {
+  if(config == "catch_up") {
+    return TickPolicy::CATCH_UP;
+  }
+  return TickPolicy::SKIP;
+}
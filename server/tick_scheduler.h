@@ -0,0 +1,116 @@
+/*
+    mc4 server
+    Copyright (C) 2021 kholland4
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TICK_SCHEDULER_H__
+#define __TICK_SCHEDULER_H__
+
+#include <string>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//What to do about ticks whose time came while an earlier tick was still running.
+enum class TickPolicy {
+  SKIP, //drop them, and wait for the next tick's own time
+  CATCH_UP //run them straight away, back to back
+};
+
+//Bucket i counts durations under 2^i ms; the last one counts everything longer.
+#define TICK_HISTOGRAM_BUCKETS 11
+
+//How long something took, over many ticks.
+class TickHistogram {
+  public:
+    TickHistogram();
+    
+    void add(std::chrono::steady_clock::duration duration);
+    std::string to_string() const;
+    
+  private:
+    unsigned long buckets[TICK_HISTOGRAM_BUCKETS];
+    unsigned long count;
+    std::chrono::steady_clock::duration total;
+    std::chrono::steady_clock::duration max;
+};
+
+//Calls the tick function every 'interval', on a thread of its own, until stopped.
+//Ticks are scheduled against a fixed timeline, so a slow tick doesn't push all the later ones back.
+//If a tick runs so long that later ticks' times have already passed, 'policy' decides whether those are
+//skipped or run late; at most 'max_catch_up' are run late in a row, and the rest are skipped regardless.
+//Also keeps a histogram of how long each tick, and each phase of one (see record), took.
+class TickScheduler {
+  public:
+    TickScheduler(std::chrono::milliseconds _interval, TickPolicy _policy, int _max_catch_up);
+    ~TickScheduler();
+    
+    void start(std::function<void()> _tick);
+    //Asks the thread to stop once the current tick is done. Safe to call from the tick itself.
+    void stop();
+    //Waits for the thread to stop. Not from the tick itself.
+    void join();
+    
+    std::chrono::milliseconds get_interval() const { return interval; }
+    
+    //Called by the tick, to add how long one phase of it took to that phase's histogram.
+    void record(const std::string& phase, std::chrono::steady_clock::duration duration);
+    //For /status
+    std::string stats();
+    
+    //'config' is the value of server.tick_policy; anything unknown counts as SKIP.
+    static TickPolicy parse_policy(const std::string& config);
+    
+  private:
+    void loop();
+    
+    std::chrono::milliseconds interval;
+    TickPolicy policy;
+    int max_catch_up;
+    
+    std::function<void()> tick;
+    std::thread thread;
+    
+    std::mutex lock;
+    std::condition_variable stop_cv;
+    bool stopping;
+    
+    //Guarded by 'lock'
+    std::map<std::string, TickHistogram> phases;
+    unsigned long ticks_run;
+    unsigned long ticks_late; //run after their time because of catching up
+    unsigned long ticks_skipped;
+};
+
+//Records how long it's in scope for as one phase of the tick.
+class TickPhaseTimer {
+  public:
+    TickPhaseTimer(TickScheduler& _scheduler, std::string _phase)
+        : scheduler(_scheduler), phase(_phase), start(std::chrono::steady_clock::now()) {}
+    ~TickPhaseTimer() {
+      scheduler.record(phase, std::chrono::steady_clock::now() - start);
+    }
+    
+  private:
+    TickScheduler& scheduler;
+    std::string phase;
+    std::chrono::time_point<std::chrono::steady_clock> start;
+};
+
+#endif
@@ -173,7 +173,7 @@ template <class T> class MapPos {
     };
     
     //FIXME
-    T distance_to(const MapPos<T>& other) {
+    T distance_to(const MapPos<T>& other) const {
       if(universe != other.universe) { return 1000000; }
       if(world != other.world) { return 1000000; }
       if(w != other.w) { return 1000000; }